@@ -5,52 +5,19 @@
 #include <cstring>
 #include <cstdlib>
 #include <fstream>
-#include <sstream>
-#include <iomanip> // For setw and setfill
-#include <openssl/evp.h>
+#include <fcntl.h>
+#include <sha256.h>
 #include "color.h"
 
 using namespace ANSIColors;
 
-// Function to compute SHA-256 hash of a file using the EVP API
+// Function to compute SHA-256 hash of a file
 std::string computeSHA256(const std::string &filePath) {
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int lengthOfHash = 0;
-    char buf[1024];
-    EVP_MD_CTX *mdctx;
-
-    if ((mdctx = EVP_MD_CTX_new()) == nullptr) {
-        throw std::runtime_error("Failed to create EVP_MD_CTX");
-    }
-    if (1 != EVP_DigestInit_ex(mdctx, EVP_sha256(), nullptr)) {
-        EVP_MD_CTX_free(mdctx);
-        throw std::runtime_error("Failed to initialize digest context");
-    }
-
-    std::ifstream file(filePath, std::ifstream::binary);
-    if (!file) {
-        EVP_MD_CTX_free(mdctx);
-        throw std::runtime_error("Could not open file: " + filePath);
-    }
-    while (file.good()) {
-        file.read(buf, sizeof(buf));
-        if (1 != EVP_DigestUpdate(mdctx, buf, file.gcount())) {
-            EVP_MD_CTX_free(mdctx);
-            throw std::runtime_error("Failed to update digest");
-        }
-    }
-
-    if (1 != EVP_DigestFinal_ex(mdctx, hash, &lengthOfHash)) {
-        EVP_MD_CTX_free(mdctx);
-        throw std::runtime_error("Failed to finalize digest");
-    }
-    EVP_MD_CTX_free(mdctx);
-
-    std::stringstream ss;
-    for (unsigned int i = 0; i < lengthOfHash; ++i) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    std::string hash;
+    if (int error = sha256File(AT_FDCWD, filePath, hash)) {
+        throw std::runtime_error("Could not hash file: " + filePath + ": " + std::strerror(error));
     }
-    return ss.str();
+    return hash;
 }
 
 // Function to read the expected SHA-256 hash from a file
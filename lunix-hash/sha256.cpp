@@ -0,0 +1,214 @@
+// sha256.cpp; SHA-256 hashing shared by the kernel and the bootloader
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "sha256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <openssl/evp.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+const size_t readSize = 1 << 20;      // Large enough for the kernel's readahead to keep up
+const size_t mapThreshold = 1 << 20;  // Files at least this big are hashed straight from the page cache
+const size_t mapWindow = 16 << 20;
+
+// Every byte's two hex digits, so encoding is one table load per byte
+struct HexTable {
+    char digits[256][2];
+
+    HexTable() {
+        const char* hex = "0123456789abcdef";
+        for (int i = 0; i < 256; ++i) {
+            digits[i][0] = hex[i >> 4];
+            digits[i][1] = hex[i & 0x0f];
+        }
+    }
+};
+
+const HexTable hexTable;
+
+struct FreeDeleter {
+    void operator()(void* p) const { free(p); }
+};
+
+// Page aligned read buffer, one per thread and reused for every file it hashes
+char* readBuffer() {
+    thread_local std::unique_ptr<char, FreeDeleter> buffer;
+    if (!buffer) {
+        void* p = nullptr;
+        if (posix_memalign(&p, 4096, readSize) != 0) {
+            return nullptr;
+        }
+        buffer.reset(static_cast<char*>(p));
+    }
+    return buffer.get();
+}
+
+int hashMapped(int fd, size_t size, std::string& hex) {
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    // Drop each window once hashed, so a multi-GB file doesn't show up as resident memory
+    const char* data = static_cast<const char*>(map);
+    Sha256 sha;
+    for (size_t done = 0; done < size; done += mapWindow) {
+        size_t length = std::min(mapWindow, size - done);
+        sha.update(data + done, length);
+        madvise(const_cast<char*>(data) + done, length, MADV_DONTNEED);
+    }
+    munmap(map, size);
+    hex = sha.hexDigest();
+    return hex.empty() ? EIO : 0;
+}
+
+}
+
+std::string toHex(const unsigned char* data, size_t length) {
+    std::string out(length * 2, '\0');
+    for (size_t i = 0; i < length; ++i) {
+        out[2 * i] = hexTable.digits[data[i]][0];
+        out[2 * i + 1] = hexTable.digits[data[i]][1];
+    }
+    return out;
+}
+
+Sha256::Sha256() : context(EVP_MD_CTX_new()) {
+    if (context == nullptr) {
+        throw std::runtime_error("Failed to create EVP_MD_CTX");
+    }
+    failed = EVP_DigestInit_ex(context, EVP_sha256(), nullptr) != 1;
+}
+
+Sha256::~Sha256() {
+    EVP_MD_CTX_free(context);
+}
+
+void Sha256::update(const void* data, size_t length) {
+    if (!failed && length > 0) {
+        failed = EVP_DigestUpdate(context, data, length) != 1;
+    }
+}
+
+std::string Sha256::hexDigest() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (failed || EVP_DigestFinal_ex(context, digest, &length) != 1) {
+        failed = true;
+        return "";
+    }
+    return toHex(digest, length);
+}
+
+std::string sha256Hex(std::string_view data) {
+    Sha256 sha;
+    sha.update(data.data(), data.size());
+    return sha.hexDigest();
+}
+
+int sha256Fd(int fd, std::string& hex) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return errno;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return EISDIR;
+    }
+    if (S_ISREG(st.st_mode) && static_cast<size_t>(st.st_size) >= mapThreshold) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (offset == 0) {
+            return hashMapped(fd, st.st_size, hex);
+        }
+    }
+
+    // Small files, pipes and devices: a few large aligned reads
+    char* buffer = readBuffer();
+    if (buffer == nullptr) {
+        return ENOMEM;
+    }
+    if (S_ISREG(st.st_mode)) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    Sha256 sha;
+    while (true) {
+        ssize_t n = read(fd, buffer, readSize);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        sha.update(buffer, n);
+    }
+    hex = sha.hexDigest();
+    return hex.empty() ? EIO : 0;
+}
+
+int sha256File(int dirFd, const std::string& path, std::string& hex) {
+    int fd = openat(dirFd, path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    int error = sha256Fd(fd, hex);
+    close(fd);
+    return error;
+}
+
+void sha256Files(int dirFd, const std::vector<std::string>& paths, size_t threads,
+                 const std::function<void(size_t index, const FileDigest& digest)>& done) {
+    threads = std::max<size_t>(1, std::min(threads, paths.size()));
+    std::vector<FileDigest> results(paths.size());
+    std::vector<uint8_t> ready(paths.size(), 0);
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    auto work = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < paths.size()) {
+            FileDigest digest;
+            digest.error = sha256File(dirFd, paths[i], digest.hex);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                results[i] = std::move(digest);
+                ready[i] = 1;
+            }
+            finished.notify_one();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+
+    // Report in order while the workers keep going
+    for (size_t i = 0; i < paths.size(); ++i) {
+        FileDigest digest;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return ready[i] != 0; });
+            digest = std::move(results[i]);
+        }
+        done(i, digest);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
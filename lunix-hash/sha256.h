@@ -0,0 +1,61 @@
+// sha256.h; SHA-256 hashing shared by the kernel and the bootloader
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+// Lower case hex digits of data
+std::string toHex(const unsigned char* data, size_t length);
+
+/*
+ * Incremental SHA-256 over OpenSSL's EVP interface, which picks the SHA extensions or
+ * AVX2 code paths of the CPU it runs on.
+ */
+class Sha256 {
+public:
+    static const size_t digestLength = 32;
+
+    Sha256();
+    ~Sha256();
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void update(const void* data, size_t length);
+    // Finishes the hash; returns "" if OpenSSL failed at any point
+    std::string hexDigest();
+
+private:
+    EVP_MD_CTX* context;
+    bool failed = false;
+};
+
+std::string sha256Hex(std::string_view data);
+
+// Hashes an open file from its current offset. Returns 0 or an errno value.
+int sha256Fd(int fd, std::string& hex);
+// Hashes path, relative to dirFd unless absolute. Returns 0 or an errno value.
+int sha256File(int dirFd, const std::string& path, std::string& hex);
+
+struct FileDigest {
+    std::string hex;
+    int error = 0;
+};
+
+/*
+ * Hashes many files at once, one file per worker thread, so the disk always has several
+ * reads queued. done is called on the calling thread, in the order of paths, as soon as
+ * each result and all the ones before it are ready.
+ */
+void sha256Files(int dirFd, const std::vector<std::string>& paths, size_t threads,
+                 const std::function<void(size_t index, const FileDigest& digest)>& done);
+
+#endif // SHA256_H
@@ -0,0 +1,166 @@
+// dispatch.cpp; Micro-benchmark of lsh command dispatch: tokenizer and registry against the old substr chain
+// SPDX-License-Identifier: GPL-3.0-or-later
+//
+// Usage: lunix-bench-dispatch [iterations]
+// Exits 1 if tokenizing and looking up a line allocates once the buffers are warm.
+
+#include "../kernel/commands.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+// The commands lsh registers, in the order help lists them
+const char* const names[] = {
+    "help", "man", "exit", "shutdown", "history", "cd", "pwd", "ls", "mkdir", "cat", "editor", "nano",
+    "chmod", "rl", "rm", "clear", "ver", "panic", "passwd", "server", "client", "netcheck", "mod", "time",
+    "ps", "top", "accounting", "svc", "sched", "dmesg", "trace", "hash", "path", "sha256sum", "sort",
+    "uniq", "wc", "head", "tail",
+};
+
+// Early, late and unknown commands, so neither approach is measured only at its best
+const char* const lines[] = {
+    "help", "ls", "cd /home/user", "cat notes.txt", "rm -R build", "ver", "server start",
+    "mod scan --verbose", "wc -l log.txt", "sort -n data | uniq", "no-such-command arg",
+};
+
+// The if/else chain lsh dispatched with before the registry, with the branch bodies reduced to an id
+int substrChain(const std::string& command) {
+    if (command == "shutdown" || command == "exit") {
+        return 1;
+    } else if (command == "") {
+        return 2;
+    } else if (command == "help") {
+        return 3;
+    } else if (command.substr(0, 4) == "man ") {
+        return 4;
+    } else if (command.substr(0, 3) == "cd ") {
+        return 5;
+    } else if (command == "pwd") {
+        return 6;
+    } else if (command.substr(0, 2) == "ls") {
+        return 7;
+    } else if (command.substr(0, 6) == "mkdir ") {
+        return 8;
+    } else if (command.substr(0, 4) == "cat ") {
+        return 9;
+    } else if (command.substr(0, 7) == "editor ") {
+        return 10;
+    } else if (command.substr(0, 4) == "nano") {
+        return 11;
+    } else if (command.substr(0, 5) == "chmod") {
+        return 12;
+    } else if (command.substr(0, 2) == "rl") {
+        return 13;
+    } else if (command.substr(0, 3) == "rm ") {
+        return 14;
+    } else if (command == "clear") {
+        return 15;
+    } else if (command == "ver") {
+        return 16;
+    } else if (command.substr(0, 2) == "./") {
+        return 17;
+    } else if (command == "panic") {
+        return 18;
+    } else if (command.substr(0, 6) == "passwd") {
+        return 19;
+    } else if (command == "server start") {
+        return 20;
+    } else if (command == "server stop") {
+        return 21;
+    } else if (command.substr(0, 7) == "client ") {
+        return 22;
+    } else if (command.substr(0, 3) == "mod") {
+        return 23;
+    }
+    return 0;
+}
+
+// Nanoseconds per line over iterations passes of lines
+template <typename Dispatch>
+double measure(long iterations, Dispatch dispatch) {
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        for (const char* line : lines) {
+            dispatch(line);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (iterations * static_cast<double>(std::size(lines)));
+}
+
+}
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+    if (iterations < 1) {
+        std::cerr << "Usage: lunix-bench-dispatch [iterations]\n";
+        return 2;
+    }
+
+    CommandRegistry registry;
+    for (const char* name : names) {
+        registry.add({name, name, "", "", [](Session&, int, char**) { return 0; }});
+    }
+
+    CommandLine commandLine;
+    volatile uintptr_t sink = 0;
+    auto dispatch = [&](const char* line) {
+        if (commandLine.parse(line) > 0) {
+            sink = sink + reinterpret_cast<uintptr_t>(registry.find(commandLine.argv()[0]));
+        }
+    };
+    // lsh reads each line into a std::string, so the chain is timed from one too
+    std::string command;
+    auto chain = [&](const char* line) {
+        command = line;
+        sink = sink + substrChain(command);
+    };
+
+    // Warm up: the tokenizer's buffers grow to fit the longest line once
+    measure(1, dispatch);
+    measure(1, chain);
+
+    uint64_t before = allocations.load();
+    double registryNs = measure(iterations, dispatch);
+    uint64_t registryAllocations = allocations.load() - before;
+
+    before = allocations.load();
+    double chainNs = measure(iterations, chain);
+    uint64_t chainAllocations = allocations.load() - before;
+
+    double total = iterations * static_cast<double>(std::size(lines));
+    std::cout << "lines\t" << static_cast<uint64_t>(total) << "\n"
+              << "registry\t" << registryNs << " ns/line\t" << registryAllocations / total << " allocations/line\n"
+              << "substr\t" << chainNs << " ns/line\t" << chainAllocations / total << " allocations/line\n";
+
+    if (registryAllocations != 0) {
+        std::cerr << "Dispatch allocated " << registryAllocations << " times in steady state\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# pipeline-spawn.sh; A module's output reaches the next stage of a pipeline
+# SPDX-License-Identifier: GPL-3.0-or-later
+#
+# Usage: pipeline-spawn.sh <path to lunix>
+# The kernel refuses to run as root, so under root the check runs as nobody.
+
+set -e
+lunix=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir -p "$dir/rootfs/modules"
+printf 'for i in range(3):\n    print("line", i)\n' > "$dir/rootfs/modules/count.py"
+cd "$dir"
+run="$lunix"
+if [ "$(id -u)" = 0 ]; then
+    chown -R 65534 "$dir"
+    run="setpriv --reuid=65534 --regid=65534 --clear-groups $lunix"
+fi
+
+check() {
+    got=$($run -c "$1" </dev/null 2>/dev/null | tr -d ' ')
+    if [ "$got" != "$2" ]; then
+        echo "$1: expected $2, got '$got'"
+        exit 1
+    fi
+}
+
+check "count | wc -l" 3
+check "mod count | wc -l" 4      # "Loading module count", then the module's lines
+check "count | sort | wc -l" 3
+check "time count | wc -l" 3     # time reports on stderr
@@ -0,0 +1,196 @@
+// commands.cpp; lsh command registry and tokenizer
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "commands.h"
+
+#include <algorithm>
+#include <mutex>
+
+CommandRegistry& commandRegistry() {
+    static CommandRegistry registry;
+    return registry;
+}
+
+CommandRegistry::CommandRegistry() : slots(64) {}
+
+uint64_t CommandRegistry::hash(std::string_view name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Slot holding name, or -1 if it isn't registered
+int CommandRegistry::findSlot(std::string_view name, uint64_t h) const {
+    size_t mask = slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.index == -1) {
+            return -1;
+        }
+        if (slot.index >= 0 && slot.hash == h && commands[slot.index]->name == name) {
+            return static_cast<int>(i);
+        }
+    }
+}
+
+void CommandRegistry::grow() {
+    std::vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+    used = 0;
+    size_t mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.index < 0) {
+            continue;
+        }
+        size_t i = slot.hash & mask;
+        while (slots[i].index != -1) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+        used++;
+    }
+}
+
+bool CommandRegistry::add(Command command) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    uint64_t h = hash(command.name);
+    if (findSlot(command.name, h) >= 0) {
+        return false;
+    }
+    if ((used + 1) * 2 > slots.size()) {
+        grow();
+    }
+
+    if (command.description.empty()) {
+        command.description = command.summary;
+    }
+    if (command.usage.empty()) {
+        command.usage = command.name;
+    }
+    commands.push_back(std::make_unique<Command>(std::move(command)));
+
+    size_t mask = slots.size() - 1;
+    size_t i = h & mask;
+    while (slots[i].index >= 0) {
+        i = (i + 1) & mask;
+    }
+    if (slots[i].index == -1) {
+        used++;
+    }
+    slots[i] = {h, static_cast<int32_t>(commands.size() - 1)};
+    changes++;
+    return true;
+}
+
+bool CommandRegistry::remove(std::string_view name) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    int slot = findSlot(name, hash(name));
+    if (slot < 0) {
+        return false;
+    }
+    // Leave a tombstone; the Command itself stays allocated for callers still holding it
+    slots[slot].index = -2;
+    changes++;
+    return true;
+}
+
+const Command* CommandRegistry::find(std::string_view name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    int slot = findSlot(name, hash(name));
+    if (slot < 0) {
+        return nullptr;
+    }
+    return commands[slots[slot].index].get();
+}
+
+std::vector<Command> CommandRegistry::list() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::vector<Command> result;
+    for (const Slot& slot : slots) {
+        if (slot.index >= 0) {
+            result.push_back(*commands[slot.index]);
+        }
+    }
+    std::sort(result.begin(), result.end(),
+              [](const Command& a, const Command& b) { return a.name < b.name; });
+    return result;
+}
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool isOperatorChar(char c) {
+    return c == '|' || c == '<' || c == '>';
+}
+
+int CommandLine::parse(std::string_view line) {
+    // Quotes only shrink words; operators split off at most one terminator per input byte
+    buffer.resize(line.size() * 2 + 1);
+    args.clear();
+    operators.clear();
+    operatorCount = 0;
+
+    char* out = buffer.data();
+    size_t i = 0;
+    while (true) {
+        while (i < line.size() && isSpace(line[i])) {
+            i++;
+        }
+        if (i >= line.size()) {
+            break;
+        }
+
+        if (isOperatorChar(line[i])) {
+            args.push_back(out);
+            operators.push_back(1);
+            operatorCount++;
+            *out++ = line[i];
+            if (line[i] == '>' && i + 1 < line.size() && line[i + 1] == '>') {
+                *out++ = '>';
+                i++;
+            }
+            *out++ = '\0';
+            i++;
+            continue;
+        }
+
+        args.push_back(out);
+        operators.push_back(0);
+        char quote = 0;
+        for (; i < line.size(); i++) {
+            char c = line[i];
+            if (quote != 0) {
+                if (c == quote) {
+                    quote = 0;
+                } else if (c == '\\' && quote == '"' && i + 1 < line.size()) {
+                    *out++ = line[++i];
+                } else {
+                    *out++ = c;
+                }
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+            } else if (c == '\\' && i + 1 < line.size()) {
+                *out++ = line[++i];
+            } else if (isSpace(c) || isOperatorChar(c)) {
+                break;
+            } else {
+                *out++ = c;
+            }
+        }
+        if (quote != 0) {
+            args.clear();
+            operators.clear();
+            operatorCount = 0;
+            args.push_back(nullptr);
+            return -1;
+        }
+        *out++ = '\0';
+    }
+
+    args.push_back(nullptr);
+    return argc();
+}
@@ -0,0 +1,99 @@
+// commands.h; lsh command registry and tokenizer
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Session;
+
+// argv[0] is the command name; the return value is the command's exit status
+using CommandHandler = std::function<int(Session& session, int argc, char** argv)>;
+
+struct Command {
+    std::string name;
+    std::string usage;        // e.g. "cat <file>", shown by man
+    std::string summary;      // one line, shown by help
+    std::string description;  // long text for man; falls back to summary
+    CommandHandler handler;
+    std::string group = "built-in";  // help lists commands by group
+    bool spawns = false;  // Starts child processes, which only see real descriptors, never a ring
+    bool secret = false;  // Takes secrets as arguments, so lines running it are kept out of history
+};
+
+/*
+ * Name -> handler table used by lsh for dispatch, help and man.
+ * Open addressing with linear probing over a power-of-two slot array keyed by an
+ * FNV-1a hash, so a lookup is one hash of the name plus (usually) one compare and
+ * never allocates. Subsystems and modules register their commands with add().
+ */
+class CommandRegistry {
+public:
+    CommandRegistry();
+
+    // Returns false if a command with the same name is already registered
+    bool add(Command command);
+    bool remove(std::string_view name);
+
+    // Registered commands are never freed, so the pointer stays valid after remove()
+    const Command* find(std::string_view name) const;
+
+    // All commands sorted by name, for help and completion
+    std::vector<Command> list() const;
+
+    // Changes whenever a command is added or removed, so callers can tell a cached list is stale
+    uint64_t generation() const { return changes.load(std::memory_order_acquire); }
+
+private:
+    static uint64_t hash(std::string_view name);
+    int findSlot(std::string_view name, uint64_t h) const;
+    void grow();
+
+    struct Slot {
+        uint64_t hash = 0;
+        int32_t index = -1;  // into commands; -1 = empty, -2 = deleted
+    };
+
+    std::vector<std::unique_ptr<Command>> commands;
+    std::vector<Slot> slots;
+    size_t used = 0;
+    std::atomic<uint64_t> changes{0};
+    mutable std::shared_mutex mutex;
+};
+
+CommandRegistry& commandRegistry();
+
+/*
+ * Splits a command line into argc/argv in place.
+ * Whitespace separates words; '...' and "..." quote, backslash escapes one character.
+ * Unquoted |, <, > and >> become operator tokens of their own.
+ * The buffers are reused between lines so steady-state parsing doesn't allocate.
+ */
+class CommandLine {
+public:
+    // Returns the number of words, or -1 on an unterminated quote
+    int parse(std::string_view line);
+
+    int argc() const { return static_cast<int>(args.size()) - 1; }
+    char** argv() { return args.data(); }
+
+    // True if argv[i] is an unquoted |, <, > or >> rather than a word
+    bool isOperator(int i) const { return operators[i] != 0; }
+    bool hasOperators() const { return operatorCount > 0; }
+
+private:
+    std::string buffer;
+    std::vector<char*> args;  // null terminated like a real argv
+    std::vector<char> operators;
+    int operatorCount = 0;
+};
+
+#endif // COMMANDS_H
@@ -0,0 +1,18 @@
+// coreutils.h; File and text utilities built into lsh
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef COREUTILS_H
+#define COREUTILS_H
+
+class CommandRegistry;
+
+// wc, head, tail
+void registerTextCommands(CommandRegistry& registry);
+
+// sort, uniq
+void registerSortCommands(CommandRegistry& registry);
+
+// sha256sum
+void registerHashCommands(CommandRegistry& registry);
+
+#endif // COREUTILS_H
@@ -0,0 +1,221 @@
+// hashutils.cpp; sha256sum
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "coreutils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <sha256.h>
+
+#include "../commands.h"
+#include "../session.h"
+
+namespace {
+
+// Enough reads in flight to keep an SSD busy even on machines with few cores
+size_t hashThreads() {
+    return std::max(4u, std::thread::hardware_concurrency());
+}
+
+// Appends the regular files under path (relative to dirFd), in name order
+int listTree(int dirFd, const std::string& path, std::vector<std::string>& files) {
+    int fd = openat(dirFd, path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    DIR* dir = fdopendir(fd);
+    if (dir == nullptr) {
+        close(fd);
+        return errno;
+    }
+    std::vector<std::pair<std::string, bool>> entries;
+    while (dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        // Symlinks are skipped, so a tree can't loop or escape into the rest of the host
+        if (type == DT_DIR || type == DT_REG) {
+            entries.emplace_back(entry->d_name, type == DT_DIR);
+        }
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    std::string prefix = path == "." ? "" : path + (path.back() == '/' ? "" : "/");
+    for (const auto& [name, isDir] : entries) {
+        if (isDir) {
+            listTree(dirFd, prefix + name, files);
+        } else {
+            files.push_back(prefix + name);
+        }
+    }
+    return 0;
+}
+
+int hashStream(Session& session) {
+    Sha256 sha;
+    std::vector<char> buffer(1 << 20);
+    while (session.in.read(buffer.data(), buffer.size()) || session.in.gcount() > 0) {
+        sha.update(buffer.data(), session.in.gcount());
+    }
+    session.out << sha.hexDigest() << "  -\n";
+    return 0;
+}
+
+// Reads "<hex>  <path>" lines (GNU format, '*' marking binary mode is accepted)
+int check(Session& session, const std::string& manifest, bool quiet) {
+    int fd = openat(session.cwdFd(), manifest.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        session.err << "sha256sum: " << manifest << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string text;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        text.append(buffer, n);
+    }
+    close(fd);
+
+    std::vector<std::string> expected;
+    std::vector<std::string> paths;
+    size_t malformed = 0;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        if (line.empty()) {
+            continue;
+        }
+        if (line.size() < 67 || line[64] != ' ' || (line[65] != ' ' && line[65] != '*') ||
+            line.find_first_not_of("0123456789abcdefABCDEF") < 64) {
+            malformed++;
+            continue;
+        }
+        std::string hex = line.substr(0, 64);
+        std::transform(hex.begin(), hex.end(), hex.begin(), ::tolower);
+        expected.push_back(hex);
+        paths.push_back(line.substr(66));
+    }
+    if (paths.empty()) {
+        session.err << "sha256sum: " << manifest << ": no properly formatted SHA256 checksum lines found" << std::endl;
+        return 1;
+    }
+
+    size_t mismatched = 0;
+    size_t unreadable = 0;
+    sha256Files(session.cwdFd(), paths, hashThreads(), [&](size_t i, const FileDigest& digest) {
+        if (digest.error != 0) {
+            unreadable++;
+            session.out << paths[i] << ": FAILED open or read (" << strerror(digest.error) << ")\n";
+        } else if (digest.hex != expected[i]) {
+            mismatched++;
+            session.out << paths[i] << ": FAILED\n";
+        } else if (!quiet) {
+            session.out << paths[i] << ": OK\n";
+        }
+    });
+
+    if (malformed > 0) {
+        session.err << "sha256sum: WARNING: " << malformed << " line" << (malformed == 1 ? " is" : "s are")
+                    << " improperly formatted" << std::endl;
+    }
+    if (unreadable > 0) {
+        session.err << "sha256sum: WARNING: " << unreadable << " listed file" << (unreadable == 1 ? "" : "s")
+                    << " could not be read" << std::endl;
+    }
+    if (mismatched > 0) {
+        session.err << "sha256sum: WARNING: " << mismatched << " computed checksum" << (mismatched == 1 ? "" : "s")
+                    << " did NOT match" << std::endl;
+    }
+    return mismatched + unreadable > 0 ? 1 : 0;
+}
+
+int sha256sum(Session& session, int argc, char** argv) {
+    const char* usage = "Usage: sha256sum [-r] [file...] | sha256sum -c [-q] manifest\n";
+    bool recursive = false;
+    bool quiet = false;
+    const char* manifest = nullptr;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-r") == 0) {
+            recursive = true;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            session.out << usage;
+            return 1;
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (manifest != nullptr) {
+        if (!args.empty() || recursive) {
+            session.out << usage;
+            return 1;
+        }
+        return check(session, manifest, quiet);
+    }
+    if (args.empty()) {
+        return hashStream(session);
+    }
+
+    int status = 0;
+    std::vector<std::string> files;
+    for (const std::string& arg : args) {
+        struct stat st;
+        if (recursive && fstatat(session.cwdFd(), arg.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+            if (int error = listTree(session.cwdFd(), arg, files)) {
+                session.err << "sha256sum: " << arg << ": " << strerror(error) << std::endl;
+                status = 1;
+            }
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    // The output doubles as a manifest for -c
+    sha256Files(session.cwdFd(), files, hashThreads(), [&](size_t i, const FileDigest& digest) {
+        if (digest.error != 0) {
+            session.err << "sha256sum: " << files[i] << ": " << strerror(digest.error) << std::endl;
+            status = 1;
+        } else {
+            session.out << digest.hex << "  " << files[i] << "\n";
+        }
+    });
+    return status;
+}
+
+}
+
+void registerHashCommands(CommandRegistry& registry) {
+    registry.add({"sha256sum", "sha256sum [-r] [file...] | sha256sum -c [-q] manifest", "Compute or verify SHA-256 checksums",
+                  "Print the SHA-256 checksum of each file (or of standard input), in the format sha256sum -c reads back. "
+                  "-r descends into directories, so 'sha256sum -r . > manifest' records a whole tree. "
+                  "-c checks the files listed in a manifest and reports each one (-q: only the failures). "
+                  "Files are hashed on several threads at once to keep the disk busy.",
+                  sha256sum});
+}
@@ -0,0 +1,761 @@
+// sortutils.cpp; sort and uniq for inputs larger than memory
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "coreutils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../commands.h"
+#include "../session.h"
+#include "../disk/disk.h"
+#include "../kernel/scheduler.h"
+
+extern disk Disk;
+
+namespace {
+
+const size_t readBlock = 1 << 20;
+const size_t maxFanIn = 64;  // Runs merged at once; more are merged in several passes
+
+// Splits a file or stream into lines without copying them; a line is valid until the next call
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd(fd), buffer(readBlock) {}
+    explicit LineReader(std::istream& in) : in(&in), buffer(readBlock) {}
+
+    bool next(std::string_view& line) {
+        while (true) {
+            const char* start = buffer.data() + begin;
+            const char* eol = static_cast<const char*>(memchr(start, '\n', end - begin));
+            if (eol != nullptr) {
+                line = std::string_view(start, eol - start);
+                begin += line.size() + 1;
+                return true;
+            }
+            if (eof) {
+                if (begin == end) {
+                    return false;
+                }
+                line = std::string_view(start, end - begin);  // Last line without a newline
+                begin = end;
+                return true;
+            }
+            fill();
+        }
+    }
+
+    bool failed() const { return error != 0; }
+    int errorCode() const { return error; }
+
+private:
+    void fill() {
+        // Keep the partial line, and make room for a line longer than the buffer
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+        if (end == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+        ssize_t n;
+        if (in != nullptr) {
+            in->read(buffer.data() + end, buffer.size() - end);
+            n = in->gcount();
+        } else {
+            do {
+                n = read(fd, buffer.data() + end, buffer.size() - end);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                error = errno;
+            }
+        }
+        if (n <= 0) {
+            eof = true;
+        } else {
+            end += n;
+        }
+    }
+
+    int fd = -1;
+    std::istream* in = nullptr;
+    std::vector<char> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+    bool eof = false;
+    int error = 0;
+};
+
+struct SortOptions {
+    bool numeric = false;
+    bool reverse = false;
+    bool unique = false;
+    size_t keyStart = 0;  // 1-based field; 0 = whole line
+    size_t keyEnd = 0;    // Last field of the key; 0 = to the end of the line
+    char separator = 0;   // 0 = runs of blanks
+    size_t memory = 0;    // Bytes of lines held before spilling a run
+};
+
+bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// The -k part of a line. Fields are split at the separator, or at runs of blanks
+std::string_view extractKey(std::string_view line, const SortOptions& options) {
+    if (options.keyStart == 0) {
+        return line;
+    }
+    size_t pos = 0;
+    auto skipField = [&]() {
+        if (options.separator != 0) {
+            size_t next = line.find(options.separator, pos);
+            pos = next == std::string_view::npos ? line.size() : next + 1;
+        } else {
+            while (pos < line.size() && isBlank(line[pos])) {
+                pos++;
+            }
+            while (pos < line.size() && !isBlank(line[pos])) {
+                pos++;
+            }
+        }
+    };
+    for (size_t field = 1; field < options.keyStart && pos < line.size(); ++field) {
+        skipField();
+    }
+    if (options.separator == 0) {
+        while (pos < line.size() && isBlank(line[pos])) {
+            pos++;
+        }
+    }
+    size_t start = pos;
+    if (options.keyEnd == 0 || options.keyEnd < options.keyStart) {
+        return line.substr(start);
+    }
+    for (size_t field = options.keyStart; field <= options.keyEnd && pos < line.size(); ++field) {
+        skipField();
+    }
+    // Don't include the separator that ends the last key field
+    size_t end = pos;
+    if (options.separator != 0 && end > start && end <= line.size() && line[end - 1] == options.separator) {
+        end--;
+    }
+    return line.substr(start, end - start);
+}
+
+// Leading number of a key ([blanks][-]digits[.digits]); anything else counts as 0
+double parseNumber(std::string_view key) {
+    size_t i = 0;
+    while (i < key.size() && isBlank(key[i])) {
+        i++;
+    }
+    bool negative = i < key.size() && key[i] == '-';
+    if (negative || (i < key.size() && key[i] == '+')) {
+        i++;
+    }
+    double value = 0;
+    while (i < key.size() && key[i] >= '0' && key[i] <= '9') {
+        value = value * 10 + (key[i++] - '0');
+    }
+    if (i < key.size() && key[i] == '.') {
+        double scale = 0.1;
+        for (i++; i < key.size() && key[i] >= '0' && key[i] <= '9'; ++i, scale /= 10) {
+            value += (key[i] - '0') * scale;
+        }
+    }
+    return negative ? -value : value;
+}
+
+// A line plus what comparisons need, computed once per line
+struct SortLine {
+    std::string_view line;
+    std::string_view key;
+    double number = 0;
+};
+
+SortLine makeLine(std::string_view line, const SortOptions& options) {
+    SortLine result{line, extractKey(line, options), 0};
+    if (options.numeric) {
+        result.number = parseNumber(result.key);
+    }
+    return result;
+}
+
+// Key order only; used for -u and by uniq-style duplicate checks
+int compareKeys(const SortLine& a, const SortLine& b, const SortOptions& options) {
+    if (options.numeric) {
+        if (a.number != b.number) {
+            return a.number < b.number ? -1 : 1;
+        }
+        return 0;
+    }
+    int c = a.key.compare(b.key);
+    return c < 0 ? -1 : c > 0 ? 1 : 0;
+}
+
+// Full order: keys, then (unless -u) the whole line as a last resort, as GNU sort does
+int compareLines(const SortLine& a, const SortLine& b, const SortOptions& options) {
+    int c = compareKeys(a, b, options);
+    if (c == 0 && !options.unique) {
+        int whole = a.line.compare(b.line);
+        c = whole < 0 ? -1 : whole > 0 ? 1 : 0;
+    }
+    return options.reverse ? -c : c;
+}
+
+// Output buffered in large blocks, to a spill file or the session
+class LineWriter {
+public:
+    explicit LineWriter(int fd) : fd(fd) { buffer.reserve(readBlock); }
+    explicit LineWriter(std::ostream& out) : out(&out) { buffer.reserve(readBlock); }
+    ~LineWriter() { flush(); }
+
+    void write(std::string_view line) {
+        if (buffer.size() + line.size() + 1 > readBlock) {
+            flush();
+        }
+        buffer.append(line.data(), line.size());
+        buffer += '\n';
+    }
+
+    bool flush() {
+        if (out != nullptr) {
+            out->write(buffer.data(), buffer.size());
+        } else {
+            size_t done = 0;
+            while (done < buffer.size()) {
+                ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    error = n < 0 ? errno : EIO;
+                    break;
+                }
+                done += n;
+            }
+        }
+        buffer.clear();
+        return error == 0;
+    }
+
+    int errorCode() const { return error; }
+
+private:
+    int fd = -1;
+    std::ostream* out = nullptr;
+    std::string buffer;
+    int error = 0;
+};
+
+// Anonymous file for a sorted run, in the rootfs so it doesn't fill a small /tmp
+int createSpillFile() {
+    std::string dir = Disk.rootfsPath().empty() ? "." : Disk.rootfsPath();
+    int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        return fd;
+    }
+    std::string name = dir + "/.sort-XXXXXX";
+    fd = mkostemp(&name[0], O_CLOEXEC);
+    if (fd >= 0) {
+        unlink(name.c_str());
+    }
+    return fd;
+}
+
+/*
+ * Sorts lines with one task per scheduler worker: each task sorts a slice, then slices are
+ * merged pairwise (also in parallel) until one is left.
+ */
+void parallelSort(std::vector<SortLine>& lines, const SortOptions& options) {
+    auto less = [&options](const SortLine& a, const SortLine& b) { return compareLines(a, b, options) < 0; };
+    // Under -u equal keys aren't told apart by the whole line, and the first one read must win
+    auto sortSlice = [&](auto first, auto last) {
+        if (options.unique) {
+            std::stable_sort(first, last, less);
+        } else {
+            std::sort(first, last, less);
+        }
+    };
+    size_t threads = std::min(scheduler().size(), lines.size() / 16384 + 1);
+    if (threads <= 1) {
+        sortSlice(lines.begin(), lines.end());
+        return;
+    }
+
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= threads; ++i) {
+        bounds.push_back(lines.size() * i / threads);
+    }
+    TaskGroup slices;
+    for (size_t i = 0; i < threads; ++i) {
+        slices.spawn([&, i] { sortSlice(lines.begin() + bounds[i], lines.begin() + bounds[i + 1]); });
+    }
+    slices.wait();
+
+    std::vector<SortLine> scratch(lines.size());
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged;
+        TaskGroup merges;
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+            if (i + 2 < bounds.size()) {
+                merges.spawn([&, i] {
+                    std::merge(lines.begin() + bounds[i], lines.begin() + bounds[i + 1], lines.begin() + bounds[i + 1],
+                               lines.begin() + bounds[i + 2], scratch.begin() + bounds[i], less);
+                });
+            } else {
+                // Odd slice out: carried over unchanged
+                std::copy(lines.begin() + bounds[i], lines.begin() + bounds[i + 1], scratch.begin() + bounds[i]);
+            }
+        }
+        merged.push_back(bounds.back());
+        merges.wait();
+        lines.swap(scratch);
+        bounds.swap(merged);
+    }
+}
+
+/*
+ * k-way merge with a loser tree: the internal nodes remember the loser of each match,
+ * so replacing the winner costs one comparison per tree level (log2 k) instead of k.
+ */
+class LoserTree {
+public:
+    LoserTree(std::vector<std::unique_ptr<LineReader>>& readers, const SortOptions& options)
+        : readers(readers), options(options), current(readers.size()), done(readers.size(), false), tree(readers.size(), -1) {
+        for (size_t i = 0; i < readers.size(); ++i) {
+            advance(i);
+        }
+        winner = readers.empty() ? -1 : build(1);
+    }
+
+    // The smallest remaining line, or false when every run is exhausted
+    bool top(SortLine& line) const {
+        if (winner < 0 || done[winner]) {
+            return false;
+        }
+        line = current[winner];
+        return true;
+    }
+
+    void pop() {
+        int run = winner;
+        advance(run);
+        size_t k = readers.size();
+        for (size_t node = (run + k) / 2; node >= 1; node /= 2) {
+            if (beats(tree[node], run)) {
+                std::swap(tree[node], run);
+            }
+        }
+        winner = run;
+    }
+
+private:
+    void advance(size_t run) {
+        std::string_view line;
+        if (readers[run]->next(line)) {
+            current[run] = makeLine(line, options);
+        } else {
+            done[run] = true;
+        }
+    }
+
+    // Exhausted runs lose to everything; ties go to the earlier run, keeping the merge stable
+    bool beats(int a, int b) const {
+        if (done[a] || done[b]) {
+            return !done[a] && done[b];
+        }
+        int c = compareLines(current[a], current[b], options);
+        return c < 0 || (c == 0 && a < b);
+    }
+
+    // Leaves are nodes k..2k-1; returns the winner of node's subtree
+    int build(size_t node) {
+        size_t k = readers.size();
+        if (node >= k) {
+            return static_cast<int>(node - k);
+        }
+        int a = build(2 * node);
+        int b = build(2 * node + 1);
+        if (beats(a, b)) {
+            tree[node] = b;
+            return a;
+        }
+        tree[node] = a;
+        return b;
+    }
+
+    std::vector<std::unique_ptr<LineReader>>& readers;
+    const SortOptions& options;
+    std::vector<SortLine> current;
+    std::vector<bool> done;
+    std::vector<int> tree;
+    int winner = -1;
+};
+
+// Merges the runs into writer, dropping lines with equal keys under -u
+int mergeRuns(const std::vector<int>& runs, LineWriter& writer, const SortOptions& options) {
+    std::vector<std::unique_ptr<LineReader>> readers;
+    for (int fd : runs) {
+        lseek(fd, 0, SEEK_SET);
+        readers.push_back(std::make_unique<LineReader>(fd));
+    }
+    LoserTree tree(readers, options);
+
+    SortLine line;
+    std::string lastKey;
+    double lastNumber = 0;
+    bool first = true;
+    while (tree.top(line)) {
+        bool duplicate = false;
+        if (options.unique && !first) {
+            SortLine last{lastKey, lastKey, lastNumber};
+            duplicate = compareKeys(line, last, options) == 0;
+        }
+        if (!duplicate) {
+            writer.write(line.line);
+            if (options.unique) {
+                lastKey.assign(line.key.data(), line.key.size());
+                lastNumber = line.number;
+                first = false;
+            }
+        }
+        tree.pop();
+    }
+    for (const auto& reader : readers) {
+        if (reader->failed()) {
+            return reader->errorCode();
+        }
+    }
+    return 0;
+}
+
+// Writes sorted lines, skipping repeated keys under -u
+void writeSorted(const std::vector<SortLine>& lines, LineWriter& writer, const SortOptions& options) {
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (options.unique && i > 0 && compareKeys(lines[i], lines[i - 1], options) == 0) {
+            continue;
+        }
+        writer.write(lines[i].line);
+    }
+}
+
+size_t defaultMemory() {
+    // An eighth of RAM, within 16MB..512MB
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t memory = pages > 0 && pageSize > 0 ? static_cast<size_t>(pages) * pageSize / 8 : 64u << 20;
+    return std::clamp<size_t>(memory, 16u << 20, 512u << 20);
+}
+
+// 64M, 512K, 2G or plain bytes
+bool parseSize(const char* text, size_t& size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) {
+        return false;
+    }
+    switch (*end) {
+    case 'K': case 'k': value <<= 10; end++; break;
+    case 'M': case 'm': value <<= 20; end++; break;
+    case 'G': case 'g': value <<= 30; end++; break;
+    default: break;
+    }
+    size = static_cast<size_t>(value);
+    return *end == '\0' && size > 0;
+}
+
+int sortCommand(Session& session, int argc, char** argv) {
+    const char* usage = "Usage: sort [-n] [-r] [-u] [-k field[,field]] [-t char] [-S size] [-o file] [file...]\n";
+    SortOptions options;
+    options.memory = defaultMemory();
+    const char* output = nullptr;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-n") {
+            options.numeric = true;
+        } else if (arg == "-r") {
+            options.reverse = true;
+        } else if (arg == "-u") {
+            options.unique = true;
+        } else if (arg == "-nr" || arg == "-rn") {
+            options.numeric = options.reverse = true;
+        } else if (arg == "-k" && hasValue) {
+            char* end;
+            options.keyStart = strtoul(argv[++i], &end, 10);
+            options.keyEnd = *end == ',' ? strtoul(end + 1, nullptr, 10) : 0;
+            if (options.keyStart == 0) {
+                session.out << usage;
+                return 2;
+            }
+        } else if (arg == "-t" && hasValue && strlen(argv[i + 1]) == 1) {
+            options.separator = argv[++i][0];
+        } else if (arg == "-S" && hasValue) {
+            if (!parseSize(argv[++i], options.memory)) {
+                session.out << usage;
+                return 2;
+            }
+        } else if (arg == "-o" && hasValue) {
+            output = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            session.out << usage;
+            return 2;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    std::vector<std::unique_ptr<LineReader>> inputs;
+    std::vector<int> inputFds;
+    auto closeInputs = [&]() {
+        for (int fd : inputFds) {
+            close(fd);
+        }
+    };
+    if (files.empty()) {
+        inputs.push_back(std::make_unique<LineReader>(session.in));
+    }
+    for (const char* file : files) {
+        int fd = openat(session.cwdFd(), file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            session.err << "sort: " << file << ": " << strerror(errno) << std::endl;
+            closeInputs();
+            return 2;
+        }
+        inputFds.push_back(fd);
+        inputs.push_back(std::make_unique<LineReader>(fd));
+    }
+
+    // Fill a run up to the memory budget, sort it, and spill it if there is more input
+    std::vector<int> runs;
+    auto closeRuns = [&]() {
+        for (int fd : runs) {
+            close(fd);
+        }
+    };
+    std::vector<char> arena;
+    std::vector<SortLine> lines;
+    size_t input = 0;
+    bool more = true;
+    while (more) {
+        arena.clear();
+        lines.clear();
+        arena.reserve(std::min<size_t>(options.memory, 64u << 20));
+
+        // Copy lines into the arena first, then point at them once it can no longer move
+        std::vector<std::pair<size_t, size_t>> spans;
+        size_t used = 0;
+        std::string_view line;
+        while (used < options.memory) {
+            if (input >= inputs.size()) {
+                more = false;
+                break;
+            }
+            if (!inputs[input]->next(line)) {
+                if (inputs[input]->failed()) {
+                    session.err << "sort: " << strerror(inputs[input]->errorCode()) << std::endl;
+                    closeInputs();
+                    closeRuns();
+                    return 2;
+                }
+                input++;
+                continue;
+            }
+            spans.emplace_back(arena.size(), line.size());
+            arena.insert(arena.end(), line.begin(), line.end());
+            used += line.size() + 2 * sizeof(SortLine) + sizeof(spans[0]);  // Lines plus the merge scratch
+        }
+        if (more && input >= inputs.size()) {
+            more = false;
+        }
+
+        lines.reserve(spans.size());
+        for (const auto& [offset, length] : spans) {
+            lines.push_back(makeLine(std::string_view(arena.data() + offset, length), options));
+        }
+        parallelSort(lines, options);
+
+        if (!more && runs.empty()) {
+            break;  // Everything fit in memory: no temp files at all
+        }
+        int fd = createSpillFile();
+        if (fd < 0) {
+            session.err << "sort: cannot create a temporary file: " << strerror(errno) << std::endl;
+            closeInputs();
+            closeRuns();
+            return 2;
+        }
+        runs.push_back(fd);
+        LineWriter spill(fd);
+        writeSorted(lines, spill, options);
+        if (!spill.flush()) {
+            session.err << "sort: writing a temporary file: " << strerror(spill.errorCode()) << std::endl;
+            closeInputs();
+            closeRuns();
+            return 2;
+        }
+    }
+    closeInputs();
+
+    // Too many runs to merge at once: merge groups of them into longer runs first
+    while (runs.size() > maxFanIn) {
+        std::vector<int> merged;
+        for (size_t i = 0; i < runs.size(); i += maxFanIn) {
+            std::vector<int> group(runs.begin() + i, runs.begin() + std::min(runs.size(), i + maxFanIn));
+            int fd = createSpillFile();
+            int error = fd < 0 ? errno : 0;
+            if (fd >= 0) {
+                LineWriter writer(fd);
+                error = mergeRuns(group, writer, options);
+                if (error == 0 && !writer.flush()) {
+                    error = writer.errorCode();
+                }
+            }
+            for (int run : group) {
+                close(run);
+            }
+            if (error != 0) {
+                session.err << "sort: merging: " << strerror(error) << std::endl;
+                if (fd >= 0) {
+                    close(fd);
+                }
+                for (int run : merged) {
+                    close(run);
+                }
+                for (size_t j = i + maxFanIn; j < runs.size(); ++j) {
+                    close(runs[j]);
+                }
+                return 2;
+            }
+            merged.push_back(fd);
+        }
+        runs.swap(merged);
+    }
+
+    // All input has been read, so -o may name one of the inputs
+    int outFd = -1;
+    if (output != nullptr) {
+        outFd = openat(session.cwdFd(), output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (outFd < 0) {
+            session.err << "sort: " << output << ": " << strerror(errno) << std::endl;
+            closeRuns();
+            return 2;
+        }
+    }
+
+    int error = 0;
+    {
+        std::unique_ptr<LineWriter> writer = outFd >= 0 ? std::make_unique<LineWriter>(outFd)
+                                                        : std::make_unique<LineWriter>(session.out);
+        if (runs.empty()) {
+            writeSorted(lines, *writer, options);
+        } else {
+            error = mergeRuns(runs, *writer, options);
+        }
+        if (!writer->flush() && error == 0) {
+            error = writer->errorCode();
+        }
+    }
+    closeRuns();
+    if (outFd >= 0) {
+        close(outFd);
+    }
+    if (error != 0) {
+        session.err << "sort: " << strerror(error) << std::endl;
+        return 2;
+    }
+    return 0;
+}
+
+int uniqCommand(Session& session, int argc, char** argv) {
+    bool count = false, repeatedOnly = false, uniqueOnly = false;
+    const char* file = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0) {
+            count = true;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            repeatedOnly = true;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            uniqueOnly = true;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            session.out << "Usage: uniq [-c] [-d] [-u] [file]\n";
+            return 2;
+        } else {
+            file = argv[i];
+        }
+    }
+
+    int fd = -1;
+    if (file != nullptr) {
+        fd = openat(session.cwdFd(), file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            session.err << "uniq: " << file << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+    LineReader reader = fd >= 0 ? LineReader(fd) : LineReader(session.in);
+    LineWriter writer(session.out);
+
+    // Only the previous line is kept, so memory doesn't depend on the input size
+    std::string previous;
+    size_t repeats = 0;
+    char prefix[32];
+    auto emit = [&]() {
+        if (repeats == 0 || (repeatedOnly && repeats < 2) || (uniqueOnly && repeats > 1)) {
+            return;
+        }
+        if (count) {
+            snprintf(prefix, sizeof(prefix), "%7zu ", repeats);
+            writer.write(std::string(prefix) + previous);
+        } else {
+            writer.write(previous);
+        }
+    };
+    std::string_view line;
+    while (reader.next(line)) {
+        if (repeats > 0 && line == previous) {
+            repeats++;
+            continue;
+        }
+        emit();
+        previous.assign(line.data(), line.size());
+        repeats = 1;
+    }
+    emit();
+    writer.flush();
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (reader.failed()) {
+        session.err << "uniq: " << strerror(reader.errorCode()) << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+}
+
+void registerSortCommands(CommandRegistry& registry) {
+    registry.add({"sort", "sort [-n] [-r] [-u] [-k field[,field]] [-t char] [-S size] [-o file] [file...]", "Sort lines of text",
+                  "Sort the lines of the files (or standard input). -n compares numbers, -r reverses, -u keeps one line per key, "
+                  "-k sorts on fields (split at blanks, or at the -t character), -o writes to a file (which may be an input). "
+                  "Up to -S bytes of lines (default an eighth of RAM) are sorted in memory using every core; larger inputs are "
+                  "sorted in runs kept in temporary files in the rootfs and merged, so files bigger than RAM can be sorted.",
+                  sortCommand});
+    registry.add({"uniq", "uniq [-c] [-d] [-u] [file]", "Collapse repeated adjacent lines",
+                  "Print each run of identical adjacent lines once. -c prefixes the number of repeats, "
+                  "-d prints only repeated lines and -u only lines that are not repeated. Use after sort to find duplicates.",
+                  uniqCommand});
+}
@@ -0,0 +1,569 @@
+// textutils.cpp; wc, head and tail that stay fast on multi-GB files
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "coreutils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../commands.h"
+#include "../session.h"
+
+namespace {
+
+const size_t blockSize = 1 << 16;
+
+int openInput(Session& session, const char* command, const char* path) {
+    int fd = openat(session.cwdFd(), path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        session.err << command << ": " << path << ": " << strerror(errno) << std::endl;
+    }
+    return fd;
+}
+
+// Parses the N of -n N or -N; returns false if it isn't a count
+bool parseCount(const char* text, long long& count) {
+    char* end;
+    errno = 0;
+    count = strtoll(text, &end, 10);
+    return errno == 0 && end != text && *end == '\0' && count >= 0;
+}
+
+inline bool isSpace(unsigned char c) {
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= 4;  // \t \n \v \f \r
+}
+
+#if defined(__SSE2__)
+// 0xFF in each lane holding a space byte
+inline __m128i spaces(__m128i v) {
+    __m128i offset = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(4)), offset);  // \t..\r, unsigned compare
+    return _mm_or_si128(control, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+#endif
+
+/*
+ * Line, word and byte counter that can be fed a file in pieces.
+ * With SSE2 it looks at 16 bytes per step: newlines and word starts (a non-space byte
+ * after a space byte) become 0xFF lanes that are subtracted into per-lane byte counters,
+ * which are folded into the totals with psadbw every 255 steps before they can wrap.
+ */
+struct WordCount {
+    uint64_t lines = 0;
+    uint64_t words = 0;
+    uint64_t bytes = 0;
+    bool inWord = false;  // The last byte seen was part of a word
+
+    void add(const char* data, size_t size, bool countWords);
+
+private:
+    void addScalar(const unsigned char* p, size_t size, bool countWords);
+};
+
+void WordCount::addScalar(const unsigned char* p, size_t size, bool countWords) {
+    for (size_t i = 0; i < size; ++i) {
+        lines += p[i] == '\n';
+        if (countWords) {
+            bool space = isSpace(p[i]);
+            words += !space && !inWord;
+            inWord = !space;
+        }
+    }
+}
+
+void WordCount::add(const char* data, size_t size, bool countWords) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    bytes += size;
+    if (size == 0) {
+        return;
+    }
+
+    // The vector loop compares each byte with the one before it, so the first byte goes alone
+    addScalar(p, 1, countWords);
+    size_t i = 1;
+
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 16 <= size) {
+        __m128i lineLanes = zero;
+        __m128i wordLanes = zero;
+        for (int step = 0; step < 255 && i + 16 <= size; ++step, i += 16) {
+            __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            lineLanes = _mm_sub_epi8(lineLanes, _mm_cmpeq_epi8(current, newline));
+            if (countWords) {
+                __m128i before = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i - 1));
+                wordLanes = _mm_sub_epi8(wordLanes, _mm_andnot_si128(spaces(current), spaces(before)));
+            }
+        }
+        __m128i lineSums = _mm_sad_epu8(lineLanes, zero);
+        __m128i wordSums = _mm_sad_epu8(wordLanes, zero);
+        lines += static_cast<uint64_t>(_mm_cvtsi128_si32(lineSums)) + _mm_cvtsi128_si32(_mm_srli_si128(lineSums, 8));
+        words += static_cast<uint64_t>(_mm_cvtsi128_si32(wordSums)) + _mm_cvtsi128_si32(_mm_srli_si128(wordSums, 8));
+    }
+    if (countWords) {
+        inWord = !isSpace(p[i - 1]);
+    }
+#endif
+
+    addScalar(p + i, size - i, countWords);
+}
+
+// Counts a file through mmap, or with read() when it can't be mapped (pipes, /proc)
+int countFile(int fd, WordCount& count, bool needContents, bool countWords) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return errno;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return EISDIR;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        if (!needContents) {
+            count.bytes += st.st_size;
+            return 0;
+        }
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            count.add(static_cast<const char*>(map), st.st_size, countWords);
+            munmap(map, st.st_size);
+            return 0;
+        }
+    }
+
+    std::vector<char> buffer(blockSize);
+    ssize_t n;
+    while ((n = read(fd, buffer.data(), buffer.size())) > 0) {
+        count.add(buffer.data(), n, countWords);
+    }
+    return n < 0 ? errno : 0;
+}
+
+int wc(Session& session, int argc, char** argv) {
+    bool lines = false, words = false, bytes = false;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            for (const char* flag = argv[i] + 1; *flag != '\0'; ++flag) {
+                if (*flag == 'l') {
+                    lines = true;
+                } else if (*flag == 'w') {
+                    words = true;
+                } else if (*flag == 'c') {
+                    bytes = true;
+                } else {
+                    session.out << "Usage: wc [-lwc] [file...]\n";
+                    return 2;
+                }
+            }
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (!lines && !words && !bytes) {
+        lines = words = bytes = true;
+    }
+
+    std::vector<WordCount> counts;
+    std::vector<const char*> names;
+    int status = 0;
+    if (files.empty()) {
+        WordCount count;
+        std::vector<char> buffer(blockSize);
+        while (session.in.read(buffer.data(), buffer.size()) || session.in.gcount() > 0) {
+            count.add(buffer.data(), session.in.gcount(), words);
+        }
+        counts.push_back(count);
+        names.push_back(nullptr);
+    }
+    for (const char* file : files) {
+        int fd = openInput(session, "wc", file);
+        if (fd < 0) {
+            status = 1;
+            continue;
+        }
+        WordCount count;
+        int error = countFile(fd, count, lines || words, words);
+        close(fd);
+        if (error != 0) {
+            session.err << "wc: " << file << ": " << strerror(error) << std::endl;
+            status = 1;
+            continue;
+        }
+        counts.push_back(count);
+        names.push_back(file);
+    }
+    if (counts.size() > 1) {
+        WordCount total;
+        for (const WordCount& count : counts) {
+            total.lines += count.lines;
+            total.words += count.words;
+            total.bytes += count.bytes;
+        }
+        counts.push_back(total);
+        names.push_back("total");
+    }
+
+    // One column for one file needs no padding; otherwise align on the widest number
+    int columns = lines + words + bytes;
+    size_t width = 1;
+    if (columns > 1 || counts.size() > 1) {
+        for (const WordCount& count : counts) {
+            width = std::max(width, std::to_string(std::max({count.lines, count.words, count.bytes})).size());
+        }
+    }
+    auto field = [&](uint64_t value, bool& first) {
+        std::string text = std::to_string(value);
+        session.out << (first ? "" : " ") << std::string(width - std::min(width, text.size()), ' ') << text;
+        first = false;
+    };
+    for (size_t i = 0; i < counts.size(); ++i) {
+        bool first = true;
+        if (lines) {
+            field(counts[i].lines, first);
+        }
+        if (words) {
+            field(counts[i].words, first);
+        }
+        if (bytes) {
+            field(counts[i].bytes, first);
+        }
+        if (names[i] != nullptr) {
+            session.out << " " << names[i];
+        }
+        session.out << "\n";
+    }
+    return status;
+}
+
+// Shared option parsing for head and tail: -n N, -N and (tail only) -f
+bool parseLineOptions(Session& session, int argc, char** argv, bool allowFollow, long long& count,
+                      bool& follow, std::vector<const char*>& files) {
+    const char* usage = allowFollow ? "Usage: tail [-f] [-n lines] [file...]\n" : "Usage: head [-n lines] [file...]\n";
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0) {
+            if (i + 1 >= argc || !parseCount(argv[++i], count)) {
+                session.out << usage;
+                return false;
+            }
+        } else if (allowFollow && strcmp(argv[i], "-f") == 0) {
+            follow = true;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            if (!parseCount(argv[i] + 1, count)) {
+                session.out << usage;
+                return false;
+            }
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    return true;
+}
+
+void printHeader(Session& session, const char* file, bool& first) {
+    session.out << (first ? "" : "\n") << "==> " << file << " <==\n";
+    first = false;
+}
+
+// Copies up to count lines from fd, stopping at the newline that ends the last one
+int headFd(Session& session, int fd, long long count) {
+    std::vector<char> buffer(blockSize);
+    ssize_t n = 0;  // head -n 0 reads nothing
+    while (count > 0 && (n = read(fd, buffer.data(), buffer.size())) > 0) {
+        const char* p = buffer.data();
+        const char* end = p + n;
+        while (count > 0 && p < end) {
+            const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (eol == nullptr) {
+                p = end;
+                break;
+            }
+            p = eol + 1;
+            count--;
+        }
+        session.out.write(buffer.data(), p - buffer.data());
+    }
+    return n < 0 ? errno : 0;
+}
+
+int head(Session& session, int argc, char** argv) {
+    long long count = 10;
+    bool follow = false;
+    std::vector<const char*> files;
+    if (!parseLineOptions(session, argc, argv, false, count, follow, files)) {
+        return 2;
+    }
+
+    if (files.empty()) {
+        // Line at a time, so an interactive head stops as soon as it has enough
+        std::string line;
+        for (long long i = 0; i < count && std::getline(session.in, line); ++i) {
+            session.out << line;
+            if (!session.in.eof()) {
+                session.out << "\n";
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    bool first = true;
+    for (const char* file : files) {
+        int fd = openInput(session, "head", file);
+        if (fd < 0) {
+            status = 1;
+            continue;
+        }
+        if (files.size() > 1) {
+            printHeader(session, file, first);
+        }
+        int error = headFd(session, fd, count);
+        close(fd);
+        if (error != 0) {
+            session.err << "head: " << file << ": " << strerror(error) << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Writes [offset, end) of fd
+void copyRange(Session& session, int fd, off_t offset, off_t end) {
+    std::vector<char> buffer(blockSize);
+    while (offset < end) {
+        ssize_t n = pread(fd, buffer.data(), std::min<off_t>(buffer.size(), end - offset), offset);
+        if (n <= 0) {
+            break;
+        }
+        session.out.write(buffer.data(), n);
+        offset += n;
+    }
+}
+
+/*
+ * Offset where the last count lines of the first size bytes of fd start.
+ * Reads backwards from the end one block at a time, so only the tail of the file is touched.
+ */
+off_t tailStart(int fd, off_t size, long long count) {
+    if (count == 0) {
+        return size;
+    }
+    std::vector<char> buffer(blockSize);
+    off_t blockEnd = size;
+    long long newlines = 0;
+    while (blockEnd > 0) {
+        off_t blockStart = blockEnd > static_cast<off_t>(buffer.size()) ? blockEnd - buffer.size() : 0;
+        ssize_t n = pread(fd, buffer.data(), blockEnd - blockStart, blockStart);
+        if (n <= 0) {
+            return 0;
+        }
+        const char* p = buffer.data() + n;
+        while (p > buffer.data()) {
+            const char* nl = static_cast<const char*>(memrchr(buffer.data(), '\n', p - buffer.data()));
+            if (nl == nullptr) {
+                break;
+            }
+            off_t at = blockStart + (nl - buffer.data());
+            // A newline at the very end closes the last line instead of starting an empty one
+            if (at != size - 1 && ++newlines == count) {
+                return at + 1;
+            }
+            p = nl;
+        }
+        blockEnd = blockStart;
+    }
+    return 0;
+}
+
+// Last count lines of a stream that can't seek: keep a window of lines
+void tailStream(Session& session, std::istream& in, long long count) {
+    std::deque<std::string> window;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (count == 0) {
+            continue;
+        }
+        if (static_cast<long long>(window.size()) == count) {
+            window.pop_front();
+        }
+        window.push_back(std::move(line));
+    }
+    for (const std::string& kept : window) {
+        session.out << kept << "\n";
+    }
+}
+
+/*
+ * Prints what is appended to fd from offset on until the file is deleted, the output
+ * goes away, or Enter is pressed on the session's input. inotify wakes us on writes,
+ * so an idle follow costs nothing.
+ */
+int follow(Session& session, int fd, const char* file, off_t offset) {
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify < 0) {
+        session.err << "tail: inotify: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    // Watch the open file itself, wherever it is renamed to
+    std::string self = "/proc/self/fd/" + std::to_string(fd);
+    if (inotify_add_watch(notify, self.c_str(), IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF) < 0) {
+        session.err << "tail: " << file << ": " << strerror(errno) << std::endl;
+        close(notify);
+        return 1;
+    }
+
+    session.out.flush();  // The last lines, before waiting for more
+    bool watchInput = session.inFd >= 0;
+    bool running = true;
+    while (running && session.out) {
+        struct pollfd fds[2] = {{notify, POLLIN, 0}, {session.inFd, POLLIN, 0}};
+        if (poll(fds, watchInput ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (watchInput && (fds[1].revents & (POLLIN | POLLHUP))) {
+            char discard[256];
+            if (read(session.inFd, discard, sizeof(discard)) > 0) {
+                break;
+            }
+            watchInput = false;  // Input is closed, e.g. a script run without a terminal
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        alignas(struct inotify_event) char events[4096];
+        ssize_t len;
+        while ((len = read(notify, events, sizeof(events))) > 0) {
+            for (char* p = events; p < events + len;) {
+                auto* event = reinterpret_cast<struct inotify_event*>(p);
+                if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+                    running = false;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            break;
+        }
+        if (st.st_size < offset) {
+            session.err << "tail: " << file << ": file truncated" << std::endl;
+            offset = 0;
+        }
+        copyRange(session, fd, offset, st.st_size);
+        offset = st.st_size;
+        session.out.flush();
+
+        // Our open fd keeps an unlinked file alive, so DELETE_SELF only comes after we close it
+        if (st.st_nlink == 0) {
+            running = false;
+        }
+    }
+    if (!running) {
+        session.err << "tail: " << file << " has been removed" << std::endl;
+    }
+    close(notify);
+    return 0;
+}
+
+int tail(Session& session, int argc, char** argv) {
+    long long count = 10;
+    bool followFile = false;
+    std::vector<const char*> files;
+    if (!parseLineOptions(session, argc, argv, true, count, followFile, files)) {
+        return 2;
+    }
+    if (followFile && files.size() != 1) {
+        session.out << "tail: -f follows exactly one file\n";
+        return 2;
+    }
+
+    if (files.empty()) {
+        tailStream(session, session.in, count);
+        return 0;
+    }
+
+    int status = 0;
+    bool first = true;
+    for (const char* file : files) {
+        int fd = openInput(session, "tail", file);
+        if (fd < 0) {
+            status = 1;
+            continue;
+        }
+        if (files.size() > 1) {
+            printHeader(session, file, first);
+        }
+
+        struct stat st;
+        int error = fstat(fd, &st) != 0 ? errno : S_ISDIR(st.st_mode) ? EISDIR : 0;
+        if (error != 0) {
+            session.err << "tail: " << file << ": " << strerror(error) << std::endl;
+            close(fd);
+            status = 1;
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            // Pipes and /proc files have no size to read back from
+            std::string data;
+            std::vector<char> buffer(blockSize);
+            ssize_t n;
+            while ((n = read(fd, buffer.data(), buffer.size())) > 0) {
+                data.append(buffer.data(), n);
+            }
+            std::istringstream in(data);
+            tailStream(session, in, count);
+            close(fd);
+            continue;
+        }
+
+        copyRange(session, fd, tailStart(fd, st.st_size, count), st.st_size);
+        if (followFile) {
+            session.out.flush();
+            status = follow(session, fd, file, st.st_size);
+        }
+        close(fd);
+    }
+    return status;
+}
+
+}
+
+void registerTextCommands(CommandRegistry& registry) {
+    registry.add({"wc", "wc [-lwc] [file...]", "Count lines, words and bytes",
+                  "Count the lines, words and bytes in each file, or in standard input. "
+                  "Files are memory mapped and scanned 16 bytes at a time, so multi-GB logs are counted at memory speed.",
+                  wc});
+    registry.add({"head", "head [-n lines] [file...]", "Print the first lines of a file",
+                  "Print the first 10 lines (or -n lines) of each file, or of standard input. "
+                  "Only the blocks containing those lines are read.",
+                  head});
+    registry.add({"tail", "tail [-f] [-n lines] [file...]", "Print the last lines of a file",
+                  "Print the last 10 lines (or -n lines) of each file, or of standard input. "
+                  "Regular files are read backwards from the end, so the size of the file doesn't matter. "
+                  "-f keeps printing what is appended to the file until Enter is pressed or the file is removed.",
+                  tail});
+}
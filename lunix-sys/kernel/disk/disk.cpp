@@ -2,14 +2,29 @@
 #include "../kernel/kernel.h"
 #include "../kernel/error_handler.h"
 #include "../security/userman.h"
+#include "../session.h"
+#include "../pathcache.h"
+#include "../kernel/trace.h"
+#include "../kernel/eventbus.h"
+#include "../kernel/timer.h"
+#include "../kernel/services.h"
+#include "../kernel/klog.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <cerrno>
+#include <csignal>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 using namespace std;
@@ -17,11 +32,135 @@ namespace fs = std::filesystem;
 
 kernel Kernel;
 extern error_handler ErrHandler;
-extern UserManager userManager;
 
 disk::disk() {}
 
+// How long a process past its deadline gets to exit after SIGTERM before it is killed
+static const std::chrono::seconds terminateGrace(2);
+// How often the flusher writes back the rootfs
+static const std::chrono::seconds flushInterval(30);
+
+/*
+ * Run program with argv and the session's working directory and streams. name is what
+ * it is accounted and limited as (the program's file name if empty); a process still
+ * running after deadline (if non-zero) is terminated.
+ * Returns the exit status of the child, or -1 if it could not be run or did not exit normally.
+ */
+static int runInSession(Session& session, const char* program, char* const argv[], const std::string& name = "",
+                        std::chrono::milliseconds deadline = std::chrono::milliseconds(0)) {
+    session.out.flush();  // Keep our buffered output ahead of the child's
+
+    SpawnOptions options;
+    options.cwdFd = session.cwdFd();
+    options.inFd = session.inFd;
+    options.outFd = session.outFd;
+    options.errFd = session.outFd != STDOUT_FILENO ? session.outFd : -1;
+    options.owner = session.user.getUsername();
+    options.name = name;
+    pid_t pid = Kernel.exec(program, argv, options);
+    if (pid < 0) {
+        session.err << "Error: Fork failed\n";
+        return -1;
+    }
+
+    // The process manager only signals pids it still tracks, so a late timer can't hit a reused pid
+    auto expired = std::make_shared<std::atomic<bool>>(false);
+    TimerWheel::Id terminate = 0, kill = 0;
+    if (deadline.count() > 0) {
+        terminate = timers().after(deadline, [pid, expired] {
+            *expired = true;
+            processManager().signal(pid, SIGTERM);
+        });
+        kill = timers().after(deadline + terminateGrace, [pid] { processManager().signal(pid, SIGKILL); });
+    }
+
+    int status;
+    struct rusage usage = {};
+    int result = Kernel.wait(pid, status, &usage);
+    if (deadline.count() > 0) {
+        timers().cancel(terminate);
+        timers().cancel(kill);
+    }
+    if (result != 0) {
+        return -1;
+    }
+    session.addChildUsage(usage);
+    if (*expired) {
+        session.err << "Terminated: still running after " << deadline.count() / 1000.0 << "s\n";
+        klog(LogLevel::Warning, "disk", (name.empty() ? std::string(program) : name) + " terminated: still running after " +
+                                            std::to_string(deadline.count()) + "ms");
+    }
+
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return -1;
+}
+
+// Remove name under dirfd, descending into directories; like remove_all but fd relative
+static int removeTreeAt(int dirfd, const char* name) {
+    if (unlinkat(dirfd, name, 0) == 0) {
+        return 0;
+    }
+    if (errno != EISDIR && errno != EPERM) {
+        return -1;
+    }
+
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    DIR* dir = fdopendir(fd);
+    if (dir == nullptr) {
+        close(fd);
+        return -1;
+    }
+    int result = 0;
+    while (struct dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (removeTreeAt(fd, entry->d_name) != 0) {
+            result = -1;
+        }
+    }
+    closedir(dir);
+
+    if (unlinkat(dirfd, name, AT_REMOVEDIR) != 0) {
+        return -1;
+    }
+    return result;
+}
+
+// The value of a "# key: value" line among a module's first lines, or "" if it has none
+static std::string moduleHeader(const fs::path& path, const std::string& key) {
+    std::ifstream module(path);
+    std::string line;
+    const std::string prefix = "# " + key + ":";
+    for (int i = 0; i < 5 && std::getline(module, line); ++i) {
+        if (line.compare(0, prefix.size(), prefix) == 0) {
+            return line.substr(prefix.size());
+        }
+    }
+    return "";
+}
+
+/*
+ * A module's deadline, from a "# timeout: <seconds>" line among its first lines.
+ * Modules without one may run for as long as they like.
+ */
+static std::chrono::milliseconds moduleDeadline(const fs::path& path) {
+    std::string value = moduleHeader(path, "timeout");
+    char* end = nullptr;
+    double seconds = strtod(value.c_str(), &end);
+    if (end != value.c_str() && seconds > 0) {
+        return std::chrono::milliseconds(static_cast<int64_t>(seconds * 1000));
+    }
+    return std::chrono::milliseconds(0);
+}
+
 void disk::rootfs() {
+    TraceScope scope("disk", "rootfs");
     std::string path = "rootfs";
     std::string pathmod = "modules";
     std::string usr_input;
@@ -29,97 +168,100 @@ void disk::rootfs() {
     this->rootfsAbsolutePath = rootfsPath.string(); // Save the absolute path
 
     fs::path modPath = rootfsPath / pathmod; // Make modPath a subdirectory of rootfs
+    std::ostream& console = Kernel.console();
 
-    if (!fs::exists(rootfsPath)) {
+    if (!fs::exists(rootfsPath) && Kernel.quiet) {
+        // Nobody to ask in batch mode; behave as if the user answered yes
+        if (!fs::create_directory(rootfsPath)) {
+            ErrHandler.panic("Failed to create rootfs");
+        }
+    } else if (!fs::exists(rootfsPath)) {
         std::cout << "\nThe rootfs directory doesn't exist. Make new rootfs at " << fs::current_path() << "? (y/n): ";
         std::getline(std::cin, usr_input);
 
         if (usr_input == "y" || usr_input == "Y") {
-            std::cout << "Creating rootfs...";
+            console << "Creating rootfs...";
             if (fs::create_directory(rootfsPath)) {
-                std::cout << "done\n";
+                console << "done\n";
             } else {
                 ErrHandler.panic("Failed to create rootfs");
             }
         } else if (usr_input == "n" || usr_input == "N") {
             ErrHandler.panic("Failed to mount rootfs");
         } else {
-            std::cout << "Invalid input. Please enter 'y' or 'n'.\n";
+            console << "Invalid input. Please enter 'y' or 'n'.\n";
             disk::rootfs(); // Retry if invalid input
             return;
         }
     } else {
-        std::cout << "done\n";
+        console << "done\n";
     }
 
-    std::cout << "Changing to rootfs directory...\n";
+    console << "Changing to rootfs directory...\n";
     try {
         fs::current_path(rootfsPath);
-        std::cout << "Current working directory: " << fs::current_path() << std::endl;
+        console << "Current working directory: " << fs::current_path() << "\n";
     } catch (const fs::filesystem_error& e) {
         ErrHandler.panic("Failed to change to rootfs directory: " + std::string(e.what()));
     }
 
     // Now check for the modules directory
     if (!fs::exists(modPath)) {
-        std::cout << "Creating modules directory...";
+        console << "Creating modules directory...";
         if (fs::create_directory(modPath)) {
-            std::cout << "done\n";
+            console << "done\n";
         } else {
             ErrHandler.oops("Failed to create modules directory. To install modules you may have to create the folder manually.");
         }
     } else {
-        std::cout << "Modules directory found; loading modules...\n";
+        console << "Modules directory found; loading modules...\n";
 
         // Loop through each file in the modules directory
         for (const auto& entry : fs::directory_iterator(modPath)) {
             if (entry.is_regular_file() && entry.path().extension() == ".py") {
-                std::cout << "Loaded " << entry.path().filename().string() << std::endl;
+                console << "Loaded " << entry.path().filename().string() << "\n";
             }
         }
     }
 }
 
-int disk::loadMod(const std::string& modName) {
+int disk::loadMod(Session& session, const std::string& modName, const std::vector<std::string>& args) {
+    TraceScope scope("module", modName);
     // Always look for modules in the absolute rootfsAbsolutePath
     std::string modulesDir = "modules";
     fs::path modPath = fs::path(this->rootfsAbsolutePath) / modulesDir / (modName + ".py");
 
     // Check if the module exists and is a file
     if (!fs::exists(modPath) || !fs::is_regular_file(modPath)) {
-        std::cerr << "Error: Module " << modName << " does not exist in " << modPath << std::endl;
+        session.err << "Error: Module " << modName << " does not exist in " << modPath << "\n";
         return -1;  // Error code for file not found
     }
 
-    // Create a child process to run the Python script
-    pid_t pid = fork();
-    if (pid < 0) {
-        std::cerr << "Error: Fork failed" << std::endl;
-        return -1;  // Fork failed
-    } else if (pid == 0) {
-        // In child process, execute the python3 interpreter with the module
-        std::string modPathStr = modPath.string();
-        char* args[] = {const_cast<char*>("python3"), const_cast<char*>(modPathStr.c_str()), nullptr};
-
-        execvp(args[0], args);  // Replace the child process with python3
-        // If execvp returns, it means the exec call failed
-        std::cerr << "Error: Exec failed for module " << modName << std::endl;
-        exit(EXIT_FAILURE);  // Exit child process on failure
-    } else {
-        // In parent process, wait for the child to complete
-        int status;
-        waitpid(pid, &status, 0);
-
-        if (WIFEXITED(status)) {
-            return WEXITSTATUS(status);  // Return the exit code of the Python script
-        } else {
-            std::cerr << "Error: Child process did not terminate normally" << std::endl;
-            return -1;  // Return error if the process didn't terminate normally
-        }
+    // Run the python3 interpreter with the module in a child process
+    std::string python = pathCache().lookup("python3");
+    if (python.empty()) {
+        session.err << "python3: command not found\n";
+        return 127;
+    }
+    std::vector<std::string> argv = {"python3", modPath.string()};
+    argv.insert(argv.end(), args.begin(), args.end());
+    std::vector<char*> pointers;
+    for (std::string& arg : argv) {
+        pointers.push_back(arg.data());
+    }
+    pointers.push_back(nullptr);
+    int status = runInSession(session, python.c_str(), pointers.data(), "module:" + modName, moduleDeadline(modPath));
+    if (status < 0) {
+        session.err << "Error: Child process did not terminate normally\n";
+        klog(LogLevel::Warning, "module", modName + " did not terminate normally");
+    } else if (status != 0) {
+        klog(LogLevel::Notice, "module", modName + " exited with status " + std::to_string(status));
     }
+    return status;
 }
 
 int disk::fopen(const std::string& filename, std::ios::openmode mode) {
+    TraceScope scope("disk", "fopen");
     fs.open(filename, mode);
     if (fs.is_open()) {
         return 0;
@@ -129,6 +271,7 @@ int disk::fopen(const std::string& filename, std::ios::openmode mode) {
 }
 
 int disk::fclose() {
+    TraceScope scope("disk", "fclose");
     if (fs.is_open()) {
         fs.close();
         return 0;
@@ -138,6 +281,7 @@ int disk::fclose() {
 }
 
 int disk::fread(char* buffer, std::streamsize size) {
+    TraceScope scope("disk", "fread");
     if (fs.is_open() && fs.read(buffer, size)) {
         return static_cast<int>(fs.gcount());
     } else {
@@ -146,6 +290,7 @@ int disk::fread(char* buffer, std::streamsize size) {
 }
 
 int disk::fwrite(const char* buffer, std::streamsize size) {
+    TraceScope scope("disk", "fwrite");
     if (fs.is_open() && fs.write(buffer, size)) {
         return 0;
     } else {
@@ -153,91 +298,274 @@ int disk::fwrite(const char* buffer, std::streamsize size) {
     }
 }
 
-int disk::funlink(const std::string& filename) {
-    // Check if the file is in the protected files list
-    if (std::find(protectedFiles.begin(), protectedFiles.end(), filename) != protectedFiles.end()) {
+bool disk::isProtected(const struct stat& st) const {
+    for (const std::string& name : protectedFiles) {
+        struct stat file;
+        if (stat((rootfsAbsolutePath + "/" + name).c_str(), &file) == 0 && file.st_dev == st.st_dev && file.st_ino == st.st_ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool disk::isProtected(int dirFd, const std::string& path) const {
+    struct stat st;
+    if (fstatat(dirFd, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        return isProtected(st);
+    }
+    fs::path target(path);
+    std::string name = target.filename().string();
+    if (std::find(protectedFiles.begin(), protectedFiles.end(), name) == protectedFiles.end()) {
+        return false;
+    }
+    std::string parent = target.has_parent_path() ? target.parent_path().string() : ".";
+    struct stat dir, root;
+    return fstatat(dirFd, parent.c_str(), &dir, 0) == 0 && stat(rootfsAbsolutePath.c_str(), &root) == 0 &&
+           dir.st_dev == root.st_dev && dir.st_ino == root.st_ino;
+}
+
+int disk::funlink(Session& session, const std::string& filename) {
+    TraceScope scope("disk", "funlink");
+    // Check if the file is in the protected files list; by inode, so ./.passwd is caught too
+    struct stat st;
+    if (fstatat(session.cwdFd(), filename.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && isProtected(st)) {
         // If the file is protected, check if the user is root
-        if (!userManager.isRoot()) {
-            std::cerr << "Permission denied: " << filename << " is a protected file." << std::endl;
+        if (!session.user.isRoot()) {
+            session.err << "Permission denied: " << filename << " is a protected file.\n";
             return -1;  // Return -1 to indicate an error
         }
     }
-    if (remove(filename.c_str()) == 0) {
+    // Like remove(): files and empty directories
+    if (unlinkat(session.cwdFd(), filename.c_str(), 0) == 0 ||
+        (errno == EISDIR && unlinkat(session.cwdFd(), filename.c_str(), AT_REMOVEDIR) == 0)) {
+        eventBus().publish(EventType::FileChange, session.path(filename), "removed");
         return 0;
-    } else {
-        return 1;
     }
+    return 1;
 }
 
-int disk::fopenbin(const std::string& binary) {
-    pid_t pid = fork();  // Create a child process
+int disk::fopenbin(Session& session, const std::string& binary) {
+    TraceScope scope("disk", "fopenbin");
+    char* args[] = {const_cast<char*>(binary.c_str()), nullptr};
+    return runInSession(session, binary.c_str(), args);
+}
 
-    if (pid < 0) {
-        // Fork failed
-        std::cerr << "Fork failed" << std::endl;
+int disk::fexec(Session& session, const std::vector<std::string>& argv, const std::string& program) {
+    TraceScope scope("disk", "fexec");
+    if (argv.empty()) {
         return -1;
-    } else if (pid == 0) {
-        // Child process
-        char *args[] = {const_cast<char*>(binary.c_str()), nullptr};
-        execvp(args[0], args);  // Replace the child process with the new binary
-
-        // If execvp returns, it must have failed
-        std::cerr << "Exec failed" << std::endl;
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);  // Wait for the child process to finish
-
-        if (WIFEXITED(status)) {
-            return WEXITSTATUS(status);  // Return the exit status of the child process
-        } else {
-            return -1;  // Child process did not terminate normally
-        }
     }
+    std::string file = program;
+    if (file.empty()) {
+        file = argv[0].find('/') != std::string::npos ? argv[0] : pathCache().lookup(argv[0]);
+    }
+    if (file.empty()) {
+        session.err << argv[0] << ": command not found\n";
+        return 127;
+    }
+    std::vector<char*> args;
+    args.reserve(argv.size() + 1);
+    for (const std::string& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+    return runInSession(session, file.c_str(), args.data());
 }
 
-int disk::fmkdir(const std::string& path) {
-    if (fs::create_directory(path)) {  // Use fs::create_directory
+int disk::fmkdir(Session& session, const std::string& path) {
+    TraceScope scope("disk", "fmkdir");
+    if (mkdirat(session.cwdFd(), path.c_str(), 0755) == 0) {
+        eventBus().publish(EventType::FileChange, session.path(path), "created");
         return 0;
     } else {
         return 1;
     }
 }
 
-int disk::frmdir(const std::string& path) {
-    if (fs::remove_all(path) > 0) {  // Use fs::remove_all
+int disk::frmdir(Session& session, const std::string& path) {
+    TraceScope scope("disk", "frmdir");
+    if (removeTreeAt(session.cwdFd(), path.c_str()) == 0) {
+        eventBus().publish(EventType::FileChange, session.path(path), "removed");
         return 0;
     } else {
         return 1;
     }
 }
 
-int disk::frmdir_r(const std::string& path) {
-    if (fs::remove_all(path) > 0) {  // Use fs::remove_all
+int disk::frmdir_r(Session& session, const std::string& path) {
+    TraceScope scope("disk", "frmdir_r");
+    if (removeTreeAt(session.cwdFd(), path.c_str()) == 0) {
+        eventBus().publish(EventType::FileChange, session.path(path), "removed");
         return 0;
     } else {
         return 1;
     }
 }
 
-int disk::fchdir(const std::string& path) {
-    if (chdir(path.c_str()) == 0) {
-        return 0;
-    } else {
-        return 1;
-    }
+int disk::fchdir(Session& session, const std::string& path) {
+    return session.chdir(path);
 }
 
 int disk::ftest() {
-    std::cout << "done" << std::endl;
+    Kernel.console() << "done\n";
     return 0;
 }
 
 void disk::umount() {
-    std::cout << "Unmounting..." << std::endl;
+    TraceScope scope("disk", "umount");
+    Kernel.console() << "Unmounting...\n";
+    sync();
+}
+
+int disk::sync() {
+    TraceScope scope("disk", "sync");
+    int fd = open(rootfsAbsolutePath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    int result = syncfs(fd) == 0 ? 0 : errno;
+    close(fd);
+    return result;
+}
+
+int disk::startFlusher() {
+    std::lock_guard<std::mutex> lock(flushMutex);
+    if (flusher.joinable()) {
+        return 0;
+    }
+    flushStop = false;
+    flusher = std::thread([this] {
+        std::unique_lock<std::mutex> lock(flushMutex);
+        while (!flushWake.wait_for(lock, flushInterval, [this] { return flushStop; })) {
+            lock.unlock();
+            int result = sync();
+            if (result != 0) {
+                klog(LogLevel::Warning, "disk", std::string("Write-back failed: ") + strerror(result));
+            }
+            lock.lock();
+        }
+    });
+    return 0;
+}
+
+void disk::stopFlusher() {
+    {
+        std::lock_guard<std::mutex> lock(flushMutex);
+        flushStop = true;
+    }
+    flushWake.notify_all();
+    if (flusher.joinable()) {
+        flusher.join();
+    }
+    sync();  // What the last round would have written
+}
+
+// Logs what a service module writes, a line at a time, until every writer has closed the pipe
+static void logModuleOutput(int fd, const std::string& name) {
+    std::string pending;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+        pending.append(buffer, std::max<ssize_t>(n, 0));
+        size_t start = 0;
+        for (size_t eol; (eol = pending.find('\n', start)) != std::string::npos; start = eol + 1) {
+            klog(LogLevel::Info, "module", name + ": " + pending.substr(start, eol - start));
+        }
+        pending.erase(0, start);
+    }
+    if (!pending.empty()) {
+        klog(LogLevel::Info, "module", name + ": " + pending);
+    }
+    close(fd);
+}
+
+/*
+ * A module with a "# runlevels: 3 4" line runs as a service in those runlevels, restarted
+ * if it exits; "# after: <service>..." starts it once those services are up. It runs
+ * as the kernel, in the rootfs, detached from the console: stdin is /dev/null, and what
+ * it prints goes to the kernel log under "module".
+ */
+static ServiceManager::Service moduleService(const fs::path& path, const std::string& runlevels) {
+    std::string name = path.stem().string();
+    ServiceManager::Service service;
+    service.name = "module:" + name;
+    service.description = "module " + name;
+    std::istringstream levels(runlevels);
+    for (int level; levels >> level;) {
+        service.runlevels.push_back(level);
+    }
+    std::istringstream after(moduleHeader(path, "after"));
+    for (std::string dependency; after >> dependency;) {
+        service.after.push_back(dependency);
+    }
+
+    auto pid = std::make_shared<std::atomic<pid_t>>(-1);
+    std::string file = path.string();
+    service.start = [file, name, pid] {
+        std::string module = file;
+        // Unbuffered, so lines reach the log as they are printed rather than when the module exits
+        char* argv[] = {const_cast<char*>("python3"), const_cast<char*>("-u"), module.data(), nullptr};
+        int null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (null < 0) {
+            return errno;
+        }
+        int output[2];
+        if (pipe2(output, O_CLOEXEC) != 0) {
+            int error = errno;
+            close(null);
+            return error;
+        }
+        SpawnOptions options;
+        options.inFd = null;
+        options.outFd = output[1];
+        options.errFd = output[1];
+        options.searchPath = true;  // Services start at boot, before lsh has set up its PATH
+        options.name = "module:" + name;
+        pid_t child = Kernel.exec("python3", argv, options);
+        int error = errno;
+        close(null);
+        close(output[1]);
+        if (child < 0) {
+            close(output[0]);
+            return error;
+        }
+        // Ends by itself once the module and anything it started have exited
+        std::thread(logModuleOutput, output[0], name).detach();
+        *pid = child;
+        return 0;
+    };
+    service.health = [pid] { return Kernel.process_is_alive(*pid) ? std::string() : std::string("exited"); };
+    service.stop = [pid] {
+        pid_t child = pid->exchange(-1);
+        if (child < 0) {
+            return;
+        }
+        processManager().signal(child, SIGTERM);
+        TimerWheel::Id kill = timers().after(terminateGrace, [child] { processManager().signal(child, SIGKILL); });
+        int status;
+        Kernel.wait(child, status);
+        timers().cancel(kill);
+    };
+    return service;
+}
+
+void disk::registerServices() {
+    services().add({"flusher", "disk write-back flusher", {2, 3, 4}, {},
+                    [this] { return startFlusher(); }, [this] { stopFlusher(); }, nullptr, {}});
+
+    fs::path modPath = fs::path(rootfsAbsolutePath) / "modules";
+    std::error_code error;
+    for (const auto& entry : fs::directory_iterator(modPath, error)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".py") {
+            continue;
+        }
+        std::string runlevels = moduleHeader(entry.path(), "runlevels");
+        if (!runlevels.empty()) {
+            services().add(moduleService(entry.path(), runlevels));
+        }
+    }
 }
 
-std::string disk::fcwd() {
-    return fs::current_path().string();
+std::string disk::fcwd(Session& session) {
+    return session.cwd();
 }
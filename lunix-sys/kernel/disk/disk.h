@@ -6,17 +6,29 @@
 #include <string>
 #include <filesystem>
 #include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+
+class Session;
 
 class disk
 {
 public:
     disk();
     const std::vector<std::string> protectedFiles = {".passwd"};
+    // True if st (from stat or fstat) is one of the protected files in the rootfs, whatever path led to it
+    bool isProtected(const struct stat& st) const;
+    // True if path in dirFd is a protected file, or would create one in its place
+    bool isProtected(int dirFd, const std::string& path) const;
 
     // Configure root filesystem folder
     void rootfs();
 
-    int loadMod(const std::string& modName);
+    std::string rootfsPath() const { return rootfsAbsolutePath; }
+
+    int loadMod(Session& session, const std::string& modName, const std::vector<std::string>& args = {});
 
     // File operations
     std::fstream fs;
@@ -24,25 +36,39 @@ public:
     int fclose();
     int fread(char* buffer, std::streamsize size);
     int fwrite(const char* buffer, std::streamsize size);
-    int funlink(const std::string& filename);
+    int funlink(Session& session, const std::string& filename);
 
-    int fopenbin(const std::string& binary);
+    int fopenbin(Session& session, const std::string& binary);
+    // Run argv in the session's directory with its streams as stdio.
+    // program is the file to execute; if empty, argv[0] is looked up in the PATH cache.
+    int fexec(Session& session, const std::vector<std::string>& argv, const std::string& program = "");
 
-    // Directory operations
-    int fmkdir(const std::string& path);
-    int frmdir(const std::string& path);
-    int frmdir_r(const std::string& path);
-    int fchdir(const std::string& path);
+    // Directory operations, relative to the session's working directory
+    int fmkdir(Session& session, const std::string& path);
+    int frmdir(Session& session, const std::string& path);
+    int frmdir_r(Session& session, const std::string& path);
+    int fchdir(Session& session, const std::string& path);
 
     int ftest();
 
     void umount();
-    std::string fcwd();
+    // Write back what the host has buffered for the rootfs; 0 or an errno value
+    int sync();
+    // The write-back flusher, and the modules that declare runlevels, as services
+    void registerServices();
+    std::string fcwd(Session& session);
 
 private:
     std::string rootfsAbsolutePath; // Moved to private section
     std::vector<std::ifstream*> openInputFiles;
     std::vector<std::ofstream*> openOutputFiles;
+
+    int startFlusher();
+    void stopFlusher();
+    std::thread flusher;  // Syncs the rootfs every flushInterval while running
+    std::mutex flushMutex;
+    std::condition_variable flushWake;
+    bool flushStop = false;
 };
 
 #endif // DISK_H
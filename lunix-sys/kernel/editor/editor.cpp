@@ -0,0 +1,339 @@
+// editor.cpp; Line editor used by the lsh editor command
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "editor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#include "../session.h"
+#include "../kernel/eventbus.h"
+#include "../disk/disk.h"
+
+extern disk Disk;
+
+Editor::Editor(Session& session, const std::string& filename) : session(session), filename(filename) {}
+
+int Editor::run() {
+    int file = openat(session.cwdFd(), filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file >= 0) {
+        int error = text.load(file);
+        close(file);
+        if (error != 0) {
+            session.err << "editor: " << filename << ": " << strerror(error) << std::endl;
+            return 1;
+        }
+    } else if (errno != ENOENT) {
+        session.err << "editor: " << filename << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    current = text.lines();
+    session.out << "Editing " << filename << " (" << text.lines() << " lines, " << text.size()
+                << " bytes). Type 'h' for help.\n";
+
+    std::string command;
+    while (true) {
+        session.out << ": " << std::flush;
+        if (!std::getline(session.in, command)) {
+            if (text.modified()) {
+                session.out << "\nUnsaved changes discarded.\n";
+            }
+            return 0;
+        }
+        if (!command.empty() && command.back() == '\r') {
+            command.pop_back();
+        }
+
+        size_t pos = 0;
+        Range range{current, current};
+        bool given = false;
+        if (!parseRange(command, pos, range, given)) {
+            session.out << "? Invalid line address\n";
+            continue;
+        }
+        while (pos < command.size() && command[pos] == ' ') {
+            pos++;
+        }
+        std::string action = command.substr(pos);
+        size_t count = text.lines();
+        bool needLines = action != "a" && action != "" && action != "=" && action != "h" && action != "u" &&
+                         action[0] != 'w' && action[0] != 'q' && action[0] != ':' && action[0] != 'x' && action[0] != '/';
+        if (needLines && (range.first < 1 || range.last > count || range.first > range.last)) {
+            session.out << "? No such line\n";
+            continue;
+        }
+
+        if (action.empty()) {
+            // A bare address moves there; a bare Enter steps to the next line
+            size_t target = given ? range.last : current + 1;
+            if (target < 1 || target > count) {
+                session.out << "? No such line\n";
+                continue;
+            }
+            print({target, target}, false);
+        } else if (action == "p" || action == "n") {
+            print(range, action == "n");
+        } else if (action == "a") {
+            size_t after = given ? range.last : current;
+            if (after > count) {
+                session.out << "? No such line\n";
+                continue;
+            }
+            insertLines(after, readBlock());
+        } else if (action == "i") {
+            insertLines(range.first - 1, readBlock());
+        } else if (action == "c") {
+            std::vector<std::string> block = readBlock();
+            deleteLines(range);
+            insertLines(range.first - 1, block);
+        } else if (action == "d") {
+            deleteLines(range);
+        } else if (action[0] == 's' && action.size() > 1) {
+            substitute(range, action);
+        } else if (action[0] == '/') {
+            find(action.substr(1));
+        } else if (action == "u") {
+            if (!text.undo()) {
+                session.out << "? Nothing to undo\n";
+            }
+            current = std::min(std::max<size_t>(current, 1), text.lines());
+        } else if (action == "=") {
+            session.out << count << "\n";
+        } else if (action == "w") {
+            write();
+        } else if (action == "wq" || action == "x" || action == ":wq!") {
+            if (write()) {
+                return 0;
+            }
+        } else if (action == "q") {
+            if (!text.modified()) {
+                return 0;
+            }
+            session.out << "? Unsaved changes: 'wq' saves and quits, 'q!' quits without saving\n";
+        } else if (action == "q!") {
+            return 0;
+        } else if (action == "h") {
+            help();
+        } else {
+            session.out << "? Unknown command. Type 'h' for help.\n";
+        }
+        text.checkpoint();
+    }
+}
+
+bool Editor::parseAddress(const std::string& command, size_t& pos, size_t& line) const {
+    if (pos >= command.size()) {
+        return false;
+    }
+    if (command[pos] == '.') {
+        pos++;
+        line = current;
+        return true;
+    }
+    if (command[pos] == '$') {
+        pos++;
+        line = text.lines();
+        return true;
+    }
+    if (!isdigit(static_cast<unsigned char>(command[pos]))) {
+        return false;
+    }
+    line = 0;
+    while (pos < command.size() && isdigit(static_cast<unsigned char>(command[pos]))) {
+        line = line * 10 + (command[pos++] - '0');
+    }
+    return true;
+}
+
+bool Editor::parseRange(const std::string& command, size_t& pos, Range& range, bool& given) const {
+    if (pos < command.size() && (command[pos] == ',' || command[pos] == '%')) {
+        // Whole buffer
+        pos++;
+        range = {1, text.lines()};
+        given = true;
+        return true;
+    }
+    size_t first;
+    if (!parseAddress(command, pos, first)) {
+        return true;  // No address: the caller's default stays
+    }
+    given = true;
+    range = {first, first};
+    if (pos < command.size() && command[pos] == ',') {
+        pos++;
+        return parseAddress(command, pos, range.last);
+    }
+    return true;
+}
+
+std::string Editor::line(size_t number) const {
+    size_t start = text.lineOffset(number - 1);
+    std::string content = text.read(start, text.lineOffset(number) - start);
+    if (!content.empty() && content.back() == '\n') {
+        content.pop_back();
+    }
+    return content;
+}
+
+void Editor::print(const Range& range, bool numbered) {
+    if (!numbered) {
+        // One read for the whole range
+        size_t start = text.lineOffset(range.first - 1);
+        std::string content = text.read(start, text.lineOffset(range.last) - start);
+        session.out << content;
+        if (!content.empty() && content.back() != '\n') {
+            session.out << "\n";
+        }
+    } else {
+        for (size_t n = range.first; n <= range.last; ++n) {
+            session.out << n << "\t" << line(n) << "\n";
+        }
+    }
+    current = range.last;
+}
+
+std::vector<std::string> Editor::readBlock() {
+    std::vector<std::string> block;
+    std::string input;
+    while (std::getline(session.in, input)) {
+        if (!input.empty() && input.back() == '\r') {
+            input.pop_back();
+        }
+        if (input == ".") {
+            break;
+        }
+        block.push_back(input);
+    }
+    return block;
+}
+
+void Editor::insertLines(size_t after, const std::vector<std::string>& block) {
+    if (block.empty()) {
+        return;
+    }
+    std::string joined;
+    size_t offset = text.lineOffset(after);
+    // Appending to a last line that has no newline: end that line first
+    if (offset == text.size() && offset > 0 && text.read(offset - 1, 1) != "\n") {
+        joined += '\n';
+    }
+    for (const std::string& content : block) {
+        joined += content;
+        joined += '\n';
+    }
+    text.insert(offset, joined);
+    current = after + block.size();
+}
+
+void Editor::deleteLines(const Range& range) {
+    size_t start = text.lineOffset(range.first - 1);
+    text.erase(start, text.lineOffset(range.last) - start);
+    size_t count = text.lines();
+    current = range.first <= count ? range.first : count;
+}
+
+int Editor::substitute(const Range& range, const std::string& command) {
+    // s/old/new/ or s/old/new/g, with any delimiter
+    char delimiter = command[1];
+    size_t middle = command.find(delimiter, 2);
+    if (middle == std::string::npos) {
+        session.out << "? Usage: s/old/new/[g]\n";
+        return 1;
+    }
+    size_t end = command.find(delimiter, middle + 1);
+    std::string from = command.substr(2, middle - 2);
+    std::string to = command.substr(middle + 1, end == std::string::npos ? std::string::npos : end - middle - 1);
+    bool global = end != std::string::npos && command.compare(end + 1, std::string::npos, "g") == 0;
+    if (from.empty()) {
+        session.out << "? Empty pattern\n";
+        return 1;
+    }
+
+    size_t changed = 0;
+    for (size_t n = range.first; n <= range.last; ++n) {
+        std::string content = line(n);
+        size_t at = content.find(from);
+        if (at == std::string::npos) {
+            continue;
+        }
+        size_t length = content.size();
+        while (at != std::string::npos) {
+            content.replace(at, from.size(), to);
+            if (!global) {
+                break;
+            }
+            at = content.find(from, at + to.size());
+        }
+        size_t start = text.lineOffset(n - 1);
+        text.erase(start, length);
+        text.insert(start, content);
+        current = n;
+        changed++;
+    }
+    if (changed == 0) {
+        session.out << "? No match\n";
+        return 1;
+    }
+    print({current, current}, false);
+    return 0;
+}
+
+void Editor::find(const std::string& pattern) {
+    if (pattern.empty() || text.size() == 0) {
+        session.out << "? No match\n";
+        return;
+    }
+    // Search forward from the next line in large blocks, then wrap around to the top
+    const size_t block = 1 << 20;
+    size_t origin = text.lineOffset(current);
+    size_t size = text.size();
+    for (int pass = 0; pass < 2; ++pass) {
+        size_t from = pass == 0 ? origin : 0;
+        size_t to = pass == 0 ? size : std::min(size, origin + pattern.size() - 1);
+        while (from < to) {
+            std::string chunk = text.read(from, std::min(block + pattern.size() - 1, to - from));
+            size_t at = chunk.find(pattern);
+            if (at != std::string::npos) {
+                size_t number = text.lineOf(from + at) + 1;
+                print({number, number}, true);
+                return;
+            }
+            from += block;
+        }
+    }
+    session.out << "? No match\n";
+}
+
+bool Editor::write() {
+    // Saving renames a new file over the old one, so what matters is the entry being replaced
+    if (!session.user.isRoot() && Disk.isProtected(session.cwdFd(), filename)) {
+        session.err << "editor: " << filename << ": Permission denied: protected file" << std::endl;
+        return false;
+    }
+    if (int error = text.save(session.cwdFd(), filename)) {
+        session.err << "editor: " << filename << ": " << strerror(error) << std::endl;
+        return false;
+    }
+    eventBus().publish(EventType::FileChange, session.path(filename), "written");
+    session.out << "Saved " << text.lines() << " lines, " << text.size() << " bytes\n";
+    return true;
+}
+
+void Editor::help() {
+    session.out << "Lines are numbered from 1; '.' is the current line, '$' the last and ',' all of them.\n"
+                << "  [n]          go to line n and print it (Enter prints the next line)\n"
+                << "  [a,b]p       print lines            [a,b]n   print with line numbers\n"
+                << "  [n]a         append after line n    [n]i     insert before line n\n"
+                << "  [a,b]c       change lines           [a,b]d   delete lines\n"
+                << "               (a, i and c read text until a line containing only '.')\n"
+                << "  [a,b]s/x/y/g replace x with y       /text    find the next line containing text\n"
+                << "  u            undo the last command  =        print the number of lines\n"
+                << "  w            save                   wq       save and quit\n"
+                << "  q            quit                   q!       quit without saving\n";
+}
@@ -0,0 +1,52 @@
+// editor.h; Line editor used by the lsh editor command
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <string>
+#include <vector>
+
+#include "piecetable.h"
+
+class Session;
+
+/*
+ * ed-style editor reading commands from the session, so it works the same on the console
+ * and in remote sessions. Lines are addressed by number (1-based), '.', '$' or a range
+ * "a,b"; the text itself is kept in a PieceTable, so opening and editing large files
+ * doesn't copy them.
+ */
+class Editor {
+public:
+    Editor(Session& session, const std::string& filename);
+
+    // Returns the exit status for the editor command
+    int run();
+
+private:
+    struct Range {
+        size_t first = 0;
+        size_t last = 0;
+    };
+
+    bool parseAddress(const std::string& text, size_t& pos, size_t& line) const;
+    bool parseRange(const std::string& text, size_t& pos, Range& range, bool& given) const;
+
+    std::string line(size_t number) const;
+    void print(const Range& range, bool numbered);
+    std::vector<std::string> readBlock();
+    void insertLines(size_t before, const std::vector<std::string>& block);
+    void deleteLines(const Range& range);
+    int substitute(const Range& range, const std::string& command);
+    void find(const std::string& text);
+    bool write();
+    void help();
+
+    Session& session;
+    std::string filename;
+    PieceTable text;
+    size_t current = 0;  // Current line, 0 when the buffer is empty
+};
+
+#endif // EDITOR_H
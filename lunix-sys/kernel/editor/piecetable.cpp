@@ -0,0 +1,382 @@
+// piecetable.cpp; Text buffer for the built-in editor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "piecetable.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PieceTable::PieceTable() : random(std::random_device{}()) {}
+
+PieceTable::~PieceTable() {
+    if (original != nullptr) {
+        munmap(const_cast<char*>(original), originalSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int PieceTable::load(int file) {
+    struct stat st;
+    if (fstat(file, &st) != 0) {
+        return errno;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        return S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+    }
+    fd = fcntl(file, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+    original = static_cast<const char*>(map);
+    originalSize = st.st_size;
+
+    // One pass to index the newlines; everything after this is O(log n)
+    madvise(map, originalSize, MADV_SEQUENTIAL);
+    const char* p = original;
+    const char* end = original + originalSize;
+    while ((p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr) {
+        originalNewlines.push_back(p - original);
+        ++p;
+    }
+    madvise(map, originalSize, MADV_RANDOM);
+
+    root = makeNode(Original, 0, originalSize, random());
+    return 0;
+}
+
+size_t PieceTable::size() const {
+    return bytesOf(root);
+}
+
+size_t PieceTable::newlines() const {
+    return newlinesOf(root);
+}
+
+size_t PieceTable::lines() const {
+    size_t total = size();
+    if (total == 0) {
+        return 0;
+    }
+    return newlines() + (read(total - 1, 1)[0] != '\n' ? 1 : 0);
+}
+
+size_t PieceTable::countNewlines(Buffer buffer, size_t start, size_t length) const {
+    const std::vector<size_t>& index = newlineIndex(buffer);
+    auto first = std::lower_bound(index.begin(), index.end(), start);
+    auto last = std::lower_bound(first, index.end(), start + length);
+    return last - first;
+}
+
+int PieceTable::makeNode(Buffer buffer, size_t start, size_t length, uint32_t priority) {
+    Node node;
+    node.priority = priority;
+    node.buffer = buffer;
+    node.start = start;
+    node.length = length;
+    node.newlines = countNewlines(buffer, start, length);
+    nodes.push_back(node);
+    int index = static_cast<int>(nodes.size()) - 1;
+    update(index);
+    return index;
+}
+
+void PieceTable::update(int node) {
+    Node& n = nodes[node];
+    n.subtreeBytes = bytesOf(n.left) + n.length + bytesOf(n.right);
+    n.subtreeNewlines = newlinesOf(n.left) + n.newlines + newlinesOf(n.right);
+}
+
+int PieceTable::merge(int left, int right) {
+    if (left < 0) {
+        return right;
+    }
+    if (right < 0) {
+        return left;
+    }
+    if (nodes[left].priority > nodes[right].priority) {
+        nodes[left].right = merge(nodes[left].right, right);
+        update(left);
+        return left;
+    }
+    nodes[right].left = merge(left, nodes[right].left);
+    update(right);
+    return right;
+}
+
+// left gets the first offset bytes of node's subtree, right the rest
+void PieceTable::split(int node, size_t offset, int& left, int& right) {
+    if (node < 0) {
+        left = right = -1;
+        return;
+    }
+    size_t leftBytes = bytesOf(nodes[node].left);
+    size_t length = nodes[node].length;
+    int a, b;
+    if (offset <= leftBytes) {
+        split(nodes[node].left, offset, a, b);
+        nodes[node].left = b;
+        update(node);
+        left = a;
+        right = node;
+    } else if (offset >= leftBytes + length) {
+        split(nodes[node].right, offset - leftBytes - length, a, b);
+        nodes[node].right = a;
+        update(node);
+        left = node;
+        right = b;
+    } else {
+        // The offset falls inside this piece: cut it in two. The tail inherits the
+        // priority and right subtree, so the heap order still holds on both sides.
+        size_t cut = offset - leftBytes;
+        Node piece = nodes[node];
+        int tail = makeNode(piece.buffer, piece.start + cut, piece.length - cut, piece.priority);
+        nodes[tail].right = piece.right;
+        update(tail);
+
+        Node& head = nodes[node];
+        head.length = cut;
+        head.newlines -= nodes[tail].newlines;
+        head.right = -1;
+        update(node);
+        left = node;
+        right = tail;
+    }
+}
+
+void PieceTable::collect(int node, size_t base, size_t from, size_t to, std::string& out) const {
+    if (node < 0 || from >= base + nodes[node].subtreeBytes || to <= base) {
+        return;
+    }
+    const Node& n = nodes[node];
+    collect(n.left, base, from, to, out);
+    size_t pieceStart = base + bytesOf(n.left);
+    size_t begin = std::max(from, pieceStart);
+    size_t end = std::min(to, pieceStart + n.length);
+    if (begin < end) {
+        out.append(data(n.buffer) + n.start + (begin - pieceStart), end - begin);
+    }
+    collect(n.right, pieceStart + n.length, from, to, out);
+}
+
+std::string PieceTable::read(size_t offset, size_t length) const {
+    std::string out;
+    out.reserve(std::min(length, size() - std::min(offset, size())));
+    collect(root, 0, offset, offset + length, out);
+    return out;
+}
+
+size_t PieceTable::lineOffset(size_t line) const {
+    if (line == 0) {
+        return 0;
+    }
+    if (line > newlines()) {
+        return size();
+    }
+    // Find the piece holding the line-th newline; the line starts right after it
+    int node = root;
+    size_t base = 0;
+    while (node >= 0) {
+        const Node& n = nodes[node];
+        size_t leftNewlines = newlinesOf(n.left);
+        if (line <= leftNewlines) {
+            node = n.left;
+            continue;
+        }
+        line -= leftNewlines;
+        base += bytesOf(n.left);
+        if (line <= n.newlines) {
+            const std::vector<size_t>& index = newlineIndex(n.buffer);
+            size_t first = std::lower_bound(index.begin(), index.end(), n.start) - index.begin();
+            return base + (index[first + line - 1] - n.start) + 1;
+        }
+        line -= n.newlines;
+        base += n.length;
+        node = n.right;
+    }
+    return size();
+}
+
+size_t PieceTable::lineOf(size_t offset) const {
+    // Count the newlines before offset
+    size_t line = 0;
+    size_t base = 0;
+    int node = root;
+    while (node >= 0) {
+        const Node& n = nodes[node];
+        size_t leftBytes = bytesOf(n.left);
+        if (offset < base + leftBytes) {
+            node = n.left;
+            continue;
+        }
+        line += newlinesOf(n.left);
+        base += leftBytes;
+        if (offset < base + n.length) {
+            return line + countNewlines(n.buffer, n.start, offset - base);
+        }
+        line += n.newlines;
+        base += n.length;
+        node = n.right;
+    }
+    return line;
+}
+
+void PieceTable::insertPieces(size_t offset, int pieces) {
+    int left, right;
+    split(root, offset, left, right);
+    root = merge(merge(left, pieces), right);
+}
+
+int PieceTable::removeRange(size_t offset, size_t length) {
+    int left, middle, right;
+    split(root, offset, left, middle);
+    int removed;
+    split(middle, length, removed, right);
+    root = merge(left, right);
+    return removed;
+}
+
+void PieceTable::insert(size_t offset, std::string_view text) {
+    if (text.empty()) {
+        return;
+    }
+    offset = std::min(offset, size());
+    size_t start = added.size();
+    added.append(text.data(), text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+            addedNewlines.push_back(start + i);
+        }
+    }
+
+    insertPieces(offset, makeNode(Added, start, text.size(), random()));
+    edits.push_back({true, offset, text.size(), -1, nextId++, group});
+}
+
+void PieceTable::erase(size_t offset, size_t length) {
+    offset = std::min(offset, size());
+    length = std::min(length, size() - offset);
+    if (length == 0) {
+        return;
+    }
+    int removed = removeRange(offset, length);
+    edits.push_back({false, offset, length, removed, nextId++, group});
+}
+
+void PieceTable::checkpoint() {
+    group++;
+}
+
+bool PieceTable::undo() {
+    if (edits.empty()) {
+        return false;
+    }
+    uint64_t last = edits.back().group;
+    while (!edits.empty() && edits.back().group == last) {
+        Edit edit = edits.back();
+        edits.pop_back();
+        if (edit.insert) {
+            removeRange(edit.offset, edit.length);  // The inserted pieces are simply dropped
+        } else {
+            insertPieces(edit.offset, edit.erased);
+        }
+    }
+    group++;
+    return true;
+}
+
+bool PieceTable::modified() const {
+    return (edits.empty() ? 0 : edits.back().id) != savedId;
+}
+
+int PieceTable::writePieces(int node, int out) const {
+    if (node < 0) {
+        return 0;
+    }
+    const Node& n = nodes[node];
+    if (int error = writePieces(n.left, out)) {
+        return error;
+    }
+
+    size_t done = 0;
+    if (n.buffer == Original) {
+        // Let the filesystem copy (or share) unchanged extents without passing through us
+        loff_t from = n.start;
+        while (done < n.length) {
+            ssize_t copied = copy_file_range(fd, &from, out, nullptr, n.length - done, 0);
+            if (copied <= 0) {
+                break;  // Not supported here; fall back to writing from the mapping
+            }
+            done += copied;
+        }
+    }
+    const char* text = data(n.buffer) + n.start;
+    while (done < n.length) {
+        ssize_t written = write(out, text + done, n.length - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return written < 0 ? errno : EIO;
+        }
+        done += written;
+    }
+
+    return writePieces(n.right, out);
+}
+
+int PieceTable::save(int dirFd, const std::string& name) {
+    // Like mkostemp, relative to dirFd: O_EXCL never opens an existing file or follows a symlink planted there
+    std::string tmpName;
+    int out = -1;
+    for (int tries = 0; out < 0 && tries < 100; ++tries) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), ".%08x~", static_cast<unsigned>(random()));
+        tmpName = name + suffix;
+        out = openat(dirFd, tmpName.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (out < 0 && errno != EEXIST) {
+            return errno;
+        }
+    }
+    if (out < 0) {
+        return EEXIST;
+    }
+
+    // Keep the permissions of the file being replaced
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0) {
+        fchmod(out, st.st_mode & 07777);
+    }
+
+    int error = writePieces(root, out);
+    if (error == 0 && fsync(out) != 0) {
+        error = errno;
+    }
+    close(out);
+    if (error == 0 && renameat(dirFd, tmpName.c_str(), dirFd, name.c_str()) != 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        unlinkat(dirFd, tmpName.c_str(), 0);
+        return error;
+    }
+
+    // The mapping still refers to the old inode, so the pieces stay valid after the rename
+    savedId = edits.empty() ? 0 : edits.back().id;
+    return 0;
+}
@@ -0,0 +1,116 @@
+// piecetable.h; Text buffer for the built-in editor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Piece table over a memory mapped file.
+ * The original file is never copied or modified: the text is a sequence of pieces, each a
+ * span of either the mapped original or an append-only buffer holding everything typed.
+ * Pieces live in an implicit treap whose nodes also carry subtree byte and newline counts,
+ * so finding a byte offset or the start of a line, inserting and erasing are all O(log n)
+ * in the number of pieces. Newline positions of both buffers are indexed once, so splitting
+ * a piece never rescans text.
+ * Erased pieces are kept aside rather than freed, which makes undo a split and a merge.
+ */
+class PieceTable {
+public:
+    PieceTable();
+    ~PieceTable();
+
+    PieceTable(const PieceTable&) = delete;
+    PieceTable& operator=(const PieceTable&) = delete;
+
+    // Maps the file open as fd (the table keeps its own duplicate). Returns 0 or an errno value.
+    int load(int fd);
+
+    size_t size() const;
+    size_t newlines() const;
+    // Number of lines, counting a last line that has no newline
+    size_t lines() const;
+    // Offset where 0-based line starts; past the last line this is size()
+    size_t lineOffset(size_t line) const;
+    // 0-based line containing offset
+    size_t lineOf(size_t offset) const;
+
+    std::string read(size_t offset, size_t length) const;
+    void insert(size_t offset, std::string_view text);
+    void erase(size_t offset, size_t length);
+
+    // Changes made between checkpoints are undone together
+    void checkpoint();
+    bool undo();
+    bool modified() const;
+
+    // Writes the text to a new temporary file next to name in dirFd, then renames it over name.
+    // Returns 0 or an errno value.
+    int save(int dirFd, const std::string& name);
+
+private:
+    enum Buffer : uint8_t { Original, Added };
+
+    struct Node {
+        int left = -1;
+        int right = -1;
+        uint32_t priority = 0;
+        Buffer buffer = Original;
+        size_t start = 0;
+        size_t length = 0;
+        size_t newlines = 0;      // In this piece
+        size_t subtreeBytes = 0;
+        size_t subtreeNewlines = 0;
+    };
+
+    struct Edit {
+        bool insert;
+        size_t offset;
+        size_t length;
+        int erased;       // Root of the pieces an erase removed
+        uint64_t id;
+        uint64_t group;
+    };
+
+    const char* data(Buffer buffer) const { return buffer == Original ? original : added.data(); }
+    const std::vector<size_t>& newlineIndex(Buffer buffer) const {
+        return buffer == Original ? originalNewlines : addedNewlines;
+    }
+    size_t countNewlines(Buffer buffer, size_t start, size_t length) const;
+
+    int makeNode(Buffer buffer, size_t start, size_t length, uint32_t priority);
+    size_t bytesOf(int node) const { return node < 0 ? 0 : nodes[node].subtreeBytes; }
+    size_t newlinesOf(int node) const { return node < 0 ? 0 : nodes[node].subtreeNewlines; }
+    void update(int node);
+    int merge(int left, int right);
+    void split(int node, size_t offset, int& left, int& right);
+    void collect(int node, size_t base, size_t from, size_t to, std::string& out) const;
+    int writePieces(int node, int fd) const;
+
+    void insertPieces(size_t offset, int pieces);
+    int removeRange(size_t offset, size_t length);
+
+    int fd = -1;
+    const char* original = nullptr;
+    size_t originalSize = 0;
+    std::vector<size_t> originalNewlines;
+    std::string added;
+    std::vector<size_t> addedNewlines;
+
+    std::vector<Node> nodes;
+    int root = -1;
+    std::mt19937 random;
+
+    std::vector<Edit> edits;
+    uint64_t nextId = 1;
+    uint64_t group = 0;
+    uint64_t savedId = 0;  // Id of the newest edit at the last load or save
+};
+
+#endif // PIECETABLE_H
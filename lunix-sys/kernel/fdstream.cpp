@@ -0,0 +1,66 @@
+// fdstream.cpp; iostream buffer over a raw file descriptor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "fdstream.h"
+
+#include <unistd.h>
+#include <cerrno>
+
+FdStreamBuf::FdStreamBuf(int fd, size_t bufferSize)
+    : fileDescriptor(fd), inBuffer(bufferSize), outBuffer(bufferSize) {
+    setg(inBuffer.data(), inBuffer.data(), inBuffer.data());
+    setp(outBuffer.data(), outBuffer.data() + outBuffer.size());
+}
+
+FdStreamBuf::~FdStreamBuf() {
+    flushOutput();
+}
+
+FdStreamBuf::int_type FdStreamBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+
+    ssize_t n;
+    do {
+        n = read(fileDescriptor, inBuffer.data(), inBuffer.size());
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return traits_type::eof();
+    }
+    setg(inBuffer.data(), inBuffer.data(), inBuffer.data() + n);
+    return traits_type::to_int_type(*gptr());
+}
+
+FdStreamBuf::int_type FdStreamBuf::overflow(int_type ch) {
+    if (flushOutput() != 0) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int FdStreamBuf::sync() {
+    return flushOutput();
+}
+
+int FdStreamBuf::flushOutput() {
+    char* p = pbase();
+    while (p < pptr()) {
+        ssize_t n = write(fileDescriptor, p, pptr() - p);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            setp(outBuffer.data(), outBuffer.data() + outBuffer.size());
+            return -1;
+        }
+        p += n;
+    }
+    setp(outBuffer.data(), outBuffer.data() + outBuffer.size());
+    return 0;
+}
@@ -0,0 +1,34 @@
+// fdstream.h; iostream buffer over a raw file descriptor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef FDSTREAM_H
+#define FDSTREAM_H
+
+#include <streambuf>
+#include <vector>
+
+/*
+ * Buffered std::streambuf reading from and writing to a file descriptor
+ * (socket, pipe or terminal). The descriptor is not owned and is not closed.
+ */
+class FdStreamBuf : public std::streambuf {
+public:
+    explicit FdStreamBuf(int fd, size_t bufferSize = 4096);
+    ~FdStreamBuf() override;
+
+    int fd() const { return fileDescriptor; }
+
+protected:
+    int_type underflow() override;
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    int flushOutput();
+
+    int fileDescriptor;
+    std::vector<char> inBuffer;
+    std::vector<char> outBuffer;
+};
+
+#endif // FDSTREAM_H
@@ -0,0 +1,135 @@
+// boot.cpp; Boot steps as a dependency graph of init units, started in parallel
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "boot.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <unordered_map>
+
+#include "../color.h"
+#include "trace.h"
+
+using namespace ANSIColors;
+
+struct BootGraph::Shared {
+    struct Node {
+        Unit unit;
+        size_t waitingOn = 0;           // Dependencies that haven't finished
+        std::vector<size_t> dependants;
+    };
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::vector<Node> nodes;
+    size_t criticalLeft = 0;
+    std::ostream* console = nullptr;    // Null once silenced
+};
+
+BootGraph::BootGraph() : shared(std::make_shared<Shared>()) {}
+
+// Runs on the unit's thread
+void BootGraph::runUnit(std::shared_ptr<Shared> shared, size_t index) {
+    const Unit& unit = shared->nodes[index].unit;  // Not changed while units run
+    pthread_setname_np(pthread_self(), ("boot/" + unit.name).substr(0, 15).c_str());
+    int result = 0;
+    if (unit.start) {
+        TraceScope scope("boot", unit.name);
+        result = unit.start();
+    }
+
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    const std::string& message = result == 0 ? unit.done : unit.failed;
+    if (shared->console != nullptr && !message.empty()) {
+        if (result == 0) {
+            *shared->console << "[  " << GREEN << "OK" << RESET << "  ] " << message << "\n";
+        } else {
+            *shared->console << "[" << RED << "FAILED" << RESET << "] " << message << "\n";
+        }
+    }
+    if (shared->console != nullptr) {
+        *shared->console << std::flush;  // This thread's lines, before its dependants print theirs
+    }
+    for (size_t dependant : shared->nodes[index].dependants) {
+        if (--shared->nodes[dependant].waitingOn == 0) {
+            launch(shared, dependant);
+        }
+    }
+    if (unit.critical) {
+        shared->criticalLeft--;
+    }
+    shared->finished.notify_all();
+}
+
+void BootGraph::launch(const std::shared_ptr<Shared>& shared, size_t index) {
+    std::thread(runUnit, shared, index).detach();
+}
+
+void BootGraph::add(Unit unit) {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->nodes.push_back({std::move(unit), 0, {}});
+}
+
+int BootGraph::run(std::ostream& console) {
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    std::vector<Shared::Node>& nodes = shared->nodes;
+    std::unordered_map<std::string, size_t> byName;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        byName[nodes[i].unit.name] = i;
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].waitingOn = nodes[i].unit.after.size();
+        for (const std::string& dependency : nodes[i].unit.after) {
+            auto it = byName.find(dependency);
+            if (it == byName.end()) {
+                return EINVAL;
+            }
+            nodes[it->second].dependants.push_back(i);
+        }
+    }
+
+    // Kahn's algorithm on a copy of the counts: every unit has to be reachable from the roots
+    std::vector<size_t> waiting(nodes.size());
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        waiting[i] = nodes[i].waitingOn;
+        if (waiting[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+    size_t ordered = 0;
+    while (!ready.empty()) {
+        size_t next = ready.back();
+        ready.pop_back();
+        ordered++;
+        for (size_t dependant : nodes[next].dependants) {
+            if (--waiting[dependant] == 0) {
+                ready.push_back(dependant);
+            }
+        }
+    }
+    if (ordered != nodes.size()) {
+        return EINVAL;
+    }
+
+    shared->console = &console;
+    shared->criticalLeft = 0;
+    for (const Shared::Node& node : nodes) {
+        shared->criticalLeft += node.unit.critical ? 1 : 0;
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].waitingOn == 0) {
+            launch(shared, i);
+        }
+    }
+    shared->finished.wait(lock, [this] { return shared->criticalLeft == 0; });
+    return 0;
+}
+
+void BootGraph::silence() {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    shared->console = nullptr;
+}
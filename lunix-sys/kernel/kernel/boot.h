@@ -0,0 +1,50 @@
+// boot.h; Boot steps as a dependency graph of init units, started in parallel
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Init units and the order between them. run() starts every unit whose dependencies
+ * have finished, each on a thread of its own (units mount disks, ask questions and wait
+ * for child processes, so they would stall scheduler workers), and returns once all the
+ * critical ones are done. Non-critical units, such as the network probe, keep running
+ * and report when they finish, after the shell is up.
+ * Dependencies only order units: a unit still starts when one it comes after failed,
+ * as the serial boot carried on past a failed disk test.
+ */
+class BootGraph {
+public:
+    struct Unit {
+        std::string name;
+        std::vector<std::string> after;  // Units that have to finish first
+        std::function<int()> start;      // Returns 0 on success; empty for a unit that only marks a point in boot
+        bool critical = true;            // run() waits for it
+        std::string done;                // Reported as "[  OK  ] done" on success, if not empty
+        std::string failed;              // Reported as "[FAILED] failed" otherwise
+    };
+
+    BootGraph();
+
+    void add(Unit unit);
+    // Runs the units, reporting to console. Returns 0 once every critical unit has
+    // finished, or EINVAL (starting nothing) if a dependency is unknown or circular.
+    int run(std::ostream& console);
+    // Stop reporting: units still running finish silently. Used at shutdown.
+    void silence();
+
+private:
+    struct Shared;
+    static void launch(const std::shared_ptr<Shared>& shared, size_t index);  // Caller holds the mutex
+    static void runUnit(std::shared_ptr<Shared> shared, size_t index);
+
+    std::shared_ptr<Shared> shared;  // Also held by the unit threads, which may outlive the graph
+};
+
+#endif // BOOT_H
@@ -1,6 +1,5 @@
 #include "error_handler.h"
 #include <iostream>
-#include <fstream>
 #include <unistd.h> // for geteuid
 #include <execinfo.h>
 #include <csignal> // for signal handling
@@ -9,6 +8,8 @@
 #include <cstdio>
 #include <string>
 #include "kernel.h"
+#include "eventbus.h"
+#include "klog.h"
 #include "../color.h"
 
 using namespace std;
@@ -24,7 +25,7 @@ error_handler::error_handler() {}
 void error_handler::panic(string reason) {
     // Capture panic information
     std::stringstream panic_info;
-    panic_info << BG_BLUE << BOLD_WHITE << "\nKernel panic: " << reason << endl;
+    panic_info << "\nKernel panic: " << reason << endl;
     panic_info << "[STACK TRACE START]\n";
 
     const int maxFrames = 64;
@@ -45,13 +46,18 @@ void error_handler::panic(string reason) {
     panic_info << "The kernel has been halted due to a fatal error or critical condition. If this is a bug, please report this on the GitHub issue tracker.\n";
     panic_info << "Version string(s): " << Kernel.ver << endl; // Replace with actual version
 
-    panic_info << "\n[STACK TRACE END] \nKernel panic: " << reason << RESET << endl;
+    panic_info << "\n[STACK TRACE END] \nKernel panic: " << reason;
 
     // Output the panic information
-    std::cout << panic_info.str();
+    std::cout << BG_BLUE << BOLD_WHITE << panic_info.str() << RESET << endl << std::flush;
 
-    // Log to file
-    log_to_file(panic_info.str());
+    // Log it, and wait for it to be written: we're about to exit. Before the rootfs
+    // is mounted the log isn't open yet, so it goes to the working directory.
+    klog(LogLevel::Critical, "kernel", panic_info.str());
+    if (!kernelLog().isOpen()) {
+        kernelLog().open("kernel.log");
+    }
+    kernelLog().flush();
 
     if (restart_after_panic) {
         system("../lunix_bootloader -r");
@@ -65,7 +71,7 @@ void error_handler::oops(string reason) {
     oops_count += 1;
     // Capture panic information
     std::stringstream panic_info;
-    panic_info << BG_YELLOW << BOLD_WHITE << "\nKernel oops: " << reason << endl;
+    panic_info << "\nKernel oops: " << reason << endl;
     panic_info << "Stack trace:\n";
 
     const int maxFrames = 64;
@@ -87,13 +93,13 @@ void error_handler::oops(string reason) {
     panic_info << "OS Version: " << Kernel.ver << endl; // Replace with actual version
     panic_info << "CPU Architecture: " << "x86_64" << endl; // Replace with actual
 
-    panic_info << "\nend Kernel oops: " << reason << RESET << endl;
+    panic_info << "\nend Kernel oops: " << reason;
 
     // Output the panic information
-    std::cout << panic_info.str();
+    std::cout << BG_YELLOW << BOLD_WHITE << panic_info.str() << RESET << endl;
 
-    // Log to file
-    log_to_file(panic_info.str());
+    klog(LogLevel::Error, "kernel", panic_info.str());
+    eventBus().publish(EventType::Oops, "", reason);
 
     if (oops_count >= 10) {
         std::ostringstream oss;
@@ -125,6 +131,7 @@ void error_handler::setup_signal_handlers() {
     signal(SIGFPE, error_handler::handle_signal);  // Floating-point exception
     signal(SIGILL, error_handler::handle_signal);  // Illegal instruction
     signal(SIGBUS, error_handler::handle_signal);  // Bus error
+    signal(SIGPIPE, SIG_IGN);                      // Closed sockets and pipes are reported as write errors
 }
 
 void error_handler::handle_signal(int signal) {
@@ -143,13 +150,3 @@ void error_handler::handle_signal(int signal) {
         error_handler().oops(signal_name);
     }
 }
-
-void error_handler::log_to_file(const string& log_message) {
-    ofstream log_file("kernel.log", ios_base::app);
-    if (log_file.is_open()) {
-        log_file << log_message;
-        log_file.close();
-    } else {
-        std::cout << "Failed to open log file." << std::endl;
-    }
-}
\ No newline at end of file
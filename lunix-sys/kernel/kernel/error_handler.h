@@ -17,7 +17,6 @@ private:
     void print_stack_trace();
     static void handle_signal(int signal);
 
-    void log_to_file(const string& log_message);
     void dump_registers(stringstream& panic_info);
 };
 
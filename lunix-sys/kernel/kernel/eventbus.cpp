@@ -0,0 +1,370 @@
+// eventbus.cpp; Kernel event bus: typed notifications from subsystems to subscribers
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "eventbus.h"
+#include "klog.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const char* const typeNames[eventTypeCount] = {"runlevel", "login", "client-join", "client-leave", "file-change", "oops"};
+
+// Out of descriptors or memory, accept fails until something is freed; the connection waits in the backlog meanwhile
+const std::chrono::milliseconds acceptBackoff(100);
+
+/*
+ * Vyukov's intrusive MPSC queue: producers only exchange the head, so a push never
+ * waits; the single consumer follows the next links from the tail. A stub node keeps
+ * the list non-empty. A push that has exchanged the head but not linked its node yet
+ * is invisible to pop() until it does.
+ */
+class EventQueue {
+public:
+    EventQueue() : head(&stub), tail(&stub) {}
+    ~EventQueue() {
+        while (pop()) {
+        }
+    }
+
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    void push(std::shared_ptr<const KernelEvent> event) {
+        Node* node = new Node;
+        node->event = std::move(event);
+        link(node);
+    }
+
+    // Consumer only
+    std::shared_ptr<const KernelEvent> pop() {
+        Node* first = tail.load(std::memory_order_relaxed);
+        Node* next = first->next.load(std::memory_order_acquire);
+        if (first == &stub) {
+            if (next == nullptr) {
+                return nullptr;
+            }
+            tail.store(next, std::memory_order_relaxed);
+            first = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next == nullptr) {
+            if (first != head.load(std::memory_order_acquire)) {
+                return nullptr;  // A push is halfway; its producer will schedule a drain
+            }
+            link(&stub);  // So first has a successor and can be taken
+            next = first->next.load(std::memory_order_acquire);
+            if (next == nullptr) {
+                return nullptr;
+            }
+        }
+        tail.store(next, std::memory_order_relaxed);
+        std::shared_ptr<const KernelEvent> event = std::move(first->event);
+        delete first;
+        return event;
+    }
+
+    bool empty() const {
+        Node* first = tail.load(std::memory_order_acquire);
+        return first == &stub && first->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        std::shared_ptr<const KernelEvent> event;
+    };
+
+    void link(Node* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    std::atomic<Node*> head;  // Last pushed
+    std::atomic<Node*> tail;  // Next to pop; atomic only so empty() may race with a drain
+    Node stub;
+};
+
+// A module's socket, shared by its callback and the coroutine that closes it
+struct ModuleConnection {
+    std::mutex mutex;
+    int fd;
+};
+
+void appendJsonString(std::string& out, const std::string& text) {
+    out += '"';
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+// The types named on a module's subscription line
+bool parseTypes(const std::string& line, uint32_t& types, std::string& bad) {
+    types = 0;
+    size_t start = 0;
+    while (start < line.size()) {
+        size_t end = line.find_first_of(" \t,\r", start);
+        if (end == std::string::npos) {
+            end = line.size();
+        }
+        std::string word = line.substr(start, end - start);
+        start = end + 1;
+        EventType type;
+        if (word.empty()) {
+            continue;
+        } else if (word == "*") {
+            types |= EventBus::allTypes;
+        } else if (EventBus::parseType(word, type)) {
+            types |= EventBus::mask(type);
+        } else {
+            bad = word;
+            return false;
+        }
+    }
+    if (types == 0) {
+        types = EventBus::allTypes;
+    }
+    return true;
+}
+
+}
+
+struct EventBus::Subscriber {
+    uint64_t id = 0;
+    uint32_t types = 0;
+    Callback callback;
+    EventQueue queue;
+    std::atomic<bool> scheduled{false};  // A drain job is posted or running
+    std::atomic<bool> active{true};
+};
+
+uint64_t EventBus::subscribe(uint32_t types, Callback callback) {
+    auto subscriber = std::make_shared<Subscriber>();
+    subscriber->id = nextId.fetch_add(1);
+    subscriber->types = types;
+    subscriber->callback = std::move(callback);
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    subscribers.push_back(subscriber);
+    return subscriber->id;
+}
+
+void EventBus::unsubscribe(uint64_t id) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [id](const auto& subscriber) { return subscriber->id == id; });
+    if (it != subscribers.end()) {
+        (*it)->active = false;  // A drain job may still hold it
+        subscribers.erase(it);
+    }
+}
+
+void EventBus::publish(EventType type, std::string subject, std::string detail, int64_t value) {
+    auto event = std::make_shared<KernelEvent>();
+    event->type = type;
+    event->subject = std::move(subject);
+    event->detail = std::move(detail);
+    event->value = value;
+    clock_gettime(CLOCK_REALTIME, &event->time);
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    for (const std::shared_ptr<Subscriber>& subscriber : subscribers) {
+        if ((subscriber->types & mask(type)) == 0) {
+            continue;
+        }
+        subscriber->queue.push(event);
+        if (!subscriber->scheduled.exchange(true)) {
+            scheduler().spawn([subscriber] { drain(subscriber); });
+        }
+    }
+}
+
+void EventBus::drain(const std::shared_ptr<Subscriber>& subscriber) {
+    while (true) {
+        while (std::shared_ptr<const KernelEvent> event = subscriber->queue.pop()) {
+            if (!subscriber->active) {
+                continue;
+            }
+            try {
+                subscriber->callback(*event);
+            } catch (const std::exception& e) {
+                std::cerr << "Event bus: subscriber " << subscriber->id << " failed: " << e.what() << "\n";
+            }
+        }
+        // Give up the queue, unless something arrived in the meantime and no other drain took it
+        subscriber->scheduled = false;
+        if (subscriber->queue.empty() || subscriber->scheduled.exchange(true)) {
+            return;
+        }
+    }
+}
+
+int EventBus::listen(const std::string& path) {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return ENAMETOOLONG;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno;
+    }
+    // A socket left behind by a kernel that crashed is replaced; one that still answers is not
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && connect(probe, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0;
+        if (probe >= 0) {
+            ::close(probe);
+        }
+        if (live) {
+            ::close(fd);
+            return EADDRINUSE;
+        }
+        unlink(path.c_str());
+    }
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, 16) != 0) {
+        int error = errno;
+        ::close(fd);
+        return error;
+    }
+
+    socketPath = path;
+    setenv("LUNIX_EVENTS", path.c_str(), 1);  // Inherited by modules
+    scheduler().spawn(acceptModules(fd));
+    return 0;
+}
+
+void EventBus::close() {
+    if (!socketPath.empty()) {
+        unlink(socketPath.c_str());
+        socketPath.clear();
+    }
+}
+
+Task<void> EventBus::acceptModules(int listenSocket) {
+    while (true) {
+        co_await scheduler().readable(listenSocket);
+        int fd = accept4(listenSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) {
+            scheduler().spawn(serveModule(fd));
+            continue;
+        }
+        int error = errno;
+        if (error == EAGAIN || error == EWOULDBLOCK || error == EINTR || error == ECONNABORTED) {
+            continue;
+        }
+        if (error == EBADF || error == ENOTSOCK || error == EINVAL) {
+            break;  // The socket itself is gone
+        }
+        klog(LogLevel::Warning, "events", std::string("Error accepting module connection: ") + strerror(error));
+        if (error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM) {
+            co_await timers().sleep(acceptBackoff);
+            co_await scheduler().schedule();  // Off the timer thread
+        }
+    }
+    ::close(listenSocket);
+}
+
+Task<void> EventBus::serveModule(int fd) {
+    // The subscription line
+    std::string request;
+    char buffer[256];
+    while (request.find('\n') == std::string::npos) {
+        co_await scheduler().readable(fd);
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) || request.size() > 1024) {
+            ::close(fd);
+            co_return;
+        }
+        if (n > 0) {
+            request.append(buffer, n);
+        }
+    }
+    uint32_t types;
+    std::string bad;
+    if (!parseTypes(request.substr(0, request.find('\n')), types, bad)) {
+        std::string reply = "ERR unknown event type " + bad + "\n";
+        send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+        ::close(fd);
+        co_return;
+    }
+
+    auto connection = std::make_shared<ModuleConnection>();
+    connection->fd = fd;
+    send(fd, "OK\n", 3, MSG_NOSIGNAL);
+    uint64_t id = subscribe(types, [connection](const KernelEvent& event) {
+        std::string line = toJson(event) + "\n";
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        if (connection->fd >= 0) {
+            send(connection->fd, line.data(), line.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+    });
+
+    // Wait for the module to hang up; anything else it sends is ignored
+    while (true) {
+        co_await scheduler().readable(fd);
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            break;
+        }
+    }
+    unsubscribe(id);
+    std::lock_guard<std::mutex> lock(connection->mutex);
+    ::close(fd);
+    connection->fd = -1;
+}
+
+const char* EventBus::typeName(EventType type) {
+    return typeNames[static_cast<int>(type)];
+}
+
+bool EventBus::parseType(const std::string& name, EventType& type) {
+    for (int i = 0; i < eventTypeCount; ++i) {
+        if (name == typeNames[i]) {
+            type = static_cast<EventType>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string EventBus::toJson(const KernelEvent& event) {
+    std::string out = "{\"type\":";
+    appendJsonString(out, typeName(event.type));
+    out += ",\"subject\":";
+    appendJsonString(out, event.subject);
+    out += ",\"detail\":";
+    appendJsonString(out, event.detail);
+    char tail[96];
+    snprintf(tail, sizeof(tail), ",\"value\":%lld,\"time\":%lld.%03ld}", static_cast<long long>(event.value),
+             static_cast<long long>(event.time.tv_sec), event.time.tv_nsec / 1000000);
+    return out + tail;
+}
+
+EventBus& eventBus() {
+    static EventBus* bus = new EventBus();  // Never destroyed, like the scheduler its jobs run on
+    return *bus;
+}
@@ -0,0 +1,79 @@
+// eventbus.h; Kernel event bus: typed notifications from subsystems to subscribers
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef EVENTBUS_H
+#define EVENTBUS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "scheduler.h"
+
+enum class EventType : uint8_t { Runlevel, Login, ClientJoin, ClientLeave, FileChange, Oops };
+const int eventTypeCount = 6;
+
+struct KernelEvent {
+    EventType type = EventType::Oops;
+    std::string subject;             // User, client or path the event is about
+    std::string detail;              // What happened to a file (created, removed, written); the oops reason
+    int64_t value = 0;               // New runlevel
+    struct timespec time = {0, 0};   // CLOCK_REALTIME
+};
+
+/*
+ * Subsystems publish events; subscribers get callbacks for the types they asked for.
+ * Every subscriber has its own lock-free MPSC queue: publishing pushes onto the queues
+ * and, when a queue was idle, posts one job to the scheduler that drains it. So a
+ * subscriber's callbacks run one at a time and in order, on a worker thread, and a slow
+ * subscriber delays nobody else. Callbacks should be short and must not block.
+ *
+ * Modules subscribe through the Unix socket named by $LUNIX_EVENTS: they send one line
+ * with the types they want, separated by spaces ("runlevel login"; empty or "*" for all),
+ * get "OK" back and then read one JSON object per line for each event. A module that
+ * doesn't keep up loses events instead of stalling the bus.
+ */
+class EventBus {
+public:
+    using Callback = std::function<void(const KernelEvent& event)>;
+
+    static uint32_t mask(EventType type) { return 1u << static_cast<int>(type); }
+    static const uint32_t allTypes = (1u << eventTypeCount) - 1;
+
+    // Returns an id for unsubscribe()
+    uint64_t subscribe(uint32_t types, Callback callback);
+    // No callback starts once this returns; one already running may still finish
+    void unsubscribe(uint64_t id);
+    void publish(EventType type, std::string subject, std::string detail = "", int64_t value = 0);
+
+    // Opens the module socket at path and exports it as LUNIX_EVENTS. Returns 0 or errno.
+    int listen(const std::string& path);
+    // Removes the module socket; used at shutdown
+    void close();
+
+    static const char* typeName(EventType type);
+    static bool parseType(const std::string& name, EventType& type);
+    // One line of the module protocol, without the newline
+    static std::string toJson(const KernelEvent& event);
+
+private:
+    struct Subscriber;
+    static void drain(const std::shared_ptr<Subscriber>& subscriber);
+    Task<void> acceptModules(int listenSocket);
+    Task<void> serveModule(int fd);
+
+    std::shared_mutex mutex;  // Guards the subscriber list, not the queues
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+    std::atomic<uint64_t> nextId{1};
+    std::string socketPath;
+};
+
+// The kernel's event bus, created on first use
+EventBus& eventBus();
+
+#endif // EVENTBUS_H
@@ -9,11 +9,17 @@
 #include <stdexcept>
 #include <string>
 #include <array>
+#include <cerrno>
+#include <fcntl.h>
 #include "../color.h"
 #include "../net/network.h"
 #include "../disk/disk.h"
 #include "../lsh.h"
 #include "error_handler.h"
+#include "trace.h"
+#include "eventbus.h"
+#include "services.h"
+#include "klog.h"
 
 using namespace std;
 using namespace std::filesystem;
@@ -30,7 +36,8 @@ kernel::kernel() {
 }
 
 void kernel::halt(string reason) {
-    cout << endl << "System cannot continue: " << reason << " Halted.\n";
+    cout << "\nSystem cannot continue: " << reason << " Halted.\n";
+    kernelLog().close();
     exit(0);
 }
 
@@ -40,7 +47,18 @@ void kernel::haltrq(string reason) {
 
 void kernel::crl(int rl) {
     runlevel = rl;
-    cout << "Runlevel changed to " << to_string(runlevel) << endl;
+    traceCounter("kernel", "runlevel", rl);
+    eventBus().publish(EventType::Runlevel, "", "", rl);
+    console() << "Runlevel changed to " << to_string(runlevel) << "\n" << std::flush;
+    klog(LogLevel::Info, "kernel", "Runlevel changed to " + to_string(runlevel));
+    if (rl > 0) {
+        services().enter(rl, console());
+    }
+}
+
+std::ostream& kernel::console() {
+    static std::ostream discard(nullptr);  // No streambuf: every write is dropped
+    return quiet ? discard : std::cout;
 }
 
 void kernel::crlrq(int rl) {
@@ -54,19 +72,107 @@ void kernel::check_sudo() {
     }
 }
 
+pid_t kernel::fork(const string& name) {
+    return processManager().fork(name);
+}
+
+pid_t kernel::exec(const string& program, char* const argv[], const SpawnOptions& options) {
+    // Launches without limits of their own get their profile from rootfs/.limits
+    SpawnOptions launch = options;
+    if (launch.name.empty()) {
+        launch.name = program.substr(program.rfind('/') + 1);
+    }
+    if (!launch.limits.any()) {
+        launch.limits = resourceProfiles().lookup(launch.name);
+    }
+    return processManager().spawn(program, argv, launch);
+}
+
+int kernel::wait(pid_t pid, int& status, struct rusage* usage) {
+    return processManager().wait(pid, status, usage);
+}
+
+bool kernel::process_is_alive(pid_t pid) {
+    return processManager().alive(pid);
+}
+
+// Runs cmd with /bin/sh and returns what it wrote to stdout
 std::string dexec(const char* cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) {
-        throw std::runtime_error("popen() failed!");
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        throw std::runtime_error("pipe() failed!");
+    }
+    SpawnOptions options;
+    options.outFd = fds[1];
+    char* argv[] = {const_cast<char*>("sh"), const_cast<char*>("-c"), const_cast<char*>(cmd), nullptr};
+    pid_t pid = processManager().spawn("/bin/sh", argv, options);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        throw std::runtime_error("fork() failed!");
     }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
+
+    std::array<char, 4096> buffer;
+    std::string result;
+    ssize_t n;
+    while ((n = read(fds[0], buffer.data(), buffer.size())) != 0) {
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        if (n > 0) {
+            result.append(buffer.data(), n);
+        }
     }
+    close(fds[0]);
+    int status;
+    processManager().wait(pid, status);
     return result;
 }
 
+void kernel::boot(bool probeNetwork) {
+    std::ostream& out = console();
+    out << std::flush;  // Units print from their own threads
+
+    units.add({"rootfs", {}, [this] {
+        console() << "Mounting root filesystem..." << std::flush;
+        Disk.rootfs();
+        return 0;
+    }, true, "", ""});
+    // Up before runlevel 2, so startup modules can subscribe
+    units.add({"events", {"rootfs"}, [] { return eventBus().listen(Disk.rootfsPath() + "/.events"); }, true,
+               "", "Failed to open the event socket"});
+    units.add({"klog", {"rootfs"}, [] { return kernelLog().open(Disk.rootfsPath() + "/kernel.log"); }, true,
+               "", "Failed to open the kernel log"});
+    units.add({"services", {"rootfs"}, [] {
+        Disk.registerServices();
+        LSH.registerServices();
+        return 0;
+    }, true, "", ""});
+    units.add({"runlevel2", {"klog", "events", "services"}, [this] {
+        crl(2);
+        console() << "\n";
+        return 0;
+    }, true, "", ""});
+    if (probeNetwork) {
+        // Nothing waits for the network: the in-process probe reports whenever its targets answer or time out
+        units.add({"network", {"runlevel2"}, [] { return Network.test(); }, false,
+                   "Started and tested network", "Failed to test network"});
+    }
+    units.add({"disktest", {"runlevel2"}, [this] {
+        console() << "         Testing disk reliability...";
+        return Disk.ftest();
+    }, true, "Disk test PASS", "Disk test FAIL, currect directory might be write protected"});
+    units.add({"runlevel3", {"disktest"}, [this] {
+        console() << "\n";
+        crl(3);
+        return 0;
+    }, true, "", ""});
+
+    if (units.run(out) != 0) {
+        ErrHandler.panic("Boot units have an unknown or circular dependency");
+    }
+}
+
 /**
  * Starts the Lunar kernel.
  * This function performs various initialization tasks and tests the network and disk reliability.
@@ -80,40 +186,45 @@ void kernel::start() {
     kernel::crl(1);
     kernel::check_sudo();
     std::cout << "An initial boot image isn't configured.\n";
-    std::cout << "Mounting root filesystem..." << std::flush;
-
-    Disk.rootfs();
-
-    kernel::crl(2);
-    std::cout << std::endl;
-    // Additional startup stuff
-    if (Network.test() == 0) {
-        std::cout << "[  " << GREEN << "OK" << RESET << "  ] " << "Started and tested network\n";
-    } else {
-        std::cout << "[" << RED << "FAILED" << RESET << "] " << "Failed to test network\n";
-    }
-    cout << "         Testing disk reliability...";
-    if (Disk.ftest() == 0) {
-        std::cout << "[  " << GREEN << "OK" << RESET << "  ] " << "Disk test PASS\n";
-    } else {
-        std::cout << "[" << RED << "FAILED" << RESET << "] " << "Disk test FAIL, currect directory might be write protected\n";
-    }
-    std::cout << std::endl;
-    kernel::crl(3);
+    boot(true);
     std::cout << "Started the " << CYAN << "Lunix" << RESET << " OS successfully. Welcome!\n";
     LSH.lshStart();
     kernel::shutdown();
 }
 
-void kernel::shutdown() {
-    cout << YELLOW << "\nSystem is going down NOW!\n" << RESET;
-    cout << "Sending shutdown signals to all processes...\n";
-    cout << "Unmounting all filesystems..." << flush;
+/**
+ * Starts the kernel for a non-interactive run (lunix -c / lunix script.lsh).
+ * Boot output is suppressed and the network probe is skipped, since nothing a script
+ * runs waits on it; the disk is still mounted before the commands run.
+ */
+int kernel::startBatch(std::istream& script) {
+    quiet = true;
+    kernel::crl(1);
+    kernel::check_sudo();
+    boot(false);
+
+    int status = LSH.lshBatch(script);
+    kernel::shutdown(status);
+    return status;
+}
+
+void kernel::shutdown(int status) {
+    std::ostream& out = console();
+    units.silence();  // A probe still running is killed below; it has nothing left to report
+    out << YELLOW << "\nSystem is going down NOW!\n" << RESET;
+    klog(LogLevel::Notice, "kernel", "System is going down");
+    out << "Stopping services...\n";
+    services().stopAll(out);
+    out << "Sending shutdown signals to all processes...\n";
+    processManager().signalAll(SIGTERM);
+    eventBus().close();
+    out << "Unmounting all filesystems..." << flush;
     Disk.umount();
-    cout << "done\n";
-    cout << "Spinning down disks...\n";
+    out << "done\n";
+    out << "Spinning down disks...\n";
     crl(0);
-    cout << CYAN << "It is now safe to turn off your computer.\n\n" << RESET;
+    kernelLog().close();
+    out << CYAN << "It is now safe to turn off your computer.\n\n" << RESET;
 
-    exit(0);
+    exit(status);
 }
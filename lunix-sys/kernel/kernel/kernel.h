@@ -2,6 +2,8 @@
 #define KERNEL_H
 
 #include <iostream>
+#include "boot.h"
+#include "process.h"
 using namespace std;
 
 class kernel
@@ -18,13 +20,26 @@ public:
     // Start the kernel
     void start();
 
+    // Boot quietly and run lsh commands from script without a terminal.
+    // Returns the exit status of the last command.
+    int startBatch(std::istream& script);
+
     // Shutdown the system
-    void shutdown();
+    void shutdown(int status = 0);
+
+    // Batch mode: no boot banner, runlevel messages or prompts
+    bool quiet = false;
+    // Boot messages go here; discards everything when quiet
+    std::ostream& console();
 
-    // Process control
-    int fork();
-    int exec();
-    int wait();
+    // Process control, through the process manager (process.h), which reaps every child.
+    // fork: the child may only make async-signal-safe calls until it execs.
+    pid_t fork(const string& name);
+    // Starts program; returns its pid, or -1 with errno set
+    pid_t exec(const string& program, char* const argv[], const SpawnOptions& options = {});
+    // Waits for a child started by fork or exec. Returns 0 or an errno value.
+    int wait(pid_t pid, int& status, struct rusage* usage = nullptr);
+    bool process_is_alive(pid_t pid);
 
     void haltrq(string reason); // External request to halt
     void crlrq(int rl); // External request to change runlevel
@@ -39,6 +54,14 @@ private:
      */
     void crl(int rl);
 
+    /*
+     * Boots through init units (boot.h), run in parallel as their dependencies allow.
+     * The runlevel moves to 2 once rootfs is mounted and to 3 once every critical unit
+     * is done; the network probe (left out of batch boots) may still be running then.
+     */
+    void boot(bool probeNetwork);
+    BootGraph units;
+
     /*
      * Simplified version of kernel panic.
      * Halts the kernel, exits, does not hang the system like panic.
@@ -47,8 +70,6 @@ private:
 
     // Check if there are root privileges at startup
     void check_sudo();
-
-    bool process_is_alive(pid_t pid);
 };
 
 #endif // KERNEL_H
@@ -0,0 +1,481 @@
+// klog.cpp; Kernel log: per-thread buffers drained to a rotating file by a writer thread
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "klog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<uint8_t> logThreshold{static_cast<uint8_t>(LogLevel::Info)};
+
+namespace {
+
+const std::chrono::milliseconds flushInterval(200);
+
+// Precedes each record's category and message, in the rings and in binary logs
+struct RecordHeader {
+    uint64_t time;
+    uint32_t tid;
+    uint16_t length;
+    uint8_t level;
+    uint8_t categoryLength;
+};
+static_assert(sizeof(RecordHeader) == 16, "no padding in the file format");
+
+const char* const levelNames[] = {"debug", "info", "notice", "warn", "error", "crit"};
+
+uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+// Marks the thread's ring as reclaimable when the thread exits
+struct RetireOnExit {
+    std::atomic<bool>* retired = nullptr;
+    ~RetireOnExit() {
+        if (retired != nullptr) {
+            retired->store(true);
+        }
+    }
+};
+
+}
+
+struct KernelLog::Ring {
+    static const size_t capacity = 1 << 16;
+
+    std::atomic<uint64_t> head{0};  // Bytes ever logged; only the owner stores it
+    std::atomic<uint64_t> tail{0};  // Bytes ever drained; only drain() stores it
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> retired{false};
+    pid_t tid = 0;
+    char bytes[capacity];
+
+    void put(uint64_t at, const void* data, size_t size) {
+        size_t offset = at % capacity;
+        size_t first = std::min(size, capacity - offset);
+        memcpy(bytes + offset, data, first);
+        memcpy(bytes, static_cast<const char*>(data) + first, size - first);
+    }
+    void get(uint64_t at, void* data, size_t size) const {
+        size_t offset = at % capacity;
+        size_t first = std::min(size, capacity - offset);
+        memcpy(data, bytes + offset, first);
+        memcpy(static_cast<char*>(data) + first, bytes, size - first);
+    }
+};
+
+KernelLog::Ring& KernelLog::local() {
+    static thread_local Ring* mine = nullptr;
+    static thread_local RetireOnExit retire;
+    if (mine == nullptr) {
+        std::unique_ptr<Ring> ring(new Ring);  // Not make_unique: that would zero (and fault in) the whole ring
+        ring->tid = static_cast<pid_t>(syscall(SYS_gettid));
+        mine = ring.get();
+        retire.retired = &ring->retired;
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(std::move(ring));
+    }
+    return *mine;
+}
+
+void KernelLog::write(LogLevel level, const char* category, std::string_view message) {
+    Ring& ring = local();
+    size_t categoryLength = std::min<size_t>(strlen(category), UINT8_MAX);
+    size_t length = std::min(message.size(), maxMessage);
+    size_t size = sizeof(RecordHeader) + categoryLength + length;
+
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t used = head - ring.tail.load(std::memory_order_acquire);
+    bool wakeWriter = level >= LogLevel::Error || used + size > Ring::capacity / 2;
+    if (used + size > Ring::capacity) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        RecordHeader header = {nowNs(), static_cast<uint32_t>(ring.tid), static_cast<uint16_t>(length),
+                               static_cast<uint8_t>(level), static_cast<uint8_t>(categoryLength)};
+        ring.put(head, &header, sizeof(header));
+        ring.put(head + sizeof(header), category, categoryLength);
+        ring.put(head + sizeof(header) + categoryLength, message.data(), length);
+        ring.head.store(head + size, std::memory_order_release);
+    }
+    // Notifying without wakeMutex keeps callers off the writer's lock; a wakeup lost
+    // to the race only delays the batch to the next flushInterval
+    if (wakeWriter && !wakeRequested.exchange(true)) {
+        wake.notify_one();
+    }
+}
+
+void KernelLog::drain() {
+    if (fd < 0) {
+        return;  // Kept in the rings until the log is opened
+    }
+    std::vector<Ring*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (auto it = rings.begin(); it != rings.end();) {
+            Ring& ring = **it;
+            bool empty = ring.head.load(std::memory_order_acquire) == ring.tail.load(std::memory_order_relaxed);
+            if (ring.retired.load() && empty && ring.dropped.load() == 0) {
+                it = rings.erase(it);
+            } else {
+                snapshot.push_back(it->get());
+                ++it;
+            }
+        }
+    }
+
+    // Copy every ring's records out, then write them in time order
+    std::string raw;
+    std::vector<std::pair<uint64_t, size_t>> order;  // time, offset in raw
+    uint64_t dropped = 0;
+    for (Ring* ring : snapshot) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        size_t base = raw.size();
+        raw.resize(base + (head - tail));
+        ring->get(tail, raw.data() + base, head - tail);
+        ring->tail.store(head, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+
+        for (size_t offset = base; offset < raw.size();) {
+            RecordHeader header;
+            memcpy(&header, raw.data() + offset, sizeof(header));
+            order.emplace_back(header.time, offset);
+            offset += sizeof(header) + header.categoryLength + header.length;
+        }
+    }
+    if (dropped != 0) {
+        std::string message = std::to_string(dropped) + " records dropped: logged faster than they could be written";
+        RecordHeader header = {nowNs(), static_cast<uint32_t>(syscall(SYS_gettid)), static_cast<uint16_t>(message.size()),
+                               static_cast<uint8_t>(LogLevel::Warning), 4};
+        order.emplace_back(header.time, raw.size());
+        raw.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        raw.append("klog");
+        raw.append(message);
+        counters.dropped += dropped;
+    }
+    if (order.empty()) {
+        return;
+    }
+    std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::string batch;
+    batch.reserve(options.binary ? raw.size() : raw.size() * 2);
+    for (const auto& [time, offset] : order) {
+        RecordHeader header;
+        memcpy(&header, raw.data() + offset, sizeof(header));
+        size_t size = sizeof(header) + header.categoryLength + header.length;
+        if (options.binary) {
+            batch.append(raw, offset, size);
+            continue;
+        }
+        Record record;
+        record.time = header.time;
+        record.tid = static_cast<pid_t>(header.tid);
+        record.level = static_cast<LogLevel>(header.level);
+        record.category.assign(raw, offset + sizeof(header), header.categoryLength);
+        record.message.assign(raw, offset + sizeof(header) + header.categoryLength, header.length);
+        batch += format(record);
+        batch += '\n';
+    }
+
+    size_t empty = options.binary ? sizeof(magic) : 0;  // A fresh file is never rotated away
+    if (fileBytes > empty && (fileBytes + batch.size() > options.maxBytes ||
+                          std::chrono::system_clock::now() - fileStarted >= options.maxAge)) {
+        rotate();
+    }
+    size_t written = 0;
+    while (fd >= 0 && written < batch.size()) {
+        ssize_t n = ::write(fd, batch.data() + written, batch.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // Nowhere to report it but the log itself
+        }
+        written += n;
+    }
+    fileBytes += written;
+    counters.records += order.size();
+    counters.bytes += written;
+    counters.batches++;
+}
+
+int KernelLog::openFile(bool truncate) {
+    fd = ::open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0600);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat st;
+    fileBytes = fstat(fd, &st) == 0 ? st.st_size : 0;
+    fileStarted = std::chrono::system_clock::now();
+    if (fileBytes == 0) {
+        if (options.binary && ::write(fd, magic, sizeof(magic)) == sizeof(magic)) {
+            fileBytes = sizeof(magic);
+        }
+        return 0;
+    }
+    // An existing log counts as started when it was last written, and one in the other format is rotated away
+    fileStarted = std::chrono::system_clock::from_time_t(st.st_mtime);
+    char start[sizeof(magic)] = {};
+    bool binary = pread(fd, start, sizeof(start), 0) == sizeof(start) && memcmp(start, magic, sizeof(magic)) == 0;
+    if (binary != options.binary) {
+        rotate();
+    }
+    return fd >= 0 ? 0 : errno;
+}
+
+void KernelLog::rotate() {
+    ::close(fd);
+    fd = -1;
+    for (unsigned i = options.keep; i > 1; --i) {
+        rename((logPath + "." + std::to_string(i - 1)).c_str(), (logPath + "." + std::to_string(i)).c_str());
+    }
+    if (options.keep > 0) {
+        rename(logPath.c_str(), (logPath + ".1").c_str());
+    }
+    counters.rotations++;
+    openFile(true);
+}
+
+void KernelLog::run() {
+    pthread_setname_np(pthread_self(), "klog");
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    while (!stopping) {
+        wake.wait_for(lock, flushInterval, [this] { return stopping || wakeRequested.load(); });
+        wakeRequested = false;
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> drainLock(drainMutex);
+            drain();
+        }
+        lock.lock();
+    }
+}
+
+void KernelLog::configure(const Options& newOptions) {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    if (fd < 0) {
+        options = newOptions;
+    }
+}
+
+int KernelLog::open(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(drainMutex);
+        if (fd >= 0) {
+            return EALREADY;
+        }
+        logPath = path;
+        int result = openFile(false);
+        if (result != 0) {
+            return result;
+        }
+        drain();
+    }
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    stopping = false;
+    writer = std::thread(&KernelLog::run, this);
+    return 0;
+}
+
+bool KernelLog::isOpen() {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    return fd >= 0;
+}
+
+std::string KernelLog::path() {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    return logPath;
+}
+
+void KernelLog::flush() {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    drain();
+}
+
+void KernelLog::close() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+    std::lock_guard<std::mutex> lock(drainMutex);
+    drain();
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+KernelLog::Stats KernelLog::stats() {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(drainMutex);
+        stats = counters;
+    }
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    for (const auto& ring : rings) {
+        stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    stats.threads = rings.size();
+    return stats;
+}
+
+const char* KernelLog::levelName(LogLevel level) {
+    size_t index = static_cast<size_t>(level);
+    return index < sizeof(levelNames) / sizeof(levelNames[0]) ? levelNames[index] : "?";
+}
+
+int KernelLog::parseLevel(const std::string& name) {
+    for (size_t i = 0; i < sizeof(levelNames) / sizeof(levelNames[0]); ++i) {
+        if (name == levelNames[i]) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// "2024-07-30 12:00:00.123 warn   server[1234]: message", further lines indented by 4 spaces
+std::string KernelLog::format(const Record& record) {
+    if (record.time == 0 && record.category.empty()) {
+        return record.message;  // A line read from a text log that isn't a record
+    }
+    // Records come in bursts from the same second; localtime_r is the slow part
+    static thread_local time_t cachedSecond = -1;
+    static thread_local char date[32];
+    time_t seconds = static_cast<time_t>(record.time / 1000000000ULL);
+    if (seconds != cachedSecond) {
+        struct tm local;
+        localtime_r(&seconds, &local);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+        cachedSecond = seconds;
+    }
+    char prefix[96];
+    snprintf(prefix, sizeof(prefix), "%s.%03u %-6s ", date, static_cast<unsigned>(record.time / 1000000 % 1000),
+             levelName(record.level));
+
+    std::string message = record.message;
+    while (!message.empty() && message.back() == '\n') {
+        message.pop_back();
+    }
+    std::string out = prefix + record.category + "[" + std::to_string(record.tid) + "]: ";
+    for (char c : message) {
+        out += c;
+        if (c == '\n') {
+            out += "    ";
+        }
+    }
+    return out;
+}
+
+namespace {
+
+// A line written by format(), or false if it isn't one
+bool parseLine(const std::string& line, KernelLog::Record& record) {
+    struct tm local = {};
+    unsigned millis;
+    char level[16];
+    int consumed = 0;
+    if (sscanf(line.c_str(), "%d-%d-%d %d:%d:%d.%3u %15s %n", &local.tm_year, &local.tm_mon, &local.tm_mday, &local.tm_hour,
+               &local.tm_min, &local.tm_sec, &millis, level, &consumed) != 8 || consumed == 0) {
+        return false;
+    }
+    int parsed = KernelLog::parseLevel(level);
+    size_t open = line.find('[', consumed);
+    size_t close = line.find("]: ", consumed);
+    if (parsed < 0 || open == std::string::npos || close == std::string::npos || close < open) {
+        return false;
+    }
+    local.tm_year -= 1900;
+    local.tm_mon -= 1;
+    local.tm_isdst = -1;
+    record.time = static_cast<uint64_t>(mktime(&local)) * 1000000000ULL + millis * 1000000ULL;
+    record.level = static_cast<LogLevel>(parsed);
+    record.category = line.substr(consumed, open - consumed);
+    record.tid = static_cast<pid_t>(atoi(line.c_str() + open + 1));
+    record.message = line.substr(close + 3);
+    return true;
+}
+
+}
+
+int KernelLog::read(const std::string& path, std::vector<Record>& records) {
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) {
+        return errno;
+    }
+    std::string data;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = ::read(file, buffer, sizeof(buffer))) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            int error = errno;
+            ::close(file);
+            return error;
+        }
+        data.append(buffer, n);
+    }
+    ::close(file);
+
+    if (data.compare(0, sizeof(magic), magic, sizeof(magic)) == 0) {
+        size_t offset = sizeof(magic);
+        while (offset + sizeof(RecordHeader) <= data.size()) {
+            RecordHeader header;
+            memcpy(&header, data.data() + offset, sizeof(header));
+            size_t size = sizeof(header) + header.categoryLength + header.length;
+            if (offset + size > data.size() || header.level > static_cast<uint8_t>(LogLevel::Critical)) {
+                return EINVAL;  // Cut short, or not a log after all
+            }
+            Record record;
+            record.time = header.time;
+            record.tid = static_cast<pid_t>(header.tid);
+            record.level = static_cast<LogLevel>(header.level);
+            record.category.assign(data, offset + sizeof(header), header.categoryLength);
+            record.message.assign(data, offset + sizeof(header) + header.categoryLength, header.length);
+            records.push_back(std::move(record));
+            offset += size;
+        }
+        return 0;
+    }
+
+    size_t start = 0;
+    while (start < data.size()) {
+        size_t end = data.find('\n', start);
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+        std::string line = data.substr(start, end - start);
+        start = end + 1;
+        Record record;
+        if (line.compare(0, 4, "    ") == 0 && !records.empty() && records.back().time != 0) {
+            records.back().message += "\n" + line.substr(4);
+        } else if (parseLine(line, record)) {
+            records.push_back(std::move(record));
+        } else {
+            record.message = line;  // Written before the kernel log existed
+            records.push_back(std::move(record));
+        }
+    }
+    return 0;
+}
+
+KernelLog& kernelLog() {
+    static KernelLog* log = new KernelLog();  // Never destroyed: threads may log until the process exits
+    return *log;
+}
@@ -0,0 +1,120 @@
+// klog.h; Kernel log: per-thread buffers drained to a rotating file by a writer thread
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class LogLevel : uint8_t { Debug, Info, Notice, Warning, Error, Critical };
+
+/*
+ * Each thread appends its records to a byte ring of its own, which only it writes and
+ * only the writer thread reads, so logging takes no lock and never touches the file. A
+ * full ring drops the record and counts it rather than wait. The writer wakes every
+ * flushInterval, or early once a ring is half full or an error is logged, merges what the
+ * rings hold in time order and appends it to the log with one write().
+ *
+ * The log is rotated once it would grow past maxBytes or is older than maxAge:
+ * kernel.log becomes kernel.log.1, and so on up to keep files. In the binary format
+ * records are stored as they are in the rings, after an 8 byte magic; dmesg reads both.
+ */
+class KernelLog {
+public:
+    struct Options {
+        size_t maxBytes = 1 << 20;
+        std::chrono::hours maxAge{24};
+        unsigned keep = 3;     // Rotated files kept besides the current one
+        bool binary = false;
+    };
+
+    struct Stats {
+        uint64_t records = 0;  // Written to the file
+        uint64_t dropped = 0;  // Lost to full rings
+        uint64_t bytes = 0;
+        uint64_t batches = 0;  // write() calls
+        uint64_t rotations = 0;
+        size_t threads = 0;    // Rings in use
+    };
+
+    // A record as it was logged, for dmesg
+    struct Record {
+        uint64_t time = 0;  // Nanoseconds since the epoch
+        pid_t tid = 0;
+        LogLevel level = LogLevel::Info;
+        std::string category;
+        std::string message;
+    };
+
+    static constexpr size_t maxMessage = 8192;  // Longer messages are truncated
+    static constexpr char magic[8] = {'L', 'U', 'N', 'X', 'L', 'O', 'G', '1'};
+
+    // Set before open(); the format can't change while the log is open
+    void configure(const Options& options);
+    // Starts the writer on path; what was logged before is written first. Returns 0 or an errno value.
+    int open(const std::string& path);
+    bool isOpen();
+    std::string path();
+    // Writes out everything logged so far before returning; used by dmesg and panic
+    void flush();
+    // Flushes and stops the writer; logging afterwards is kept in the rings
+    void close();
+
+    void write(LogLevel level, const char* category, std::string_view message);
+
+    Stats stats();
+
+    static const char* levelName(LogLevel level);
+    // -1 if name is not a level
+    static int parseLevel(const std::string& name);
+    static std::string format(const Record& record);
+    // Reads a log in either format; EINVAL if it is neither
+    static int read(const std::string& path, std::vector<Record>& records);
+
+private:
+    struct Ring;
+    Ring& local();
+    void run();
+    void drain();  // Caller holds drainMutex
+    void rotate(); // Caller holds drainMutex
+    int openFile(bool truncate);
+
+    std::mutex ringsMutex;  // Guards rings, not the records in them
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    std::mutex drainMutex;  // One drain at a time; guards the file and options
+    Options options;
+    std::string logPath;
+    int fd = -1;
+    size_t fileBytes = 0;
+    std::chrono::system_clock::time_point fileStarted;
+    Stats counters;
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<bool> wakeRequested{false};
+    bool stopping = false;
+    std::thread writer;
+};
+
+KernelLog& kernelLog();
+
+// Read inline by every log call; records below it are dropped at no cost
+extern std::atomic<uint8_t> logThreshold;
+
+inline void klog(LogLevel level, const char* category, std::string_view message) {
+    if (static_cast<uint8_t>(level) >= logThreshold.load(std::memory_order_relaxed)) {
+        kernelLog().write(level, category, message);
+    }
+}
+
+#endif // KLOG_H
@@ -0,0 +1,420 @@
+// process.cpp; Process manager: spawns, tracks and reaps every child process of Lunix
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "process.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t recentLimit = 64;
+const int pollIntervalMs = 100;
+
+int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));  // Always close-on-exec
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int pidfdSignal(int pidfd, int sig) {
+#ifdef SYS_pidfd_send_signal
+    return static_cast<int>(syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void addTime(struct timeval& sum, const struct timeval& add) {
+    sum.tv_sec += add.tv_sec;
+    sum.tv_usec += add.tv_usec;
+    if (sum.tv_usec >= 1000000) {
+        sum.tv_sec++;
+        sum.tv_usec -= 1000000;
+    }
+}
+
+void addUsage(ProcessManager::Totals& totals, int status, const struct rusage& usage) {
+    totals.exited++;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        totals.failed++;
+    }
+    if (WIFSIGNALED(status)) {
+        totals.killed++;
+    }
+    addTime(totals.userTime, usage.ru_utime);
+    addTime(totals.systemTime, usage.ru_stime);
+    totals.maxRssKb = std::max(totals.maxRssKb, usage.ru_maxrss);
+    totals.readBytes += static_cast<uint64_t>(usage.ru_inblock) * 512;
+    totals.writtenBytes += static_cast<uint64_t>(usage.ru_oublock) * 512;
+}
+
+// Lowers one limit; never raises the hard limit, which an unprivileged process can't
+void lowerLimit(int resource, uint64_t soft, uint64_t hard) {
+    struct rlimit current;
+    if (getrlimit(resource, &current) != 0) {
+        return;
+    }
+    struct rlimit limit;
+    limit.rlim_max = current.rlim_max == RLIM_INFINITY ? hard : std::min<rlim_t>(current.rlim_max, hard);
+    limit.rlim_cur = std::min<rlim_t>(soft, limit.rlim_max);
+    setrlimit(resource, &limit);
+}
+
+// Async-signal-safe: runs in the child between fork and exec
+void applyLimits(const ResourceLimits& limits) {
+    if (limits.cpuSeconds != 0) {
+        lowerLimit(RLIMIT_CPU, limits.cpuSeconds, limits.cpuSeconds + 1);  // SIGXCPU first, SIGKILL a second later
+    }
+    if (limits.memoryBytes != 0) {
+        lowerLimit(RLIMIT_AS, limits.memoryBytes, limits.memoryBytes);
+    }
+    if (limits.openFiles != 0) {
+        lowerLimit(RLIMIT_NOFILE, limits.openFiles, limits.openFiles);
+    }
+}
+
+// First executable name in the host PATH, or "" if there is none
+std::string findInPath(const std::string& name) {
+    const char* path = getenv("PATH");
+    std::string dirs = path != nullptr ? path : "/usr/local/bin:/usr/bin:/bin";
+    size_t start = 0;
+    while (start <= dirs.size()) {
+        size_t end = dirs.find(':', start);
+        if (end == std::string::npos) {
+            end = dirs.size();
+        }
+        std::string dir = dirs.substr(start, end - start);
+        std::string candidate = (dir.empty() ? "." : dir) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+        start = end + 1;
+    }
+    return "";
+}
+
+}
+
+ProcessManager::ProcessManager() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = 0;  // Never a child's pid
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    reaperThread = std::thread(&ProcessManager::reaper, this);
+}
+
+ProcessManager::~ProcessManager() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof(one));
+    if (reaperThread.joinable()) {
+        reaperThread.join();
+    }
+    for (auto& [pid, entry] : table) {
+        if (entry.pidfd >= 0) {
+            close(entry.pidfd);
+        }
+    }
+    close(wakeFd);
+    close(epollFd);
+}
+
+pid_t ProcessManager::fork(const std::string& name, const SpawnOptions& options) {
+    pid_t pid = ::fork();
+    if (pid > 0) {
+        track(pid, name, options);
+    }
+    return pid;
+}
+
+pid_t ProcessManager::spawn(const std::string& program, char* const argv[], const SpawnOptions& options) {
+    // Everything that allocates happens here, before the fork
+    std::string path = program;
+    if (options.searchPath && program.find('/') == std::string::npos) {
+        path = findInPath(program);
+        if (path.empty()) {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+    size_t slash = program.rfind('/');
+    std::string name = !options.name.empty() ? options.name : slash == std::string::npos ? program : program.substr(slash + 1);
+    std::string cgroup;
+    int cgroupProcs = -1;
+    if (options.limits.needsCgroup() && cgroups().available()) {
+        cgroupProcs = cgroups().create(name, options.limits, cgroup);
+    }
+
+    pid_t pid = ::fork();
+    if (pid != 0) {
+        if (pid > 0) {
+            track(pid, name, options, cgroup);
+        } else if (!cgroup.empty()) {
+            cgroups().remove(cgroup);
+        }
+        if (cgroupProcs >= 0) {
+            close(cgroupProcs);
+        }
+        return pid;
+    }
+
+    // Child process: only async-signal-safe calls until exec
+    if (cgroupProcs >= 0) {
+        write(cgroupProcs, "0", 1);  // Join the launch's cgroup; the rlimits still apply if this fails
+    }
+    applyLimits(options.limits);
+    if (options.cwdFd >= 0 && fchdir(options.cwdFd) != 0) {
+        _exit(EXIT_FAILURE);
+    }
+    if (options.inFd >= 0 && options.inFd != STDIN_FILENO) {
+        dup2(options.inFd, STDIN_FILENO);
+    }
+    if (options.outFd >= 0 && options.outFd != STDOUT_FILENO) {
+        dup2(options.outFd, STDOUT_FILENO);
+    }
+    if (options.errFd >= 0 && options.errFd != STDERR_FILENO) {
+        dup2(options.errFd, STDERR_FILENO);
+    }
+    // The kernel ignores SIGPIPE, and SIGINT while it waits for some children; programs expect the defaults
+    ::signal(SIGPIPE, SIG_DFL);
+    ::signal(SIGINT, SIG_DFL);
+    ::signal(SIGQUIT, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    execv(path.c_str(), argv);
+
+    // If execv returns, it must have failed
+    const char msg[] = "Exec failed\n";
+    write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    _exit(127);
+}
+
+void ProcessManager::track(pid_t pid, const std::string& name, const SpawnOptions& options, const std::string& cgroup) {
+    Entry entry;
+    entry.process.pid = pid;
+    entry.process.parent = options.parent;
+    entry.process.name = name;
+    entry.process.owner = options.owner;
+    clock_gettime(CLOCK_MONOTONIC, &entry.process.started);
+    entry.detached = options.detached;
+    entry.cgroup = cgroup;
+    // The child can't be reaped before this: only the reaper reaps pids in the table
+    entry.pidfd = pidfdOpen(pid);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    sums.spawned++;
+    users[options.owner.empty() ? "kernel" : options.owner].spawned++;
+    commands[name].spawned++;
+    if (entry.pidfd >= 0) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = static_cast<uint64_t>(pid);
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, entry.pidfd, &event);
+    } else if (polled++ == 0) {
+        uint64_t one = 1;
+        write(wakeFd, &one, sizeof(one));  // Start polling
+    }
+    table[pid] = std::move(entry);
+}
+
+void ProcessManager::reaper() {
+    struct epoll_event events[64];
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        int timeout = polled > 0 ? pollIntervalMs : -1;
+        lock.unlock();
+        int n = epoll_wait(epollFd, events, 64, timeout);
+        lock.lock();
+
+        bool any = false;
+        for (int i = 0; i < n; ++i) {
+            pid_t pid = static_cast<pid_t>(events[i].data.u64);
+            if (pid == 0) {
+                uint64_t count;
+                read(wakeFd, &count, sizeof(count));
+            } else if (collect(pid)) {
+                any = true;
+            }
+        }
+        if (polled > 0) {
+            std::vector<pid_t> waiting;
+            for (const auto& [pid, entry] : table) {
+                if (entry.pidfd < 0 && entry.process.running) {
+                    waiting.push_back(pid);
+                }
+            }
+            for (pid_t pid : waiting) {
+                any = collect(pid) || any;
+            }
+        }
+        if (any) {
+            exited.notify_all();
+        }
+    }
+}
+
+bool ProcessManager::collect(pid_t pid) {
+    auto it = table.find(pid);
+    if (it == table.end() || !it->second.process.running) {
+        return false;
+    }
+    Entry& entry = it->second;
+    int status;
+    struct rusage usage = {};
+    pid_t result;
+    do {
+        result = wait4(pid, &status, WNOHANG, &usage);
+    } while (result < 0 && errno == EINTR);
+    if (result == 0) {
+        return false;  // Still running
+    }
+    if (result < 0) {
+        status = 0;  // Reaped behind our back; nothing to report
+    }
+
+    Process& process = entry.process;
+    process.running = false;
+    process.status = status;
+    process.usage = usage;
+    clock_gettime(CLOCK_MONOTONIC, &process.ended);
+    if (entry.pidfd >= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, entry.pidfd, nullptr);  // Other forks may still hold a copy
+        close(entry.pidfd);
+        entry.pidfd = -1;
+    } else {
+        polled--;
+    }
+
+    if (!entry.cgroup.empty()) {
+        cgroups().remove(entry.cgroup);
+        entry.cgroup.clear();
+    }
+
+    addUsage(sums, status, usage);
+    addUsage(users[process.owner.empty() ? "kernel" : process.owner], status, usage);
+    addUsage(commands[process.name], status, usage);
+    finished.push_back(process);
+    if (finished.size() > recentLimit) {
+        finished.pop_front();
+    }
+    if (entry.detached) {
+        table.erase(it);
+    }
+    return true;
+}
+
+int ProcessManager::wait(pid_t pid, int& status, struct rusage* usage) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = table.find(pid);
+    if (it == table.end() || it->second.detached) {
+        return ECHILD;
+    }
+    exited.wait(lock, [&] {
+        it = table.find(pid);
+        return it == table.end() || !it->second.process.running;
+    });
+    if (it == table.end()) {
+        return ECHILD;  // Another thread waited for it first
+    }
+    status = it->second.process.status;
+    if (usage != nullptr) {
+        *usage = it->second.process.usage;
+    }
+    table.erase(it);
+    return 0;
+}
+
+bool ProcessManager::alive(pid_t pid) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = table.find(pid);
+        if (it != table.end()) {
+            return it->second.process.running;
+        }
+    }
+    // Not ours: any process the host knows about, even one we may not signal
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+int ProcessManager::signal(pid_t pid, int sig) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = table.find(pid);
+    if (it == table.end() || !it->second.process.running) {
+        return ESRCH;
+    }
+    int result = it->second.pidfd >= 0 ? pidfdSignal(it->second.pidfd, sig) : kill(pid, sig);
+    return result == 0 ? 0 : errno;
+}
+
+void ProcessManager::signalAll(int sig) {
+    std::vector<pid_t> running;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [pid, entry] : table) {
+            if (entry.process.running) {
+                running.push_back(pid);
+            }
+        }
+    }
+    for (pid_t pid : running) {
+        signal(pid, sig);
+    }
+}
+
+std::vector<ProcessManager::Process> ProcessManager::processes() {
+    std::vector<Process> out;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.reserve(table.size());
+        for (const auto& [pid, entry] : table) {
+            out.push_back(entry.process);
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const Process& a, const Process& b) { return a.pid < b.pid; });
+    return out;
+}
+
+std::vector<ProcessManager::Process> ProcessManager::recent() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<Process>(finished.begin(), finished.end());
+}
+
+ProcessManager::Totals ProcessManager::totals() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return sums;
+}
+
+std::map<std::string, ProcessManager::Totals> ProcessManager::userTotals() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return users;
+}
+
+std::map<std::string, ProcessManager::Totals> ProcessManager::commandTotals() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return commands;
+}
+
+ProcessManager& processManager() {
+    static ProcessManager manager;
+    return manager;
+}
@@ -0,0 +1,133 @@
+// process.h; Process manager: spawns, tracks and reaps every child process of Lunix
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "resources.h"
+
+struct SpawnOptions {
+    int cwdFd = -1;     // Working directory (an O_PATH fd); -1 keeps the kernel's
+    int inFd = -1;      // Descriptors to become stdin/stdout/stderr; -1 keeps the kernel's
+    int outFd = -1;
+    int errFd = -1;
+    bool searchPath = false;  // Look program up in the host PATH, like execvp
+    bool detached = false;    // Nobody will wait: forget the process once it exits
+    pid_t parent = 0;         // Lunix process this one was started for, 0 for the kernel
+    std::string owner;        // Lunix user it runs for, for accounting
+    std::string name;         // Listed and accounted under this; the program's file name if empty
+    ResourceLimits limits;    // Applied to programs started with spawn()
+};
+
+/*
+ * Table of the processes Lunix started. Each child gets a pidfd that a single reaper
+ * thread watches with epoll; when one becomes readable the reaper collects the exit
+ * status and resource usage with wait4(pid, WNOHANG) and wakes anyone waiting for it.
+ * So children never linger as zombies, waiting never blocks in waitpid, and a pid can't
+ * be confused with a reused one while it is in the table. Hosts without pidfd_open
+ * (before Linux 5.3) fall back to the reaper polling its children every 100ms.
+ * Only pids in the table are ever reaped, so code that still runs its own child
+ * (std::system, popen) is left alone.
+ */
+class ProcessManager {
+public:
+    struct Process {
+        pid_t pid = 0;
+        pid_t parent = 0;
+        std::string name;
+        std::string owner;
+        struct timespec started = {0, 0};  // CLOCK_MONOTONIC
+        struct timespec ended = {0, 0};
+        bool running = true;
+        int status = 0;                    // wait status, valid once not running
+        struct rusage usage = {};
+    };
+
+    struct Totals {
+        uint64_t spawned = 0;
+        uint64_t exited = 0;
+        uint64_t failed = 0;               // Exited non-zero or killed by a signal
+        uint64_t killed = 0;               // By a signal, such as SIGXCPU or SIGKILL from a CPU limit
+        struct timeval userTime = {0, 0};
+        struct timeval systemTime = {0, 0};
+        long maxRssKb = 0;
+        uint64_t readBytes = 0;            // Block I/O
+        uint64_t writtenBytes = 0;
+    };
+
+    ProcessManager();
+    ~ProcessManager();
+
+    ProcessManager(const ProcessManager&) = delete;
+    ProcessManager& operator=(const ProcessManager&) = delete;
+
+    // fork() and track the child. The child (return value 0) may only make
+    // async-signal-safe calls until it execs. Returns -1 with errno set on failure.
+    pid_t fork(const std::string& name, const SpawnOptions& options = {});
+    // fork(), set up the child as options says and exec program. Returns the pid, or
+    // -1 with errno set if there was no process to start; exec failures exit with 127.
+    // The child gets options.limits as rlimits, and a cgroup of its own for the limits
+    // that need one when cgroups() is available.
+    pid_t spawn(const std::string& program, char* const argv[], const SpawnOptions& options = {});
+
+    // Blocks until pid exits and removes it from the table. Returns 0, or ECHILD if
+    // pid isn't a (waitable) child of Lunix.
+    int wait(pid_t pid, int& status, struct rusage* usage = nullptr);
+    bool alive(pid_t pid);
+    // Signals pid through its pidfd, so a reused pid can't be hit. Returns 0 or errno.
+    int signal(pid_t pid, int sig);
+    // Signals every running process; used at shutdown
+    void signalAll(int sig);
+
+    // Running processes and exited ones nobody has waited for yet, by pid
+    std::vector<Process> processes();
+    // The last exited processes, oldest first
+    std::vector<Process> recent();
+    Totals totals();
+    // Totals of the exited processes by owner ("kernel" for none), and by name
+    std::map<std::string, Totals> userTotals();
+    std::map<std::string, Totals> commandTotals();
+
+private:
+    struct Entry {
+        Process process;
+        int pidfd = -1;
+        bool detached = false;
+        std::string cgroup;  // Removed once the process is reaped
+    };
+
+    void track(pid_t pid, const std::string& name, const SpawnOptions& options, const std::string& cgroup = "");
+    void reaper();
+    bool collect(pid_t pid);  // Caller holds mutex
+
+    std::mutex mutex;
+    std::condition_variable exited;
+    std::unordered_map<pid_t, Entry> table;
+    std::deque<Process> finished;
+    Totals sums;
+    std::map<std::string, Totals> users;
+    std::map<std::string, Totals> commands;
+    size_t polled = 0;  // Entries without a pidfd, which the reaper has to poll
+
+    int epollFd = -1;
+    int wakeFd = -1;    // eventfd that tells the reaper to stop or start polling
+    bool stopping = false;
+    std::thread reaperThread;
+};
+
+ProcessManager& processManager();
+
+#endif // PROCESS_H
@@ -0,0 +1,234 @@
+// proctable.cpp; Sampled view of the host process table for ps and top
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "proctable.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+ProcessTable::ProcessTable() {
+    ticksPerSecond = sysconf(_SC_CLK_TCK);
+    pageKb = sysconf(_SC_PAGESIZE) / 1024;
+}
+
+ProcessTable::~ProcessTable() {
+    for (const auto& [pid, fd] : statFds) {
+        close(fd);
+    }
+    if (proc != nullptr) {
+        closedir(proc);
+    }
+}
+
+bool ProcessTable::refresh() {
+    if (proc == nullptr) {
+        proc = opendir("/proc");
+        if (proc == nullptr) {
+            return false;
+        }
+    } else {
+        rewinddir(proc);
+    }
+
+    // Keep the old snapshot's buffer instead of freeing it
+    previous.swap(current);
+    current.clear();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pids.clear();
+    struct dirent* entry;
+    while ((entry = readdir(proc)) != nullptr) {
+        if (entry->d_name[0] >= '1' && entry->d_name[0] <= '9') {
+            pids.push_back(static_cast<pid_t>(strtol(entry->d_name, nullptr, 10)));
+        }
+    }
+    std::sort(pids.begin(), pids.end());
+
+    // Walk the new pid list and the open stat files together; both are sorted
+    size_t fdCap = maxOpenFds();
+    size_t old = 0;
+    nextStatFds.clear();
+    for (pid_t pid : pids) {
+        while (old < statFds.size() && statFds[old].first < pid) {
+            close(statFds[old++].second);  // Exited
+        }
+        int fd = -1;
+        if (old < statFds.size() && statFds[old].first == pid) {
+            fd = statFds[old++].second;
+        }
+
+        ProcessInfo info;
+        fd = readProcess(pid, fd, info);
+        if (fd >= 0 && nextStatFds.size() < fdCap) {
+            nextStatFds.emplace_back(pid, fd);
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        if (info.pid != 0) {
+            current.push_back(info);
+        }
+    }
+    while (old < statFds.size()) {
+        close(statFds[old++].second);
+    }
+    statFds.swap(nextStatFds);
+
+    if (previous.empty()) {
+        // Nothing to diff against yet: average over each process's lifetime
+        double uptime = uptimeSeconds();
+        for (ProcessInfo& info : current) {
+            double age = uptime - static_cast<double>(info.startTicks) / ticksPerSecond;
+            info.cpuPercent = age > 0 ? 100.0 * info.cpuTicks / ticksPerSecond / age : 0;
+        }
+    } else {
+        // Both snapshots are sorted by pid, so one merge pass pairs them up
+        double elapsed = (now.tv_sec - lastSample.tv_sec) + (now.tv_nsec - lastSample.tv_nsec) / 1e9;
+        auto prev = previous.begin();
+        for (ProcessInfo& info : current) {
+            while (prev != previous.end() && prev->pid < info.pid) {
+                ++prev;
+            }
+            // A matching start time tells a reused pid apart from the same process
+            unsigned long long base = 0;
+            if (prev != previous.end() && prev->pid == info.pid && prev->startTicks == info.startTicks) {
+                base = prev->cpuTicks;
+            }
+            double ticks = info.cpuTicks >= base ? static_cast<double>(info.cpuTicks - base) : 0;
+            info.cpuPercent = elapsed > 0 ? 100.0 * ticks / ticksPerSecond / elapsed : 0;
+        }
+    }
+    lastSample = now;
+
+    markOurs();
+    return true;
+}
+
+size_t ProcessTable::maxOpenFds() const {
+    // Leave nearly all descriptors to the server, the event bus, pipelines and other sessions;
+    // processes past the cap are read by path, which only costs a path walk each
+    const size_t cap = 256;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return cap;
+    }
+    return std::min<size_t>(cap, limit.rlim_cur / 8);
+}
+
+int ProcessTable::readProcess(pid_t pid, int fd, ProcessInfo& info) {
+    // Reading an open stat file again regenerates it, which saves the /proc path walk
+    char buffer[1024];
+    ssize_t n = -1;
+    if (fd >= 0) {
+        n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+        if (n <= 0) {
+            close(fd);  // The process we opened is gone; the pid may belong to a new one
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        char path[32];
+        snprintf(path, sizeof(path), "%d/stat", pid);
+        fd = openat(dirfd(proc), path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return -1;  // Exited since readdir
+        }
+        n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    }
+    if (n <= 0) {
+        close(fd);
+        return -1;
+    }
+    buffer[n] = '\0';
+
+    // "pid (comm) state ppid ..."; comm may itself contain spaces and parentheses
+    char* nameStart = strchr(buffer, '(');
+    char* nameEnd = strrchr(buffer, ')');
+    if (nameStart == nullptr || nameEnd == nullptr || nameEnd < nameStart || nameEnd[1] == '\0') {
+        return fd;
+    }
+    size_t nameLength = std::min<size_t>(nameEnd - nameStart - 1, sizeof(info.name) - 1);
+    memcpy(info.name, nameStart + 1, nameLength);
+    info.name[nameLength] = '\0';
+    info.pid = pid;
+
+    // Fields after comm, numbered as in proc(5): 3 state, 4 ppid, 14 utime, 15 stime, 22 starttime, 24 rss
+    char* p = nameEnd + 2;
+    info.state = *p++;
+    unsigned long long utime = 0, stime = 0;
+    for (int field = 4; field <= 24 && *p != '\0'; ++field) {
+        unsigned long long value = strtoull(p, &p, 10);
+        switch (field) {
+        case 4: info.ppid = static_cast<pid_t>(value); break;
+        case 14: utime = value; break;
+        case 15: stime = value; break;
+        case 22: info.startTicks = value; break;
+        case 24: info.rssKb = static_cast<long>(value) * pageKb; break;
+        default: break;
+        }
+    }
+    info.cpuTicks = utime + stime;
+    return fd;
+}
+
+void ProcessTable::markOurs() {
+    // Walk each parent chain up to us or to a process already known either way
+    pid_t self = getpid();
+    known.assign(current.size(), -1);
+    auto indexOf = [this](pid_t pid) -> long {
+        auto it = std::lower_bound(current.begin(), current.end(), pid,
+                                   [](const ProcessInfo& info, pid_t value) { return info.pid < value; });
+        return it != current.end() && it->pid == pid ? it - current.begin() : -1;
+    };
+
+    ours = 0;
+    for (size_t i = 0; i < current.size(); ++i) {
+        chain.clear();
+        long at = static_cast<long>(i);
+        signed char result = 0;
+        while (at >= 0) {
+            if (known[at] >= 0) {
+                result = known[at];
+                break;
+            }
+            if (current[at].pid == self) {
+                result = 1;
+                chain.push_back(at);
+                break;
+            }
+            chain.push_back(at);
+            if (chain.size() > current.size()) {
+                break;  // Defensive: a pid loop from a racy snapshot
+            }
+            at = current[at].ppid > 0 ? indexOf(current[at].ppid) : -1;
+        }
+        for (size_t index : chain) {
+            known[index] = result;
+        }
+    }
+    for (size_t i = 0; i < current.size(); ++i) {
+        current[i].ours = known[i] == 1;
+        ours += current[i].ours;
+    }
+}
+
+double ProcessTable::uptimeSeconds() const {
+    int fd = open("/proc/uptime", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    char buffer[64];
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buffer[n] = '\0';
+    return strtod(buffer, nullptr);
+}
@@ -0,0 +1,71 @@
+// proctable.h; Sampled view of the host process table for ps and top
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PROCTABLE_H
+#define PROCTABLE_H
+
+#include <dirent.h>
+#include <sys/types.h>
+#include <ctime>
+#include <utility>
+#include <vector>
+
+struct ProcessInfo {
+    pid_t pid = 0;
+    pid_t ppid = 0;
+    char state = '?';
+    char name[17] = {};               // comm, at most 16 characters
+    unsigned long long cpuTicks = 0;  // utime + stime
+    unsigned long long startTicks = 0;
+    long rssKb = 0;
+    double cpuPercent = 0;            // since the previous sample, or over the lifetime on the first
+    bool ours = false;                // this Lunix process or one of its descendants
+};
+
+/*
+ * Snapshot of /proc that is cheap enough to refresh every second.
+ * Only /proc/<pid>/stat is read for each process, into a fixed buffer. The stat files
+ * stay open between refreshes (at most 256, and an eighth of the fd limit) and are
+ * re-read with pread, so a refresh is one getdents pass plus one read per process,
+ * and the directory stream and snapshot vectors are reused so nothing is allocated
+ * once warmed up.
+ * CPU% comes from diffing the tick counters of successive snapshots.
+ */
+class ProcessTable {
+public:
+    ProcessTable();
+    ~ProcessTable();
+
+    ProcessTable(const ProcessTable&) = delete;
+    ProcessTable& operator=(const ProcessTable&) = delete;
+
+    // Takes a new snapshot. Returns false if /proc can't be read.
+    bool refresh();
+
+    // Sorted by pid
+    const std::vector<ProcessInfo>& processes() const { return current; }
+    size_t oursCount() const { return ours; }
+
+private:
+    // Fills info from the stat file open as fd (or opens it if fd < 0). Returns the fd to keep, or -1.
+    // info.pid stays 0 if the process is gone.
+    int readProcess(pid_t pid, int fd, ProcessInfo& info);
+    size_t maxOpenFds() const;
+    void markOurs();
+    double uptimeSeconds() const;
+
+    DIR* proc = nullptr;
+    std::vector<ProcessInfo> current;
+    std::vector<ProcessInfo> previous;
+    std::vector<pid_t> pids;
+    std::vector<std::pair<pid_t, int>> statFds;  // Open /proc/<pid>/stat files, sorted by pid
+    std::vector<std::pair<pid_t, int>> nextStatFds;
+    std::vector<signed char> known;  // markOurs scratch: -1 unknown, 0 no, 1 yes
+    std::vector<size_t> chain;
+    struct timespec lastSample = {0, 0};
+    size_t ours = 0;
+    long ticksPerSecond;
+    long pageKb;
+};
+
+#endif // PROCTABLE_H
@@ -0,0 +1,331 @@
+// resources.cpp; Resource limits for the programs and modules Lunix launches
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "resources.h"
+#include "../disk/disk.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern disk Disk;
+
+namespace {
+
+// The cgroup controllers launches can be limited with
+const char* const wantedControllers[] = {"memory", "cpu", "pids"};
+
+bool parseCount(const std::string& text, uint64_t& value, uint64_t multiplier = 1) {
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos || text.size() > 15) {
+        return false;
+    }
+    value = std::stoull(text) * multiplier;
+    return value > 0;
+}
+
+bool parseSize(std::string text, uint64_t& bytes) {
+    uint64_t multiplier = 1;
+    if (!text.empty()) {
+        switch (text.back()) {
+            case 'k': case 'K': multiplier = 1ULL << 10; break;
+            case 'm': case 'M': multiplier = 1ULL << 20; break;
+            case 'g': case 'G': multiplier = 1ULL << 30; break;
+        }
+        if (multiplier != 1) {
+            text.pop_back();
+        }
+    }
+    return parseCount(text, bytes, multiplier);
+}
+
+std::string formatSize(uint64_t bytes) {
+    const char* units[] = {"", "K", "M", "G"};
+    int unit = 0;
+    while (unit < 3 && bytes % 1024 == 0) {
+        bytes /= 1024;
+        unit++;
+    }
+    return std::to_string(bytes) + units[unit];
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+bool writeFile(const std::string& path, const std::string& text) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+    close(fd);
+    return ok;
+}
+
+// Where the kernel's cgroup v2 is mounted: the mount point of the unified hierarchy plus our path in it
+std::string ownCgroup() {
+    std::string relative;
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(self, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            relative = line.substr(3);
+        }
+    }
+    if (relative.empty()) {
+        return "";
+    }
+    // mountinfo: id parent major:minor root mountpoint options... - fstype source superoptions
+    std::ifstream mounts("/proc/self/mountinfo");
+    while (std::getline(mounts, line)) {
+        size_t separator = line.find(" - ");
+        if (separator == std::string::npos || line.compare(separator + 3, 8, "cgroup2 ") != 0) {
+            continue;
+        }
+        std::istringstream fields(line.substr(0, separator));
+        std::string id, parent, device, root, mountPoint;
+        fields >> id >> parent >> device >> root >> mountPoint;
+        if (root != "/" && relative.compare(0, root.size(), root) == 0) {
+            relative = relative.substr(root.size());
+        }
+        return relative == "/" ? mountPoint : mountPoint + relative;
+    }
+    return "";
+}
+
+}
+
+std::string ResourceLimits::describe() const {
+    std::string text;
+    auto add = [&text](const std::string& item) {
+        text += (text.empty() ? "" : " ") + item;
+    };
+    if (cpuSeconds != 0) {
+        add("cpu=" + std::to_string(cpuSeconds) + "s");
+    }
+    if (memoryBytes != 0) {
+        add("mem=" + formatSize(memoryBytes));
+    }
+    if (openFiles != 0) {
+        add("files=" + std::to_string(openFiles));
+    }
+    if (cpuPercent != 0) {
+        add("share=" + std::to_string(cpuPercent) + "%");
+    }
+    if (processes != 0) {
+        add("procs=" + std::to_string(processes));
+    }
+    return text.empty() ? "none" : text;
+}
+
+bool ResourceProfiles::parseLimit(const std::string& text, ResourceLimits& limits) {
+    size_t equals = text.find('=');
+    if (equals == std::string::npos) {
+        return false;
+    }
+    std::string key = text.substr(0, equals);
+    std::string value = text.substr(equals + 1);
+    uint64_t number;
+    if (key == "cpu") {
+        if (!value.empty() && value.back() == 's') {
+            value.pop_back();
+        }
+        if (!parseCount(value, number)) {
+            return false;
+        }
+        limits.cpuSeconds = number;
+    } else if (key == "mem") {
+        if (!parseSize(value, number)) {
+            return false;
+        }
+        limits.memoryBytes = number;
+    } else if (key == "files") {
+        if (!parseCount(value, number)) {
+            return false;
+        }
+        limits.openFiles = number;
+    } else if (key == "share") {
+        if (!value.empty() && value.back() == '%') {
+            value.pop_back();
+        }
+        if (!parseCount(value, number) || number > 100000) {
+            return false;
+        }
+        limits.cpuPercent = static_cast<unsigned>(number);
+    } else if (key == "procs") {
+        if (!parseCount(value, number)) {
+            return false;
+        }
+        limits.processes = number;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ResourceLimits ResourceProfiles::lookup(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reload();
+    const std::string group = name.compare(0, 7, "module:") == 0 ? "modules" : "programs";
+    ResourceLimits limits;
+    for (const std::string& who : {std::string("default"), group, name}) {
+        for (const Profile& profile : profiles) {
+            if (profile.who != who) {
+                continue;
+            }
+            const ResourceLimits& set = profile.limits;
+            limits.cpuSeconds = set.cpuSeconds ? set.cpuSeconds : limits.cpuSeconds;
+            limits.memoryBytes = set.memoryBytes ? set.memoryBytes : limits.memoryBytes;
+            limits.openFiles = set.openFiles ? set.openFiles : limits.openFiles;
+            limits.cpuPercent = set.cpuPercent ? set.cpuPercent : limits.cpuPercent;
+            limits.processes = set.processes ? set.processes : limits.processes;
+        }
+    }
+    return limits;
+}
+
+void ResourceProfiles::reload() {
+    std::string path = Disk.rootfsPath() + "/.limits";
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        profiles.clear();
+        loaded = {0, 0};
+        return;
+    }
+    if (st.st_mtim.tv_sec == loaded.tv_sec && st.st_mtim.tv_nsec == loaded.tv_nsec) {
+        return;
+    }
+    loaded = st.st_mtim;
+    profiles.clear();
+
+    std::ifstream file(path);
+    std::string line;
+    int number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        std::istringstream words(line);
+        Profile profile;
+        if (!(words >> profile.who) || profile.who[0] == '#') {
+            continue;
+        }
+        std::string word;
+        while (words >> word) {
+            if (!parseLimit(word, profile.limits)) {
+                std::cerr << ".limits:" << number << ": ignoring '" << word << "'\n";
+            }
+        }
+        profiles.push_back(profile);
+    }
+}
+
+ResourceProfiles& resourceProfiles() {
+    static ResourceProfiles profiles;
+    return profiles;
+}
+
+bool CgroupDelegate::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!initialized) {
+        initialized = true;
+        setup();
+    }
+    return !root.empty();
+}
+
+std::string CgroupDelegate::describe() {
+    if (!available()) {
+        return "none (" + problem + ")";
+    }
+    return root + " (" + controllers + ")";
+}
+
+void CgroupDelegate::setup() {
+    std::string dir = ownCgroup();
+    if (dir.empty()) {
+        problem = "no cgroup v2 hierarchy";
+        return;
+    }
+    if (access(dir.c_str(), W_OK) != 0 || access((dir + "/cgroup.subtree_control").c_str(), W_OK) != 0) {
+        problem = dir + " is not delegated to Lunix";
+        return;
+    }
+    // Processes may only live in leaves of a cgroup that limits its children
+    std::string leaf = dir + "/kernel";
+    if ((mkdir(leaf.c_str(), 0755) != 0 && errno != EEXIST) || !writeFile(leaf + "/cgroup.procs", std::to_string(getpid()))) {
+        problem = "can't move into " + leaf + ": " + strerror(errno);
+        return;
+    }
+
+    std::string offered = " " + readFile(dir + "/cgroup.controllers");
+    for (char& c : offered) {
+        c = c == '\n' ? ' ' : c;
+    }
+    std::string enabled;
+    for (const char* controller : wantedControllers) {
+        if (offered.find(" " + std::string(controller) + " ") == std::string::npos) {
+            continue;
+        }
+        if (writeFile(dir + "/cgroup.subtree_control", "+" + std::string(controller))) {
+            enabled += (enabled.empty() ? "" : " ") + std::string(controller);
+        }
+    }
+    if (enabled.empty()) {
+        problem = "no memory, cpu or pids controller in " + dir;
+        return;
+    }
+    root = dir;
+    controllers = enabled;
+}
+
+int CgroupDelegate::create(const std::string& name, const ResourceLimits& limits, std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (root.empty()) {
+        return -1;
+    }
+    std::string safe = name;
+    for (char& c : safe) {
+        c = c == ':' || c == '/' ? '-' : c;
+    }
+    path = root + "/" + safe + "." + std::to_string(++launches);
+    if (mkdir(path.c_str(), 0755) != 0) {
+        path.clear();
+        return -1;
+    }
+    auto has = [this](const char* controller) {
+        return (" " + controllers + " ").find(" " + std::string(controller) + " ") != std::string::npos;
+    };
+    if (limits.memoryBytes != 0 && has("memory")) {
+        writeFile(path + "/memory.max", std::to_string(limits.memoryBytes));
+    }
+    if (limits.cpuPercent != 0 && has("cpu")) {
+        writeFile(path + "/cpu.max", std::to_string(limits.cpuPercent * 1000ULL) + " 100000");
+    }
+    if (limits.processes != 0 && has("pids")) {
+        writeFile(path + "/pids.max", std::to_string(limits.processes));
+    }
+    int fd = open((path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        rmdir(path.c_str());
+        path.clear();
+    }
+    return fd;
+}
+
+void CgroupDelegate::remove(const std::string& path) {
+    // Empty once its process is reaped: exiting processes leave their cgroup before that
+    rmdir(path.c_str());
+}
+
+CgroupDelegate& cgroups() {
+    static CgroupDelegate delegate;
+    return delegate;
+}
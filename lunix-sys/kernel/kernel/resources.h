@@ -0,0 +1,90 @@
+// resources.h; Resource limits for the programs and modules Lunix launches
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// What one launch may use; 0 leaves a resource unlimited
+struct ResourceLimits {
+    uint64_t cpuSeconds = 0;   // RLIMIT_CPU: SIGXCPU at the limit, SIGKILL a second later
+    uint64_t memoryBytes = 0;  // RLIMIT_AS, and memory.max in a cgroup
+    uint64_t openFiles = 0;    // RLIMIT_NOFILE
+    unsigned cpuPercent = 0;   // cpu.max, of one core; cgroup only
+    uint64_t processes = 0;    // pids.max; cgroup only
+
+    bool any() const { return cpuSeconds || memoryBytes || openFiles || cpuPercent || processes; }
+    bool needsCgroup() const { return memoryBytes || cpuPercent || processes; }
+    // "cpu=10s mem=256M", or "none"
+    std::string describe() const;
+};
+
+/*
+ * Resource profiles from rootfs/.limits, one per line:
+ *     <who> <limit>=<value>...
+ * where who is default, modules, programs, module:<name> or a program's file name, and
+ * the limits are cpu=<seconds>, mem=<bytes, K/M/G suffixes>, files=<count>,
+ * share=<percent of a core> and procs=<count>. A launch gets default, then modules or
+ * programs, then its own line, each overriding the limits it sets. The file is read
+ * again when it changes.
+ */
+class ResourceProfiles {
+public:
+    // name is module:<name> for modules, else the program's file name
+    ResourceLimits lookup(const std::string& name);
+
+    static bool parseLimit(const std::string& text, ResourceLimits& limits);
+
+private:
+    struct Profile {
+        std::string who;
+        ResourceLimits limits;
+    };
+
+    void reload();
+
+    std::mutex mutex;
+    std::vector<Profile> profiles;
+    struct timespec loaded = {0, 0};  // mtime of the file profiles came from
+};
+
+ResourceProfiles& resourceProfiles();
+
+/*
+ * cgroup v2 subtree delegated to Lunix, if there is one: the kernel's own cgroup when
+ * it is writable (e.g. under systemd-run --user -p Delegate=yes). Because cgroups with
+ * controllers enabled for their children may not hold processes, the kernel first
+ * moves itself into a "kernel" leaf; each limited launch then gets a cgroup of its own
+ * next to it, removed once the process is reaped.
+ */
+class CgroupDelegate {
+public:
+    // Sets up the delegation on first use; false if there is none
+    bool available();
+    // The delegated cgroup and its controllers, or why there is none
+    std::string describe();
+
+    // Creates a cgroup for one launch and opens its cgroup.procs for the child to
+    // join by writing "0". Returns the fd, or -1 if no cgroup could be made.
+    int create(const std::string& name, const ResourceLimits& limits, std::string& path);
+    void remove(const std::string& path);
+
+private:
+    void setup();
+
+    std::mutex mutex;
+    bool initialized = false;
+    std::string root;         // Directory of the delegated cgroup; empty if none
+    std::string controllers;  // Enabled for launches, space separated
+    std::string problem;      // Why there is no delegation
+    uint64_t launches = 0;
+};
+
+CgroupDelegate& cgroups();
+
+#endif // RESOURCES_H
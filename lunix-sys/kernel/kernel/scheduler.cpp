@@ -0,0 +1,396 @@
+// scheduler.cpp; Work-stealing scheduler for in-kernel tasks and coroutines
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+thread_local Scheduler* currentScheduler = nullptr;
+thread_local void* currentWorker = nullptr;
+
+uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+detail::Detached runDetached(Task<void> task) {
+    co_await task;
+}
+
+detail::Detached runJob(std::function<void()> job) {
+    job();
+    co_return;
+}
+
+Task<void> jobTask(std::function<void()> job) {
+    job();
+    co_return;
+}
+
+}
+
+void detail::Detached::promise_type::unhandled_exception() noexcept {
+    try {
+        throw;
+    } catch (const std::exception& e) {
+        std::cerr << "sched: task failed: " << e.what() << "\n";
+    } catch (...) {
+        std::cerr << "sched: task failed\n";
+    }
+}
+
+WorkDeque::WorkDeque(size_t capacity) {
+    rings.push_back(std::make_unique<Ring>(capacity));
+    ring.store(rings.back().get(), std::memory_order_relaxed);
+}
+
+WorkDeque::~WorkDeque() = default;
+
+// The orderings follow Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models"
+void WorkDeque::push(std::coroutine_handle<> handle) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Ring* r = ring.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(r->capacity()) - 1) {
+        auto bigger = std::make_unique<Ring>(r->capacity() * 2);
+        for (int64_t i = t; i < b; ++i) {
+            bigger->put(i, r->get(i));
+        }
+        r = bigger.get();
+        rings.push_back(std::move(bigger));
+        ring.store(r, std::memory_order_release);
+    }
+    r->put(b, handle.address());
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+std::coroutine_handle<> WorkDeque::take() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Ring* r = ring.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    void* item = r->get(b);
+    if (t == b) {
+        // The last item: race the thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            item = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return std::coroutine_handle<>::from_address(item);
+}
+
+std::coroutine_handle<> WorkDeque::steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return nullptr;
+    }
+    Ring* r = ring.load(std::memory_order_acquire);
+    void* item = r->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return std::coroutine_handle<>::from_address(item);
+}
+
+size_t WorkDeque::size() const {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+}
+
+Scheduler::Scheduler(size_t count) : started(std::chrono::steady_clock::now()) {
+    if (count == 0) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < count; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+        workers.back()->random = 0x9e3779b97f4a7c15ULL * (i + 1);
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;  // Never a coroutine
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    for (size_t i = 0; i < count; ++i) {
+        workers[i]->thread = std::thread(&Scheduler::workerLoop, this, i);
+    }
+    reactor = std::thread(&Scheduler::reactorLoop, this);
+}
+
+Scheduler::~Scheduler() {
+    stopping = true;
+    epoch.fetch_add(1);
+    epoch.notify_all();
+    uint64_t one = 1;
+    write(wakeFd, &one, sizeof(one));
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+    reactor.join();
+    close(wakeFd);
+    close(epollFd);
+}
+
+void Scheduler::post(std::coroutine_handle<> handle) {
+    if (currentScheduler == this && currentWorker != nullptr) {
+        static_cast<Worker*>(currentWorker)->deque.push(handle);
+    } else {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        shared.push_back(handle);
+        sharedSize.fetch_add(1, std::memory_order_relaxed);
+        posted.fetch_add(1, std::memory_order_relaxed);
+    }
+    wake();
+}
+
+void Scheduler::wake() {
+    // Pairs with the check in workerLoop: either the worker sees the new epoch, or we see it sleeping
+    epoch.fetch_add(1);
+    if (sleeping.load() > 0) {
+        epoch.notify_one();
+    }
+}
+
+void Scheduler::spawn(Task<void> task) {
+    post(runDetached(std::move(task)).handle);
+}
+
+void Scheduler::spawn(std::function<void()> job) {
+    post(runJob(std::move(job)).handle);
+}
+
+Scheduler::IoAwaiter Scheduler::readable(int fd) {
+    return {*this, fd, EPOLLIN | EPOLLRDHUP};
+}
+
+Scheduler::IoAwaiter Scheduler::writable(int fd) {
+    return {*this, fd, EPOLLOUT};
+}
+
+bool Scheduler::onWorker() const {
+    return currentScheduler == this && currentWorker != nullptr;
+}
+
+bool Scheduler::runOne() {
+    if (!onWorker()) {
+        return false;
+    }
+    Worker& worker = *static_cast<Worker*>(currentWorker);
+    std::coroutine_handle<> handle = findWork(worker);
+    if (!handle) {
+        return false;
+    }
+    run(worker, handle);
+    return true;
+}
+
+std::coroutine_handle<> Scheduler::findWork(Worker& worker) {
+    if (std::coroutine_handle<> handle = worker.deque.take()) {
+        return handle;
+    }
+    if (sharedSize.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (!shared.empty()) {
+            std::coroutine_handle<> handle = shared.front();
+            shared.pop_front();
+            sharedSize.fetch_sub(1, std::memory_order_relaxed);
+            return handle;
+        }
+    }
+
+    // Steal, starting from a random victim so thieves spread out
+    size_t n = workers.size();
+    if (n < 2) {
+        return nullptr;
+    }
+    worker.random ^= worker.random << 13;
+    worker.random ^= worker.random >> 7;
+    worker.random ^= worker.random << 17;
+    size_t start = worker.random % n;
+    for (size_t i = 0; i < n; ++i) {
+        Worker& victim = *workers[(start + i) % n];
+        if (&victim == &worker) {
+            continue;
+        }
+        worker.stealAttempts.fetch_add(1, std::memory_order_relaxed);
+        if (std::coroutine_handle<> handle = victim.deque.steal()) {
+            worker.steals.fetch_add(1, std::memory_order_relaxed);
+            return handle;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::run(Worker& worker, std::coroutine_handle<> handle) {
+    auto start = std::chrono::steady_clock::now();
+    handle.resume();
+    worker.busyNs.fetch_add(nanosecondsSince(start), std::memory_order_relaxed);
+    worker.executed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Scheduler::workerLoop(size_t index) {
+    Worker& worker = *workers[index];
+    currentScheduler = this;
+    currentWorker = &worker;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        if (std::coroutine_handle<> handle = findWork(worker)) {
+            run(worker, handle);
+            continue;
+        }
+        // Look once more after reading the epoch, then sleep unless something was posted since
+        uint32_t seen = epoch.load();
+        if (std::coroutine_handle<> handle = findWork(worker)) {
+            run(worker, handle);
+            continue;
+        }
+        sleeping.fetch_add(1);
+        if (!stopping && epoch.load() == seen) {
+            worker.parks.fetch_add(1, std::memory_order_relaxed);
+            epoch.wait(seen);
+        }
+        sleeping.fetch_sub(1);
+    }
+}
+
+void Scheduler::watch(int fd, uint32_t events, std::coroutine_handle<> handle) {
+    ioWaits.fetch_add(1, std::memory_order_relaxed);
+    ioWaiting.fetch_add(1, std::memory_order_relaxed);
+    struct epoll_event event = {};
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = handle.address();
+    // The fd stays registered (but disarmed) after it fires, so usually it only needs re-arming.
+    // Once this succeeds the coroutine may already be running elsewhere: touch nothing of it.
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == 0) {
+        return;
+    }
+    if (errno == ENOENT && epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0) {
+        return;
+    }
+    // Not pollable (a regular file) or closed: let the coroutine find out from its read
+    ioWaiting.fetch_sub(1, std::memory_order_relaxed);
+    post(handle);
+}
+
+void Scheduler::reactorLoop() {
+    struct epoll_event events[128];
+    while (!stopping) {
+        int n = epoll_wait(epollFd, events, 128, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t count;
+                read(wakeFd, &count, sizeof(count));
+                continue;
+            }
+            ioWaiting.fetch_sub(1, std::memory_order_relaxed);
+            post(std::coroutine_handle<>::from_address(events[i].data.ptr));
+        }
+    }
+}
+
+Scheduler::Stats Scheduler::stats() {
+    Stats stats;
+    uint64_t uptimeNs = std::max<uint64_t>(1, nanosecondsSince(started));
+    stats.uptime = uptimeNs / 1e9;
+    for (const auto& worker : workers) {
+        WorkerStats w;
+        w.executed = worker->executed.load(std::memory_order_relaxed);
+        w.steals = worker->steals.load(std::memory_order_relaxed);
+        w.stealAttempts = worker->stealAttempts.load(std::memory_order_relaxed);
+        w.parks = worker->parks.load(std::memory_order_relaxed);
+        w.queued = worker->deque.size();
+        w.busy = static_cast<double>(worker->busyNs.load(std::memory_order_relaxed)) / uptimeNs;
+        stats.workers.push_back(w);
+    }
+    stats.posted = posted.load(std::memory_order_relaxed);
+    stats.sharedQueued = sharedSize.load(std::memory_order_relaxed);
+    stats.ioWaits = ioWaits.load(std::memory_order_relaxed);
+    stats.ioWaiting = ioWaiting.load(std::memory_order_relaxed);
+    return stats;
+}
+
+Scheduler& scheduler() {
+    // Never destroyed: coroutines may still be waiting on sockets at exit, and static
+    // objects (the LISP server) stop their tasks from their destructors
+    static Scheduler* instance = new Scheduler();
+    return *instance;
+}
+
+TaskGroup::TaskGroup(Scheduler& scheduler) : owner(scheduler) {}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::spawn(Task<void> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+    }
+    owner.post(track(std::move(task)).handle);
+}
+
+void TaskGroup::spawn(std::function<void()> job) {
+    spawn(jobTask(std::move(job)));
+}
+
+detail::Detached TaskGroup::track(Task<void> task) {
+    try {
+        co_await task;
+    } catch (const std::exception& e) {
+        std::cerr << "sched: task failed: " << e.what() << "\n";
+    } catch (...) {
+        std::cerr << "sched: task failed\n";
+    }
+    finish();
+}
+
+void TaskGroup::finish() {
+    // Notify under the lock: once pending reaches 0 the waiter may destroy the group
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0) {
+        done.notify_all();
+    }
+}
+
+void TaskGroup::wait() {
+    if (owner.onWorker()) {
+        // Blocking here could leave no worker to run what we wait for
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (pending == 0) {
+                    return;
+                }
+            }
+            if (!owner.runOne()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+}
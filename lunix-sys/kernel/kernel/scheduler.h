@@ -0,0 +1,326 @@
+// scheduler.h; Work-stealing scheduler for in-kernel tasks and coroutines
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ * Chase-Lev work-stealing deque of coroutine handles. The worker that owns it pushes
+ * and takes at the bottom without locking; other workers steal from the top with a
+ * single compare-and-swap. The ring doubles when it fills up; replaced rings are kept
+ * until the deque is destroyed, since a thief may still be reading from one.
+ */
+class WorkDeque {
+public:
+    explicit WorkDeque(size_t capacity = 256);
+    ~WorkDeque();
+
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    void push(std::coroutine_handle<> handle);  // Owner only
+    std::coroutine_handle<> take();             // Owner only; null when empty
+    std::coroutine_handle<> steal();            // Any thread; null when empty or another thief won
+    size_t size() const;
+
+private:
+    struct Ring {
+        explicit Ring(size_t capacity) : mask(capacity - 1), slots(new std::atomic<void*>[capacity]) {}
+        size_t capacity() const { return mask + 1; }
+        void* get(int64_t index) const { return slots[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, void* value) { slots[index & mask].store(value, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<void*>[]> slots;
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Ring*> ring;
+    std::vector<std::unique_ptr<Ring>> rings;  // Every ring ever used, owner only
+};
+
+namespace detail {
+
+struct TaskPromiseBase {
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            std::coroutine_handle<> continuation = self.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+};
+
+// Fire-and-forget coroutine: starts when posted, frees itself when done
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept;
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+}
+
+/*
+ * Lazily started coroutine returning T. co_await on a Task runs it on the awaiting
+ * thread and resumes the awaiter when it finishes (or rethrows what it threw); to run
+ * one concurrently, hand it to Scheduler::spawn or a TaskGroup.
+ */
+template <typename T = void>
+class Task {
+public:
+    struct promise_type : detail::TaskPromiseBase {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        template <typename U>
+        void return_value(U&& value) { result.emplace(std::forward<U>(value)); }
+
+        std::optional<T> result;
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    T await_resume() {
+        if (handle.promise().exception) {
+            std::rethrow_exception(handle.promise().exception);
+        }
+        return std::move(*handle.promise().result);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class Task<void> {
+public:
+    struct promise_type : detail::TaskPromiseBase {
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() noexcept {}
+    };
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    void await_resume() {
+        if (handle.promise().exception) {
+            std::rethrow_exception(handle.promise().exception);
+        }
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/*
+ * M:N scheduler: coroutines and small jobs run on one worker thread per core. Each
+ * worker keeps its own WorkDeque, so work a task creates stays on that worker's cache
+ * until an idle worker steals it; work posted from other threads goes through a shared
+ * queue. Idle workers sleep on a futex and are woken only when work arrives.
+ * A reactor thread watches sockets with epoll and resumes the coroutines waiting on
+ * them, so a connection costs a coroutine frame instead of a thread.
+ * Tasks must not block for long (on locks, sleep or blocking I/O): that stalls a
+ * worker. Long blocking work, such as an lsh session, belongs on a thread of its own.
+ */
+class Scheduler {
+public:
+    struct WorkerStats {
+        uint64_t executed = 0;
+        uint64_t steals = 0;
+        uint64_t stealAttempts = 0;
+        uint64_t parks = 0;
+        size_t queued = 0;
+        double busy = 0;  // Fraction of the time since start spent running tasks
+    };
+
+    struct Stats {
+        std::vector<WorkerStats> workers;
+        uint64_t posted = 0;  // From threads that aren't workers
+        size_t sharedQueued = 0;
+        uint64_t ioWaits = 0;
+        size_t ioWaiting = 0;
+        double uptime = 0;
+    };
+
+    // co_await schedule(): continue on a worker
+    struct ScheduleAwaiter {
+        Scheduler& scheduler;
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { scheduler.post(handle); }
+        void await_resume() noexcept {}
+    };
+
+    // co_await readable(fd) / writable(fd): continue on a worker once fd is ready (or failed)
+    struct IoAwaiter {
+        Scheduler& scheduler;
+        int fd;
+        uint32_t events;
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { scheduler.watch(fd, events, handle); }
+        void await_resume() noexcept {}
+    };
+
+    explicit Scheduler(size_t workers = 0);  // 0: one per core
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Resume handle on a worker: this worker's deque when called from one, else the shared queue
+    void post(std::coroutine_handle<> handle);
+    // Run a task or job to completion in the background; exceptions are logged
+    void spawn(Task<void> task);
+    void spawn(std::function<void()> job);
+
+    ScheduleAwaiter schedule() { return {*this}; }
+    // One coroutine may wait on an fd at a time
+    IoAwaiter readable(int fd);
+    IoAwaiter writable(int fd);
+
+    // True on one of this scheduler's workers
+    bool onWorker() const;
+    // Runs one queued task on the calling worker; false if there was none
+    bool runOne();
+
+    size_t size() const { return workers.size(); }
+    Stats stats();
+
+private:
+    struct Worker {
+        WorkDeque deque;
+        std::thread thread;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> steals{0};
+        std::atomic<uint64_t> stealAttempts{0};
+        std::atomic<uint64_t> parks{0};
+        std::atomic<uint64_t> busyNs{0};
+        uint64_t random = 0;  // xorshift state for picking victims
+    };
+
+    void workerLoop(size_t index);
+    std::coroutine_handle<> findWork(Worker& worker);
+    void run(Worker& worker, std::coroutine_handle<> handle);
+    void wake();
+    void watch(int fd, uint32_t events, std::coroutine_handle<> handle);
+    void reactorLoop();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex sharedMutex;
+    std::deque<std::coroutine_handle<>> shared;
+    std::atomic<size_t> sharedSize{0};
+    std::atomic<uint64_t> posted{0};
+
+    // Parking: a worker sleeps only if no work was posted since it last looked
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> sleeping{0};
+    std::atomic<bool> stopping{false};
+
+    int epollFd = -1;
+    int wakeFd = -1;
+    std::thread reactor;
+    std::atomic<uint64_t> ioWaits{0};
+    std::atomic<size_t> ioWaiting{0};
+
+    std::chrono::steady_clock::time_point started;
+};
+
+// The kernel's scheduler, started on first use
+Scheduler& scheduler();
+
+/*
+ * Tasks and jobs spawned together and waited for together. wait() blocks the calling
+ * thread; called on a worker, it runs queued tasks while it waits instead.
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(Scheduler& scheduler = ::scheduler());
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void spawn(Task<void> task);
+    void spawn(std::function<void()> job);
+    void wait();
+
+private:
+    detail::Detached track(Task<void> task);
+    void finish();
+
+    Scheduler& owner;
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+};
+
+#endif // SCHEDULER_H
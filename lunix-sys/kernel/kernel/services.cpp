@@ -0,0 +1,367 @@
+// services.cpp; Service manager: runlevel-driven, health-checked, restarted on failure
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "services.h"
+#include "boot.h"
+#include "klog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+
+#include "../color.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::chrono::seconds healthInterval(1);
+const std::chrono::seconds maxBackoff(60);
+const std::chrono::seconds stableAfter(60);  // Up this long, a service's failures are forgiven
+
+bool belongs(const ServiceManager::Service& service, int runlevel) {
+    return std::find(service.runlevels.begin(), service.runlevels.end(), runlevel) != service.runlevels.end();
+}
+
+double secondsUntil(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+}
+
+void ServiceManager::add(Service service) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = std::make_unique<Entry>();
+    entry->service = std::move(service);
+    entries.push_back(std::move(entry));
+}
+
+ServiceManager::Entry* ServiceManager::find(const std::string& name) {
+    for (const auto& entry : entries) {
+        if (entry->service.name == name) {
+            return entry.get();
+        }
+    }
+    return nullptr;
+}
+
+std::vector<ServiceManager::Entry*> ServiceManager::ordered() {
+    // Kahn's algorithm; dependencies on unknown services are ignored, and services
+    // caught in a cycle go last, in the order they were added
+    std::unordered_map<std::string, size_t> byName;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        byName[entries[i]->service.name] = i;
+    }
+    std::vector<size_t> waiting(entries.size(), 0);
+    std::vector<std::vector<size_t>> dependants(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        for (const std::string& dependency : entries[i]->service.after) {
+            auto it = byName.find(dependency);
+            if (it != byName.end()) {
+                waiting[i]++;
+                dependants[it->second].push_back(i);
+            }
+        }
+    }
+    std::vector<Entry*> out;
+    std::vector<bool> placed(entries.size(), false);
+    for (size_t pass = 0; pass < entries.size(); ++pass) {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!placed[i] && waiting[i] == 0) {
+                placed[i] = true;
+                out.push_back(entries[i].get());
+                for (size_t dependant : dependants[i]) {
+                    waiting[dependant]--;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!placed[i]) {
+            out.push_back(entries[i].get());
+        }
+    }
+    return out;
+}
+
+int ServiceManager::enter(int runlevel, std::ostream& console) {
+    std::vector<Entry*> toStop;
+    std::vector<Entry*> toStart;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (shuttingDown) {
+            return 0;
+        }
+        for (Entry* entry : ordered()) {
+            entry->wanted = belongs(entry->service, runlevel);
+            if (!entry->wanted && entry->state != Stopped) {
+                toStop.push_back(entry);
+            } else if (entry->wanted && entry->state != Running && entry->state != Starting) {
+                toStart.push_back(entry);
+            }
+        }
+    }
+
+    for (auto it = toStop.rbegin(); it != toStop.rend(); ++it) {
+        if (stopEntry(**it) == 0) {
+            console << "[  " << ANSIColors::GREEN << "OK" << ANSIColors::RESET << "  ] Stopped " << (*it)->service.description << "\n";
+        }
+    }
+    if (toStart.empty()) {
+        return 0;
+    }
+
+    // Services this runlevel starts wait for the ones they come after; those already up don't hold them back
+    BootGraph graph;
+    for (Entry* entry : toStart) {
+        std::vector<std::string> after;
+        for (const std::string& dependency : entry->service.after) {
+            auto starting = [&dependency](const Entry* other) { return other->service.name == dependency; };
+            if (std::any_of(toStart.begin(), toStart.end(), starting)) {
+                after.push_back(dependency);
+            }
+        }
+        graph.add({entry->service.name, after, [this, entry] { return startEntry(*entry); }, true,
+                   "Started " + entry->service.description, "Failed to start " + entry->service.description});
+    }
+    return graph.run(console);
+}
+
+void ServiceManager::stopAll(std::ostream& console) {
+    std::vector<Entry*> all;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        shuttingDown = true;
+        all = ordered();
+        for (Entry* entry : all) {
+            entry->wanted = false;
+        }
+    }
+    for (auto it = all.rbegin(); it != all.rend(); ++it) {
+        Entry& entry = **it;
+        bool wasRunning;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wasRunning = entry.state == Running;
+        }
+        // A service still starting, or being cleaned up after a failure, gets a few seconds to settle
+        int result;
+        for (int tries = 0; (result = stopEntry(entry)) == EBUSY && tries < 500; ++tries) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (wasRunning && result == 0) {
+            console << "[  " << ANSIColors::GREEN << "OK" << ANSIColors::RESET << "  ] Stopped " << entry.service.description << "\n";
+        }
+    }
+}
+
+int ServiceManager::start(const std::string& name) {
+    Entry* entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry = find(name);
+        if (entry == nullptr) {
+            return ENOENT;
+        }
+        entry->wanted = true;
+        if (entry->state == Failed) {
+            entry->failures = 0;  // Asked for by hand: retry from the shortest backoff
+        }
+    }
+    return startEntry(*entry);
+}
+
+int ServiceManager::stop(const std::string& name) {
+    Entry* entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry = find(name);
+        if (entry == nullptr) {
+            return ENOENT;
+        }
+        entry->wanted = false;
+    }
+    return stopEntry(*entry);
+}
+
+int ServiceManager::startEntry(Entry& entry) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry.state == Running) {
+            return 0;
+        }
+        if (entry.state == Starting || entry.state == Stopping) {
+            return EBUSY;
+        }
+        if (shuttingDown) {
+            return ECANCELED;
+        }
+        entry.state = Starting;
+        timers().cancel(entry.retryTimer);
+        entry.retryTimer = 0;
+    }
+
+    int result = entry.service.start ? entry.service.start() : 0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (result != 0) {
+        const std::vector<int>& fatal = entry.service.fatal;
+        fail(entry, strerror(result), std::find(fatal.begin(), fatal.end(), result) == fatal.end());
+        return result;
+    }
+    if (shuttingDown) {
+        // stopAll() went past this service while it was starting
+        entry.state = Stopping;
+        lock.unlock();
+        if (entry.service.stop) {
+            entry.service.stop();
+        }
+        lock.lock();
+        entry.state = Stopped;
+        return ECANCELED;
+    }
+    entry.state = Running;
+    entry.since = Clock::now();
+    entry.problem.clear();
+    klog(LogLevel::Info, "services", "Started " + entry.service.name);
+    if (entry.service.health) {
+        Entry* watched = &entry;
+        entry.healthTimer = timers().every(healthInterval, [this, watched] { check(*watched); });
+    }
+    return 0;
+}
+
+int ServiceManager::stopEntry(Entry& entry) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry.state == Starting || entry.state == Stopping) {
+            return EBUSY;
+        }
+        timers().cancel(entry.healthTimer);
+        timers().cancel(entry.retryTimer);
+        entry.healthTimer = 0;
+        entry.retryTimer = 0;
+        if (entry.state != Running) {
+            entry.state = Stopped;  // A failed service was cleaned up when it failed
+            return 0;
+        }
+        entry.state = Stopping;
+    }
+    if (entry.service.stop) {
+        entry.service.stop();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    entry.state = Stopped;
+    entry.failures = 0;
+    klog(LogLevel::Info, "services", "Stopped " + entry.service.name);
+    return 0;
+}
+
+// Runs on the timer wheel, so it only looks; cleaning up happens on a thread of its own
+void ServiceManager::check(Entry& entry) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry.state != Running) {
+            return;
+        }
+    }
+    std::string problem = entry.service.health();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entry.state != Running) {
+        return;
+    }
+    if (problem.empty()) {
+        if (entry.failures != 0 && Clock::now() - entry.since >= stableAfter) {
+            entry.failures = 0;
+        }
+        return;
+    }
+    timers().cancel(entry.healthTimer);
+    entry.healthTimer = 0;
+    entry.state = Stopping;
+    entry.problem = problem;
+    Entry* failed = &entry;
+    std::thread([this, failed] {
+        if (failed->service.stop) {
+            failed->service.stop();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        fail(*failed, failed->problem);
+    }).detach();
+}
+
+void ServiceManager::fail(Entry& entry, const std::string& problem, bool retry) {
+    entry.state = Failed;
+    entry.problem = problem;
+    if (!retry) {
+        klog(LogLevel::Error, "services", entry.service.name + " failed (" + problem + "); not retrying");
+        return;
+    }
+    scheduleRetry(entry);
+}
+
+void ServiceManager::scheduleRetry(Entry& entry) {
+    if (!entry.wanted || shuttingDown) {
+        klog(LogLevel::Warning, "services", entry.service.name + " failed (" + entry.problem + ")");
+        return;
+    }
+    std::chrono::seconds delay = std::min<std::chrono::seconds>(std::chrono::seconds(1LL << std::min(entry.failures, 6u)), maxBackoff);
+    entry.failures++;
+    entry.retryAt = Clock::now() + delay;
+    klog(LogLevel::Warning, "services", entry.service.name + " failed (" + entry.problem + "); retrying in " +
+                                            std::to_string(delay.count()) + "s");
+    Entry* failed = &entry;
+    entry.retryTimer = timers().after(delay, [this, failed] {
+        // Starting may block (binding, forking), which a timer callback must not
+        std::thread([this, failed] {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (failed->state != Failed || !failed->wanted || shuttingDown) {
+                    return;
+                }
+                failed->restarts++;
+            }
+            startEntry(*failed);
+        }).detach();
+    });
+}
+
+std::vector<ServiceManager::Status> ServiceManager::status() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    std::vector<Status> out;
+    for (const auto& entry : entries) {
+        Status status;
+        status.name = entry->service.name;
+        status.description = entry->service.description;
+        status.runlevels = entry->service.runlevels;
+        status.state = entry->state;
+        status.uptime = entry->state == Running ? secondsUntil(entry->since, now) : 0;
+        status.restarts = entry->restarts;
+        if (entry->state == Failed && entry->retryTimer != 0) {
+            status.retryIn = std::max(0.0, secondsUntil(now, entry->retryAt));
+        }
+        status.problem = entry->problem;
+        out.push_back(status);
+    }
+    return out;
+}
+
+const char* ServiceManager::stateName(State state) {
+    switch (state) {
+        case Stopped: return "stopped";
+        case Starting: return "starting";
+        case Running: return "running";
+        case Failed: return "failed";
+        case Stopping: return "stopping";
+    }
+    return "?";
+}
+
+ServiceManager& services() {
+    static ServiceManager* manager = new ServiceManager();  // Never destroyed: timers point into it
+    return *manager;
+}
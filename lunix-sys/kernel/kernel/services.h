@@ -0,0 +1,101 @@
+// services.h; Service manager: runlevel-driven, health-checked, restarted on failure
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef SERVICES_H
+#define SERVICES_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "timer.h"
+
+/*
+ * Long-running parts of Lunix (the LISP server, the disk flusher, service modules)
+ * declare the runlevels they belong to. Entering a runlevel stops the services that
+ * don't belong to it, dependants first, and starts the ones that do in parallel, as
+ * their order allows (on a BootGraph, so start functions may block).
+ *
+ * A running service is health-checked every second on the timer wheel. A failed
+ * start or health check stops what is left of it and retries after 1s, doubling up to
+ * a minute; a service that then stays up for a minute is back to the 1s backoff. A start
+ * that fails with one of the service's fatal errors is not retried until started by hand.
+ * Only services that should be running (in the runlevel, or started by hand) are
+ * restarted, and none once stopAll() has begun.
+ */
+class ServiceManager {
+public:
+    enum State { Stopped, Starting, Running, Failed, Stopping };
+
+    struct Service {
+        std::string name;
+        std::string description;
+        std::vector<int> runlevels;          // Started on entering these, stopped on leaving them
+        std::vector<std::string> after;      // Started after and stopped before these services
+        std::function<int()> start;          // 0 once the service is up, else an errno value
+        std::function<void()> stop;          // Returns once it is down; also called after a failure
+        std::function<std::string()> health; // Empty while healthy, else what is wrong; must not block
+        std::vector<int> fatal;              // Start errors retrying won't fix: the service stays failed
+    };
+
+    struct Status {
+        std::string name;
+        std::string description;
+        std::vector<int> runlevels;
+        State state = Stopped;
+        double uptime = 0;      // Seconds since it came up, while Running
+        unsigned restarts = 0;  // Attempts after a failure
+        double retryIn = -1;    // Seconds to the next attempt, if one is scheduled
+        std::string problem;    // Why it last failed
+    };
+
+    void add(Service service);
+
+    // Stops the services that don't belong to runlevel and starts the ones that do,
+    // reporting to console. Returns 0, or EINVAL if the order between them is circular.
+    int enter(int runlevel, std::ostream& console);
+    // Stops every service, dependants first, for good; used at shutdown
+    void stopAll(std::ostream& console);
+
+    // By hand: 0, ENOENT, EBUSY while it is starting or stopping, or the start error
+    int start(const std::string& name);
+    int stop(const std::string& name);
+
+    std::vector<Status> status();
+    static const char* stateName(State state);
+
+private:
+    struct Entry {
+        Service service;
+        State state = Stopped;
+        bool wanted = false;    // Should be running, so failures are retried
+        std::chrono::steady_clock::time_point since;
+        unsigned restarts = 0;
+        unsigned failures = 0;  // In a row, for the backoff
+        std::string problem;
+        TimerWheel::Id healthTimer = 0;
+        TimerWheel::Id retryTimer = 0;
+        std::chrono::steady_clock::time_point retryAt;
+    };
+
+    Entry* find(const std::string& name);  // Caller holds mutex
+    std::vector<Entry*> ordered();         // Dependencies first; caller holds mutex
+    int startEntry(Entry& entry);
+    int stopEntry(Entry& entry);
+    void check(Entry& entry);
+    void fail(Entry& entry, const std::string& problem, bool retry = true);  // Caller holds mutex
+    void scheduleRetry(Entry& entry);                     // Caller holds mutex
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Entry>> entries;  // Never removed: timers hold pointers
+    bool shuttingDown = false;
+};
+
+// The kernel's service manager, created on first use
+ServiceManager& services();
+
+#endif // SERVICES_H
@@ -0,0 +1,35 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed-size pool of worker threads pulling jobs from a shared FIFO queue.
+ * Used to run long-lived jobs such as remote lsh sessions without a thread per job.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    void submit(std::function<void()> job);
+
+    size_t size() const { return threads.size(); }
+    size_t pending();
+
+private:
+    void worker();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
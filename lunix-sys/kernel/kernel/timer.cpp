@@ -0,0 +1,291 @@
+// timer.cpp; Kernel timer service: a hierarchical timing wheel driven by a timerfd
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "timer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+const int64_t nsPerTick = 1000000;
+
+int64_t nanosecondsBetween(const struct timespec& from, const struct timespec& to) {
+    return (to.tv_sec - from.tv_sec) * 1000000000LL + (to.tv_nsec - from.tv_nsec);
+}
+
+}
+
+TimerWheel::TimerWheel() {
+    std::fill(std::begin(heads), std::end(heads), none);
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) {
+        std::cerr << "Timers: timerfd_create failed: " << strerror(errno) << "\n";
+        return;
+    }
+    scheduler().spawn(run());
+}
+
+uint64_t TimerWheel::nowTick() const {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return nanosecondsBetween(origin, now) / nsPerTick;
+}
+
+// The first tick at or after now + delay, so timers never fire early
+uint64_t TimerWheel::deadline(std::chrono::milliseconds delay) const {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t ns = nanosecondsBetween(origin, now) + std::max<int64_t>(0, delay.count()) * 1000000LL;
+    return (ns + nsPerTick - 1) / nsPerTick;
+}
+
+TimerWheel::Id TimerWheel::after(std::chrono::milliseconds delay, Callback callback) {
+    return add(deadline(delay), 0, std::move(callback));
+}
+
+TimerWheel::Id TimerWheel::every(std::chrono::milliseconds interval, Callback callback) {
+    uint64_t ticks = std::max<int64_t>(1, interval.count());
+    return add(deadline(interval), ticks, std::move(callback));
+}
+
+TimerWheel::Id TimerWheel::add(uint64_t expires, uint64_t interval, Callback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending == 0) {
+        // An idle wheel has processed nothing lately; catch up so new timers land low
+        current = std::max(current, nowTick());
+    }
+    uint32_t index;
+    if (freeList != none) {
+        index = freeList;
+        freeList = nodes[index].next;
+    } else {
+        index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+    }
+    Node& node = nodes[index];
+    node.expires = std::max(expires, current + 1);
+    node.interval = interval;
+    node.callback = std::move(callback);
+    place(index);
+    pending++;
+    counters.added++;
+    uint64_t next = nextEvent();
+    if (next < armed) {
+        arm(next);
+    }
+    return (static_cast<uint64_t>(node.generation) << 32) | index;
+}
+
+TimerWheel::Node* TimerWheel::find(Id id) {
+    uint32_t index = static_cast<uint32_t>(id);
+    if (index >= nodes.size()) {
+        return nullptr;
+    }
+    Node& node = nodes[index];
+    if (node.generation != static_cast<uint32_t>(id >> 32) || node.bucket == none) {
+        return nullptr;
+    }
+    return &node;
+}
+
+bool TimerWheel::restart(Id id, std::chrono::milliseconds delay) {
+    uint64_t expires = deadline(delay);
+    std::lock_guard<std::mutex> lock(mutex);
+    Node* node = find(id);
+    if (node == nullptr) {
+        return false;
+    }
+    uint32_t index = static_cast<uint32_t>(id);
+    unlink(index);
+    node->expires = std::max(expires, current + 1);
+    place(index);
+    uint64_t next = nextEvent();
+    if (next < armed) {
+        arm(next);
+    }
+    return true;
+}
+
+bool TimerWheel::cancel(Id id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (find(id) == nullptr) {
+        return false;
+    }
+    uint32_t index = static_cast<uint32_t>(id);
+    unlink(index);
+    release(index);
+    counters.cancelled++;
+    return true;  // The timerfd may still wake us for nothing; cheaper than re-arming
+}
+
+/*
+ * The level is the lowest one whose span covers the time left, and the slot is the
+ * expiry's digit at that level. Each level's slots are then reached, in order, by the
+ * first tick after now whose lower digits are all zero, which is when they fire (level
+ * 0) or cascade. Timers beyond the top level's span are parked at its far end and
+ * placed again when they cascade.
+ */
+void TimerWheel::place(uint32_t index) {
+    Node& node = nodes[index];
+    const uint64_t span = (1ULL << (levelBits * levels)) - 1;
+    uint64_t expires = std::min(node.expires, current + span);
+    uint64_t left = expires > current ? expires - current : 0;
+    int level = 0;
+    while (level < levels - 1 && left >= (1ULL << (levelBits * (level + 1)))) {
+        level++;
+    }
+    uint32_t slot = (expires >> (levelBits * level)) & (slots - 1);
+    uint32_t bucket = level * slots + slot;
+
+    node.bucket = bucket;
+    node.prev = none;
+    node.next = heads[bucket];
+    if (node.next != none) {
+        nodes[node.next].prev = index;
+    }
+    heads[bucket] = index;
+    occupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& node = nodes[index];
+    if (node.prev != none) {
+        nodes[node.prev].next = node.next;
+    } else {
+        heads[node.bucket] = node.next;
+        if (node.next == none) {
+            occupied[node.bucket / slots] &= ~(1ULL << (node.bucket % slots));
+        }
+    }
+    if (node.next != none) {
+        nodes[node.next].prev = node.prev;
+    }
+    node.bucket = none;
+}
+
+void TimerWheel::release(uint32_t index) {
+    Node& node = nodes[index];
+    node.callback = nullptr;
+    node.bucket = none;
+    node.generation = node.generation == UINT32_MAX ? 1 : node.generation + 1;  // Stale ids stop matching
+    node.next = freeList;
+    freeList = index;
+    pending--;
+}
+
+// The next tick after current at which an occupied slot fires or cascades
+uint64_t TimerWheel::nextEvent() const {
+    uint64_t best = UINT64_MAX;
+    for (int level = 0; level < levels; ++level) {
+        if (occupied[level] == 0) {
+            continue;
+        }
+        int shift = levelBits * level;
+        uint64_t digit = current >> shift;
+        // Bit i of rotated is the slot reached i + 1 steps of this level from now
+        uint64_t rotated = std::rotr(occupied[level], static_cast<int>((digit + 1) & (slots - 1)));
+        uint64_t tick = (digit + std::countr_zero(rotated) + 1) << shift;
+        best = std::min(best, tick);
+    }
+    return best;
+}
+
+void TimerWheel::processTick(uint64_t tick, std::vector<Callback>& due) {
+    current = tick;
+    // Higher levels first, so what cascades all the way down still fires on this tick
+    for (int level = levels - 1; level >= 0; --level) {
+        int shift = levelBits * level;
+        if (level > 0 && (tick & ((1ULL << shift) - 1)) != 0) {
+            continue;
+        }
+        uint32_t slot = (tick >> shift) & (slots - 1);
+        uint32_t bucket = level * slots + slot;
+        uint32_t index = heads[bucket];
+        heads[bucket] = none;
+        occupied[level] &= ~(1ULL << slot);
+
+        while (index != none) {
+            Node& node = nodes[index];
+            uint32_t next = node.next;
+            node.bucket = none;
+            if (level > 0 || node.expires > tick) {
+                place(index);
+                counters.cascaded++;
+            } else if (node.interval != 0) {
+                node.expires += ((tick - node.expires) / node.interval + 1) * node.interval;
+                place(index);
+                due.push_back(node.callback);
+                counters.fired++;
+            } else {
+                due.push_back(std::move(node.callback));
+                release(index);
+                counters.fired++;
+            }
+            index = next;
+        }
+    }
+}
+
+void TimerWheel::arm(uint64_t tick) {
+    if (tick == armed || timerFd < 0) {
+        return;
+    }
+    armed = tick;
+    struct itimerspec spec = {};
+    if (tick != UINT64_MAX) {
+        int64_t ns = origin.tv_nsec + static_cast<int64_t>(tick % 1000) * nsPerTick;
+        spec.it_value.tv_sec = origin.tv_sec + tick / 1000 + ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void TimerWheel::advance() {
+    std::vector<Callback> due;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.wakeups++;
+        uint64_t now = nowTick();
+        uint64_t next;
+        while ((next = nextEvent()) <= now) {
+            processTick(next, due);
+        }
+        // No slot is reached before next, so skipping ahead leaves every timer where it belongs
+        current = std::max(current, now);
+        armed = UINT64_MAX;  // The timerfd fired, so it's disarmed
+        arm(nextEvent());
+    }
+    for (Callback& callback : due) {
+        scheduler().spawn(std::move(callback));
+    }
+}
+
+Task<void> TimerWheel::run() {
+    while (true) {
+        co_await scheduler().readable(timerFd);
+        uint64_t expirations;
+        read(timerFd, &expirations, sizeof(expirations));
+        advance();
+    }
+}
+
+TimerWheel::Stats TimerWheel::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats stats = counters;
+    stats.pending = pending;
+    stats.capacity = nodes.size();
+    return stats;
+}
+
+TimerWheel& timers() {
+    static TimerWheel* wheel = new TimerWheel();  // Never destroyed, like the scheduler it runs on
+    return *wheel;
+}
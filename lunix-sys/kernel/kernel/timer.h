@@ -0,0 +1,120 @@
+// timer.h; Kernel timer service: a hierarchical timing wheel driven by a timerfd
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "scheduler.h"
+
+/*
+ * Timers for idle timeouts, heartbeats, retry backoffs and deadlines, cheap enough to
+ * keep one per connection. Time is counted in 1ms ticks on a wheel of 6 levels of 64
+ * slots: level 0 holds the timers due within 64 ticks, one slot per tick, and each level
+ * up covers 64 times the span of the one below, so timers up to two years ahead fit.
+ * When the wheel reaches a slot of a higher level, its timers are redistributed to the
+ * levels below. Timers live in a slab and are linked into their slot's list, so adding,
+ * restarting and cancelling are O(1) whatever the number of timers.
+ *
+ * Nothing ticks while nothing is due: a bitmap of occupied slots per level gives the
+ * next tick at which a slot fires or cascades, and a timerfd is armed for exactly that
+ * tick. The scheduler's reactor watches the timerfd; due callbacks run as scheduler
+ * jobs, so like any task they must not block.
+ */
+class TimerWheel {
+public:
+    using Callback = std::function<void()>;
+    using Id = uint64_t;  // 0 is never a timer
+
+    struct Stats {
+        size_t pending = 0;
+        size_t capacity = 0;  // Timer slots allocated, pending or free
+        uint64_t added = 0;
+        uint64_t fired = 0;
+        uint64_t cancelled = 0;
+        uint64_t cascaded = 0;  // Timers moved down a level
+        uint64_t wakeups = 0;
+    };
+
+    // co_await sleep(delay): continue on a worker once delay has passed
+    struct SleepAwaiter {
+        TimerWheel& wheel;
+        std::chrono::milliseconds delay;
+        bool await_ready() noexcept { return delay.count() <= 0; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            wheel.after(delay, [handle] { handle.resume(); });
+        }
+        void await_resume() noexcept {}
+    };
+
+    TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // Run callback once, delay from now
+    Id after(std::chrono::milliseconds delay, Callback callback);
+    // Run callback every interval until cancelled; a late wheel skips missed runs
+    Id every(std::chrono::milliseconds interval, Callback callback);
+    // Move a pending timer's deadline to delay from now; false if it already fired or was cancelled
+    bool restart(Id id, std::chrono::milliseconds delay);
+    // False if it already fired or was cancelled; a callback already started still finishes
+    bool cancel(Id id);
+
+    SleepAwaiter sleep(std::chrono::milliseconds delay) { return {*this, delay}; }
+
+    Stats stats();
+
+private:
+    static constexpr int levelBits = 6;
+    static constexpr int slots = 1 << levelBits;
+    static constexpr int levels = 6;
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Node {
+        uint64_t expires = 0;   // Tick
+        uint64_t interval = 0;  // Ticks; 0 for one-shot timers
+        uint32_t prev = none;
+        uint32_t next = none;   // Also links the free list
+        uint32_t generation = 1;
+        uint32_t bucket = none; // level * slots + slot while in the wheel
+        Callback callback;
+    };
+
+    uint64_t nowTick() const;
+    uint64_t deadline(std::chrono::milliseconds delay) const;
+    Id add(uint64_t expires, uint64_t interval, Callback callback);
+    Node* find(Id id);
+    void place(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    uint64_t nextEvent() const;
+    void processTick(uint64_t tick, std::vector<Callback>& due);
+    void arm(uint64_t tick);
+    void advance();
+    Task<void> run();
+
+    std::mutex mutex;
+    std::vector<Node> nodes;
+    uint32_t freeList = none;
+    uint32_t heads[levels * slots];
+    uint64_t occupied[levels] = {};
+    uint64_t current = 0;        // Last tick processed
+    uint64_t armed = UINT64_MAX; // Tick the timerfd will fire at
+    size_t pending = 0;
+    int timerFd = -1;
+    struct timespec origin = {0, 0};  // CLOCK_MONOTONIC time of tick 0
+    Stats counters;
+};
+
+// The kernel's timer service, started on first use
+TimerWheel& timers();
+
+#endif // TIMER_H
@@ -0,0 +1,234 @@
+// trace.cpp; Event tracer for boot and runtime profiling, exported as Chrome trace JSON
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+std::atomic<bool> traceEnabled{false};
+
+struct Tracer::Ring {
+    static const size_t capacity = 16384;  // 1MB of events per thread
+
+    std::atomic<uint64_t> head{0};  // Events ever recorded; only the owner stores it
+    uint64_t from = 0;              // head when tracing last started
+    std::atomic<bool> retired{false};
+    pid_t tid = 0;
+    std::string thread;
+    Event events[capacity];
+};
+
+namespace {
+
+uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs();
+#endif
+}
+
+// Marks the thread's ring as reclaimable when the thread exits
+struct RetireOnExit {
+    std::atomic<bool>* retired = nullptr;
+    ~RetireOnExit() {
+        if (retired != nullptr) {
+            retired->store(true);
+        }
+    }
+};
+
+void writeString(std::ostream& out, const char* s) {
+    out << '"';
+    for (; *s != '\0'; ++s) {
+        unsigned char c = static_cast<unsigned char>(*s);
+        if (c == '"' || c == '\\') {
+            out << '\\' << *s;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        } else {
+            out << *s;
+        }
+    }
+    out << '"';
+}
+
+}
+
+Tracer::Ring& Tracer::local() {
+    static thread_local Ring* mine = nullptr;
+    static thread_local RetireOnExit retire;
+    if (mine == nullptr) {
+        std::unique_ptr<Ring> ring(new Ring);  // Not make_unique: that would zero (and fault in) every event up front
+        ring->tid = static_cast<pid_t>(syscall(SYS_gettid));
+        char name[16] = {0};
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0) {
+            ring->thread = name;
+        }
+        mine = ring.get();
+        retire.retired = &ring->retired;
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(std::move(ring));
+    }
+    return *mine;
+}
+
+int Tracer::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (traceEnabled) {
+        return EALREADY;
+    }
+    // Rings of threads that have exited only hold events from the previous trace
+    rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::unique_ptr<Ring>& ring) { return ring->retired.load(); }),
+                rings.end());
+    for (const auto& ring : rings) {
+        ring->from = ring->head.load(std::memory_order_acquire);
+    }
+    startTicks = readTicks();
+    startNs = nowNs();
+    traceEnabled = true;
+    return 0;
+}
+
+int Tracer::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!traceEnabled) {
+        return EALREADY;
+    }
+    traceEnabled = false;
+    return 0;
+}
+
+bool Tracer::running() const {
+    return traceEnabled.load(std::memory_order_relaxed);
+}
+
+void Tracer::record(Phase phase, const char* category, std::string_view name, int64_t value) {
+    Ring& ring = local();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    Event& event = ring.events[head % Ring::capacity];
+    event.ticks = readTicks();
+    event.value = value;
+    event.category = category;
+    event.phase = phase;
+    size_t length = std::min(name.size(), sizeof(event.name) - 1);
+    memcpy(event.name, name.data(), length);
+    event.name[length] = '\0';
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+size_t Tracer::events(size_t* threads) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t total = 0;
+    size_t active = 0;
+    for (const auto& ring : rings) {
+        uint64_t count = std::min<uint64_t>(ring->head.load(std::memory_order_acquire) - ring->from, Ring::capacity);
+        total += count;
+        active += count > 0 ? 1 : 0;
+    }
+    if (threads != nullptr) {
+        *threads = active;
+    }
+    return total;
+}
+
+size_t Tracer::dump(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Calibrate the TSC against the steady clock over the whole trace
+    double nsPerTick = 1;
+    uint64_t elapsedTicks = readTicks() - startTicks;
+    uint64_t elapsedNs = nowNs() - startNs;
+    if (elapsedTicks > 0) {
+        nsPerTick = static_cast<double>(elapsedNs) / elapsedTicks;
+    }
+    pid_t pid = getpid();
+    char number[32];
+    size_t written = 0;
+    bool first = true;
+    auto separator = [&] {
+        out << (first ? "\n" : ",\n");
+        first = false;
+    };
+
+    out << "{\"traceEvents\":[";
+    std::vector<Event> copied;
+    for (const auto& ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = std::max(ring->from, head > Ring::capacity ? head - Ring::capacity : 0);
+        if (begin == head) {
+            continue;
+        }
+        // The owner may still be recording, even after stop() (the ends of scopes that were
+        // open), and a full ring reuses its oldest slots. So copy up to head first, then
+        // drop the copies of slots it may have reused meanwhile, as a seqlock reader would.
+        copied.assign(head - begin, Event{});
+        for (uint64_t i = begin; i < head; ++i) {
+            copied[i - begin] = ring->events[i % Ring::capacity];
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t now = ring->head.load(std::memory_order_relaxed);
+        // Slots of events before now + 1 - capacity are reused by the events up to now, the one being written included
+        uint64_t valid = now + 1 > Ring::capacity ? now + 1 - Ring::capacity : 0;
+        uint64_t skip = valid > begin ? std::min(valid - begin, head - begin) : 0;
+        if (skip == head - begin) {
+            continue;
+        }
+        if (!ring->thread.empty()) {
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << ring->tid << ",\"args\":{\"name\":";
+            writeString(out, ring->thread.c_str());
+            out << "}}";
+        }
+        size_t depth = 0;  // An end whose begin was overwritten is dropped
+        for (uint64_t i = skip; i < copied.size(); ++i) {
+            const Event& event = copied[i];
+            if (event.phase == End && depth == 0) {
+                continue;
+            }
+            depth += event.phase == Begin ? 1 : 0;
+            depth -= event.phase == End ? 1 : 0;
+            int64_t ticks = static_cast<int64_t>(event.ticks - startTicks);
+            snprintf(number, sizeof(number), "%.3f", ticks * nsPerTick / 1000);
+            separator();
+            out << "{";
+            if (event.phase != End) {
+                out << "\"name\":";
+                writeString(out, event.name);
+                out << ",\"cat\":";
+                writeString(out, event.category);
+                out << ",";
+            }
+            out << "\"ph\":\"" << (event.phase == Begin ? 'B' : event.phase == End ? 'E' : 'C') << "\",\"ts\":" << number
+                << ",\"pid\":" << pid << ",\"tid\":" << ring->tid;
+            if (event.phase == Counter) {
+                out << ",\"args\":{\"value\":" << event.value << "}";
+            }
+            out << "}";
+            written++;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return written;
+}
+
+Tracer& tracer() {
+    static Tracer* instance = new Tracer();  // Never destroyed: threads may record while the kernel exits
+    return *instance;
+}
@@ -0,0 +1,95 @@
+// trace.h; Event tracer for boot and runtime profiling, exported as Chrome trace JSON
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+/*
+ * Records begin/end and counter events into a ring buffer per thread, timestamped with
+ * the TSC, and writes them out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+ * Only the owning thread writes to a ring, so recording takes no lock; a full ring
+ * overwrites its oldest events. dump() copies each ring before formatting it and drops
+ * what the owner may have overwritten meanwhile. While tracing is off, TraceScope and
+ * traceCounter cost one relaxed load and a branch that is predicted not taken.
+ * Setting LUNIX_TRACE in the environment starts tracing before boot (see main.cpp).
+ */
+class Tracer {
+public:
+    enum Phase : uint8_t { Begin, End, Counter };
+
+    struct Event {
+        uint64_t ticks;
+        int64_t value;         // Counter value
+        const char* category;  // Static string
+        Phase phase;
+        char name[39];         // Copied and truncated, so it may come from a temporary
+    };
+    static_assert(sizeof(Event) == 64, "one event per cache line");
+
+    // Returns 0, or EALREADY if tracing was already on
+    int start();
+    // Returns 0, or EALREADY if tracing was already off
+    int stop();
+    bool running() const;
+
+    void record(Phase phase, const char* category, std::string_view name, int64_t value = 0);
+    // Writes the events recorded since the last start() as JSON. Returns the number written.
+    size_t dump(std::ostream& out);
+    // Events in the rings since the last start(), and threads that recorded any
+    size_t events(size_t* threads = nullptr);
+
+private:
+    struct Ring;
+    Ring& local();
+
+    std::mutex mutex;  // Guards rings, not the events in them
+    std::vector<std::unique_ptr<Ring>> rings;
+    uint64_t startTicks = 0;
+    uint64_t startNs = 0;
+};
+
+Tracer& tracer();
+
+// Read inline by every instrumented call; set by Tracer::start and stop
+extern std::atomic<bool> traceEnabled;
+
+inline bool tracing() {
+    return __builtin_expect(traceEnabled.load(std::memory_order_relaxed), 0);
+}
+
+inline void traceCounter(const char* category, const char* name, int64_t value) {
+    if (tracing()) {
+        tracer().record(Tracer::Counter, category, name, value);
+    }
+}
+
+// Begin event now, end event when it goes out of scope
+class TraceScope {
+public:
+    TraceScope(const char* category, std::string_view name) : active(tracing()) {
+        if (active) {
+            tracer().record(Tracer::Begin, category, name);
+        }
+    }
+    ~TraceScope() {
+        if (active) {
+            tracer().record(Tracer::End, "", "");  // Even if tracing stopped meanwhile, so the pair stays whole
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    bool active;
+};
+
+#endif // TRACE_H
@@ -10,7 +10,25 @@
 #include <string>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <map>
+#include <limits>
+#include <cmath>
+#include <iomanip>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <poll.h>
 
 
 #include "disk/disk.h"
@@ -20,147 +38,247 @@
 #include "security/userman.h"
 #include "net/lisp/server/server.h"
 #include "net/lisp/client/client.h"
+#include "net/network.h"
+#include "session.h"
+#include "fdstream.h"
+#include "output.h"
+#include "kernel/threadpool.h"
+#include "kernel/proctable.h"
+#include "kernel/scheduler.h"
+#include "kernel/trace.h"
+#include "kernel/timer.h"
+#include "kernel/services.h"
+#include "kernel/klog.h"
+#include "commands.h"
+#include "pipeline.h"
+#include "pathcache.h"
+#include "coreutils/coreutils.h"
+#include "editor/editor.h"
+#include "term/completion.h"
+#include "term/history.h"
+#include "term/lineeditor.h"
 
 using namespace ANSIColors;
 
 namespace fs = std::filesystem;
 extern disk Disk;
 extern kernel Kernel;
+extern network Network;
 extern error_handler ErrHandler;
-UserManager userManager;
 
 Server server;
 Client client;
 
-std::string python_bin;
+extern lsh LSH;
+
+// Remote sessions are long-lived and block on their socket, so they get their own pool.
+// Never destroyed: workers may still be blocked in a session when the kernel exits.
+static ThreadPool& sessionPool() {
+    static ThreadPool* pool = new ThreadPool(std::max(4u, std::thread::hardware_concurrency()));
+    return *pool;
+}
 
 lsh::lsh() {}
 
-void lsh::printHelp() {
-    const std::vector<std::pair<std::string, std::string>> commands = {
-        {"cat", "Display the contents of a file"},
-        {"cd", "Change the current working directory"},
-        {"chmod", "Change the permissions of a file or directory"},
-        {"editor", "Open a simple text editor (use 'nano' for more advanced features)"},
-        {"exit", "Exit the shell"},
-        {"help", "Display this help information"},
-        {"ls", "List files and directories in the current directory"},
-        {"mkdir", "Create a new directory in the current working folder"},
-        {"nano", "Run the Nano text editor"},
-        {"passwd", "Change the password for a user (root only)"},
-        {"pwd", "Print the current working directory"},
-        {"mod", "Run a module"},
-        {"rl", "Display the current system runlevel"},
-        {"rm", "Remove a file or empty directory\n"
-             "  Use -R to delete a directory and its contents recursively"},
-        {"shutdown", "Shut down the system and exit the shell"},
-        {"ver", "Display the OS and shell version information"}
-    };
+// True if any stage of the line runs a command marked secret, such as passwd
+static bool holdsSecret(CommandLine& line, const std::string& command) {
+    if (line.parse(command) <= 0) {
+        return false;
+    }
+    char** argv = line.argv();
+    for (int i = 0; i < line.argc(); ++i) {
+        if (i == 0 || (line.isOperator(i - 1) && strcmp(argv[i - 1], "|") == 0)) {
+            const Command* entry = commandRegistry().find(argv[i]);
+            if (entry != nullptr && entry->secret) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
-    std::cout << "\n" << "Available commands:" << "\n\n";
-    std::cout << "built-in: {";
-    for (size_t i = 0; i < commands.size(); ++i) {
-        std::cout << commands[i].first;
-        if (i < commands.size() - 1) {
-            std::cout << ", ";
+// Each user's console history is a file of their own; names that aren't plain file names get none
+static int openHistory(const fs::path& rootfsPath, const std::string& username) {
+    if (username.empty() || username[0] == '.' || username.find('/') != std::string::npos) {
+        return EINVAL;
+    }
+    return consoleHistory().open(AT_FDCWD, rootfsPath.string() + "/.lsh_history." + username);
+}
+
+void lsh::printHelp(Session& session) {
+    std::vector<Command> commands = commandRegistry().list();
+
+    session.out << "\n" << "Available commands:" << "\n\n";
+    std::vector<std::string> groups;
+    for (const Command& command : commands) {
+        if (std::find(groups.begin(), groups.end(), command.group) == groups.end()) {
+            groups.push_back(command.group);
         }
-        if ((i + 1) % 10 == 0) {
-            std::cout << "\n          ";
+    }
+
+    for (const std::string& group : groups) {
+        std::string indent(group.size() + 3, ' ');
+        session.out << group << ": {";
+        size_t printed = 0;
+        for (const Command& command : commands) {
+            if (command.group != group) {
+                continue;
+            }
+            if (printed > 0) {
+                session.out << ", ";
+                if (printed % 10 == 0) {
+                    session.out << "\n" << indent;
+                }
+            }
+            session.out << command.name;
+            printed++;
         }
+        session.out << "}\n";
     }
-    std::cout << "}\n";
 }
 
-void lsh::man(const std::string& command) {
-    const std::vector<std::pair<std::string, std::string>> commands = {
-        {"cat <file>", "Display the contents of a file"},
-        {"cd <directory>", "Change the current working directory"},
-        {"mod <module-name>", "Run a python module that adds functionality to Lunix. (e.g. a module that scans the directory for a file). Modules can be used as commands. Startup modules have a startup function that runs on Lunix boot."},
-        {"chmod <args>", "Change the permissions of a file or directory"},
-        {"editor <file>", "Open a simple text editor (use 'nano' for more advanced features)"},
-        {"exit", "Exit the shell"},
-        {"help", "Display this help information"},
-        {"ls", "List files and directories in the current directory"},
-        {"mkdir <directory>", "Create a new directory in the current working folder"},
-        {"nano", "Run the Nano text editor"},
-        {"passwd <username> <new_password>", "Change the password for a user (root only)"},
-        {"pwd", "Print the current working directory"},
-        {"rl", "Display the current system runlevel"},
-        {"rm [-R] <file/directory>", "Remove a file or empty directory\n"
-             "  Use -R to delete a directory and its contents recursively"},
-        {"shutdown", "Shut down the system and exit the shell"},
-        {"ver", "Display the OS and shell version information"}
-    };
-
-    for (const auto& [cmd, desc] : commands) {
-        if (cmd.find(command) != std::string::npos) {
-            std::cout << cmd << "\n" << desc << "\n";
-            return;
+void lsh::man(Session& session, const std::string& command) {
+    const Command* entry = commandRegistry().find(command);
+    if (entry == nullptr) {
+        // Fall back to the first command whose name starts with the query
+        for (const Command& candidate : commandRegistry().list()) {
+            if (candidate.name.compare(0, command.size(), command) == 0) {
+                session.out << candidate.usage << "\n" << candidate.description << "\n";
+                return;
+            }
         }
+        session.out << "No manual entry for " << command << "\n";
+        return;
     }
-    std::cout << "No manual entry for " << command << "\n";
+    session.out << entry->usage << "\n" << entry->description << "\n";
 }
 
-void lsh::changeDirectory(const std::string& path) {
-    Disk.fchdir(path);
+void lsh::changeDirectory(Session& session, const std::string& path) {
+    Disk.fchdir(session, path);
 }
 
-void lsh::printWorkingDirectory() {
-    std::cout << fs::current_path() << std::endl;
+void lsh::printWorkingDirectory(Session& session) {
+    session.out << session.cwd() << "\n";
 }
 
-void lsh::catFile(const std::string& filename) {
-    try {
-        std::ifstream file(filename);
-        if (file) {
-            if (fs::is_directory(filename)) {
-                throw std::runtime_error("Cannot cat a directory");
-            }
-            std::cout << file.rdbuf();
+int lsh::catFile(Session& session, const std::string& filename) {
+    int fd = openat(session.cwdFd(), filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        session.err << "No such file: " << filename << "\n";
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+        session.err << "Error: Cannot cat a directory\n";
+        close(fd);
+        return 1;
+    }
+
+    // Into a pipe, let the kernel move the pages instead of copying them through us
+    ssize_t n = -1;
+    if (session.outFd >= 0 && session.out.flush()) {
+        while ((n = splice(fd, nullptr, session.outFd, nullptr, 1 << 20, SPLICE_F_MOVE)) > 0) {}
+    }
+    if (n < 0) {
+        // Not a pipe (terminal, socket) or splice unsupported: copy through the stream
+        char buffer[65536];
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            session.out.write(buffer, n);
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        session.err << "Error: " << strerror(errno) << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int lsh::simpleEditor(Session& session, const std::string& filename) {
+    Editor editor(session, filename);
+    return editor.run();
+}
+
+int lsh::listFiles(Session& session, const std::string& path) {
+    int fd = openat(session.cwdFd(), path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        session.err << "Error: " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    DIR* dir = fdopendir(fd);
+    if (dir == nullptr) {
+        close(fd);
+        session.err << "Error: " << path << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    while (struct dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        bool isDirectory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            isDirectory = fstatat(fd, entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (isDirectory) {
+            session.out << BOLD_BLUE << entry->d_name << "/" << RESET << "\n";
         } else {
-            std::cerr << "No such file: " << filename << std::endl;
+            session.out << entry->d_name << "\n";
         }
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
     }
+    closedir(dir);
+    return 0;
 }
 
-void lsh::simpleEditor(const std::string& filename) {
-    std::string content;
-    std::cout << "Simple Editor\n";
-    std::cout << "Editing " << filename << ". Type ':wq!' to save and exit.\n";
+/**
+ * Starts the Lunix shell on the console.
+ * Handles the login process, then runs the shell until the user exits.
+ */
+int lsh::lshStart() {
+    registerBuiltins();
+    registerModules();
+
+    // Clients that send SHELL to the LISP server get their own session
+    server.setShellHandler([](int fd) {
+        sessionPool().submit([fd] { LSH.remoteSession(fd); });
+    });
+
+    Session session(std::cin, std::cout, std::cerr, STDIN_FILENO, STDOUT_FILENO);
 
-    std::ofstream outFile(filename, std::ios::app);
-    while (true) {
-        std::getline(std::cin, content);
-        if (content == ":wq!") break;
-        outFile << content << std::endl;
+    // Initialize user management and handle login
+    if (!session.user.initialize(std::cin, std::cout, STDIN_FILENO)) {
+        std::cerr << "Shutting down...\n";
+        exit(1);
     }
-    outFile.close();
+
+    Kernel.crlrq(4);
+    return runSession(session);
 }
 
-void lsh::listFiles(const std::string& path) {
-    try {
-        fs::path dirPath = fs::absolute(path);
-        for (const auto& entry : fs::directory_iterator(dirPath)) {
-            std::string name = entry.path().filename().string();
-            if (fs::is_directory(entry.status())) {
-                std::cout << BOLD_BLUE << name << "/" << RESET << std::endl;
-            } else {
-                std::cout << name << std::endl;
-            }
+void lsh::remoteSession(int fd) {
+    FdStreamBuf buffer(fd);
+    std::istream in(&buffer);
+    std::ostream out(&buffer);
+    in.tie(&out);  // Flush prompts before blocking on the socket
+
+    {
+        Session session(in, out, out, fd, fd, true);
+        if (session.user.initialize(in, out, fd, session.remote)) {
+            runSession(session);
         }
-    } catch (const fs::filesystem_error& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
+        out.flush();
     }
+    server.releaseShell(fd);
 }
 
 /**
- * Starts the Lunix shell.
+ * Runs the Lunix shell for a logged in session.
  *
- * This function initializes user management and handles the login process.
- * It displays a welcome message and a prompt for user input.
+ * It displays a welcome message and a prompt for user input on the session's streams.
  * The function continuously reads user commands and executes them until the user enters "shutdown" or "exit".
+ * In a remote session both only end that session; the kernel keeps running.
  * Supported commands include changing directories, listing files, creating directories, viewing file contents,
  * editing files, changing permissions, deleting files and directories, and more.
  *
@@ -168,19 +286,26 @@ void lsh::listFiles(const std::string& path) {
  */
 
 
-int lsh::lshStart() {
-    userManager.initialize();  // Initialize user management and handle login
-
-    Kernel.crlrq(4);
+int lsh::runSession(Session& session) {
     std::string command;
-    fs::path rootfsPath = fs::current_path();  // Get the current path after rootfs() has been called
+    CommandLine line;
+    fs::path rootfsPath = Disk.rootfsPath();
+
+    session.out << "\nWelcome to Lunix, a small simulation OS built on C++\n";
+    session.out << "lsh shell 0.2.0; type 'help' for commands\n\n";
+    session.out << "Current working directory: " << rootfsPath << "\n";
 
-    std::cout << "\nWelcome to Lunix, a small simulation OS built on C++" << std::endl;
-    std::cout << "lsh shell 0.2.0; type 'help' for commands\n\n";
-    std::cout << "Current working directory: " << rootfsPath << std::endl;
+    // On a terminal, lines are read with editing, history and tab completion
+    std::unique_ptr<Completer> completer;
+    std::unique_ptr<LineEditor> editor;
+    if (!session.remote && LineEditor::available(session.inFd, session.outFd)) {
+        openHistory(rootfsPath, session.user.getUsername());
+        completer = std::make_unique<Completer>();
+        editor = std::make_unique<LineEditor>(session.inFd, session.outFd, consoleHistory(), *completer);
+    }
 
-    while (true) {
-        fs::path currentPath = fs::current_path();
+    while (!session.exitRequested) {
+        fs::path currentPath = session.cwd();
         std::string promptPath;
 
         if (currentPath == rootfsPath) {
@@ -191,136 +316,968 @@ int lsh::lshStart() {
             promptPath = currentPath.string();
         }
 
-        std::cout << (userManager.isRoot() ? BOLD_RED + "root" + RESET : BOLD_GREEN + userManager.getUsername() + RESET)
-                  << "@" << BOLD_CYAN << "lunix " << RESET << promptPath << (userManager.isRoot() ? " # " : " % ");
-
-        if (!std::getline(std::cin, command)) {
-            std::cout << std::endl;  // Print a newline to move to the next line after the prompt
-            break;
-        }
-
-        if (command == "shutdown" || command == "exit") {
-            break;
-        } else if (command == "") {
-
-        } else if (command == "help") {
-            printHelp();
-        } else if (command.substr(0, 4) == "man ") {
-            lsh::man(command.substr(4));
-        } else if (command.substr(0, 3) == "cd ") {
-            if (Disk.fchdir(command.substr(3)) != 0) {
-                std::cout << "Directory " << command.substr(3) << " not found.\n";
-            }
-        } else if (command == "pwd") {
-            std::cout << Disk.fcwd() << std::endl;
-        } else if (command.substr(0, 2) == "ls") {
-            std::string path = ".";
-            if (command.length() > 3) {
-                path = command.substr(3);
-            }
-            listFiles(path);
-        } else if (command.substr(0, 6) == "mkdir ") {
-            Disk.fmkdir(command.substr(6));
-        } else if (command.substr(0, 4) == "cat ") {
-            catFile(command.substr(4));
-        } else if (command.substr(0, 7) == "editor ") {
-            simpleEditor(command.substr(7));
-        } else if (command.substr(0, 4) == "nano") {
-            system(command.c_str());
-        } else if (command.substr(0, 5) == "chmod") {
-            system(command.c_str());
-        } else if (command.substr(0, 2) == "rl") {
-            std::cout << Kernel.runlevel << std::endl;
-        } else if (command.substr(0, 3) == "rm ") {
-            std::string args = command.substr(3);
-            bool recursive = false;
-
-            if (args.substr(0, 3) == "-R ") {
-                recursive = true;
-                args = args.substr(3);
+        // Output other threads (the LISP server) buffered while the last command ran
+        if (!session.remote) {
+            flushConsoleOutput();
+        }
+        std::string prompt = (session.user.isRoot() ? BOLD_RED + "root" + RESET : BOLD_GREEN + session.user.getUsername() + RESET) +
+                             "@" + BOLD_CYAN + "lunix " + RESET + promptPath + (session.user.isRoot() ? " # " : " % ");
+
+        if (editor) {
+            completer->prefetch(currentPath.string());  // List the directory while the user types
+            if (!editor->readLine(prompt, currentPath.string(), command)) {
+                session.out << "\n";
+                break;
+            }
+            if (!holdsSecret(line, command)) {
+                consoleHistory().add(command);
             }
+        } else {
+            session.out << prompt << std::flush;
+            if (!std::getline(session.in, command)) {
+                session.out << "\n";  // Print a newline to move to the next line after the prompt
+                break;
+            }
+        }
+
+        executeLine(session, line, command);
+    }
+
+    return session.lastStatus;
+}
+
+int lsh::lshBatch(std::istream& script) {
+    registerBuiltins();
+    registerModules();
+
+    // std::cout is buffered (see output.h); children get it flushed before they run
+    Session session(script, std::cout, std::cerr, STDIN_FILENO, STDOUT_FILENO);
+    const char* user = getenv("USER");
+    session.user.loginUnprivileged(user != nullptr && *user != '\0' ? user : "batch");
+
+    std::string command;
+    CommandLine line;
+    while (!session.exitRequested && std::getline(script, command)) {
+        // Skip comments and a #! line
+        size_t start = command.find_first_not_of(" \t");
+        if (start == std::string::npos || command[start] == '#') {
+            continue;
+        }
+        executeLine(session, line, command);
+    }
+
+    flushConsoleOutput();
+    return session.lastStatus;
+}
+
+int lsh::executeLine(Session& session, CommandLine& line, const std::string& command) {
+    int words = line.parse(command);
+    if (words < 0) {
+        session.err << "Syntax error: unterminated quote\n";
+        session.lastStatus = 2;
+    } else if (words > 0 && line.hasOperators()) {
+        Pipeline pipeline([this](Session& stage, int argc, char** argv) { return execute(stage, argc, argv); });
+        std::string error;
+        if (!pipeline.parse(line, error)) {
+            session.err << "lsh: " << error << "\n";
+            session.lastStatus = 2;
+        } else {
+            session.lastStatus = pipeline.run(session);
+        }
+    } else if (words > 0) {
+        session.lastStatus = execute(session, line.argc(), line.argv());
+    }
+    return session.lastStatus;
+}
+
+int lsh::execute(Session& session, int argc, char** argv) {
+    TraceScope scope("lsh", argv[0]);
+    const Command* command = commandRegistry().find(argv[0]);
+    if (command != nullptr) {
+        return command->handler(session, argc, argv);
+    }
+
+    // Anything else is a program: a path such as ./binary, or a name found in PATH
+    std::string program = strchr(argv[0], '/') != nullptr ? argv[0] : pathCache().lookup(argv[0]);
+    if (program.empty()) {
+        session.out << "Command not found: " << argv[0] << "\n";
+        return 127;
+    }
+
+    int status = Disk.fexec(session, std::vector<std::string>(argv, argv + argc), program);
+    if (status < 0) {
+        session.out << "Failed to execute '" << argv[0] << "'.\n";
+    }
+    return status;
+}
+
+void lsh::registerServices() {
+    // Without a private address there is nothing to listen on, however often it is tried
+    services().add({"lisp-server", "LISP server", {4}, {}, [] { return server.start(); }, [] { server.stop(); },
+                    [] { return server.listening() ? std::string() : std::string("not listening"); }, {EADDRNOTAVAIL}});
+}
+
+void lsh::registerModules() {
+    fs::path modPath = fs::path(Disk.rootfsPath()) / "modules";
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(modPath, ec)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".py") {
+            continue;
+        }
+        // Modules can be used as commands unless they shadow a built-in
+        std::string name = entry.path().stem().string();
+        commandRegistry().add({name, name + " [args]", "Module " + entry.path().filename().string(), "", [name](Session& session, int argc, char** argv) {
+            return Disk.loadMod(session, name, std::vector<std::string>(argv + 1, argv + argc));
+        }, "modules", true});
+    }
+}
+
+namespace {
+
+// What time reports for one run of a command
+struct TimeSample {
+    double real = 0, user = 0, sys = 0;
+    long maxRss = 0;  // KB, of the largest child process; 0 if none ran
+    long minorFaults = 0, majorFaults = 0;
+    long voluntarySwitches = 0, involuntarySwitches = 0;
+    long blocksIn = 0, blocksOut = 0;
+    unsigned long long bytesRead = 0, bytesWritten = 0;
+};
+
+// rchar/wchar of the calling thread; builtins run on the session's thread
+void readThreadIo(unsigned long long& bytesRead, unsigned long long& bytesWritten) {
+    bytesRead = bytesWritten = 0;
+    int fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    char buffer[512];
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) {
+        return;
+    }
+    buffer[n] = '\0';
+    if (const char* p = strstr(buffer, "rchar:")) {
+        bytesRead = strtoull(p + 6, nullptr, 10);
+    }
+    if (const char* p = strstr(buffer, "wchar:")) {
+        bytesWritten = strtoull(p + 6, nullptr, 10);
+    }
+}
+
+double seconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
 
+}
+
+int lsh::timeCommand(Session& session, int argc, char** argv) {
+    const long maxRuns = 100000;  // Samples are kept for the percentiles
+    long runs = 1;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-r") == 0) {
+        char* end = nullptr;
+        runs = std::strtol(argv[2], &end, 10);
+        if (*end != '\0') {
+            runs = 0;
+        }
+        first = 3;
+    }
+    if (argc <= first || runs < 1 || runs > maxRuns) {
+        session.out << "Usage: time [-r runs] <command> [args]; runs is 1 to " << maxRuns << "\n";
+        return 2;
+    }
+
+    std::vector<TimeSample> samples;
+    int status = 0;
+    for (long run = 0; run < runs && !session.exitRequested; ++run) {
+        // Builtins are measured on this thread, child processes through wait4
+        struct rusage children = {};
+        struct rusage* outer = session.childUsage;
+        session.childUsage = &children;
+
+        struct rusage before, after;
+        unsigned long long readBefore, writtenBefore, readAfter, writtenAfter;
+        struct timespec start, end;
+        getrusage(RUSAGE_THREAD, &before);
+        readThreadIo(readBefore, writtenBefore);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        status = execute(session, argc - first, argv + first);
+        session.out.flush();
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        readThreadIo(readAfter, writtenAfter);
+        getrusage(RUSAGE_THREAD, &after);
+
+        session.childUsage = outer;
+        session.addChildUsage(children);  // Nested time sees the inner children too
+
+        TimeSample sample;
+        sample.real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        sample.user = seconds(after.ru_utime) - seconds(before.ru_utime) + seconds(children.ru_utime);
+        sample.sys = seconds(after.ru_stime) - seconds(before.ru_stime) + seconds(children.ru_stime);
+        // A thread has no peak of its own (RUSAGE_THREAD reports the whole kernel's), so builtins get none
+        sample.maxRss = children.ru_maxrss;
+        sample.minorFaults = after.ru_minflt - before.ru_minflt + children.ru_minflt;
+        sample.majorFaults = after.ru_majflt - before.ru_majflt + children.ru_majflt;
+        sample.voluntarySwitches = after.ru_nvcsw - before.ru_nvcsw + children.ru_nvcsw;
+        sample.involuntarySwitches = after.ru_nivcsw - before.ru_nivcsw + children.ru_nivcsw;
+        sample.blocksIn = after.ru_inblock - before.ru_inblock + children.ru_inblock;
+        sample.blocksOut = after.ru_oublock - before.ru_oublock + children.ru_oublock;
+        sample.bytesRead = readAfter - readBefore;
+        sample.bytesWritten = writtenAfter - writtenBefore;
+        samples.push_back(sample);
+    }
+
+    std::ostream& err = session.err;
+    std::ios::fmtflags flags = err.flags();
+    err << std::fixed << std::setprecision(3);
+    auto rss = [](long kb) { return kb > 0 ? std::to_string(kb) + " KB" : std::string("-"); };
+    if (samples.size() == 1) {
+        const TimeSample& s = samples[0];
+        err << "\nreal\t" << s.real << "s\n"
+            << "user\t" << s.user << "s\n"
+            << "sys\t" << s.sys << "s\n"
+            << "maxrss\t" << rss(s.maxRss) << "\n"
+            << "faults\t" << s.minorFaults << " minor, " << s.majorFaults << " major\n"
+            << "ctxsw\t" << s.voluntarySwitches << " voluntary, " << s.involuntarySwitches << " involuntary\n"
+            << "io\t" << s.bytesRead << " bytes read, " << s.bytesWritten << " bytes written (builtin), "
+            << s.blocksIn << " blocks in, " << s.blocksOut << " blocks out\n";
+    } else if (!samples.empty()) {
+        auto summarize = [&](const char* label, double TimeSample::*field) {
+            std::vector<double> values;
+            values.reserve(samples.size());
+            for (const TimeSample& s : samples) {
+                values.push_back(s.*field);
+            }
+            std::sort(values.begin(), values.end());
+            err << label << "\t" << values.front() << "s\t" << percentile(values, 50) << "s\t"
+                << percentile(values, 90) << "s\t" << percentile(values, 99) << "s\t" << values.back() << "s\n";
+        };
+        long maxRss = 0;
+        for (const TimeSample& s : samples) {
+            maxRss = std::max(maxRss, s.maxRss);
+        }
+        err << "\n" << samples.size() << " runs\tmin\tp50\tp90\tp99\tmax\n";
+        summarize("real", &TimeSample::real);
+        summarize("user", &TimeSample::user);
+        summarize("sys", &TimeSample::sys);
+        err << "maxrss\t" << rss(maxRss) << "\n";
+    }
+    err.flags(flags);
+    err.flush();
+    return status;
+}
+
+// ps/top table; processes started by this Lunix instance are highlighted
+static void printProcesses(Session& session, const std::vector<const ProcessInfo*>& rows) {
+    char line[128];
+    snprintf(line, sizeof(line), "%7s %7s S %6s %9s %9s %s\n", "PID", "PPID", "%CPU", "RSS(KB)", "TIME", "COMMAND");
+    session.out << line;
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    for (const ProcessInfo* info : rows) {
+        unsigned long long cpuSeconds = info->cpuTicks / ticksPerSecond;
+        char time[24];
+        snprintf(time, sizeof(time), "%llu:%02llu", cpuSeconds / 60, cpuSeconds % 60);
+        snprintf(line, sizeof(line), "%7d %7d %c %6.1f %9ld %9s %s", info->pid, info->ppid, info->state,
+                 info->cpuPercent, info->rssKb, time, info->name);
+        if (info->ours) {
+            session.out << BOLD_CYAN << line << RESET << "\n";
+        } else {
+            session.out << line << "\n";
+        }
+    }
+}
+
+// accounting table, busiest first; commands also show the limits they'd get now
+static void printTotals(Session& session, const char* heading, const std::map<std::string, ProcessManager::Totals>& totals,
+                        bool showLimits) {
+    auto cpu = [](const ProcessManager::Totals& t) {
+        return t.userTime.tv_sec + t.systemTime.tv_sec + (t.userTime.tv_usec + t.systemTime.tv_usec) / 1e6;
+    };
+    std::vector<std::pair<std::string, ProcessManager::Totals>> rows(totals.begin(), totals.end());
+    std::stable_sort(rows.begin(), rows.end(), [&](const auto& a, const auto& b) { return cpu(a.second) > cpu(b.second); });
+
+    char line[192];
+    snprintf(line, sizeof(line), "%-20s %6s %6s %6s %9s %10s %10s %10s%s\n", heading, "RUNS", "FAILED", "KILLED", "CPU",
+             "RSS(KB)", "READ(KB)", "WRITE(KB)", showLimits ? "  LIMITS" : "");
+    session.out << line;
+    for (const auto& [name, t] : rows) {
+        snprintf(line, sizeof(line), "%-20s %6llu %6llu %6llu %8.2fs %10ld %10llu %10llu", name.c_str(),
+                 (unsigned long long) t.exited, (unsigned long long) t.failed, (unsigned long long) t.killed, cpu(t),
+                 t.maxRssKb, (unsigned long long) (t.readBytes / 1024), (unsigned long long) (t.writtenBytes / 1024));
+        session.out << line;
+        if (showLimits) {
+            session.out << "  " << resourceProfiles().lookup(name).describe();
+        }
+        session.out << "\n";
+    }
+}
+
+static int usage(Session& session, const std::string& text) {
+    session.out << "Usage: " << text << "\n";
+    return 2;
+}
+
+void lsh::registerBuiltins() {
+    CommandRegistry& registry = commandRegistry();
+
+    // Programs are found in the rootfs bin directory first, then on the host
+    const char* lunixPath = getenv("LUNIX_PATH");
+    const char* hostPath = getenv("PATH");
+    std::string searchPath = lunixPath != nullptr ? lunixPath : std::string("bin") + (hostPath != nullptr ? std::string(":") + hostPath : "");
+    pathCache().setPath(searchPath, Disk.rootfsPath());
+
+    registry.add({"help", "help", "Display this help information", "", [this](Session& session, int, char**) {
+        printHelp(session);
+        return 0;
+    }});
+    registry.add({"man", "man <command>", "Show the manual entry for a command", "", [this](Session& session, int argc, char** argv) {
+        if (argc < 2) {
+            return usage(session, "man <command>");
+        }
+        man(session, argv[1]);
+        return 0;
+    }});
+    auto exitShell = [](Session& session, int argc, char** argv) {
+        session.exitRequested = true;
+        return argc > 1 ? std::atoi(argv[1]) : session.lastStatus;
+    };
+    registry.add({"exit", "exit [status]", "Exit the shell", "", exitShell});
+    registry.add({"shutdown", "shutdown", "Shut down the system and exit the shell",
+                  "Shut down the system and exit the shell. In a remote session only the session ends.", exitShell});
+    registry.add({"history", "history [-c]", "List or clear the console command history",
+                  "List the lines entered at the console, oldest first. With -c, clear the history. Each user has their own "
+                  "history, kept in .lsh_history.<user>; lines that run passwd are never recorded.",
+                  [](Session& session, int argc, char** argv) {
+        if (session.remote) {
+            session.err << "history: only available on the console\n";
+            return 1;
+        }
+        History& history = consoleHistory();
+        if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+            history.clear();
+            return 0;
+        }
+        for (size_t i = 0; i < history.size(); ++i) {
+            session.out << std::setw(5) << i + 1 << "  " << history.at(i) << "\n";
+        }
+        return 0;
+    }});
+    registry.add({"cd", "cd <directory>", "Change the current working directory", "", [](Session& session, int argc, char** argv) {
+        std::string path = argc > 1 ? argv[1] : Disk.rootfsPath();
+        if (Disk.fchdir(session, path) != 0) {
+            session.out << "Directory " << path << " not found.\n";
+            return 1;
+        }
+        return 0;
+    }});
+    registry.add({"pwd", "pwd", "Print the current working directory", "", [](Session& session, int, char**) {
+        session.out << Disk.fcwd(session) << "\n";
+        return 0;
+    }});
+    registry.add({"ls", "ls [directory]", "List files and directories in the current directory", "", [this](Session& session, int argc, char** argv) {
+        return listFiles(session, argc > 1 ? argv[1] : ".");
+    }});
+    registry.add({"mkdir", "mkdir <directory>", "Create a new directory in the current working folder", "", [](Session& session, int argc, char** argv) {
+        if (argc < 2) {
+            return usage(session, "mkdir <directory>");
+        }
+        return Disk.fmkdir(session, argv[1]);
+    }});
+    registry.add({"cat", "cat [file...]", "Display the contents of a file",
+                  "Display the contents of one or more files. With no file, or '-', copies standard input (e.g. in a pipeline).",
+                  [this](Session& session, int argc, char** argv) {
+        if (argc < 2) {
+            session.out << session.in.rdbuf();
+            return 0;
+        }
+        int status = 0;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "-") == 0) {
+                session.out << session.in.rdbuf();
+            } else if (catFile(session, argv[i]) != 0) {
+                status = 1;
+            }
+        }
+        return status;
+    }});
+    registry.add({"editor", "editor <file>", "Edit a text file with the built-in line editor (use 'nano' for a full-screen editor)",
+                  "Open a file in an ed-style line editor: print, append, insert, change, delete, substitute, find and undo "
+                  "by line number. Large files open instantly and are saved atomically. Type 'h' in the editor for its commands.", [this](Session& session, int argc, char** argv) {
+        if (argc < 2) {
+            return usage(session, "editor <file>");
+        }
+        return simpleEditor(session, argv[1]);
+    }});
+    auto external = [](Session& session, int argc, char** argv) {
+        return Disk.fexec(session, std::vector<std::string>(argv, argv + argc));
+    };
+    registry.add({"nano", "nano [file]", "Run the Nano text editor", "", external, "built-in", true});
+    registry.add({"chmod", "chmod <args>", "Change the permissions of a file or directory", "", external, "built-in", true});
+    registry.add({"rl", "rl", "Display the current system runlevel", "", [](Session& session, int, char**) {
+        session.out << Kernel.runlevel << "\n";
+        return 0;
+    }});
+    registry.add({"rm", "rm [-R] <file/directory>", "Remove a file or empty directory\n"
+                  "  Use -R to delete a directory and its contents recursively", "", [](Session& session, int argc, char** argv) {
+        bool recursive = argc > 1 && strcmp(argv[1], "-R") == 0;
+        int first = recursive ? 2 : 1;
+        if (argc <= first) {
+            return usage(session, "rm [-R] <file/directory>");
+        }
+
+        int status = 0;
+        for (int i = first; i < argc; ++i) {
+            std::string args = argv[i];
             if (recursive) {
-                if (Disk.frmdir_r(args) == 0) {
-                    std::cout << "Deleted directory " << args << " recursively.\n";
+                if (Disk.frmdir_r(session, args) == 0) {
+                    session.out << "Deleted directory " << args << " recursively.\n";
                 } else {
-                    std::cout << "Failed to delete directory " << args << ".\n";
+                    session.out << "Failed to delete directory " << args << ".\n";
+                    status = 1;
                 }
             } else {
-                if (Disk.funlink(args) == 0) {
-                    std::cout << "Deleted " << args << ".\n";
+                int result = Disk.funlink(session, args);
+                if (result == 0) {
+                    session.out << "Deleted " << args << ".\n";
                 } else {
-                    std::cout << "Failed to unlink " << args << ". Error code " << Disk.funlink(args) << std::endl;
+                    session.out << "Failed to unlink " << args << ". Error code " << result << "\n";
+                    status = 1;
                 }
             }
-        } else if (command == "clear") {
-            system("clear");
-        } else if (command == "ver") {
-            std::cout << Kernel.ver << std::endl << "Codename " << Kernel.codename << std::endl;
-            std::ifstream buildDateFile("../.builddate");
-            if (buildDateFile) {
-                std::string buildDate;
-                std::getline(buildDateFile, buildDate);
-                std::cout << "Built on: " << buildDate << std::endl;
+        }
+        return status;
+    }});
+    registry.add({"clear", "clear", "Clear the terminal screen", "", [](Session& session, int, char**) {
+        session.out << "\033[H\033[2J" << std::flush;
+        return 0;
+    }});
+    registry.add({"ver", "ver", "Display the OS and shell version information", "", [](Session& session, int, char**) {
+        session.out << Kernel.ver << "\nCodename " << Kernel.codename << "\n";
+        std::ifstream buildDateFile("../.builddate");
+        if (buildDateFile) {
+            std::string buildDate;
+            std::getline(buildDateFile, buildDate);
+            session.out << "Built on: " << buildDate << "\n";
+            return 0;
+        }
+        session.err << "Failed to open .builddate file.\n";
+        return 1;
+    }});
+    registry.add({"panic", "panic", "Panic the kernel for testing (root only)", "", [](Session& session, int, char**) {
+        if (session.user.isRoot()) {
+            ErrHandler.panic("User initiated panic using 'panic' command");
+        }
+        session.out << "Failed to run command: Permission denied\n";
+        return 1;
+    }});
+    registry.add({"passwd", "passwd <username> <new_password>", "Change the password for a user (root only)", "", [](Session& session, int argc, char** argv) {
+        if (!session.user.isRoot()) {
+            session.err << "Only root can change other users' passwords.\n";
+            return 1;
+        }
+        if (argc != 3) {
+            return usage(session, "passwd <username> <new_password>");
+        }
+        int result = session.user.setPassword(argv[1], argv[2]);
+        if (result != 0) {
+            session.err << "Failed to set the password for " << argv[1] << "; it is unchanged.\n";
+            return 1;
+        }
+        return 0;
+    }, "built-in", false, true});
+    registry.add({"server", "server <start|stop>", "Start or stop the LISP server",
+                  "Start or stop the lisp-server service. It starts by itself in runlevel 4 and is restarted if it "
+                  "stops listening; see svc.",
+                  [](Session& session, int argc, char** argv) {
+        if (argc != 2 || (strcmp(argv[1], "start") != 0 && strcmp(argv[1], "stop") != 0)) {
+            return usage(session, "server <start|stop>");
+        }
+        bool start = strcmp(argv[1], "start") == 0;
+        int result = start ? services().start("lisp-server") : services().stop("lisp-server");
+        if (result != 0) {
+            bool retrying = false;
+            for (const ServiceManager::Status& status : services().status()) {
+                retrying |= status.name == "lisp-server" && status.retryIn >= 0;
+            }
+            session.err << "server: " << strerror(result) << (retrying ? "; retrying in the background" : "") << "\n";
+            return 1;
+        }
+        return 0;
+    }});
+    registry.add({"client", "client <ping|connect|shell>", "Talk to a LISP server",
+                  "Ping a LISP server, join its chat, or open a remote lsh session on it. Console only.",
+                  [](Session& session, int argc, char** argv) {
+        if (argc != 2 || (strcmp(argv[1], "ping") != 0 && strcmp(argv[1], "connect") != 0 && strcmp(argv[1], "shell") != 0)) {
+            return usage(session, "client <ping|connect|shell>");
+        }
+        if (session.remote) {
+            session.out << "The LISP client is only available on the console.\n";
+            return 1;
+        }
+
+        std::string ipAddr;
+        std::cout << "IP address of the server: ";
+        std::cin >> ipAddr;
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        bool ok;
+        if (strcmp(argv[1], "ping") == 0) {
+            ok = client.pingServer(ipAddr.c_str(), 6942);
+        } else if (strcmp(argv[1], "connect") == 0) {
+            ok = client.connectToServer(ipAddr.c_str(), 6942);
+        } else {
+            ok = client.openShell(ipAddr.c_str(), 6942);
+        }
+        return ok ? 0 : 1;
+    }});
+    registry.add({"netcheck", "netcheck [-t ms] [target...]", "Check which hosts answer on the network",
+                  "Probe every target at once and show whether it answered and how fast. Targets are "
+                  "tcp:host:port, udp:host:port or icmp:host; by default those in .netcheck at the top of "
+                  "the rootfs, else loopback. A refusal still means the host answered. -t sets the timeout "
+                  "of each probe (1000ms by default).",
+                  [](Session& session, int argc, char** argv) {
+        const char* usageText = "netcheck [-t ms] [target...]";
+        int timeoutMs = 1000;
+        std::vector<network::ProbeTarget> targets;
+        for (int i = 1; i < argc; ++i) {
+            network::ProbeTarget target;
+            if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+                timeoutMs = std::atoi(argv[++i]);
+                if (timeoutMs <= 0) {
+                    return usage(session, usageText);
+                }
+            } else if (network::parseTarget(argv[i], target)) {
+                targets.push_back(target);
             } else {
-                std::cerr << "Failed to open .builddate file." << std::endl;
+                session.err << "netcheck: bad target '" << argv[i] << "'\n";
+                return usage(session, usageText);
             }
-        } else if (command.substr(0, 2) == "./") {
-            std::string executable = command.substr(0);
-            if (Disk.fopenbin(executable) != 0) {
-                std::cout << "Failed to execute '" << executable << "'." << std::endl;
+        }
+        if (targets.empty()) {
+            targets = Network.targets();
+        }
+        for (network::ProbeTarget& target : targets) {
+            target.timeoutMs = timeoutMs;
+        }
+
+        bool any = false;
+        char line[160];
+        snprintf(line, sizeof(line), "%-32s %-13s %10s\n", "TARGET", "RESULT", "LATENCY");
+        session.out << line;
+        for (const network::ProbeResult& result : Network.probe(targets)) {
+            snprintf(line, sizeof(line), "%-32s %-13s %8.2fms%s%s\n", network::describe(result.target).c_str(),
+                     network::statusName(result.status), result.latencyMs, result.error != 0 ? "  " : "",
+                     result.error != 0 ? strerror(result.error) : "");
+            session.out << line;
+            any = any || result.ok();
+        }
+        return any ? 0 : 1;
+    }});
+    registry.add({"mod", "mod <module-name> [args]", "Run a module",
+                  "Run a python module that adds functionality to Lunix. (e.g. a module that scans the directory for a file). Modules can be used as commands. Startup modules have a startup function that runs on Lunix boot.",
+                  [](Session& session, int argc, char** argv) {
+        if (argc < 2) {
+            return usage(session, "mod <module-name>");
+        }
+        std::string moduleName = argv[1];
+        session.out << "Loading module " << moduleName << "\n";
+        int status = Disk.loadMod(session, moduleName, std::vector<std::string>(argv + 2, argv + argc));
+        if (status != 0) {
+            session.out << "An error occurred loading the module\n";
+        }
+        return status;
+    }, "built-in", true});
+    registerTextCommands(registry);
+    registerSortCommands(registry);
+    registerHashCommands(registry);
+    registry.add({"time", "time [-r runs] <command> [args]", "Run a command and report the time and resources it used",
+                  "Reports wall time, user and system CPU time, maximum resident set size, page faults, context switches and I/O "
+                  "for a builtin, module or program. Builtins are measured on the shell's own thread; child processes are included "
+                  "through their exit accounting. maxrss is the peak of the largest child process, and \"-\" when none ran, since a "
+                  "builtin shares the kernel's memory. With -r the command runs that many times and percentiles are printed.",
+                  [this](Session& session, int argc, char** argv) {
+        return timeCommand(session, argc, argv);
+    }, "built-in", true});
+    registry.add({"ps", "ps [-a]", "List processes started by Lunix",
+                  "List this Lunix process and everything it has started (modules, programs, pipelines). "
+                  "-a lists every process on the host, with Lunix's own highlighted. %CPU is averaged over each process's lifetime.",
+                  [](Session& session, int argc, char** argv) {
+        bool all = argc > 1 && strcmp(argv[1], "-a") == 0;
+        ProcessTable table;
+        if (!table.refresh()) {
+            session.err << "ps: /proc is not available\n";
+            return 1;
+        }
+        std::vector<const ProcessInfo*> rows;
+        for (const ProcessInfo& info : table.processes()) {
+            if (all || info.ours) {
+                rows.push_back(&info);
             }
-        } else if (command == "panic") {
-            if (userManager.isRoot()) {
-                ErrHandler.panic("User initiated panic using 'panic' command");
+        }
+        printProcesses(session, rows);
+        return 0;
+    }});
+    registry.add({"top", "top [-d seconds] [-n iterations] [-a]", "Show the busiest processes, refreshed periodically",
+                  "Show the processes using the most CPU since the last refresh, every 3 seconds by default. "
+                  "Lunix processes are highlighted; -a shows every row instead of one screen. Press Enter to stop.",
+                  [](Session& session, int argc, char** argv) {
+        double delay = 3;  // As procps top; keeps a refresh of thousands of processes under 1% CPU
+        long iterations = -1;
+        bool all = false;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+                delay = std::atof(argv[++i]);
+            } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+                iterations = std::atol(argv[++i]);
+            } else if (strcmp(argv[i], "-a") == 0) {
+                all = true;
             } else {
-                cout << "Failed to run command: Permission denied\n";
-            }
-        } else if (command.substr(0, 6) == "passwd") {
-            if (userManager.isRoot()) {
-                std::string user, newPassword;
-                std::istringstream iss(command.substr(7));
-                iss >> user >> newPassword;
-                if (user.empty() || newPassword.empty()) {
-                    std::cout << "Usage: passwd <username> <new_password>\n";
-                } else {
-                    userManager.setPassword(user, newPassword);
+                return usage(session, "top [-d seconds] [-n iterations] [-a]");
+            }
+        }
+        if (delay < 0.1) {
+            delay = 0.1;
+        }
+
+        ProcessTable table;
+        std::vector<const ProcessInfo*> rows;
+        bool watchInput = session.inFd >= 0;
+        for (long frame = 0; iterations < 0 || frame < iterations; ++frame) {
+            if (!table.refresh()) {
+                session.err << "top: /proc is not available\n";
+                return 1;
+            }
+            rows.clear();
+            for (const ProcessInfo& info : table.processes()) {
+                rows.push_back(&info);
+            }
+            size_t shown = all ? rows.size() : std::min<size_t>(rows.size(), 20);
+            std::partial_sort(rows.begin(), rows.begin() + shown, rows.end(), [](const ProcessInfo* a, const ProcessInfo* b) {
+                if (a->cpuPercent != b->cpuPercent) {
+                    return a->cpuPercent > b->cpuPercent;
                 }
-            } else {
-                std::cerr << "Only root can change other users' passwords.\n";
-            }
-        } else if (command == "server start") {
-            server.start();
-        } else if (command == "server stop") {
-            server.stop();
-        } else if (command == "client ping") {
-            std::string ipAddr;
-            std::cout << "IP address of the server: ";
-            std::cin >> ipAddr;
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            client.pingServer(ipAddr.c_str(), 6942);
-        } else if (command == "client connect") {
-            std::string ipAddr;
-            std::cout << "IP address of the server: ";
-            std::cin >> ipAddr;
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            client.connectToServer(ipAddr.c_str(), 6942);
-        } else if (command.substr(0, 3) == "mod") {
-            // Check if the command length is sufficient to avoid out_of_range exception
-            if (command.length() < 4) {
-                std::cout << "Usage: mod <module-name>\n";
-            } else {
-                std::string moduleName = command.substr(4);
-                std::cout << "Loading module " << moduleName << "\n";
-                if (Disk.loadMod(moduleName) != 0) {
-                    std::cout << "An error occurred loading the module\n";
+                return a->ours != b->ours ? a->ours : a->pid < b->pid;  // Idle Lunix processes before idle host ones
+            });
+            rows.resize(shown);
+
+            double load[3] = {0, 0, 0};
+            getloadavg(load, 3);
+            char header[128];
+            snprintf(header, sizeof(header), "%zu processes, %zu from Lunix; load average %.2f %.2f %.2f\n\n",
+                     table.processes().size(), table.oursCount(), load[0], load[1], load[2]);
+            session.out << "\033[H\033[2J" << header;
+            printProcesses(session, rows);
+            session.out.flush();
+
+            if (iterations >= 0 && frame + 1 >= iterations) {
+                break;
+            }
+            // Sleep until the next refresh, or stop early when the user presses Enter
+            if (!watchInput) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<long>(delay * 1000)));
+                continue;
+            }
+            struct pollfd pfd = {session.inFd, POLLIN, 0};
+            if (poll(&pfd, 1, static_cast<int>(delay * 1000)) > 0) {
+                char discard[256];
+                if (read(session.inFd, discard, sizeof(discard)) > 0) {
+                    break;
                 }
+                watchInput = false;  // Input is closed, e.g. a script run without a terminal
             }
         }
-        else {
-            std::cout << "Command not found: " << command << std::endl;
+        return 0;
+    }});
+    registry.add({"accounting", "accounting [-u | -c]", "Show the resources used by each user and command",
+                  "Show what the programs and modules Lunix ran have used once they exited, summed per Lunix user (-u) "
+                  "and per command (-c), busiest first: runs, failures, runs killed by a signal (as by a CPU limit), "
+                  "CPU time, the largest RSS and block I/O. Commands also show the limits their next run gets from "
+                  "rootfs/.limits. Modules are listed as module:<name>.",
+                  [](Session& session, int argc, char** argv) {
+        bool byUser = true;
+        bool byCommand = true;
+        if (argc == 2 && strcmp(argv[1], "-u") == 0) {
+            byCommand = false;
+        } else if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+            byUser = false;
+        } else if (argc != 1) {
+            return usage(session, "accounting [-u | -c]");
+        }
+        session.out << "cgroup: " << cgroups().describe() << "\n\n";
+        if (byUser) {
+            printTotals(session, "USER", processManager().userTotals(), false);
+        }
+        if (byUser && byCommand) {
+            session.out << "\n";
+        }
+        if (byCommand) {
+            printTotals(session, "COMMAND", processManager().commandTotals(), true);
+        }
+        return 0;
+    }});
+    registry.add({"svc", "svc [status] | svc <start|stop> <name>", "Show, start or stop services",
+                  "Show each service's state, the runlevels it runs in, how long it has been up and how often it was "
+                  "restarted after a failure, with why it last failed and when it is retried next. Services start on "
+                  "entering their runlevels and are health-checked every second; one that fails is restarted after "
+                  "1s, doubling up to a minute. start and stop act on one service until the next runlevel change.",
+                  [](Session& session, int argc, char** argv) {
+        const char* usageText = "svc [status] | svc <start|stop> <name>";
+        if (argc == 3 && (strcmp(argv[1], "start") == 0 || strcmp(argv[1], "stop") == 0)) {
+            int result = strcmp(argv[1], "start") == 0 ? services().start(argv[2]) : services().stop(argv[2]);
+            if (result == ENOENT) {
+                session.err << "svc: " << argv[2] << ": no such service\n";
+            } else if (result != 0) {
+                session.err << "svc: " << argv[2] << ": " << strerror(result) << "\n";
+            }
+            return result == 0 ? 0 : 1;
+        }
+        if (argc > 2 || (argc == 2 && strcmp(argv[1], "status") != 0)) {
+            return usage(session, usageText);
+        }
+        char line[160];
+        snprintf(line, sizeof(line), "%-20s %-9s %-10s %10s %8s  %s\n", "NAME", "STATE", "RUNLEVELS", "UPTIME", "RESTARTS", "DESCRIPTION");
+        session.out << line;
+        for (const ServiceManager::Status& service : services().status()) {
+            std::string runlevels;
+            for (int level : service.runlevels) {
+                runlevels += (runlevels.empty() ? "" : ",") + std::to_string(level);
+            }
+            char uptime[32] = "-";
+            if (service.state == ServiceManager::Running) {
+                snprintf(uptime, sizeof(uptime), "%.1fs", service.uptime);
+            }
+            snprintf(line, sizeof(line), "%-20s %-9s %-10s %10s %8u  %s", service.name.c_str(),
+                     ServiceManager::stateName(service.state), runlevels.c_str(), uptime, service.restarts,
+                     service.description.c_str());
+            session.out << line;
+            if (!service.problem.empty()) {
+                session.out << " (" << service.problem;
+                if (service.retryIn >= 0) {
+                    snprintf(line, sizeof(line), "; retry in %.1fs", service.retryIn);
+                    session.out << line;
+                }
+                session.out << ")";
+            }
+            session.out << "\n";
+        }
+        return 0;
+    }});
+    registry.add({"sched", "sched stats", "Show what the kernel task scheduler is doing",
+                  "Show each scheduler worker's tasks run, successful/attempted steals, times parked, "
+                  "queue length and the share of its lifetime spent running tasks, then the shared queue "
+                  "and sockets with a task waiting on them, then the timer wheel: pending timers, "
+                  "timers started, fired, cancelled and moved down a level, and timerfd wakeups.",
+                  [](Session& session, int argc, char** argv) {
+        if (argc != 2 || strcmp(argv[1], "stats") != 0) {
+            return usage(session, "sched stats");
+        }
+        Scheduler::Stats stats = scheduler().stats();
+        char line[128];
+        snprintf(line, sizeof(line), "%6s %12s %21s %9s %7s %6s\n", "WORKER", "TASKS", "STEALS/ATTEMPTS", "PARKS", "QUEUED", "BUSY");
+        session.out << line;
+        for (size_t i = 0; i < stats.workers.size(); ++i) {
+            const Scheduler::WorkerStats& worker = stats.workers[i];
+            std::string steals = std::to_string(worker.steals) + "/" + std::to_string(worker.stealAttempts);
+            snprintf(line, sizeof(line), "%6zu %12llu %21s %9llu %7zu %5.1f%%\n", i, (unsigned long long) worker.executed,
+                     steals.c_str(), (unsigned long long) worker.parks, worker.queued, worker.busy * 100);
+            session.out << line;
+        }
+        snprintf(line, sizeof(line), "\nShared queue: %llu posted, %zu queued\nI/O: %llu waits, %zu waiting\nUptime: %.1fs\n",
+                 (unsigned long long) stats.posted, stats.sharedQueued, (unsigned long long) stats.ioWaits, stats.ioWaiting, stats.uptime);
+        session.out << line;
+        TimerWheel::Stats timerStats = timers().stats();
+        snprintf(line, sizeof(line), "Timers: %zu pending, %llu added, %llu fired, %llu cancelled, %llu cascaded, %llu wakeups\n",
+                 timerStats.pending, (unsigned long long) timerStats.added, (unsigned long long) timerStats.fired,
+                 (unsigned long long) timerStats.cancelled, (unsigned long long) timerStats.cascaded,
+                 (unsigned long long) timerStats.wakeups);
+        session.out << line;
+        return 0;
+    }});
+    registry.add({"dmesg", "dmesg [-s] [-l level] [-c category] [-n count] [file]", "Show the kernel log",
+                  "Show the kernel log (rootfs/kernel.log), text or binary, after writing out what is still buffered. "
+                  "-l shows records at a level or above (debug, info, notice, warn, error, crit), -c those of one "
+                  "category (kernel, services, server, disk, module, auth), -n only the last count. file reads a "
+                  "rotated log instead, such as kernel.log.1. -s shows how much was logged, dropped and rotated.",
+                  [](Session& session, int argc, char** argv) {
+        const char* usageText = "dmesg [-s] [-l level] [-c category] [-n count] [file]";
+        int minLevel = 0;
+        std::string category;
+        size_t count = 0;
+        std::string file;
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "-s") == 0 && argc == 2) {
+                KernelLog::Stats stats = kernelLog().stats();
+                char line[192];
+                snprintf(line, sizeof(line), "Log: %s\nRecords: %llu written, %llu dropped, from %zu threads\n"
+                         "Writes: %llu batches, %llu bytes, %llu rotations\n",
+                         kernelLog().isOpen() ? kernelLog().path().c_str() : "not open", (unsigned long long) stats.records,
+                         (unsigned long long) stats.dropped, stats.threads, (unsigned long long) stats.batches,
+                         (unsigned long long) stats.bytes, (unsigned long long) stats.rotations);
+                session.out << line;
+                return 0;
+            } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+                minLevel = KernelLog::parseLevel(argv[++i]);
+                if (minLevel < 0) {
+                    session.err << "dmesg: unknown level '" << argv[i] << "'\n";
+                    return 2;
+                }
+            } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+                category = argv[++i];
+            } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+                count = std::strtoul(argv[++i], nullptr, 10);
+            } else if (argv[i][0] != '-' && file.empty()) {
+                file = argv[i][0] == '/' ? argv[i] : session.cwd() + "/" + argv[i];
+            } else {
+                return usage(session, usageText);
+            }
+        }
+        if (file.empty()) {
+            if (!kernelLog().isOpen()) {
+                session.err << "dmesg: the kernel log isn't open\n";
+                return 1;
+            }
+            kernelLog().flush();
+            file = kernelLog().path();
         }
-    }
 
-    return 0;
-}
\ No newline at end of file
+        std::vector<KernelLog::Record> records;
+        int result = KernelLog::read(file, records);
+        if (result != 0) {
+            session.err << "dmesg: " << file << ": " << strerror(result) << "\n";
+            return 1;
+        }
+        std::vector<const KernelLog::Record*> shown;
+        for (const KernelLog::Record& record : records) {
+            if (static_cast<int>(record.level) >= minLevel && (category.empty() || record.category == category)) {
+                shown.push_back(&record);
+            }
+        }
+        size_t first = count != 0 && shown.size() > count ? shown.size() - count : 0;
+        for (size_t i = first; i < shown.size(); ++i) {
+            session.out << KernelLog::format(*shown[i]) << "\n";
+        }
+        return 0;
+    }});
+    registry.add({"trace", "trace <start|stop|status|dump [file]>", "Trace where the kernel spends its time",
+                  "Record boot units, runlevel changes, commands, disk operations, module runs and server "
+                  "messages with TSC timestamps. dump writes what was recorded since start as Chrome trace JSON, "
+                  "for chrome://tracing or ui.perfetto.dev; stop tracing first. Set LUNIX_TRACE to trace the boot.",
+                  [](Session& session, int argc, char** argv) {
+        const char* usageText = "trace <start|stop|status|dump [file]>";
+        if (argc < 2) {
+            return usage(session, usageText);
+        }
+        std::string action = argv[1];
+        size_t threads = 0;
+        if (action == "start" && argc == 2) {
+            if (tracer().start() != 0) {
+                session.err << "trace: already tracing\n";
+                return 1;
+            }
+            session.out << "Tracing started\n";
+        } else if (action == "stop" && argc == 2) {
+            if (tracer().stop() != 0) {
+                session.err << "trace: not tracing\n";
+                return 1;
+            }
+            size_t events = tracer().events(&threads);
+            session.out << "Tracing stopped: " << events << " events from " << threads << " threads\n";
+        } else if (action == "status" && argc == 2) {
+            size_t events = tracer().events(&threads);
+            session.out << (tracer().running() ? "Tracing" : "Not tracing") << "; " << events << " events from " << threads << " threads\n";
+        } else if (action == "dump" && argc <= 3) {
+            if (tracer().running()) {
+                session.err << "trace: stop tracing before dumping\n";
+                return 1;
+            }
+            if (argc == 2) {
+                tracer().dump(session.out);
+                return 0;
+            }
+            int fd = openat(session.cwdFd(), argv[2], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                session.err << "trace: " << argv[2] << ": " << strerror(errno) << "\n";
+                return 1;
+            }
+            size_t events;
+            {
+                FdStreamBuf buffer(fd, 1 << 16);
+                std::ostream file(&buffer);
+                events = tracer().dump(file);
+            }
+            close(fd);
+            session.out << "Wrote " << events << " events to " << argv[2] << "\n";
+        } else {
+            return usage(session, usageText);
+        }
+        return 0;
+    }});
+    registry.add({"hash", "hash [-r] [-d name] [-t name] [name...]", "Show or update the remembered locations of programs",
+                  "Programs run by name are looked up in PATH once and remembered; changes to the PATH directories update the table automatically. "
+                  "With no arguments, lists the remembered programs and how often each was used. -r forgets all of them, -d forgets one, "
+                  "-t prints where a program is, and a plain name is looked up and remembered.",
+                  [](Session& session, int argc, char** argv) {
+        PathCache& cache = pathCache();
+        if (argc < 2) {
+            std::vector<PathCache::Entry> entries = cache.entries();
+            if (entries.empty()) {
+                session.out << "hash: hash table empty\n";
+                return 0;
+            }
+            session.out << "hits\tcommand\n";
+            for (const PathCache::Entry& entry : entries) {
+                session.out << std::setw(4) << entry.hits << "\t" << entry.path << "\n";
+            }
+            return 0;
+        }
+        if (strcmp(argv[1], "-r") == 0) {
+            cache.clear();
+            return 0;
+        }
+        if ((strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "-t") == 0) && argc < 3) {
+            return usage(session, "hash [-r] [-d name] [-t name] [name...]");
+        }
+
+        int status = 0;
+        int first = argv[1][0] == '-' ? 2 : 1;
+        for (int i = first; i < argc; ++i) {
+            if (strcmp(argv[1], "-d") == 0) {
+                cache.forget(argv[i]);
+                continue;
+            }
+            std::string path = cache.lookup(argv[i]);
+            if (path.empty()) {
+                session.err << "hash: " << argv[i] << ": not found\n";
+                status = 1;
+            } else if (strcmp(argv[1], "-t") == 0) {
+                session.out << path << "\n";
+            }
+        }
+        return status;
+    }});
+    registry.add({"path", "path [dir:dir...]", "Show or set the directories searched for programs",
+                  "With no argument, prints the search path. Otherwise replaces it with a colon separated list; "
+                  "relative directories are inside the rootfs. The path is shared by every session, so only root "
+                  "can set it. The default is bin followed by the host PATH, or $LUNIX_PATH if it is set.",
+                  [](Session& session, int argc, char** argv) {
+        if (argc < 2) {
+            session.out << pathCache().path() << "\n";
+            return 0;
+        }
+        if (!session.user.isRoot()) {
+            session.err << "Only root can set the search path.\n";
+            return 1;
+        }
+        pathCache().setPath(argv[1], Disk.rootfsPath());
+        return 0;
+    }});
+}
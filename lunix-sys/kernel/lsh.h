@@ -9,6 +9,9 @@
 
 using namespace std;
 
+class Session;
+class CommandLine;
+
 /**
  * @todo write docs
  */
@@ -16,15 +19,28 @@ class lsh
 {
 public:
     lsh();
+    // Console session on stdin/stdout; returns when the user exits
     int lshStart();
+    // Login and shell over a connected socket, run on the session pool
+    void remoteSession(int fd);
+    // Run script lines without prompts as an unprivileged user; returns the last exit status
+    int lshBatch(std::istream& script);
+    // Adds the services the shell owns (the LISP server) to the service manager
+    void registerServices();
 private:
-    void printHelp();
-    void man(const std::string& command);
-    void changeDirectory(const std::string& path);
-    void printWorkingDirectory();
-    void catFile(const std::string& filename);
-    void simpleEditor(const std::string& filename);
-    void listFiles(const std::string& path = ".");
+    int runSession(Session& session);
+    int execute(Session& session, int argc, char** argv);
+    int timeCommand(Session& session, int argc, char** argv);
+    int executeLine(Session& session, CommandLine& line, const std::string& command);
+    void registerBuiltins();
+    void registerModules();
+    void printHelp(Session& session);
+    void man(Session& session, const std::string& command);
+    void changeDirectory(Session& session, const std::string& path);
+    void printWorkingDirectory(Session& session);
+    int catFile(Session& session, const std::string& filename);
+    int simpleEditor(Session& session, const std::string& filename);
+    int listFiles(Session& session, const std::string& path = ".");
 };
 
 #endif // LSH_H
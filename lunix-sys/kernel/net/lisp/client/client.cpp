@@ -3,7 +3,6 @@
 #include <cstring>
 #include <sys/socket.h>
 #include <arpa/inet.h>
-#include <thread>
 #include <unistd.h>
 #include <string>
 
@@ -45,13 +44,16 @@ bool Client::pingServer(const char* serverIP, int port) {
     return (strcmp(buffer, "200") == 0);
 }
 
-void Client::receiveMessages(int sock) {
+Task<void> Client::receiveMessages(int sock) {
     char buffer[1024] = {0};
     while (running) {
+        co_await scheduler().readable(sock);
         memset(buffer, 0, sizeof(buffer));
-        int bytesRead = recv(sock, buffer, sizeof(buffer), 0);
+        int bytesRead = recv(sock, buffer, sizeof(buffer) - 1, 0);
         if (bytesRead <= 0) {
-            std::cout << "\nServer closed the connection" << std::endl;
+            if (running) {
+                std::cout << "\nServer closed the connection" << std::endl;
+            }
             running = false;
             break;
         }
@@ -128,7 +130,8 @@ bool Client::connectToServer(const char* serverIP, int port) {
     }
 
     running = true;
-    receiveThread = std::thread(&Client::receiveMessages, this, sock);
+    TaskGroup receiver;
+    receiver.spawn(receiveMessages(sock));
 
     std::cout << "Connected to server. Type '/exit' to quit or 'CHAT [message]' to send a message." << std::endl;
     std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -148,9 +151,88 @@ bool Client::connectToServer(const char* serverIP, int port) {
     }
 
     running = false;
-    if (receiveThread.joinable()) {
-        receiveThread.join();
+    shutdown(sock, SHUT_RDWR);  // Wakes the receiver
+    receiver.wait();
+    close(sock);
+    std::cout << "Disconnected from server" << std::endl;
+    return true;
+}
+
+int Client::connectSocket(const char* serverIP, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        std::cerr << "Socket creation error" << std::endl;
+        return -1;
+    }
+
+    struct sockaddr_in serv_addr;
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, serverIP, &serv_addr.sin_addr) <= 0) {
+        std::cerr << "Invalid address/ Address not supported" << std::endl;
+        close(sock);
+        return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        std::cerr << "Connection Failed" << std::endl;
+        close(sock);
+        return -1;
     }
+    return sock;
+}
+
+Task<void> Client::relayShellOutput(int sock) {
+    char buffer[4096];
+    while (running) {
+        co_await scheduler().readable(sock);
+        int bytesRead = recv(sock, buffer, sizeof(buffer), 0);
+        if (bytesRead <= 0) {
+            if (running) {
+                std::cout << "\nRemote session closed. Press enter to return." << std::endl;
+            }
+            running = false;
+            break;
+        }
+        std::cout.write(buffer, bytesRead);
+        std::cout.flush();
+    }
+}
+
+bool Client::openShell(const char* serverIP, int port) {
+    int sock = connectSocket(serverIP, port);
+    if (sock < 0) {
+        return false;
+    }
+
+    char buffer[16] = {0};
+    send(sock, "SHELL", 5, MSG_NOSIGNAL);
+    int valread = read(sock, buffer, 8);
+    if (valread != 8 || strncmp(buffer, "SHELL_OK", 8) != 0) {
+        std::cerr << "Server refused the shell session" << std::endl;
+        close(sock);
+        return false;
+    }
+
+    running = true;
+    TaskGroup relay;
+    relay.spawn(relayShellOutput(sock));
+
+    std::string input;
+    while (running && std::getline(std::cin, input)) {
+        if (!running) {
+            break;
+        }
+        input += '\n';
+        if (send(sock, input.c_str(), input.length(), MSG_NOSIGNAL) <= 0) {
+            break;
+        }
+    }
+
+    running = false;
+    shutdown(sock, SHUT_RDWR);
+    relay.wait();
     close(sock);
     std::cout << "Disconnected from server" << std::endl;
     return true;
@@ -2,17 +2,21 @@
 #define CLIENT_H
 
 #include <atomic>
-#include <thread>
+
+#include "../../../kernel/scheduler.h"
 
 class Client {
 public:
     Client();
     bool pingServer(const char* serverIP, int port);
     bool connectToServer(const char* serverIP, int port);
+    // Open a remote lsh session on the server and relay the terminal to it
+    bool openShell(const char* serverIP, int port);
 private:
-    void receiveMessages(int sock);
+    Task<void> receiveMessages(int sock);
+    Task<void> relayShellOutput(int sock);
+    int connectSocket(const char* serverIP, int port);
     std::atomic<bool> running;
-    std::thread receiveThread;
 };
 
 #endif // CLIENT_H
\ No newline at end of file
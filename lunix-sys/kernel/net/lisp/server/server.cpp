@@ -6,7 +6,14 @@
 #include <unistd.h>
 #include <ifaddrs.h>
 #include <arpa/inet.h>
-#include <thread>
+#include <cerrno>
+#include <algorithm>
+#include <string_view>
+
+#include "../../../kernel/trace.h"
+#include "../../../kernel/eventbus.h"
+#include "../../../kernel/timer.h"
+#include "../../../kernel/klog.h"
 
 Server::Server() : running(false) {}
 
@@ -16,31 +23,49 @@ Server::~Server() {
     }
 }
 
-void Server::start() {
-    if (!running) {
-        running = true;
-        serverThread = std::thread(&Server::run, this);
-    }
-}
-
 void Server::stop() {
     if (running) {
         running = false;
         closeAllConnections();
-        if (serverThread.joinable()) {
-            serverThread.join();
-        }
+        tasks->wait();
+        tasks.reset();
     }
 }
 
+bool Server::listening() {
+    std::lock_guard<std::mutex> lock(clientMutex);
+    int accepting = 0;
+    socklen_t length = sizeof(accepting);
+    return running && listenSocket >= 0 &&
+           getsockopt(listenSocket, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &length) == 0 && accepting;
+}
+
 void Server::closeAllConnections() {
     std::lock_guard<std::mutex> lock(clientMutex);
+    // Wakes the accept loop and every client coroutine; each closes its own socket
+    if (listenSocket >= 0) {
+        shutdown(listenSocket, SHUT_RDWR);
+    }
     for (int socket : clientSockets) {
         shutdown(socket, SHUT_RDWR);
-        close(socket);
     }
-    clientSockets.clear();
-    clientUsernames.clear();
+
+    // Shell sockets are closed by their sessions once they see the shutdown
+    for (int socket : shellSockets) {
+        shutdown(socket, SHUT_RDWR);
+    }
+}
+
+void Server::setShellHandler(std::function<void(int)> handler) {
+    shellHandler = std::move(handler);
+}
+
+void Server::releaseShell(int socket) {
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        shellSockets.erase(socket);
+    }
+    close(socket);
 }
 
 std::string getPrivateIP() {
@@ -72,26 +97,26 @@ std::string getPrivateIP() {
     return privateIP;
 }
 
-void Server::run() {
-    
-    int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+int Server::start() {
+    if (running) {
+        return 0;
+    }
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (serverSocket == -1) {
+        return errno;
+    }
     // Release the socket if it's already in use
     int opt = 1;
     if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        std::cerr << "Error setting socket options\n";
+        int error = errno;
         close(serverSocket);
-        return;
-    }
-    if (serverSocket == -1) {
-        std::cerr << "Error creating socket\n";
-        return;
+        return error;
     }
 
     std::string privateIP = getPrivateIP();
     if (privateIP.empty()) {
-        std::cerr << "Error retrieving private IP address\n";
         close(serverSocket);
-        return;
+        return EADDRNOTAVAIL;
     }
 
     sockaddr_in serverAddr;
@@ -100,100 +125,135 @@ void Server::run() {
     serverAddr.sin_port = htons(PORT);
 
     if (bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
-        std::cerr << "Error binding socket\n";
+        int error = errno;
         close(serverSocket);
-        return;
+        return error;
     }
 
     if (listen(serverSocket, 3) < 0) {
-        std::cerr << "Error listening on socket\n";
+        int error = errno;
         close(serverSocket);
-        return;
+        return error;
     }
 
-    std::cout << "\n\nLunix Inter-terminal Server Protocol" << std::endl;
-    std::cout << "Server running on " << privateIP << ":" << PORT << std::endl;
-    std::cout << "NOTE: ALWAYS type 'server stop' to stop the server! Otherwise ports or sockets can remain open and the server may have trouble starting again." << std::endl;
-
-    while (running) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(serverSocket, &readfds);
-
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+    std::cout << "\n\nLunix Inter-terminal Server Protocol\n";
+    std::cout << "Server running on " << privateIP << ":" << PORT << "\n" << std::flush;
 
-        int activity = select(serverSocket + 1, &readfds, NULL, NULL, &timeout);
-
-        if (activity < 0) {
-            std::cerr << "Select error\n";
-            break;
-        }
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        listenSocket = serverSocket;
+    }
+    running = true;
+    tasks = std::make_unique<TaskGroup>();
+    tasks->spawn(run(serverSocket));
+    return 0;
+}
 
-        if (activity == 0) {
-            continue;  // Timeout, check running flag
+Task<void> Server::run(int serverSocket) {
+    while (running) {
+        co_await scheduler().readable(serverSocket);
+        if (!running) {
+            break;  // stop() shut the socket down to wake us
         }
-
-        if (FD_ISSET(serverSocket, &readfds)) {
-            int clientSocket = accept(serverSocket, NULL, NULL);
-            if (clientSocket < 0) {
-                std::cerr << "Error accepting connection\n";
-                continue;
+        int clientSocket = accept4(serverSocket, NULL, NULL, SOCK_CLOEXEC);
+        if (clientSocket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR) {
+                klog(LogLevel::Warning, "server", std::string("Error accepting connection: ") + strerror(errno));
             }
-
-            // Handle client in a separate thread
-            std::thread clientThread(&Server::handleClient, this, clientSocket);
-            clientThread.detach();
+            continue;
         }
+        tasks->spawn(handleClient(clientSocket));
     }
 
     // Close port and socket before continuing
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        listenSocket = -1;
+    }
     shutdown(serverSocket, SHUT_RDWR);
     close(serverSocket);
 }
 
 void Server::broadcastMessage(const std::string& message, int senderSocket) {
-    std::lock_guard<std::mutex> lock(clientMutex);
-    for (int socket : clientSockets) {
-        send(socket, message.c_str(), message.length(), 0);
+    std::vector<int> sockets;
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        sockets = clientSockets;
+    }
+    // A client that isn't reading must not hold up the others: what its socket can't take is dropped
+    for (int socket : sockets) {
+        send(socket, message.c_str(), message.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
     }
 }
 
 void Server::broadcastSystemMessage(const std::string& message) {
     std::string broadcastMessage = "SYSTEM: " + message;
-    std::cout << "Broadcasting system message: " << broadcastMessage << std::endl;
+    klog(LogLevel::Info, "server", "Broadcasting system message: " + broadcastMessage);
     this->broadcastMessage(broadcastMessage, -1);  // -1 indicates it's a system message
 }
 
+namespace {
+
+// A client's idle timer may fire while its coroutine closes the socket; fd is -1 once closed
+struct IdleWatch {
+    std::mutex mutex;
+    int fd;
+    bool expired = false;
+};
+
+}
+
 void Server::handleChatCommand(const std::string& message, int clientSocket) {
-    std::string username = clientUsernames[clientSocket];
+    std::string username;
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        username = clientUsernames[clientSocket];
+    }
     std::string broadcastMessage = username + ": " + message;
-    std::cout << "Broadcasting: " << broadcastMessage << std::endl;
+    klog(LogLevel::Debug, "server", "Broadcasting: " + broadcastMessage);
     this->broadcastMessage(broadcastMessage, clientSocket);
 }
 
-void Server::handleClient(int clientSocket) {
+Task<void> Server::handleClient(int clientSocket) {
     char buffer[1024] = {0};
     std::string username;
     bool authenticated = false;
 
-    std::cout << "New client connected." << std::endl;
+    klog(LogLevel::Info, "server", "Client " + std::to_string(clientSocket) + " connected");
     {
         std::lock_guard<std::mutex> lock(clientMutex);
         clientSockets.push_back(clientSocket);
     }
+    // Hanging up on an idle client wakes its read like any other disconnect
+    auto idle = std::make_shared<IdleWatch>();
+    idle->fd = clientSocket;
+    TimerWheel::Id idleTimer = timers().after(IDLE_TIMEOUT, [idle] {
+        std::lock_guard<std::mutex> lock(idle->mutex);
+        if (idle->fd >= 0) {
+            idle->expired = true;
+            shutdown(idle->fd, SHUT_RDWR);
+        }
+    });
+    auto stopIdleTimer = [&] {
+        timers().cancel(idleTimer);
+        std::lock_guard<std::mutex> lock(idle->mutex);
+        idle->fd = -1;
+    };
 
     while (running) {
+        co_await scheduler().readable(clientSocket);
         memset(buffer, 0, sizeof(buffer));
-        int bytesRead = read(clientSocket, buffer, 1024);
+        int bytesRead = read(clientSocket, buffer, 1023);
         if (bytesRead <= 0) {
-            std::cout << "Client disconnected." << std::endl;
+            std::lock_guard<std::mutex> lock(idle->mutex);
+            klog(LogLevel::Info, "server", "Client " + std::to_string(clientSocket) + (idle->expired ? " timed out" : " disconnected"));
             break;
         }
+        timers().restart(idleTimer, IDLE_TIMEOUT);
 
         std::string command(buffer);
-        std::cout << "Client sent: '" << command << "'" << std::endl;
+        TraceScope scope("server", std::string_view(command).substr(0, command.find(' ')));
+        klog(LogLevel::Debug, "server", "Client " + std::to_string(clientSocket) + " sent: '" + command + "'");
 
         std::string response;
         if (command == "PING") {
@@ -202,14 +262,34 @@ void Server::handleClient(int clientSocket) {
             response = "100";
         } else if (command.substr(0, 8) == "USER_SET") {
             username = command.substr(9);  // Skip "USER_SET " prefix
-            std::cout << "User set: '" << username << "'" << std::endl;
+            klog(LogLevel::Info, "server", "Client " + std::to_string(clientSocket) + " is '" + username + "'");
             response = "USER_OK";
             authenticated = true;
-            clientUsernames[clientSocket] = username;
+            {
+                std::lock_guard<std::mutex> lock(clientMutex);
+                clientUsernames[clientSocket] = username;
+            }
             broadcastSystemMessage(username + " has joined the chat.");
+            eventBus().publish(EventType::ClientJoin, username);
+        } else if (command == "SHELL") {
+            if (!shellHandler) {
+                response = "BAD_REQ";
+            } else {
+                // Hand the connection over to an lsh session
+                klog(LogLevel::Info, "server", "Client " + std::to_string(clientSocket) + " requested a shell session");
+                {
+                    std::lock_guard<std::mutex> lock(clientMutex);
+                    clientSockets.erase(std::remove(clientSockets.begin(), clientSockets.end(), clientSocket), clientSockets.end());
+                    shellSockets.insert(clientSocket);
+                }
+                stopIdleTimer();  // Shell sessions aren't chat clients
+                send(clientSocket, "SHELL_OK", 8, MSG_NOSIGNAL);
+                shellHandler(clientSocket);  // Runs the session on a thread of its own
+                co_return;
+            }
         } else if (command == "DISS") {
             response = "200";
-            std::cout << "Client requested disconnect." << std::endl;
+            klog(LogLevel::Info, "server", "Client " + std::to_string(clientSocket) + " requested disconnect");
             break;
         } else if (command.substr(0, 5) == "CHAT ") {
             if (authenticated) {
@@ -222,17 +302,24 @@ void Server::handleClient(int clientSocket) {
             response = "BAD_REQ";
         }
 
-        std::cout << "Sending response: '" << response << "'" << std::endl;
+        klog(LogLevel::Debug, "server", "Sending response: '" + response + "'");
         int bytesSent = send(clientSocket, response.c_str(), response.length(), 0);
         if (bytesSent <= 0) {
-            std::cerr << "Error sending response to client" << std::endl;
+            klog(LogLevel::Warning, "server", "Error sending response to client " + std::to_string(clientSocket));
             break;
         }
     }
 
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        clientSockets.erase(std::remove(clientSockets.begin(), clientSockets.end(), clientSocket), clientSockets.end());
+        clientUsernames.erase(clientSocket);
+    }
+    stopIdleTimer();
     close(clientSocket);
     if (authenticated) {
         broadcastSystemMessage(username + " has left the chat.");
+        eventBus().publish(EventType::ClientLeave, username);
     }
-    std::cout << "Client handler thread ending." << std::endl;
+    klog(LogLevel::Debug, "server", "Client " + std::to_string(clientSocket) + " handler ending");
 }
\ No newline at end of file
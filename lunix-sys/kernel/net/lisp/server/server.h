@@ -1,35 +1,52 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include <thread>
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <string>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <functional>
+
+#include "../../../kernel/scheduler.h"
 
 class Server {
 public:
     Server();
     ~Server();
 
-    void start();
+    // Binds and listens before returning: 0, or the errno value it failed with
+    int start();
     void stop();
+    // Up and accepting connections; the service manager's health check
+    bool listening();
+
+    // Called with the socket of a client that sent SHELL; the handler owns it until releaseShell()
+    void setShellHandler(std::function<void(int)> handler);
+    void releaseShell(int socket);
 
 private:
-    void run();
-    void handleClient(int clientSocket);
+    Task<void> run(int serverSocket);
+    Task<void> handleClient(int clientSocket);
     void broadcastMessage(const std::string& message, int senderSocket);
     void broadcastSystemMessage(const std::string& message);
     void handleChatCommand(const std::string& command, int clientSocket);
     void closeAllConnections();
 
-    std::thread serverThread;
+    // The accept loop and one coroutine per client, on the kernel scheduler
+    std::unique_ptr<TaskGroup> tasks;
+    int listenSocket = -1;
     std::atomic<bool> running;
     const int PORT = 6942;
+    const std::chrono::minutes IDLE_TIMEOUT{15};  // Clients silent for this long are disconnected
     std::vector<int> clientSockets;
-    std::mutex clientMutex;
+    std::mutex clientMutex;  // Guards clientSockets and clientUsernames
     std::unordered_map<int, std::string> clientUsernames;
+    std::unordered_set<int> shellSockets;
+    std::function<void(int)> shellHandler;
 };
 
 #endif // SERVER_H
\ No newline at end of file
@@ -3,15 +3,340 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "network.h"
+#include "../disk/disk.h"
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern disk Disk;
+
+namespace {
+
+// Loopback stand-ins: they answer (mostly with a refusal) on any host with a network stack
+const char* const defaultTargets[] = {"tcp:127.0.0.1:7", "udp:127.0.0.1:7", "icmp:127.0.0.1"};
+const char udpPayload[] = "lunix-netcheck";
+
+struct Probe {
+    network::ProbeResult result;
+    int fd = -1;
+    int family = AF_INET;
+    struct timespec started = {0, 0};
+    bool done = false;
+};
+
+double msSince(const struct timespec& start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+bool resolve(const network::ProbeTarget& target, struct sockaddr_storage& address, socklen_t& length) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = target.kind == network::Tcp ? SOCK_STREAM : SOCK_DGRAM;
+    struct addrinfo* found = nullptr;
+    std::string port = std::to_string(target.port);
+    if (getaddrinfo(target.host.c_str(), port.c_str(), &hints, &found) != 0 || found == nullptr) {
+        return false;
+    }
+    memcpy(&address, found->ai_addr, found->ai_addrlen);
+    length = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+void finish(Probe& probe, network::ProbeStatus status, int error = 0) {
+    probe.result.status = status;
+    probe.result.error = error;
+    probe.result.latencyMs = msSince(probe.started);
+    probe.done = true;
+    if (probe.fd >= 0) {
+        close(probe.fd);
+        probe.fd = -1;
+    }
+}
+
+// A failed connect, send or receive; ECONNREFUSED means the host itself said no
+void fail(Probe& probe, int error) {
+    if (error == ECONNREFUSED) {
+        finish(probe, network::Refused);
+    } else if (error == EACCES || error == EPERM) {
+        finish(probe, network::NotPermitted, error);
+    } else {
+        finish(probe, network::Unreachable, error);
+    }
+}
+
+uint16_t checksum(const unsigned char* data, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        sum += (data[i] << 8) | data[i + 1];
+    }
+    if (length % 2 != 0) {
+        sum += data[length - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+// Sends the probe; it's then waited for, unless it already finished
+void begin(Probe& probe) {
+    const network::ProbeTarget& target = probe.result.target;
+    clock_gettime(CLOCK_MONOTONIC, &probe.started);
+    struct sockaddr_storage address;
+    socklen_t length;
+    if (!resolve(target, address, length)) {
+        finish(probe, network::BadAddress);
+        return;
+    }
+    probe.family = address.ss_family;
+
+    int type = target.kind == network::Tcp ? SOCK_STREAM : SOCK_DGRAM;
+    int protocol = 0;
+    if (target.kind == network::Icmp) {
+        protocol = probe.family == AF_INET6 ? static_cast<int>(IPPROTO_ICMPV6) : static_cast<int>(IPPROTO_ICMP);
+    }
+    probe.fd = socket(probe.family, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+    if (probe.fd < 0) {
+        fail(probe, errno);
+        return;
+    }
+    // Connected datagram sockets also get ICMP errors back, as ECONNREFUSED and friends
+    if (connect(probe.fd, reinterpret_cast<struct sockaddr*>(&address), length) != 0) {
+        if (target.kind == network::Tcp && errno == EINPROGRESS) {
+            return;
+        }
+        fail(probe, errno);
+        return;
+    }
+    if (target.kind == network::Tcp) {
+        finish(probe, network::Reply);  // Loopback connections can complete at once
+        return;
+    }
+
+    ssize_t sent;
+    if (target.kind == network::Udp) {
+        sent = send(probe.fd, udpPayload, sizeof(udpPayload) - 1, 0);
+    } else {
+        // Echo request: type, code, checksum, identifier (set by the kernel), sequence
+        unsigned char echo[16] = {0};
+        echo[0] = probe.family == AF_INET6 ? 128 : 8;
+        echo[7] = 1;
+        memcpy(echo + 8, udpPayload, 8);
+        uint16_t sum = checksum(echo, sizeof(echo));
+        echo[2] = sum >> 8;
+        echo[3] = sum & 0xff;
+        sent = send(probe.fd, echo, sizeof(echo), 0);
+    }
+    if (sent < 0) {
+        fail(probe, errno);
+    }
+}
+
+// The socket is ready: see what came back
+void collect(Probe& probe) {
+    const network::ProbeTarget& target = probe.result.target;
+    if (target.kind == network::Tcp) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(probe.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error == 0) {
+            finish(probe, network::Reply);
+        } else {
+            fail(probe, error);
+        }
+        return;
+    }
+
+    unsigned char buffer[512];
+    while (!probe.done) {
+        ssize_t n = recv(probe.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fail(probe, errno);
+            }
+            return;
+        }
+        unsigned char echoReply = probe.family == AF_INET6 ? 129 : 0;
+        if (target.kind == network::Udp || (n > 0 && buffer[0] == echoReply)) {
+            finish(probe, network::Reply);
+        }
+    }
+}
+
+}
 
 network::network() {}
 
 int network::test() {
-    std::cout << "         Testing network... (Ctrl+C to cancel)\n";
-    int result = std::system("ping -c 1 -W 3 8.8.8.8 > /dev/null 2>&1");
-    if (result != 0) {
-        return 1;
+    std::cout << "         Testing network...\n" << std::flush;
+    for (const ProbeResult& result : probe(targets())) {
+        if (result.ok()) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+std::vector<network::ProbeResult> network::probe(const std::vector<ProbeTarget>& targets) {
+    std::vector<Probe> probes(targets.size());
+    for (size_t i = 0; i < targets.size(); ++i) {
+        probes[i].result.target = targets[i];
+        begin(probes[i]);
+    }
+
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> waiting;
+    while (true) {
+        fds.clear();
+        waiting.clear();
+        int timeout = -1;
+        for (size_t i = 0; i < probes.size(); ++i) {
+            Probe& probe = probes[i];
+            if (probe.done) {
+                continue;
+            }
+            int left = probe.result.target.timeoutMs - static_cast<int>(msSince(probe.started));
+            if (left <= 0) {
+                finish(probe, Timeout);
+                continue;
+            }
+            timeout = timeout < 0 ? left : std::min(timeout, left);
+            short events = probe.result.target.kind == Tcp ? POLLOUT : POLLIN;
+            fds.push_back({probe.fd, events, 0});
+            waiting.push_back(i);
+        }
+        if (fds.empty()) {
+            break;
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            for (size_t i : waiting) {
+                fail(probes[i], errno);
+            }
+            break;
+        }
+        for (size_t j = 0; j < fds.size(); ++j) {
+            if (fds[j].revents != 0) {
+                collect(probes[waiting[j]]);
+            }
+        }
+    }
+
+    std::vector<ProbeResult> results;
+    results.reserve(probes.size());
+    for (const Probe& probe : probes) {
+        results.push_back(probe.result);
+    }
+    return results;
+}
+
+std::vector<network::ProbeTarget> network::targets() {
+    std::vector<ProbeTarget> out;
+    ProbeTarget target;
+    std::ifstream config(Disk.rootfsPath() + "/.netcheck");
+    std::string line;
+    while (std::getline(config, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty() && line[0] != '#' && parseTarget(line, target)) {
+            out.push_back(target);
+        }
+    }
+    if (out.empty()) {
+        for (const char* spec : defaultTargets) {
+            parseTarget(spec, target);
+            out.push_back(target);
+        }
+    }
+    return out;
+}
+
+bool network::parseTarget(const std::string& text, ProbeTarget& target) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string kind = text.substr(0, colon);
+    std::string rest = text.substr(colon + 1);
+    ProbeTarget parsed;
+    if (kind == "tcp") {
+        parsed.kind = Tcp;
+    } else if (kind == "udp") {
+        parsed.kind = Udp;
+    } else if (kind == "icmp") {
+        parsed.kind = Icmp;
+    } else {
+        return false;
+    }
+
+    std::string port;
+    if (!rest.empty() && rest[0] == '[') {
+        size_t close = rest.find(']');
+        if (close == std::string::npos) {
+            return false;
+        }
+        parsed.host = rest.substr(1, close - 1);
+        if (close + 1 < rest.size()) {
+            if (rest[close + 1] != ':') {
+                return false;
+            }
+            port = rest.substr(close + 2);
+        }
+    } else if (parsed.kind == Icmp) {
+        parsed.host = rest;
+    } else {
+        size_t last = rest.rfind(':');
+        if (last == std::string::npos) {
+            return false;
+        }
+        parsed.host = rest.substr(0, last);
+        port = rest.substr(last + 1);
+    }
+    if (parsed.host.empty() || (parsed.kind == Icmp) != port.empty()) {
+        return false;
+    }
+    if (!port.empty()) {
+        if (port.find_first_not_of("0123456789") != std::string::npos || port.size() > 5) {
+            return false;
+        }
+        parsed.port = std::stoi(port);
+        if (parsed.port < 1 || parsed.port > 65535) {
+            return false;
+        }
+    }
+    target = parsed;
+    return true;
+}
+
+std::string network::describe(const ProbeTarget& target) {
+    const char* kinds[] = {"tcp", "udp", "icmp"};
+    bool v6 = target.host.find(':') != std::string::npos;
+    std::string host = v6 ? "[" + target.host + "]" : target.host;
+    std::string text = std::string(kinds[target.kind]) + " " + host;
+    if (target.kind != Icmp) {
+        text += ":" + std::to_string(target.port);
+    }
+    return text;
+}
+
+const char* network::statusName(ProbeStatus status) {
+    switch (status) {
+        case Reply: return "reply";
+        case Refused: return "refused";
+        case Timeout: return "timeout";
+        case Unreachable: return "unreachable";
+        case NotPermitted: return "not permitted";
+        case BadAddress: return "bad address";
     }
-    return 0;
+    return "?";
 }
@@ -5,16 +5,55 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
-/**
- * @todo write docs
+#include <string>
+#include <vector>
+
+/*
+ * Network driver: probes whether hosts answer, from inside the kernel process.
+ * All probes of one call run at once on non-blocking sockets, waited for with a single
+ * poll(), each with its own timeout:
+ * - tcp: connect(); a refused connection still proves the host answered
+ * - udp: send a datagram and wait for a reply or an ICMP port unreachable (seen as
+ *   ECONNREFUSED); silence is reported as a timeout
+ * - icmp: echo request on an ICMP datagram socket, which needs no raw socket privileges
+ *   but is only allowed for groups in net.ipv4.ping_group_range
  */
 class network
 {
 public:
+    enum ProbeKind { Tcp, Udp, Icmp };
+    enum ProbeStatus { Reply, Refused, Timeout, Unreachable, NotPermitted, BadAddress };
+
+    struct ProbeTarget {
+        ProbeKind kind = Tcp;
+        std::string host;
+        int port = 0;          // Unused for icmp
+        int timeoutMs = 1000;
+    };
+
+    struct ProbeResult {
+        ProbeTarget target;
+        ProbeStatus status = Timeout;
+        double latencyMs = 0;  // Until the answer, or until the probe gave up
+        int error = 0;         // errno behind Unreachable and NotPermitted
+        bool ok() const { return status == Reply || status == Refused; }
+    };
+
     network();
 
-    // Test the network (pings google.com)
+    // Test the network: probes the configured targets; 0 if any of them answered
     int test();
+
+    // Runs every probe concurrently; results are in the order of targets
+    std::vector<ProbeResult> probe(const std::vector<ProbeTarget>& targets);
+
+    // Targets from rootfs/.netcheck (one per line, # for comments), or the loopback defaults
+    std::vector<ProbeTarget> targets();
+
+    // Parses "tcp:host:port", "udp:host:port" or "icmp:host"; [v6 address] in brackets
+    static bool parseTarget(const std::string& text, ProbeTarget& target);
+    static std::string describe(const ProbeTarget& target);
+    static const char* statusName(ProbeStatus status);
 };
 
 #endif // NETWORK_H
@@ -0,0 +1,217 @@
+// output.cpp; Buffered console output shared by every thread
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/uio.h>
+#include <unistd.h>
+
+std::atomic<uint64_t> OutputSink::nextId{1};
+
+OutputSink::OutputSink(int fd, Mode mode, size_t bufferSize)
+    : fileDescriptor(fd), mode(mode), bufferSize(bufferSize), keepEscapes(isatty(fd) == 1), id(nextId++) {
+    // No put area of our own: every write lands in xsputn/overflow, which pick the thread's buffer
+    setp(nullptr, nullptr);
+}
+
+OutputSink::~OutputSink() {
+    flushAll();
+}
+
+OutputSink::Buffer& OutputSink::local() {
+    // Sinks are told apart by id rather than address, in case one is destroyed and another reuses it
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Buffer>>> mine;
+    for (const auto& [sink, buffer] : mine) {
+        if (sink == id) {
+            return *buffer;
+        }
+    }
+    auto buffer = std::make_shared<Buffer>();
+    buffer->data.reserve(bufferSize);
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        buffers.push_back(buffer);
+    }
+    mine.emplace_back(id, buffer);
+    return *buffer;
+}
+
+void OutputSink::append(Buffer& buffer, const char* s, size_t n) {
+    if (keepEscapes || (buffer.escape == 0 && memchr(s, '\033', n) == nullptr)) {
+        buffer.data.append(s, n);
+        return;
+    }
+    // Drop ESC x and CSI sequences (ESC [ parameters final), which may span calls
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = s[i];
+        if (buffer.escape == 0) {
+            if (c == '\033') {
+                buffer.escape = 1;
+            } else {
+                buffer.data += static_cast<char>(c);
+            }
+        } else if (buffer.escape == 1) {
+            buffer.escape = c == '[' ? 2 : 0;
+        } else if (c >= 0x40 && c <= 0x7e) {
+            buffer.escape = 0;
+        }
+    }
+}
+
+std::streamsize OutputSink::xsputn(const char* s, std::streamsize n) {
+    Buffer& buffer = local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+
+    if (keepEscapes && buffer.data.size() + n > bufferSize && static_cast<size_t>(n) >= bufferSize / 2) {
+        // A large block: send what's pending and the block together instead of copying it
+        if (writeOut(buffer.data.data(), buffer.data.size(), s, n) != 0) {
+            buffer.data.clear();
+            return 0;
+        }
+        buffer.data.clear();
+        return n;
+    }
+
+    append(buffer, s, n);
+    if (mode == LineBuffered) {
+        if (memchr(s, '\n', n) != nullptr) {
+            flush(buffer, false);
+        }
+    } else if (buffer.data.size() >= bufferSize) {
+        // Whole lines only, so another thread's output can't land in the middle of one
+        flush(buffer, false);
+        if (buffer.data.size() >= bufferSize) {
+            flush(buffer, true);
+        }
+    }
+    return n;
+}
+
+OutputSink::int_type OutputSink::overflow(int_type ch) {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        char c = traits_type::to_char_type(ch);
+        if (xsputn(&c, 1) != 1) {
+            return traits_type::eof();
+        }
+    }
+    return traits_type::not_eof(ch);
+}
+
+int OutputSink::sync() {
+    Buffer& buffer = local();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    return flush(buffer, true);
+}
+
+int OutputSink::flushAll() {
+    std::vector<std::shared_ptr<Buffer>> all;
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        // Forget buffers of threads that have exited, once they are empty
+        buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                     [](const std::shared_ptr<Buffer>& buffer) {
+                                         std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+                                         return buffer.use_count() == 1 && buffer->data.empty();
+                                     }),
+                      buffers.end());
+        all = buffers;
+    }
+    int result = 0;
+    for (const auto& buffer : all) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        if (flush(*buffer, true) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Caller holds buffer.mutex
+int OutputSink::flush(Buffer& buffer, bool partialLine) {
+    size_t length = buffer.data.size();
+    if (!partialLine) {
+        size_t newline = buffer.data.rfind('\n');
+        length = newline == std::string::npos ? 0 : newline + 1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    int result = writeOut(buffer.data.data(), length, nullptr, 0);
+    buffer.data.erase(0, length);  // Dropped on error too, so a closed pipe can't grow it forever
+    return result;
+}
+
+int OutputSink::writeOut(const char* first, size_t firstLength, const char* second, size_t secondLength) {
+    iovec parts[2] = {{const_cast<char*>(first), firstLength}, {const_cast<char*>(second), secondLength}};
+    iovec* part = parts;
+    int count = secondLength > 0 ? 2 : 1;
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+    while (count > 0) {
+        if (part->iov_len == 0) {
+            part++;
+            count--;
+            continue;
+        }
+        ssize_t n = writev(fileDescriptor, part, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        // Skip what was written, possibly ending partway through a part
+        while (count > 0 && static_cast<size_t>(n) >= part->iov_len) {
+            n -= part->iov_len;
+            part++;
+            count--;
+        }
+        if (count > 0) {
+            part->iov_base = static_cast<char*>(part->iov_base) + n;
+            part->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+namespace {
+
+struct ConsoleOutput {
+    OutputSink out{STDOUT_FILENO, OutputSink::FullyBuffered};
+    OutputSink err{STDERR_FILENO, OutputSink::LineBuffered};
+    std::streambuf* oldOut;
+    std::streambuf* oldErr;
+
+    ConsoleOutput() {
+        oldOut = std::cout.rdbuf(&out);
+        oldErr = std::cerr.rdbuf(&err);
+        std::cerr.unsetf(std::ios::unitbuf);  // err writes whole lines itself
+    }
+
+    // Runs at exit; the sinks then flush as they are destroyed
+    ~ConsoleOutput() {
+        std::cout.rdbuf(oldOut);
+        std::cerr.rdbuf(oldErr);
+        std::cerr.setf(std::ios::unitbuf);
+    }
+};
+
+ConsoleOutput* console = nullptr;
+
+}
+
+void installConsoleOutput() {
+    static ConsoleOutput output;
+    console = &output;
+}
+
+void flushConsoleOutput() {
+    if (console != nullptr) {
+        console->out.flushAll();
+        console->err.flushAll();
+    }
+}
@@ -0,0 +1,76 @@
+// output.h; Buffered console output shared by every thread
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*
+ * std::streambuf for a terminal or pipe that keeps a separate buffer per thread, so the
+ * console shell, server threads and remote sessions can all log through std::cout without
+ * their lines interleaving and without a write() per line.
+ * A thread's buffer is written out when it fills up (whole lines only, through writev),
+ * when that thread flushes the stream, or by flushAll(), which the shell calls before
+ * showing a prompt. Line buffered sinks (stderr) also write at every newline.
+ * When the descriptor isn't a terminal, ANSI escape sequences are dropped as they are
+ * written, so colors don't end up in files and pipes.
+ */
+class OutputSink : public std::streambuf {
+public:
+    enum Mode { FullyBuffered, LineBuffered };
+
+    OutputSink(int fd, Mode mode, size_t bufferSize = 1 << 16);
+    ~OutputSink() override;
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    int fd() const { return fileDescriptor; }
+    bool colors() const { return keepEscapes; }
+
+    // Writes out what every thread has buffered. Returns 0, or -1 if a write failed.
+    int flushAll();
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    struct Buffer {
+        std::mutex mutex;
+        std::string data;
+        int escape = 0;  // Progress through an escape sequence being dropped
+    };
+
+    Buffer& local();
+    void append(Buffer& buffer, const char* s, size_t n);
+    int flush(Buffer& buffer, bool partialLine);
+    int writeOut(const char* first, size_t firstLength, const char* second, size_t secondLength);
+
+    int fileDescriptor;
+    Mode mode;
+    size_t bufferSize;
+    bool keepEscapes;
+    uint64_t id;
+
+    std::mutex buffersMutex;
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    std::mutex writeMutex;
+
+    static std::atomic<uint64_t> nextId;
+};
+
+// Puts std::cout and std::cerr on OutputSinks for stdout and stderr. Call once, at startup.
+void installConsoleOutput();
+// Writes out everything buffered for stdout and stderr by any thread
+void flushConsoleOutput();
+
+#endif // OUTPUT_H
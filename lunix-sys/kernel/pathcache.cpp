@@ -0,0 +1,171 @@
+// pathcache.cpp; PATH search and command location cache for lsh
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "pathcache.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PathCache& pathCache() {
+    static PathCache cache;
+    return cache;
+}
+
+PathCache::PathCache() {}
+
+PathCache::~PathCache() {
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+    }
+}
+
+void PathCache::setPath(const std::string& path, const std::string& base) {
+    std::lock_guard<std::mutex> lock(mutex);
+    spec = path;
+    dirs.clear();
+
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::string dir = path.substr(start, end - start);
+        if (!dir.empty()) {
+            if (dir[0] != '/') {
+                dir = base + "/" + dir;
+            }
+            if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+                dirs.push_back(dir);
+            }
+        }
+        start = end + 1;
+    }
+
+    cache.clear();
+    watch();
+}
+
+std::string PathCache::path() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return spec;
+}
+
+std::vector<std::string> PathCache::directories() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dirs;
+}
+
+std::string PathCache::lookup(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    drainEvents();
+
+    auto it = cache.find(name);
+    if (it != cache.end()) {
+        // Without inotify nothing tells us the file went away
+        if (inotifyFd >= 0 || access(it->second.path.c_str(), X_OK) == 0) {
+            if (!it->second.path.empty()) {
+                it->second.hits++;
+            }
+            return it->second.path;
+        }
+        cache.erase(it);
+    }
+
+    std::string found = probe(name);
+    if (!found.empty() || allWatched) {
+        Entry& entry = cache[name];
+        entry.name = name;
+        entry.path = found;
+        entry.hits = found.empty() ? 0 : 1;
+    }
+    return found;
+}
+
+void PathCache::forget(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.erase(name);
+}
+
+void PathCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.clear();
+}
+
+std::vector<PathCache::Entry> PathCache::entries() {
+    std::lock_guard<std::mutex> lock(mutex);
+    drainEvents();
+
+    std::vector<Entry> result;
+    for (const auto& [name, entry] : cache) {
+        if (!entry.path.empty()) {
+            result.push_back(entry);
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+    return result;
+}
+
+std::string PathCache::probe(const std::string& name) const {
+    if (name.empty() || name.find('/') != std::string::npos) {
+        return "";
+    }
+    for (const std::string& dir : dirs) {
+        std::string candidate = dir + "/" + name;
+        struct stat st;
+        if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+    }
+    return "";
+}
+
+void PathCache::watch() {
+    if (inotifyFd >= 0) {
+        close(inotifyFd);  // Drops the watches on the old directories too
+    }
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    allWatched = inotifyFd >= 0;
+    if (inotifyFd < 0) {
+        return;
+    }
+
+    const uint32_t events = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    for (const std::string& dir : dirs) {
+        // A directory that doesn't exist yet could appear later, so misses can't be trusted
+        if (inotify_add_watch(inotifyFd, dir.c_str(), events) < 0) {
+            allWatched = false;
+        }
+    }
+}
+
+void PathCache::drainEvents() {
+    if (inotifyFd < 0) {
+        return;
+    }
+
+    alignas(struct inotify_event) char buffer[4096];
+    bool rewatch = false;
+    ssize_t len;
+    while ((len = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + len;) {
+            auto* event = reinterpret_cast<struct inotify_event*>(p);
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                rewatch = true;
+            } else if (event->len > 0) {
+                // A new file can shadow a later directory, so drop hits and misses alike
+                cache.erase(event->name);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (rewatch) {
+        cache.clear();
+        watch();
+    }
+}
@@ -0,0 +1,61 @@
+// pathcache.h; PATH search and command location cache for lsh
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Resolves bare command names against a colon separated search path, like bash's hash table.
+ * The first lookup of a name probes the directories in order; the result (including
+ * "not found") is remembered, so later lookups are a single hash map hit.
+ * The directories are watched with inotify and any create, delete, rename or chmod of a
+ * name drops just that entry, so the cache never has to be cleared by hand. Without
+ * inotify, hits are re-checked with access() and misses are not cached.
+ */
+class PathCache {
+public:
+    PathCache();
+    ~PathCache();
+
+    // Relative entries in path are taken relative to base (the rootfs)
+    void setPath(const std::string& path, const std::string& base);
+    std::string path();
+    // The search path's directories, in order, with relative ones resolved
+    std::vector<std::string> directories();
+
+    // Full path of the executable for name, or "" if it isn't in any directory
+    std::string lookup(const std::string& name);
+
+    void forget(const std::string& name);
+    void clear();
+
+    struct Entry {
+        std::string name;
+        std::string path;
+        unsigned hits = 0;
+    };
+    // Remembered commands (found ones only), sorted by name
+    std::vector<Entry> entries();
+
+private:
+    std::string probe(const std::string& name) const;
+    void watch();
+    void drainEvents();
+
+    std::string spec;
+    std::vector<std::string> dirs;
+    std::unordered_map<std::string, Entry> cache;
+    std::mutex mutex;
+
+    int inotifyFd = -1;
+    bool allWatched = false;  // Misses are only cached when every directory is watched
+};
+
+PathCache& pathCache();
+
+#endif // PATHCACHE_H
@@ -0,0 +1,296 @@
+// pipeline.cpp; lsh pipelines and redirection (|, <, >, >>)
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "pipeline.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "commands.h"
+#include "disk/disk.h"
+#include "kernel/kernel.h"
+#include "fdstream.h"
+#include "pathcache.h"
+#include "ringbuffer.h"
+#include "session.h"
+
+extern kernel Kernel;
+extern disk Disk;
+
+namespace {
+
+// Where a stage reads from or writes to
+struct Endpoint {
+    enum Kind { SessionStream, Descriptor, Ring } kind = SessionStream;
+    int fd = -1;  // Descriptor: owned by the stage and closed when it is done with it
+    std::shared_ptr<RingBuffer> ring;
+};
+
+void releaseInput(Endpoint& endpoint) {
+    if (endpoint.kind == Endpoint::Descriptor && endpoint.fd >= 0) {
+        close(endpoint.fd);
+    } else if (endpoint.kind == Endpoint::Ring) {
+        endpoint.ring->closeReader();
+    }
+    endpoint = Endpoint();
+}
+
+void releaseOutput(Endpoint& endpoint) {
+    if (endpoint.kind == Endpoint::Descriptor && endpoint.fd >= 0) {
+        close(endpoint.fd);
+    } else if (endpoint.kind == Endpoint::Ring) {
+        endpoint.ring->closeWriter();
+    }
+    endpoint = Endpoint();
+}
+
+}
+
+Pipeline::Pipeline(Runner runBuiltin) : runBuiltin(std::move(runBuiltin)) {}
+
+bool Pipeline::parse(CommandLine& line, std::string& error) {
+    stages.clear();
+    stages.emplace_back();
+
+    char** argv = line.argv();
+    for (int i = 0; i < line.argc(); ++i) {
+        if (!line.isOperator(i)) {
+            stages.back().argv.push_back(argv[i]);
+            continue;
+        }
+
+        std::string op = argv[i];
+        if (op == "|") {
+            if (stages.back().argv.empty()) {
+                error = "syntax error near '|'";
+                return false;
+            }
+            stages.emplace_back();
+            continue;
+        }
+
+        if (i + 1 >= line.argc() || line.isOperator(i + 1)) {
+            error = "syntax error: expected a file after '" + op + "'";
+            return false;
+        }
+        if (op == "<") {
+            stages.back().input = argv[++i];
+        } else {
+            stages.back().output = argv[++i];
+            stages.back().append = op == ">>";
+        }
+    }
+
+    for (PipelineStage& stage : stages) {
+        if (stage.argv.empty()) {
+            error = "syntax error: missing command";
+            return false;
+        }
+        const Command* command = commandRegistry().find(stage.argv[0]);
+        stage.builtin = command != nullptr;
+        stage.spawns = command != nullptr && command->spawns;
+        stage.argv.push_back(nullptr);
+    }
+    return true;
+}
+
+int Pipeline::run(Session& session) {
+    size_t n = stages.size();
+
+    // Resolve every program up front so a typo doesn't leave half a pipeline running
+    for (PipelineStage& stage : stages) {
+        if (stage.builtin) {
+            continue;
+        }
+        stage.program = strchr(stage.argv[0], '/') != nullptr ? stage.argv[0] : pathCache().lookup(stage.argv[0]);
+        if (stage.program.empty()) {
+            session.out << "Command not found: " << stage.argv[0] << std::endl;
+            return 127;
+        }
+    }
+
+    std::vector<Endpoint> inputs(n), outputs(n);
+    auto releaseAll = [&]() {
+        for (size_t i = 0; i < n; ++i) {
+            releaseInput(inputs[i]);
+            releaseOutput(outputs[i]);
+        }
+    };
+
+    // Builtin to builtin stays in memory; anything touching a child process is a real pipe
+    auto inMemory = [](const PipelineStage& stage) { return stage.builtin && !stage.spawns; };
+    for (size_t i = 0; i + 1 < n; ++i) {
+        if (inMemory(stages[i]) && inMemory(stages[i + 1])) {
+            auto ring = std::make_shared<RingBuffer>();
+            outputs[i].kind = Endpoint::Ring;
+            outputs[i].ring = ring;
+            inputs[i + 1].kind = Endpoint::Ring;
+            inputs[i + 1].ring = ring;
+        } else {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                session.err << "Error: pipe: " << strerror(errno) << std::endl;
+                releaseAll();
+                return 1;
+            }
+            outputs[i] = {Endpoint::Descriptor, fds[1], nullptr};
+            inputs[i + 1] = {Endpoint::Descriptor, fds[0], nullptr};
+        }
+    }
+
+    // Redirections replace whatever the stage was connected to
+    for (size_t i = 0; i < n; ++i) {
+        const PipelineStage& stage = stages[i];
+        if (stage.input != nullptr) {
+            int fd = openat(session.cwdFd(), stage.input, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                session.err << stage.input << ": " << strerror(errno) << std::endl;
+                releaseAll();
+                return 1;
+            }
+            releaseInput(inputs[i]);
+            inputs[i] = {Endpoint::Descriptor, fd, nullptr};
+        }
+        if (stage.output != nullptr) {
+            // Truncate only once the file is known not to be protected; a file created here is removed again if it is
+            int flags = O_WRONLY | O_CLOEXEC | (stage.append ? O_APPEND : 0);
+            bool created = true;
+            int fd = openat(session.cwdFd(), stage.output, flags | O_CREAT | O_EXCL, 0644);
+            if (fd < 0 && errno == EEXIST) {
+                created = false;
+                fd = openat(session.cwdFd(), stage.output, flags);
+            }
+            if (fd < 0) {
+                session.err << stage.output << ": " << strerror(errno) << std::endl;
+                releaseAll();
+                return 1;
+            }
+            struct stat st;
+            if (!session.user.isRoot() && fstat(fd, &st) == 0 && Disk.isProtected(st)) {
+                if (created) {
+                    unlinkat(session.cwdFd(), stage.output, 0);
+                }
+                close(fd);
+                session.err << "Permission denied: " << stage.output << " is a protected file.\n";
+                releaseAll();
+                return 1;
+            }
+            if (!stage.append && ftruncate(fd, 0) != 0 && errno != EINVAL) {
+                session.err << stage.output << ": " << strerror(errno) << std::endl;
+                close(fd);
+                releaseAll();
+                return 1;
+            }
+            releaseOutput(outputs[i]);
+            outputs[i] = {Endpoint::Descriptor, fd, nullptr};
+        }
+    }
+
+    session.out.flush();  // Keep earlier output ahead of the children's
+
+    std::vector<int> statuses(n, 0);
+    std::vector<pid_t> pids(n, -1);
+    std::vector<std::ostringstream> errors(n);
+
+    auto runStage = [&](size_t i, std::ostream& err) {
+        std::unique_ptr<std::streambuf> inBuffer, outBuffer;
+        int inFd = session.inFd;
+        int outFd = session.outFd;
+
+        if (inputs[i].kind == Endpoint::Ring) {
+            inBuffer = std::make_unique<RingStreamBuf>(*inputs[i].ring);
+            inFd = -1;
+        } else if (inputs[i].kind == Endpoint::Descriptor) {
+            inBuffer = std::make_unique<FdStreamBuf>(inputs[i].fd, 1 << 16);
+            inFd = inputs[i].fd;
+        }
+        if (outputs[i].kind == Endpoint::Ring) {
+            outBuffer = std::make_unique<RingStreamBuf>(*outputs[i].ring);
+            outFd = -1;
+        } else if (outputs[i].kind == Endpoint::Descriptor) {
+            outBuffer = std::make_unique<FdStreamBuf>(outputs[i].fd, 1 << 16);
+            outFd = outputs[i].fd;
+        }
+
+        std::istream in(inBuffer ? inBuffer.get() : session.in.rdbuf());
+        std::ostream out(outBuffer ? outBuffer.get() : session.out.rdbuf());
+        {
+            Session stageSession(session, in, out, err, inFd, outFd);
+            statuses[i] = runBuiltin(stageSession, static_cast<int>(stages[i].argv.size()) - 1, stages[i].argv.data());
+        }
+
+        // Flush before closing, so the next stage sees all of the data and then EOF
+        out.flush();
+        outBuffer.reset();
+        inBuffer.reset();
+        releaseOutput(outputs[i]);
+        releaseInput(inputs[i]);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n; ++i) {
+        if (stages[i].builtin) {
+            if (i + 1 < n) {
+                threads.emplace_back([&, i] { runStage(i, errors[i]); });
+            }
+            continue;
+        }
+
+        SpawnOptions options;
+        options.cwdFd = session.cwdFd();
+        options.inFd = inputs[i].kind == Endpoint::Descriptor ? inputs[i].fd : session.inFd;
+        options.outFd = outputs[i].kind == Endpoint::Descriptor ? outputs[i].fd : session.outFd;
+        options.errFd = session.outFd != STDOUT_FILENO ? session.outFd : -1;
+        options.owner = session.user.getUsername();
+        pid_t pid = Kernel.exec(stages[i].program, stages[i].argv.data(), options);
+        if (pid < 0) {
+            errors[i] << "Error: Fork failed" << std::endl;
+            statuses[i] = -1;
+        }
+        pids[i] = pid;
+
+        // The child has its own copies now
+        releaseInput(inputs[i]);
+        releaseOutput(outputs[i]);
+    }
+
+    // A builtin at the end runs on this thread, writing straight to the session
+    if (stages[n - 1].builtin) {
+        runStage(n - 1, session.err);
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (pids[i] <= 0) {
+            continue;
+        }
+        int status;
+        struct rusage usage = {};
+        if (Kernel.wait(pids[i], status, &usage) != 0) {
+            statuses[i] = -1;
+            continue;
+        }
+        session.addChildUsage(usage);
+        statuses[i] = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        std::string text = errors[i].str();
+        if (!text.empty()) {
+            session.err << text;
+        }
+    }
+    session.out.flush();
+    return statuses[n - 1];
+}
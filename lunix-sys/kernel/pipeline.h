@@ -0,0 +1,49 @@
+// pipeline.h; lsh pipelines and redirection (|, <, >, >>)
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Session;
+class CommandLine;
+
+struct PipelineStage {
+    std::vector<char*> argv;         // null terminated; points into the CommandLine buffer
+    const char* input = nullptr;     // < file
+    const char* output = nullptr;    // > or >> file
+    bool append = false;
+    bool builtin = false;
+    bool spawns = false;             // A builtin that starts child processes (mod, time, nano)
+    std::string program;             // file to execute for an external stage
+};
+
+/*
+ * Runs a command line such as "cat log | sort > out" without /bin/sh.
+ * Builtin stages run on their own threads in a copy of the session and talk to each
+ * other through bounded in-memory ring buffers. Any connection that involves an
+ * external program, or a builtin that starts one, is a pipe2() pipe handed to the
+ * child as stdin/stdout, so data only passes through the kernel. Memory use is
+ * bounded by the ring and pipe sizes.
+ */
+class Pipeline {
+public:
+    using Runner = std::function<int(Session& session, int argc, char** argv)>;
+
+    explicit Pipeline(Runner runBuiltin);
+
+    // Split line at | and collect redirections. On a syntax error, sets error and returns false.
+    bool parse(CommandLine& line, std::string& error);
+
+    // Returns the exit status of the last stage
+    int run(Session& session);
+
+private:
+    std::vector<PipelineStage> stages;
+    Runner runBuiltin;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,96 @@
+// ringbuffer.cpp; Bounded in-memory pipe between threads
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "ringbuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+RingBuffer::RingBuffer(size_t capacity) : ring(capacity) {}
+
+size_t RingBuffer::write(const char* data, size_t size) {
+    size_t written = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (written < size) {
+        changed.wait(lock, [this] { return readerClosed || count < ring.size(); });
+        if (readerClosed) {
+            break;
+        }
+
+        size_t tail = (head + count) % ring.size();
+        size_t chunk = std::min({size - written, ring.size() - count, ring.size() - tail});
+        memcpy(ring.data() + tail, data + written, chunk);
+        count += chunk;
+        written += chunk;
+        changed.notify_all();
+    }
+    return written;
+}
+
+size_t RingBuffer::read(char* data, size_t size) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return writerClosed || count > 0; });
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t chunk = std::min({size, count, ring.size() - head});
+    memcpy(data, ring.data() + head, chunk);
+    head = (head + chunk) % ring.size();
+    count -= chunk;
+    changed.notify_all();
+    return chunk;
+}
+
+void RingBuffer::closeWriter() {
+    std::lock_guard<std::mutex> lock(mutex);
+    writerClosed = true;
+    changed.notify_all();
+}
+
+void RingBuffer::closeReader() {
+    std::lock_guard<std::mutex> lock(mutex);
+    readerClosed = true;
+    count = 0;
+    changed.notify_all();
+}
+
+RingStreamBuf::RingStreamBuf(RingBuffer& ring, size_t bufferSize)
+    : ring(ring), inBuffer(bufferSize), outBuffer(bufferSize) {
+    setg(inBuffer.data(), inBuffer.data(), inBuffer.data());
+    setp(outBuffer.data(), outBuffer.data() + outBuffer.size());
+}
+
+RingStreamBuf::~RingStreamBuf() {
+    sync();
+}
+
+RingStreamBuf::int_type RingStreamBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    size_t n = ring.read(inBuffer.data(), inBuffer.size());
+    if (n == 0) {
+        return traits_type::eof();
+    }
+    setg(inBuffer.data(), inBuffer.data(), inBuffer.data() + n);
+    return traits_type::to_int_type(*gptr());
+}
+
+RingStreamBuf::int_type RingStreamBuf::overflow(int_type ch) {
+    if (sync() != 0) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int RingStreamBuf::sync() {
+    size_t pending = pptr() - pbase();
+    size_t written = pending == 0 ? 0 : ring.write(pbase(), pending);
+    setp(outBuffer.data(), outBuffer.data() + outBuffer.size());
+    return written == pending ? 0 : -1;
+}
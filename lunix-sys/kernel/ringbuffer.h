@@ -0,0 +1,56 @@
+// ringbuffer.h; Bounded in-memory pipe between threads
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <vector>
+
+/*
+ * Fixed-capacity byte ring with pipe semantics: writers block while it is full,
+ * readers block while it is empty, and closing either end wakes the other
+ * (EOF for the reader, a failed write for the writer).
+ */
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity = 1 << 16);
+
+    // Returns the number of bytes written; less than size only if the reader has gone away
+    size_t write(const char* data, size_t size);
+    // Returns 0 at end of stream
+    size_t read(char* data, size_t size);
+
+    void closeWriter();
+    void closeReader();
+
+private:
+    std::vector<char> ring;
+    size_t head = 0;   // next byte to read
+    size_t count = 0;  // bytes stored
+    bool writerClosed = false;
+    bool readerClosed = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+// std::streambuf over one end of a RingBuffer, so builtins can use it as in/out
+class RingStreamBuf : public std::streambuf {
+public:
+    RingStreamBuf(RingBuffer& ring, size_t bufferSize = 4096);
+    ~RingStreamBuf() override;
+
+protected:
+    int_type underflow() override;
+    int_type overflow(int_type ch) override;
+    int sync() override;
+
+private:
+    RingBuffer& ring;
+    std::vector<char> inBuffer;
+    std::vector<char> outBuffer;
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,237 @@
+// userdb.cpp
+#include "userdb.h"
+#include "../kernel/klog.h"
+
+#include <iostream>
+#include <filesystem>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+namespace fs = std::filesystem;
+
+UserDatabase::UserDatabase(const std::string& path) : path(path) {}
+
+UserDatabase::~UserDatabase() {
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+    }
+}
+
+bool UserDatabase::exists() const {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+bool UserDatabase::lookup(const std::string& username, std::string& hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reloadIfChanged();
+
+    auto it = entries.find(username);
+    if (it == entries.end()) {
+        return false;
+    }
+    hash = it->second;
+    return true;
+}
+
+int UserDatabase::set(const std::string& username, const std::string& hash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    reloadIfChanged();
+
+    entries[username] = hash;
+    return writeAtomic();
+}
+
+size_t UserDatabase::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    reloadIfChanged();
+    return entries.size();
+}
+
+void UserDatabase::watch() {
+    // Resolve the path once so later working directory changes don't move the database
+    fs::path absolute = fs::absolute(path);
+    path = absolute.string();
+    fileName = absolute.filename().string();
+
+    // Watch the directory rather than the file, since atomic writes replace the inode
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        return;  // Fall back to stat checks
+    }
+    std::string dir = absolute.parent_path().string();
+    if (inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+}
+
+bool UserDatabase::changedOnDisk() {
+    if (inotifyFd >= 0) {
+        // Drain pending events; only a touch of our file needs the stat comparison below
+        alignas(struct inotify_event) char buffer[4096];
+        bool touched = false;
+        ssize_t len;
+        while ((len = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + len;) {
+                auto* event = reinterpret_cast<struct inotify_event*>(p);
+                if (event->len > 0 && fileName == event->name) {
+                    touched = true;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (!touched) {
+            return false;
+        }
+    }
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return loadedIno != 0;  // File was removed
+    }
+    return st.st_ino != loadedIno || st.st_size != loadedSize ||
+           st.st_mtim.tv_sec != loadedMtime.tv_sec || st.st_mtim.tv_nsec != loadedMtime.tv_nsec;
+}
+
+void UserDatabase::reloadIfChanged() {
+    if (!loaded) {
+        watch();
+        load();
+        loaded = true;
+    } else if (changedOnDisk()) {
+        load();
+    }
+}
+
+int UserDatabase::load() {
+    entries.clear();
+    malformed.clear();
+    loadedIno = 0;
+    loadedSize = 0;
+    loadedMtime = {0, 0};
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+
+    std::string data(static_cast<size_t>(st.st_size), '\0');
+    size_t total = 0;
+    while (total < data.size()) {
+        ssize_t n = read(fd, &data[total], data.size() - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        total += static_cast<size_t>(n);
+    }
+    close(fd);
+    data.resize(total);
+
+    loadedIno = st.st_ino;
+    loadedSize = st.st_size;
+    loadedMtime = st.st_mtim;
+
+    // Each line is "<username>.<hash>"; later lines win, as they did with the append-only file
+    size_t parsed = 0;
+    size_t line = 0;
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (eol == nullptr) {
+            eol = end;
+        }
+        line++;
+        const char* dot = static_cast<const char*>(memchr(p, '.', eol - p));
+        if (dot != nullptr && dot != p) {
+            entries[std::string(p, dot)] = std::string(dot + 1, eol);
+            parsed++;
+        } else if (eol != p) {
+            // Only the line number: the line may hold a hash
+            klog(LogLevel::Warning, "auth", path + ":" + std::to_string(line) + ": malformed entry ignored");
+            malformed.emplace_back(p, eol);
+        }
+        p = eol + 1;
+    }
+
+    // Compact files left behind by the old append-only setPassword
+    if (parsed != entries.size()) {
+        writeAtomic();
+    }
+    return 0;
+}
+
+int UserDatabase::writeAtomic() {
+    std::string data;
+    size_t needed = 0;
+    for (const auto& [user, hash] : entries) {
+        needed += user.size() + hash.size() + 2;
+    }
+    data.reserve(needed);
+    for (const auto& [user, hash] : entries) {
+        data += user;
+        data += '.';
+        data += hash;
+        data += '\n';
+    }
+    for (const std::string& line : malformed) {
+        data += line;
+        data += '\n';
+    }
+
+    std::string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        std::cerr << "Unable to open password file.\n";
+        return 1;
+    }
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    if (written != data.size() || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmpPath.c_str());
+        std::cerr << "Unable to write password file.\n";
+        return 1;
+    }
+    close(fd);
+
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        std::cerr << "Unable to replace password file.\n";
+        return 1;
+    }
+
+    // Remember what we wrote so our own rename doesn't trigger a reload
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        loadedIno = st.st_ino;
+        loadedSize = st.st_size;
+        loadedMtime = st.st_mtim;
+    }
+    return 0;
+}
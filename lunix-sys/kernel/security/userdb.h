@@ -0,0 +1,56 @@
+// userdb.h
+#ifndef USERDB_H
+#define USERDB_H
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include <ctime>
+
+/*
+ * In-memory index of the .passwd file.
+ * The file is loaded once into a hash map and only reloaded when it changes on disk
+ * (inotify on the containing directory, falling back to an mtime/inode check).
+ * Updates replace the entry in place and rewrite the file atomically (temp file + rename),
+ * so the file never accumulates stale entries.
+ */
+class UserDatabase {
+public:
+    explicit UserDatabase(const std::string& path = ".passwd");
+    ~UserDatabase();
+
+    bool exists() const;
+
+    // Copies the stored hash of username into hash. Returns false if the user is unknown.
+    bool lookup(const std::string& username, std::string& hash);
+
+    // Adds or replaces the entry for username. Returns 0 on success.
+    int set(const std::string& username, const std::string& hash);
+
+    size_t size();
+
+private:
+    void reloadIfChanged();
+    bool changedOnDisk();
+    int load();
+    int writeAtomic();
+    void watch();
+
+    std::string path;
+    std::string fileName;
+    std::unordered_map<std::string, std::string> entries;
+    std::vector<std::string> malformed;  // Lines load() couldn't parse, written back as they were
+    std::mutex mutex;
+
+    bool loaded = false;
+    int inotifyFd = -1;
+
+    // Identity of the file contents currently held in memory
+    ino_t loadedIno = 0;
+    off_t loadedSize = 0;
+    struct timespec loadedMtime = {0, 0};
+};
+
+#endif // USERDB_H
@@ -1,96 +1,183 @@
 // userman.cpp
 #include "userman.h"
+#include "userdb.h"
+#include "../kernel/eventbus.h"
+#include "../kernel/klog.h"
 
 #include <termios.h>
-#include <thread>
 #include <unistd.h>
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
-#include <openssl/sha.h>
-#include <iomanip>
-#include <filesystem>
+#include <chrono>
+#include <limits>
+#include <cerrno>
+#include <cstdlib>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <sha256.h>
 
-namespace fs = std::filesystem;
+// Shared by every UserManager so the file is indexed once per process
+static UserDatabase userDB(".passwd");
 
-static void disableEcho() {
+// Versioned hash format: $pbkdf2-sha256$<iterations>$<salt hex>$<key hex>
+// Entries without the prefix are legacy unsalted SHA-256 hex digests.
+static const std::string kdfPrefix = "$pbkdf2-sha256$";
+static const int kdfSaltLength = 16;
+static const int kdfKeyLength = 32;
+static const int kdfMinIterations = 10000;
+static const int kdfMaxIterations = 10000000;
+
+// Failed-login backoff, shared by every UserManager and keyed by username
+struct LoginBackoff {
+    int failures = 0;
+    std::chrono::steady_clock::time_point retryAfter;
+};
+static std::unordered_map<std::string, LoginBackoff> loginBackoff;
+static std::mutex loginBackoffMutex;
+// Names remote clients make up would otherwise grow the map without bound
+static const size_t loginBackoffMaxEntries = 1024;
+static const std::chrono::minutes loginBackoffForget(10);  // Failures this long past their backoff are forgotten
+
+static bool fromHex(const std::string& hex, unsigned char* out, size_t length) {
+    if (hex.size() != length * 2) {
+        return false;
+    }
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < length; ++i) {
+        int hi = nibble(hex[2 * i]);
+        int lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        out[i] = static_cast<unsigned char>((hi << 4) | lo);
+    }
+    return true;
+}
+
+static bool pbkdf2(const std::string& password, const unsigned char* salt, int iterations, unsigned char* key) {
+    return PKCS5_PBKDF2_HMAC(password.data(), static_cast<int>(password.size()), salt, kdfSaltLength,
+                             iterations, EVP_sha256(), kdfKeyLength, key) == 1;
+}
+
+static void disableEcho(int fd) {
     struct termios tty;
-    tcgetattr(STDIN_FILENO, &tty);
+    if (tcgetattr(fd, &tty) != 0) {
+        return;  // Not a terminal (remote session or pipe)
+    }
     tty.c_lflag &= ~ECHO;
-    tcsetattr(STDIN_FILENO, TCSANOW, &tty);
+    tcsetattr(fd, TCSANOW, &tty);
 }
 
-static void enableEcho() {
+static void enableEcho(int fd) {
     struct termios tty;
-    tcgetattr(STDIN_FILENO, &tty);
+    if (tcgetattr(fd, &tty) != 0) {
+        return;
+    }
     tty.c_lflag |= ECHO;
-    tcsetattr(STDIN_FILENO, TCSANOW, &tty);
+    tcsetattr(fd, TCSANOW, &tty);
 }
 
-std::string getPassword() {
-    disableEcho();
+static std::string getPassword(std::istream& in, std::ostream& out, int ttyFd) {
+    disableEcho(ttyFd);
     std::string password;
-    std::getline(std::cin, password);
-    enableEcho();
-    std::cout << std::endl;
+    std::getline(in, password);
+    if (!password.empty() && password.back() == '\r') {
+        password.pop_back();  // Line endings from remote clients
+    }
+    enableEcho(ttyFd);
+    out << std::endl;
     return password;
 }
 
 UserManager::UserManager() : currentUsername(""), isRootUser(false) {}
 
-void UserManager::initialize() {
+bool UserManager::initialize(std::istream& in, std::ostream& out, int ttyFd, bool remote) {
     if (!passwordFileExists()) {
-        createPasswordFile();
+        if (remote) {
+            out << "No users have been set up yet. Log in at the console first.\n";
+            klog(LogLevel::Notice, "auth", "Remote login refused: no password file");
+            return false;
+        }
+        createPasswordFile(in, out, ttyFd);
     }
     
     int attempts = 0;
     const int maxAttempts = 3;
     
     while (attempts < maxAttempts) {
-        if (login()) {
-            return;
+        if (login(in, out, ttyFd)) {
+            return true;
         }
-        
+
+        // Attempts rejected by the backoff count too, so a client can't keep a session busy forever
         attempts++;
         
         if (attempts < maxAttempts) {
-            std::cerr << "Login failed. Attempts remaining: " << (maxAttempts - attempts) << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(3));
+            out << "Login failed. Attempts remaining: " << (maxAttempts - attempts) << std::endl;
         }
     }
     
-    std::cerr << "Maximum login attempts exceeded. Shutting down...\n";
-    exit(1);
+    out << "Maximum login attempts exceeded.\n";
+    return false;
 }
 
-bool UserManager::login() {
+bool UserManager::login(std::istream& in, std::ostream& out, int ttyFd) {
     std::string username, password;
 
-    std::cout << "Username: ";
-    std::cin >> username;
-    std::cout << "Password: ";
-    std::cin.ignore();  // Ignore leftover newline character from std::cin
-    password = getPassword();
+    out << "Username: " << std::flush;
+    in >> username;
+    if (!in) {
+        out << "\nNo input available for login.\n";
+        return false;
+    }
+
+    int wait = backoffRemaining(username);
+    if (wait > 0) {
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        out << "Too many failed attempts for " << username << ". Try again in " << wait << " seconds.\n";
+        klog(LogLevel::Notice, "auth", "Login for " + username + " refused by the backoff");
+        return false;
+    }
+
+    out << "Password: " << std::flush;
+    in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');  // The rest of the username line, \r included
+    password = getPassword(in, out, ttyFd);
 
     if (authenticate(username, password)) {
+        recordLoginResult(username, true);
         currentUsername = username;
         isRootUser = (username == "root");
+        eventBus().publish(EventType::Login, username);
+        klog(LogLevel::Info, "auth", username + " logged in");
         return true;
     }
 
-    std::cerr << "Invalid username or password.\n";
+    recordLoginResult(username, false);
+    klog(LogLevel::Notice, "auth", "Failed login for " + username);
+    out << "Invalid username or password.\n";
     return false;
 }
 
-void UserManager::setPassword(const std::string& username, const std::string& password) {
-    std::ofstream passwordFile(".passwd", std::ios::app);
-    if (passwordFile.is_open()) {
-        passwordFile << username << "." << hashPassword(password) << "\n";
-        passwordFile.close();
-    } else {
-        std::cerr << "Unable to open password file.\n";
+void UserManager::loginUnprivileged(const std::string& username) {
+    currentUsername = username;
+    isRootUser = false;
+}
+
+int UserManager::setPassword(const std::string& username, const std::string& password) {
+    std::string hash;
+    if (!hashPassword(password, hash)) {
+        return EIO;
     }
+    return userDB.set(username, hash) == 0 ? 0 : EIO;
 }
 
 std::string UserManager::getUsername() const {
@@ -101,55 +188,161 @@ bool UserManager::isRoot() const {
     return isRootUser;
 }
 
-void UserManager::createPasswordFile() {
-    std::ofstream passwordFile(".passwd");
-    if (passwordFile.is_open()) {
-        std::string rootPassword;
-        std::cout << "No password file found. Create a password for root: ";
-        rootPassword = getPassword();
-        passwordFile << "root." << hashPassword(rootPassword) << "\n";
-        passwordFile.close();
-    } else {
+void UserManager::createPasswordFile(std::istream& in, std::ostream& out, int ttyFd) {
+    std::string rootPassword;
+    out << "No password file found. Create a password for root: " << std::flush;
+    rootPassword = getPassword(in, out, ttyFd);
+    if (setPassword("root", rootPassword) != 0) {
         std::cerr << "Unable to create password file.\n";
     }
 }
 
 bool UserManager::authenticate(const std::string& username, const std::string& password) {
-    std::ifstream passwordFile(".passwd");
-    std::string line;
-
-    if (passwordFile.is_open()) {
-        std::string user, hash;
-        std::string passwordHash = hashPassword(password);
-
-        while (getline(passwordFile, line)) {
-            std::istringstream iss(line);
-            getline(iss, user, '.');
-            getline(iss, hash);
-
-            if (user == username && hash == passwordHash) {
-                passwordFile.close();
-                return true;
-            }
+    std::string storedHash;
+    if (!userDB.lookup(username, storedHash)) {
+        return false;
+    }
+    if (!verifyPassword(password, storedHash)) {
+        return false;
+    }
+
+    // Transparently move legacy or under-cost entries to the current KDF parameters
+    // The old entry stays if hashing fails; it still works
+    std::string hash;
+    if (needsRehash(storedHash) && hashPassword(password, hash)) {
+        userDB.set(username, hash);
+    }
+    return true;
+}
+
+int UserManager::kdfIterations() {
+    static int iterations = calibrateKdf();
+    return iterations;
+}
+
+int UserManager::calibrateKdf() {
+    int targetMs = loginLatencyTargetMs;
+    if (const char* env = std::getenv("LUNIX_LOGIN_LATENCY_MS")) {
+        int value = std::atoi(env);
+        if (value > 0) {
+            targetMs = value;
         }
-        passwordFile.close();
     }
 
-    return false;
+    // Time a small probe run and scale it linearly to the latency target
+    const int probeIterations = 4096;
+    unsigned char salt[kdfSaltLength] = {0};
+    unsigned char key[kdfKeyLength];
+    auto start = std::chrono::steady_clock::now();
+    pbkdf2("calibration", salt, probeIterations, key);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if (elapsed <= 0) {
+        elapsed = 1;
+    }
+
+    long long iterations = static_cast<long long>(probeIterations) * targetMs * 1000 / elapsed;
+    if (iterations < kdfMinIterations) {
+        iterations = kdfMinIterations;
+    } else if (iterations > kdfMaxIterations) {
+        iterations = kdfMaxIterations;
+    }
+    return static_cast<int>(iterations);
 }
 
-std::string UserManager::hashPassword(const std::string& password) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256(reinterpret_cast<const unsigned char*>(password.c_str()), password.length(), hash);
+bool UserManager::hashPassword(const std::string& password, std::string& hash) {
+    unsigned char salt[kdfSaltLength];
+    unsigned char key[kdfKeyLength];
+    int iterations = kdfIterations();
 
-    std::ostringstream result;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
-        result << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
+    if (RAND_bytes(salt, kdfSaltLength) != 1 || !pbkdf2(password, salt, iterations, key)) {
+        klog(LogLevel::Error, "auth", "Failed to hash password");
+        return false;
     }
 
-    return result.str();
+    hash = kdfPrefix + std::to_string(iterations) + "$" + toHex(salt, kdfSaltLength) + "$" + toHex(key, kdfKeyLength);
+    return true;
+}
+
+bool UserManager::verifyPassword(const std::string& password, const std::string& storedHash) {
+    if (storedHash.compare(0, kdfPrefix.size(), kdfPrefix) != 0) {
+        // Legacy entry: single unsalted SHA-256 pass
+        std::string hex = sha256Hex(password);
+        return hex.size() == storedHash.size() && CRYPTO_memcmp(hex.data(), storedHash.data(), hex.size()) == 0;
+    }
+
+    size_t iterEnd = storedHash.find('$', kdfPrefix.size());
+    size_t saltEnd = iterEnd == std::string::npos ? std::string::npos : storedHash.find('$', iterEnd + 1);
+    if (saltEnd == std::string::npos) {
+        return false;
+    }
+
+    int iterations = std::atoi(storedHash.substr(kdfPrefix.size(), iterEnd - kdfPrefix.size()).c_str());
+    unsigned char salt[kdfSaltLength];
+    unsigned char expected[kdfKeyLength];
+    unsigned char key[kdfKeyLength];
+    if (iterations <= 0 ||
+        !fromHex(storedHash.substr(iterEnd + 1, saltEnd - iterEnd - 1), salt, kdfSaltLength) ||
+        !fromHex(storedHash.substr(saltEnd + 1), expected, kdfKeyLength) ||
+        !pbkdf2(password, salt, iterations, key)) {
+        return false;
+    }
+    return CRYPTO_memcmp(key, expected, kdfKeyLength) == 0;
+}
+
+bool UserManager::needsRehash(const std::string& storedHash) {
+    if (storedHash.compare(0, kdfPrefix.size(), kdfPrefix) != 0) {
+        return true;
+    }
+    // Calibration jitter shouldn't rewrite .passwd on every login, only a real cost drop
+    int iterations = std::atoi(storedHash.c_str() + kdfPrefix.size());
+    return iterations < kdfIterations() / 2;
+}
+
+int UserManager::backoffRemaining(const std::string& username) {
+    std::lock_guard<std::mutex> lock(loginBackoffMutex);
+    auto it = loginBackoff.find(username);
+    if (it == loginBackoff.end()) {
+        return 0;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= it->second.retryAfter) {
+        return 0;
+    }
+    return static_cast<int>(std::chrono::ceil<std::chrono::seconds>(it->second.retryAfter - now).count());
+}
+
+void UserManager::recordLoginResult(const std::string& username, bool success) {
+    std::lock_guard<std::mutex> lock(loginBackoffMutex);
+    if (success) {
+        loginBackoff.erase(username);
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (loginBackoff.find(username) == loginBackoff.end() && loginBackoff.size() >= loginBackoffMaxEntries) {
+        std::erase_if(loginBackoff, [now](const auto& item) { return now - item.second.retryAfter >= loginBackoffForget; });
+        if (loginBackoff.size() >= loginBackoffMaxEntries) {
+            // Still full of recent failures: drop the one whose backoff ends first
+            auto oldest = std::min_element(loginBackoff.begin(), loginBackoff.end(), [](const auto& a, const auto& b) {
+                return a.second.retryAfter < b.second.retryAfter;
+            });
+            loginBackoff.erase(oldest);
+        }
+    }
+
+    // 1s, 2s, 4s, ... capped at loginBackoffMaxSeconds
+    LoginBackoff& entry = loginBackoff[username];
+    if (entry.failures > 0 && now - entry.retryAfter >= loginBackoffForget) {
+        entry.failures = 0;
+    }
+    entry.failures++;
+    int delay = loginBackoffMaxSeconds;
+    if (entry.failures <= 16) {
+        delay = std::min(1 << (entry.failures - 1), loginBackoffMaxSeconds);
+    }
+    entry.retryAfter = now + std::chrono::seconds(delay);
 }
 
 bool UserManager::passwordFileExists() const {
-    return fs::exists(".passwd");
+    return userDB.exists();
 }
@@ -3,13 +3,21 @@
 #define USERMAN_H
 
 #include <string>
+#include <iostream>
+#include <unistd.h>
 
 class UserManager {
 public:
     UserManager();
-    void initialize();
-    bool login();
-    void setPassword(const std::string& username, const std::string& password);
+    // Runs the login prompt on the given streams; ttyFd is used to hide password echo.
+    // Returns false once the allowed attempts are used up or input ends.
+    // Only the console (remote false) may create the password file; remote logins are refused until it exists.
+    bool initialize(std::istream& in = std::cin, std::ostream& out = std::cout, int ttyFd = STDIN_FILENO, bool remote = false);
+    bool login(std::istream& in, std::ostream& out, int ttyFd);
+    // Non-interactive identity for batch runs: never root, no password
+    void loginUnprivileged(const std::string& username);
+    // Returns 0, or an errno value if the password couldn't be hashed or stored; nothing is written then
+    int setPassword(const std::string& username, const std::string& password);
     std::string getUsername() const;
     bool isRoot() const;
 
@@ -17,10 +25,24 @@ private:
     std::string currentUsername;
     bool isRootUser;
 
-    void createPasswordFile();
+    // Target time for one password hash; LUNIX_LOGIN_LATENCY_MS overrides it
+    const int loginLatencyTargetMs = 100;
+    const int loginBackoffMaxSeconds = 60;
+
+    void createPasswordFile(std::istream& in, std::ostream& out, int ttyFd);
     bool passwordFileExists() const;
     bool authenticate(const std::string& username, const std::string& password);
-    std::string hashPassword(const std::string& password);
+    // False if no salt or key could be derived; hash is left alone then
+    bool hashPassword(const std::string& password, std::string& hash);
+    bool verifyPassword(const std::string& password, const std::string& storedHash);
+    bool needsRehash(const std::string& storedHash);
+
+    // PBKDF2 cost calibrated once per process to fit loginLatencyTargetMs
+    int kdfIterations();
+    int calibrateKdf();
+
+    int backoffRemaining(const std::string& username);
+    void recordLoginResult(const std::string& username, bool success);
 };
 
 #endif // USERMAN_H
@@ -0,0 +1,69 @@
+// session.cpp; Per-user lsh session state
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "session.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <algorithm>
+#include <sys/time.h>
+
+Session::Session(std::istream& in, std::ostream& out, std::ostream& err, int inFd, int outFd, bool remote)
+    : in(in), out(out), err(err), inFd(inFd), outFd(outFd), remote(remote) {
+    // Sessions start in the process CWD, which the kernel sets to the rootfs at boot
+    cwdfd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+Session::Session(const Session& parent, std::istream& in, std::ostream& out, std::ostream& err, int inFd, int outFd)
+    : user(parent.user), in(in), out(out), err(err), inFd(inFd), outFd(outFd), remote(parent.remote) {
+    cwdfd = fcntl(parent.cwdfd, F_DUPFD_CLOEXEC, 0);
+}
+
+Session::~Session() {
+    if (cwdfd >= 0) {
+        close(cwdfd);
+    }
+}
+
+int Session::chdir(const std::string& path) {
+    int fd = openat(cwdfd, path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 1;
+    }
+    close(cwdfd);
+    cwdfd = fd;
+    return 0;
+}
+
+std::string Session::cwd() const {
+    char buffer[PATH_MAX];
+    std::string link = "/proc/self/fd/" + std::to_string(cwdfd);
+    ssize_t n = readlink(link.c_str(), buffer, sizeof(buffer) - 1);
+    if (n < 0) {
+        return "";
+    }
+    return std::string(buffer, n);
+}
+
+std::string Session::path(const std::string& name) const {
+    if (!name.empty() && name[0] == '/') {
+        return name;
+    }
+    return cwd() + "/" + name;
+}
+
+void Session::addChildUsage(const struct rusage& usage) {
+    if (childUsage == nullptr) {
+        return;
+    }
+    timeradd(&childUsage->ru_utime, &usage.ru_utime, &childUsage->ru_utime);
+    timeradd(&childUsage->ru_stime, &usage.ru_stime, &childUsage->ru_stime);
+    childUsage->ru_maxrss = std::max(childUsage->ru_maxrss, usage.ru_maxrss);
+    childUsage->ru_minflt += usage.ru_minflt;
+    childUsage->ru_majflt += usage.ru_majflt;
+    childUsage->ru_inblock += usage.ru_inblock;
+    childUsage->ru_oublock += usage.ru_oublock;
+    childUsage->ru_nvcsw += usage.ru_nvcsw;
+    childUsage->ru_nivcsw += usage.ru_nivcsw;
+}
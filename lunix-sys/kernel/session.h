@@ -0,0 +1,59 @@
+// session.h; Per-user lsh session state
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+
+#include "security/userman.h"
+
+/*
+ * Everything a running lsh instance needs that used to be process-global:
+ * the logged in user, the working directory and the I/O streams.
+ * The working directory is held as a directory fd and resolved with the *at() syscalls,
+ * so several sessions can run concurrently in one kernel process without touching
+ * the process-wide CWD (which stays at the rootfs).
+ */
+class Session {
+public:
+    // inFd/outFd are the descriptors behind in/out, handed to child processes as stdin/stdout
+    Session(std::istream& in, std::ostream& out, std::ostream& err, int inFd, int outFd, bool remote = false);
+    // Session for one stage of a pipeline: same user and working directory as parent, other streams.
+    // inFd/outFd may be -1 when the stream isn't backed by a descriptor.
+    Session(const Session& parent, std::istream& in, std::ostream& out, std::ostream& err, int inFd, int outFd);
+    ~Session();
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    UserManager user;
+
+    std::istream& in;
+    std::ostream& out;
+    std::ostream& err;
+    int inFd;
+    int outFd;
+    bool remote;
+
+    int lastStatus = 0;          // Exit status of the last command
+    bool exitRequested = false;  // Set by exit/shutdown to end the session loop
+
+    // While set (by time), resource usage of reaped child processes is added here
+    struct rusage* childUsage = nullptr;
+    void addChildUsage(const struct rusage& usage);
+
+    // Working directory as an O_PATH directory fd
+    int cwdFd() const { return cwdfd; }
+    int chdir(const std::string& path);
+    std::string cwd() const;
+    // name as an absolute path: relative names are taken from the working directory
+    std::string path(const std::string& name) const;
+
+private:
+    int cwdfd;
+};
+
+#endif // SESSION_H
@@ -0,0 +1,306 @@
+// completion.cpp; Tab completion for the lsh line editor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "completion.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../commands.h"
+#include "../pathcache.h"
+#include "../disk/disk.h"
+
+extern disk Disk;
+
+namespace {
+
+const size_t maxListings = 32;
+
+size_t commonLength(std::string_view a, std::string_view b) {
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+std::shared_ptr<DirectoryIndex::Listing> readListing(const std::string& path, const struct stat& st) {
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return nullptr;
+    }
+    auto listing = std::make_shared<DirectoryIndex::Listing>();
+    listing->device = st.st_dev;
+    listing->inode = st.st_ino;
+    listing->mtime = st.st_mtim;
+    int fd = dirfd(dir);
+    while (dirent* entry = readdir(dir)) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        bool directory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            // Links to directories complete like directories
+            struct stat target;
+            directory = fstatat(fd, name, &target, 0) == 0 && S_ISDIR(target.st_mode);
+        }
+        listing->entries.push_back({name, directory});
+    }
+    closedir(dir);
+    std::sort(listing->entries.begin(), listing->entries.end(),
+              [](const DirectoryIndex::Entry& a, const DirectoryIndex::Entry& b) { return a.name < b.name; });
+    return listing;
+}
+
+}
+
+Trie::Trie() : nodes(1) {}
+
+void Trie::insert(std::string_view word) {
+    int node = 0;
+    for (char c : word) {
+        auto& children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), c,
+                                   [](const std::pair<char, int>& child, char key) { return child.first < key; });
+        if (it != children.end() && it->first == c) {
+            node = it->second;
+            continue;
+        }
+        int next = static_cast<int>(nodes.size());
+        children.insert(it, {c, next});  // May reallocate nodes below, so don't hold references across
+        nodes.emplace_back();
+        node = next;
+    }
+    if (!nodes[node].terminal) {
+        nodes[node].terminal = true;
+        words++;
+    }
+}
+
+void Trie::clear() {
+    nodes.assign(1, Node());
+    words = 0;
+}
+
+int Trie::find(std::string_view prefix) const {
+    int node = 0;
+    for (char c : prefix) {
+        const auto& children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), c,
+                                   [](const std::pair<char, int>& child, char key) { return child.first < key; });
+        if (it == children.end() || it->first != c) {
+            return -1;
+        }
+        node = it->second;
+    }
+    return node;
+}
+
+void Trie::collect(int node, std::string& word, std::vector<std::string>& out, size_t limit) const {
+    if (out.size() >= limit) {
+        return;
+    }
+    if (nodes[node].terminal) {
+        out.push_back(word);
+    }
+    for (const auto& [c, child] : nodes[node].children) {
+        word += c;
+        collect(child, word, out, limit);
+        word.pop_back();
+    }
+}
+
+std::vector<std::string> Trie::complete(std::string_view prefix, size_t limit) const {
+    std::vector<std::string> out;
+    int node = find(prefix);
+    if (node >= 0) {
+        std::string word(prefix);
+        collect(node, word, out, limit);
+    }
+    return out;
+}
+
+DirectoryIndex::~DirectoryIndex() {
+    if (prefetcher.joinable()) {
+        prefetcher.join();
+    }
+}
+
+std::shared_ptr<const DirectoryIndex::Listing> DirectoryIndex::cached(const std::string& path, const struct stat& st) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = listings.find(path);
+    if (it == listings.end()) {
+        return nullptr;
+    }
+    const Listing& listing = *it->second.listing;
+    if (listing.device != st.st_dev || listing.inode != st.st_ino || listing.mtime.tv_sec != st.st_mtim.tv_sec ||
+        listing.mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        return nullptr;
+    }
+    it->second.used = ++clock;
+    return it->second.listing;
+}
+
+std::shared_ptr<const DirectoryIndex::Listing> DirectoryIndex::listing(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return nullptr;
+    }
+    if (auto listing = cached(path, st)) {
+        return listing;
+    }
+
+    // Read without holding the lock; a change while reading just makes the copy stale
+    std::shared_ptr<Listing> fresh = readListing(path, st);
+    if (!fresh) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    listings[path] = {fresh, ++clock};
+    if (listings.size() > maxListings) {
+        auto oldest = std::min_element(listings.begin(), listings.end(), [](const auto& a, const auto& b) {
+            return a.second.used < b.second.used;
+        });
+        listings.erase(oldest);
+    }
+    return fresh;
+}
+
+void DirectoryIndex::prefetch(const std::string& path) {
+    if (prefetching.exchange(true)) {
+        return;  // One at a time; the next prompt tries again
+    }
+    if (prefetcher.joinable()) {
+        prefetcher.join();
+    }
+    prefetcher = std::thread([this, path] {
+        listing(path);
+        prefetching = false;
+    });
+}
+
+std::pair<size_t, size_t> DirectoryIndex::range(const Listing& listing, std::string_view prefix) {
+    const auto& entries = listing.entries;
+    auto first = std::lower_bound(entries.begin(), entries.end(), prefix,
+                                  [](const Entry& entry, std::string_view key) { return entry.name < key; });
+    auto last = std::partition_point(first, entries.end(), [prefix](const Entry& entry) {
+        return entry.name.compare(0, prefix.size(), prefix) == 0;
+    });
+    return {static_cast<size_t>(first - entries.begin()), static_cast<size_t>(last - entries.begin())};
+}
+
+void Completer::refreshCommands() {
+    uint64_t current = commandRegistry().generation();
+    if (current == generation) {
+        return;
+    }
+    commands.clear();
+    for (const Command& command : commandRegistry().list()) {
+        commands.insert(command.name);
+    }
+    generation = current;
+}
+
+void Completer::refreshModules() {
+    std::shared_ptr<const DirectoryIndex::Listing> listing = directories.listing(Disk.rootfsPath() + "/modules");
+    if (listing == modules) {
+        return;  // Same listing object: the directory hasn't changed
+    }
+    moduleNames.clear();
+    if (listing) {
+        for (const auto& entry : listing->entries) {
+            size_t dot = entry.name.rfind(".py");
+            if (!entry.directory && dot != std::string::npos && dot > 0 && dot + 3 == entry.name.size()) {
+                moduleNames.insert(std::string_view(entry.name).substr(0, dot));
+            }
+        }
+    }
+    modules = listing;
+}
+
+void Completer::completeFile(const std::string& cwd, std::string_view word, size_t listLimit, Result& result) {
+    size_t slash = word.rfind('/');
+    std::string dirPart(slash == std::string_view::npos ? "" : word.substr(0, slash + 1));
+    std::string_view base = slash == std::string_view::npos ? word : word.substr(slash + 1);
+    std::string dir = dirPart.empty() ? cwd : dirPart[0] == '/' ? dirPart : cwd + "/" + dirPart;
+
+    result.replacement = std::string(word);
+    std::shared_ptr<const DirectoryIndex::Listing> listing = directories.listing(dir);
+    if (!listing) {
+        return;
+    }
+    auto [first, last] = DirectoryIndex::range(*listing, base);
+    bool showHidden = !base.empty() && base[0] == '.';
+    const DirectoryIndex::Entry* firstMatch = nullptr;
+    const DirectoryIndex::Entry* lastMatch = nullptr;
+    for (size_t i = first; i < last; ++i) {
+        const DirectoryIndex::Entry& entry = listing->entries[i];
+        if (!showHidden && entry.name[0] == '.') {
+            continue;
+        }
+        if (firstMatch == nullptr) {
+            firstMatch = &entry;
+        }
+        lastMatch = &entry;
+        if (result.candidates.size() < listLimit) {
+            result.candidates.push_back(entry.directory ? entry.name + "/" : entry.name);
+        }
+        result.total++;
+    }
+    if (result.total == 0) {
+        return;
+    }
+    result.replacement = dirPart + firstMatch->name.substr(0, commonLength(firstMatch->name, lastMatch->name));
+    result.unique = result.total == 1;
+    if (result.unique && firstMatch->directory) {
+        result.replacement += '/';
+    }
+}
+
+Completer::Result Completer::complete(const std::string& cwd, std::string_view word, Position position,
+                                      size_t listLimit) {
+    Result result;
+    if (position == FileName || word.find('/') != std::string_view::npos) {
+        completeFile(cwd, word, listLimit, result);
+        return result;
+    }
+
+    std::vector<std::string> matches;
+    if (position == ModuleName) {
+        refreshModules();
+        matches = moduleNames.complete(word, SIZE_MAX);
+    } else {
+        refreshCommands();
+        matches = commands.complete(word, SIZE_MAX);
+        for (const std::string& dir : pathCache().directories()) {
+            std::shared_ptr<const DirectoryIndex::Listing> listing = directories.listing(dir);
+            if (!listing) {
+                continue;
+            }
+            auto [first, last] = DirectoryIndex::range(*listing, word);
+            for (size_t i = first; i < last; ++i) {
+                if (!listing->entries[i].directory) {
+                    matches.push_back(listing->entries[i].name);
+                }
+            }
+        }
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    }
+
+    result.total = matches.size();
+    result.replacement = std::string(word);
+    if (matches.empty()) {
+        return result;
+    }
+    // Sorted, so what the first and last share, every match shares
+    result.replacement = matches.front().substr(0, commonLength(matches.front(), matches.back()));
+    result.unique = matches.size() == 1;
+    matches.resize(std::min(matches.size(), listLimit));
+    result.candidates = std::move(matches);
+    return result;
+}
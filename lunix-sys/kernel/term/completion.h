@@ -0,0 +1,125 @@
+// completion.h; Tab completion for the lsh line editor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Prefix tree over a small, slowly changing word set (command names). Children are kept
+ * sorted, so completions come out in order and the longest common extension of a prefix
+ * is a walk down single-child nodes.
+ */
+class Trie {
+public:
+    Trie();
+
+    void insert(std::string_view word);
+    void clear();
+    size_t size() const { return words; }
+
+    // Words starting with prefix, in order, at most limit of them
+    std::vector<std::string> complete(std::string_view prefix, size_t limit) const;
+
+private:
+    struct Node {
+        std::vector<std::pair<char, int>> children;  // Sorted by character
+        bool terminal = false;
+    };
+
+    int find(std::string_view prefix) const;
+    void collect(int node, std::string& word, std::vector<std::string>& out, size_t limit) const;
+
+    std::vector<Node> nodes;
+    size_t words = 0;
+};
+
+/*
+ * Sorted listings of directories, cached and revalidated with one stat of the directory
+ * (its mtime changes whenever an entry is added, removed or renamed). Names starting
+ * with a prefix are a contiguous range, found by binary search, so completing in a
+ * directory of 100k entries costs the same as in a small one once it is listed.
+ */
+class DirectoryIndex {
+public:
+    struct Entry {
+        std::string name;
+        bool directory;
+    };
+
+    struct Listing {
+        dev_t device = 0;
+        ino_t inode = 0;
+        struct timespec mtime = {0, 0};
+        std::vector<Entry> entries;  // Sorted by name
+    };
+
+    ~DirectoryIndex();
+
+    // Current listing of path, or nullptr if it can't be read
+    std::shared_ptr<const Listing> listing(const std::string& path);
+    // Lists path on a background thread if the cached copy is missing or stale
+    void prefetch(const std::string& path);
+
+    // [first, last) range of a listing's entries whose names start with prefix
+    static std::pair<size_t, size_t> range(const Listing& listing, std::string_view prefix);
+
+private:
+    struct Cached {
+        std::shared_ptr<const Listing> listing;
+        uint64_t used = 0;  // For evicting the least recently used listing
+    };
+
+    std::shared_ptr<const Listing> cached(const std::string& path, const struct stat& st);
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Cached> listings;
+    uint64_t clock = 0;
+    std::thread prefetcher;
+    std::atomic<bool> prefetching{false};
+};
+
+/*
+ * Completes the word under the cursor: command names (builtins and programs in PATH) in
+ * command position, module names after mod, otherwise file names relative to the
+ * working directory. Command and module names come from tries rebuilt only when the
+ * registry or the modules directory changes.
+ */
+class Completer {
+public:
+    enum Position { CommandName, ModuleName, FileName };
+
+    struct Result {
+        std::string replacement;              // What the word becomes
+        bool unique = false;                  // Only one match: the caller appends ' ' (or nothing after '/')
+        size_t total = 0;                     // Number of matches
+        std::vector<std::string> candidates;  // The first few, for listing
+    };
+
+    Result complete(const std::string& cwd, std::string_view word, Position position, size_t listLimit);
+    void prefetch(const std::string& dir) { directories.prefetch(dir); }
+
+private:
+    void refreshCommands();
+    void refreshModules();
+    void completeFile(const std::string& cwd, std::string_view word, size_t listLimit, Result& result);
+
+    Trie commands;
+    uint64_t generation = UINT64_MAX;
+    Trie moduleNames;
+    std::shared_ptr<const DirectoryIndex::Listing> modules;
+    DirectoryIndex directories;
+};
+
+#endif // COMPLETION_H
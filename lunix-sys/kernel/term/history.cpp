@@ -0,0 +1,188 @@
+// history.cpp; Persistent command history for the lsh line editor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "history.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t growStep = 64 * 1024;
+
+size_t roundUp(size_t bytes) {
+    return (bytes + growStep - 1) / growStep * growStep;
+}
+
+}
+
+History::History(size_t maxEntries) : maxEntries(maxEntries) {}
+
+History::~History() {
+    unmap();
+}
+
+void History::unmap() {
+    if (map != nullptr) {
+        munmap(map, capacity);
+        map = nullptr;
+    }
+    if (fd >= 0) {
+        ftruncate(fd, used);  // Drop the zero padding
+        close(fd);
+        fd = -1;
+    }
+    capacity = 0;
+}
+
+int History::open(int dirFd, const std::string& name) {
+    if (fd >= 0) {
+        return 0;
+    }
+    int file = openat(dirFd, name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (file < 0) {
+        return errno;
+    }
+    struct stat st;
+    if (fstat(file, &st) != 0) {
+        int error = errno;
+        close(file);
+        return error;
+    }
+    size_t size = st.st_size;
+    bool locked = flock(file, LOCK_EX | LOCK_NB) == 0;
+
+    char* data = nullptr;
+    if (size > 0) {
+        void* p = mmap(nullptr, size, PROT_READ | (locked ? PROT_WRITE : 0), MAP_SHARED, file, 0);
+        if (p == MAP_FAILED) {
+            int error = errno;
+            close(file);
+            return error;
+        }
+        data = static_cast<char*>(p);
+    }
+
+    // History ends at the first zero byte (the padding after the last append)
+    const char* end = data == nullptr ? nullptr : static_cast<const char*>(memchr(data, '\0', size));
+    size_t length = end == nullptr ? size : end - data;
+    entries.clear();
+    lines = 0;
+    for (size_t start = 0; start < length;) {
+        const char* newline = static_cast<const char*>(memchr(data + start, '\n', length - start));
+        size_t stop = newline == nullptr ? length : newline - data;
+        if (stop > start) {
+            entries.emplace_back(data + start, stop - start);
+            if (entries.size() > maxEntries) {
+                entries.pop_front();
+            }
+            lines++;
+        }
+        start = stop + 1;
+    }
+
+    if (!locked) {
+        // Another instance owns the file: use what it had, but keep our own lines in memory
+        if (data != nullptr) {
+            munmap(data, size);
+        }
+        close(file);
+        return 0;
+    }
+    fd = file;
+    map = data;
+    capacity = size;
+    used = length;
+    if (lines > 2 * maxEntries) {
+        compact();
+    }
+    return 0;
+}
+
+bool History::reserve(size_t bytes) {
+    if (used + bytes <= capacity) {
+        return true;
+    }
+    size_t grown = roundUp(used + bytes);
+    if (ftruncate(fd, grown) != 0) {
+        return false;
+    }
+    void* p = map == nullptr ? mmap(nullptr, grown, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                             : mremap(map, capacity, grown, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED) {
+        ftruncate(fd, capacity);
+        return false;
+    }
+    map = static_cast<char*>(p);
+    capacity = grown;
+    return true;
+}
+
+void History::add(std::string_view line) {
+    if (line.empty() || line.find('\n') != std::string_view::npos || (!entries.empty() && entries.back() == line)) {
+        return;
+    }
+    entries.emplace_back(line);
+    if (entries.size() > maxEntries) {
+        entries.pop_front();
+    }
+    if (fd < 0) {
+        return;
+    }
+
+    bool needNewline = used > 0 && map[used - 1] != '\n';  // A file someone edited by hand
+    size_t bytes = line.size() + 1 + (needNewline ? 1 : 0);
+    if (!reserve(bytes)) {
+        return;
+    }
+    if (needNewline) {
+        map[used++] = '\n';
+    }
+    memcpy(map + used, line.data(), line.size());
+    used += line.size();
+    map[used++] = '\n';
+    if (++lines > 2 * maxEntries) {
+        compact();
+    }
+}
+
+void History::compact() {
+    // Rewrite just the entries still kept; they always fit in the space they used before
+    size_t offset = 0;
+    for (const std::string& entry : entries) {
+        memcpy(map + offset, entry.data(), entry.size());
+        offset += entry.size();
+        map[offset++] = '\n';
+    }
+    memset(map + offset, 0, used - offset);
+    used = offset;
+    lines = entries.size();
+}
+
+void History::clear() {
+    entries.clear();
+    if (map != nullptr) {
+        memset(map, 0, used);
+    }
+    used = 0;
+    lines = 0;
+}
+
+long History::search(std::string_view text, long before) const {
+    for (long i = std::min<long>(before, entries.size()) - 1; i >= 0; --i) {
+        if (entries[i].find(text) != std::string::npos) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+History& consoleHistory() {
+    static History history;
+    return history;
+}
@@ -0,0 +1,59 @@
+// history.h; Persistent command history for the lsh line editor
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+
+/*
+ * Command lines, oldest first, kept in a file that is memory mapped and appended to in
+ * place: adding a line is a memcpy into the mapping (the file grows in 64KB steps), so
+ * nothing is lost if the kernel crashes and no write() happens per command. The unused
+ * tail of the file is zero bytes, which load() skips and the destructor truncates away.
+ * Only the newest maxEntries lines are kept; the file is compacted when it holds twice
+ * that many. The file is locked, so a second Lunix instance keeps its history in memory.
+ */
+class History {
+public:
+    explicit History(size_t maxEntries = 1000);
+    ~History();
+
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+
+    // Loads name in dirFd and appends to it from now on. Returns 0 or an errno value.
+    int open(int dirFd, const std::string& name);
+
+    // Ignores empty lines and repeats of the newest entry
+    void add(std::string_view line);
+    void clear();
+
+    size_t size() const { return entries.size(); }
+    // 0 is the oldest entry
+    const std::string& at(size_t index) const { return entries[index]; }
+
+    // Newest entry before index `before` that contains text, or -1
+    long search(std::string_view text, long before) const;
+
+private:
+    bool reserve(size_t bytes);
+    void compact();
+    void unmap();
+
+    size_t maxEntries;
+    std::deque<std::string> entries;
+
+    int fd = -1;
+    char* map = nullptr;
+    size_t capacity = 0;  // Size of the file and the mapping
+    size_t used = 0;      // Bytes of history in it
+    size_t lines = 0;     // Lines in the file, including ones no longer in entries
+};
+
+History& consoleHistory();
+
+#endif // HISTORY_H
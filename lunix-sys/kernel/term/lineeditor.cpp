@@ -0,0 +1,618 @@
+// lineeditor.cpp; Raw-mode line editor for the lsh console
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "lineeditor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+enum Key {
+    CtrlA = 1,
+    CtrlB = 2,
+    CtrlC = 3,
+    CtrlD = 4,
+    CtrlE = 5,
+    CtrlF = 6,
+    CtrlG = 7,
+    CtrlH = 8,
+    Tab = 9,
+    LineFeed = 10,
+    CtrlK = 11,
+    CtrlL = 12,
+    Enter = 13,
+    CtrlN = 14,
+    CtrlP = 16,
+    CtrlR = 18,
+    CtrlU = 21,
+    CtrlW = 23,
+    Escape = 27,
+    Backspace = 127,
+    KeyUp = 1000,
+    KeyDown,
+    KeyLeft,
+    KeyRight,
+    KeyHome,
+    KeyEnd,
+    KeyDelete,
+};
+
+const size_t listLimit = 200;
+const int escapeTimeoutMs = 50;  // Bytes of one escape sequence arrive together; a lone ESC doesn't
+
+// Puts the terminal in raw mode for as long as it lives
+class RawMode {
+public:
+    explicit RawMode(int fd) : fd(fd) {
+        if (tcgetattr(fd, &saved) != 0) {
+            return;
+        }
+        struct termios raw = saved;
+        raw.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+        raw.c_cflag |= CS8;
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        // TCSADRAIN rather than TCSAFLUSH, so keys typed while the last command ran still count
+        active = tcsetattr(fd, TCSADRAIN, &raw) == 0;
+    }
+
+    ~RawMode() {
+        if (active) {
+            tcsetattr(fd, TCSADRAIN, &saved);
+        }
+    }
+
+private:
+    int fd;
+    struct termios saved;
+    bool active = false;
+};
+
+bool isContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// Columns taken by UTF-8 text, counting every character as one
+size_t columns(std::string_view text) {
+    return std::count_if(text.begin(), text.end(), [](char c) { return !isContinuation(c); });
+}
+
+// Same for a prompt, which may contain color sequences
+size_t promptColumns(std::string_view prompt) {
+    size_t width = 0;
+    int escape = 0;
+    for (char c : prompt) {
+        if (escape == 1) {
+            escape = c == '[' ? 2 : 0;
+        } else if (escape == 2) {
+            escape = c >= 0x40 && c <= 0x7e ? 0 : 2;
+        } else if (c == '\033') {
+            escape = 1;
+        } else if (!isContinuation(c)) {
+            width++;
+        }
+    }
+    return width;
+}
+
+size_t byteAtColumn(std::string_view text, size_t column) {
+    size_t i = 0;
+    for (; i < text.size(); ++i) {
+        if (!isContinuation(text[i]) && column-- == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+size_t terminalWidth(int fd) {
+    struct winsize size;
+    if (ioctl(fd, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        return size.ws_col;
+    }
+    return 80;
+}
+
+// Backslash-escapes what CommandLine::parse would otherwise split or strip
+std::string escapeWord(std::string_view word) {
+    std::string out;
+    for (char c : word) {
+        if (strchr(" \t'\"\\|<>", c) != nullptr) {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+struct WordAt {
+    size_t start = 0;  // Where the word begins in the line, including an opening quote
+    std::string text;  // The word with quotes and escapes removed
+    char quote = 0;    // Quote still open at the cursor
+    Completer::Position position = Completer::CommandName;
+};
+
+// The word that ends at the end of line, split the way CommandLine::parse splits it
+WordAt wordBefore(std::string_view line) {
+    WordAt word;
+    bool inWord = false;
+    bool redirect = false;  // The next word is the target of < or >
+    size_t index = 0;       // Words before this one in the current command
+    std::string first;
+
+    auto finishWord = [&] {
+        if (!inWord) {
+            return;
+        }
+        if (redirect) {
+            redirect = false;
+        } else {
+            if (index == 0) {
+                first = word.text;
+            }
+            index++;
+        }
+        word.text.clear();
+        inWord = false;
+    };
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (word.quote != 0) {
+            if (c == word.quote) {
+                word.quote = 0;
+            } else if (c == '\\' && word.quote == '"' && i + 1 < line.size()) {
+                word.text += line[++i];
+            } else {
+                word.text += c;
+            }
+            continue;
+        }
+        if (c == ' ' || c == '\t') {
+            finishWord();
+            continue;
+        }
+        if (c == '|' || c == '<' || c == '>') {
+            finishWord();
+            if (c == '|') {
+                index = 0;
+                first.clear();
+                redirect = false;
+            } else {
+                redirect = true;
+            }
+            continue;
+        }
+        if (!inWord) {
+            inWord = true;
+            word.start = i;
+        }
+        if (c == '\'' || c == '"') {
+            word.quote = c;
+        } else if (c == '\\' && i + 1 < line.size()) {
+            word.text += line[++i];
+        } else {
+            word.text += c;
+        }
+    }
+    if (!inWord) {
+        word.start = line.size();
+    }
+
+    if (redirect) {
+        word.position = Completer::FileName;
+    } else if (index == 0) {
+        word.position = Completer::CommandName;
+    } else if (index == 1 && first == "mod") {
+        word.position = Completer::ModuleName;
+    } else {
+        word.position = Completer::FileName;
+    }
+    return word;
+}
+
+}
+
+LineEditor::LineEditor(int inFd, int outFd, History& history, Completer& completer)
+    : inFd(inFd), outFd(outFd), history(history), completer(completer) {}
+
+bool LineEditor::available(int inFd, int outFd) {
+    const char* term = getenv("TERM");
+    return isatty(inFd) == 1 && isatty(outFd) == 1 && (term == nullptr || strcmp(term, "dumb") != 0);
+}
+
+bool LineEditor::readLine(const std::string& prompt, const std::string& cwd, std::string& line) {
+    RawMode raw(inFd);
+    this->prompt = prompt;
+    promptWidth = promptColumns(prompt);
+    this->cwd = cwd;
+    buffer.clear();
+    cursor = 0;
+    scroll = 0;
+    historyIndex = history.size();
+    editing.clear();
+    refresh();
+
+    auto previous = [this] {
+        size_t i = cursor;
+        while (i > 0 && isContinuation(buffer[--i])) {
+        }
+        return i;
+    };
+    auto next = [this] {
+        size_t i = cursor;
+        while (i < buffer.size() && isContinuation(buffer[++i])) {
+        }
+        return std::min(i, buffer.size());
+    };
+
+    bool tabbed = false;
+    int key = readKey();
+    while (true) {
+        if (key < 0) {
+            return false;  // The terminal went away
+        }
+        switch (key) {
+            case Enter:
+            case LineFeed:
+                cursor = buffer.size();
+                refresh();
+                write("\r\n");
+                line = buffer;
+                return true;
+            case CtrlC:
+                write("^C\r\n");
+                line.clear();
+                return true;
+            case CtrlD:
+                if (buffer.empty()) {
+                    return false;
+                }
+                erase(cursor, next());
+                break;
+            case Backspace:
+            case CtrlH:
+                erase(previous(), cursor);
+                break;
+            case KeyDelete:
+                erase(cursor, next());
+                break;
+            case KeyLeft:
+            case CtrlB:
+                cursor = previous();
+                refresh();
+                break;
+            case KeyRight:
+            case CtrlF:
+                cursor = next();
+                refresh();
+                break;
+            case KeyHome:
+            case CtrlA:
+                cursor = 0;
+                refresh();
+                break;
+            case KeyEnd:
+            case CtrlE:
+                cursor = buffer.size();
+                refresh();
+                break;
+            case CtrlK:
+                erase(cursor, buffer.size());
+                break;
+            case CtrlU:
+                erase(0, cursor);
+                break;
+            case CtrlW: {
+                size_t start = cursor;
+                while (start > 0 && buffer[start - 1] == ' ') {
+                    start--;
+                }
+                while (start > 0 && buffer[start - 1] != ' ') {
+                    start--;
+                }
+                erase(start, cursor);
+                break;
+            }
+            case CtrlL:
+                write("\033[H\033[2J");
+                refresh();
+                break;
+            case KeyUp:
+            case CtrlP:
+                moveHistory(true);
+                break;
+            case KeyDown:
+            case CtrlN:
+                moveHistory(false);
+                break;
+            case CtrlR:
+                // Returns the key that ended the search, which then acts as usual
+                key = reverseSearch();
+                tabbed = false;
+                continue;
+            case Tab:
+                complete(tabbed);
+                break;
+            default:
+                if (key >= ' ' && key < 256) {
+                    insert(std::string(1, static_cast<char>(key)));
+                }
+                break;
+        }
+        tabbed = key == Tab;
+        key = readKey();
+    }
+}
+
+int LineEditor::readByte(int timeoutMs) {
+    if (timeoutMs >= 0) {
+        struct pollfd pfd = {inFd, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0) {
+            return -1;
+        }
+    }
+    unsigned char c;
+    ssize_t n;
+    do {
+        n = read(inFd, &c, 1);
+    } while (n < 0 && errno == EINTR);
+    return n == 1 ? c : -1;
+}
+
+int LineEditor::readKey() {
+    int c = readByte(-1);
+    if (c != Escape) {
+        return c;
+    }
+    int introducer = readByte(escapeTimeoutMs);
+    if (introducer != '[' && introducer != 'O') {
+        return 0;  // A lone ESC, or Alt with a key; neither does anything
+    }
+
+    // ESC [ parameters final, e.g. ESC [ A for Up or ESC [ 3 ~ for Delete
+    int number = 0;
+    int final = readByte(escapeTimeoutMs);
+    bool firstNumber = true;
+    while (final >= 0 && final < 0x40) {
+        if (final == ';') {
+            firstNumber = false;  // Modifiers (Ctrl-Left is ESC [ 1 ; 5 D) are ignored
+        } else if (firstNumber && final >= '0' && final <= '9') {
+            number = number * 10 + (final - '0');
+        }
+        final = readByte(escapeTimeoutMs);
+    }
+    switch (final) {
+        case 'A':
+            return KeyUp;
+        case 'B':
+            return KeyDown;
+        case 'C':
+            return KeyRight;
+        case 'D':
+            return KeyLeft;
+        case 'H':
+            return KeyHome;
+        case 'F':
+            return KeyEnd;
+        case '~':
+            switch (number) {
+                case 1:
+                case 7:
+                    return KeyHome;
+                case 4:
+                case 8:
+                    return KeyEnd;
+                case 3:
+                    return KeyDelete;
+            }
+            break;
+    }
+    return 0;
+}
+
+void LineEditor::write(std::string_view text) {
+    while (!text.empty()) {
+        ssize_t n = ::write(outFd, text.data(), text.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        text.remove_prefix(n);
+    }
+}
+
+void LineEditor::refresh() {
+    refresh(prompt, promptWidth);
+}
+
+void LineEditor::refresh(const std::string& shownPrompt, size_t shownWidth) {
+    size_t width = terminalWidth(outFd);
+    size_t room = width > shownWidth + 1 ? width - shownWidth - 1 : 1;
+    size_t cursorColumn = columns(std::string_view(buffer).substr(0, cursor));
+    if (cursorColumn < scroll) {
+        scroll = cursorColumn;
+    } else if (cursorColumn >= scroll + room) {
+        scroll = cursorColumn - room + 1;
+    }
+    size_t from = byteAtColumn(buffer, scroll);
+    size_t to = byteAtColumn(buffer, scroll + room);
+
+    // Redraw the whole row in one write, so it doesn't flicker
+    std::string out = "\r" + shownPrompt;
+    out.append(buffer, from, to - from);
+    out += "\033[K\r";
+    size_t column = shownWidth + cursorColumn - scroll;
+    if (column > 0) {
+        out += "\033[" + std::to_string(column) + "C";
+    }
+    write(out);
+}
+
+void LineEditor::insert(std::string_view text) {
+    buffer.insert(cursor, text);
+    cursor += text.size();
+    refresh();
+}
+
+void LineEditor::erase(size_t from, size_t to) {
+    if (from >= to) {
+        return;
+    }
+    buffer.erase(from, to - from);
+    cursor = from;
+    refresh();
+}
+
+void LineEditor::moveHistory(bool older) {
+    if (older) {
+        if (historyIndex == 0) {
+            write("\a");
+            return;
+        }
+        if (historyIndex == history.size()) {
+            editing = buffer;
+        }
+        buffer = history.at(--historyIndex);
+    } else {
+        if (historyIndex >= history.size()) {
+            return;
+        }
+        historyIndex++;
+        buffer = historyIndex == history.size() ? editing : history.at(historyIndex);
+    }
+    cursor = buffer.size();
+    refresh();
+}
+
+int LineEditor::reverseSearch() {
+    std::string original = buffer;
+    size_t originalCursor = cursor;
+    std::string query;
+    long match = -1;
+    bool failed = false;
+
+    while (true) {
+        std::string shown = std::string(failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`") + query + "': ";
+        refresh(shown, columns(shown));
+
+        int key = readKey();
+        if (key < 0) {
+            return key;
+        }
+        long found = match;
+        if (key == CtrlG || key == CtrlC) {
+            buffer = original;
+            cursor = originalCursor;
+            refresh();
+            return 0;
+        } else if (key == CtrlR) {
+            // The next older match
+            if (!query.empty()) {
+                found = history.search(query, match >= 0 ? match : history.size());
+            }
+        } else if (key == Backspace || key == CtrlH) {
+            while (!query.empty() && isContinuation(query.back())) {
+                query.pop_back();
+            }
+            if (!query.empty()) {
+                query.pop_back();
+            }
+            found = query.empty() ? -1 : history.search(query, history.size());
+        } else if (key >= ' ' && key < 256) {
+            // The current match stays if it still contains the longer text
+            query += static_cast<char>(key);
+            found = history.search(query, match >= 0 ? match + 1 : history.size());
+        } else {
+            // Any other key accepts the match and then acts on it
+            if (match >= 0) {
+                if (historyIndex == history.size()) {
+                    editing = original;
+                }
+                historyIndex = match;
+            }
+            refresh();
+            return key;
+        }
+
+        failed = found < 0 && !query.empty();
+        if (found >= 0) {
+            match = found;
+            buffer = history.at(match);
+            cursor = buffer.find(query);
+        }
+        if (failed) {
+            write("\a");
+        }
+    }
+}
+
+void LineEditor::complete(bool repeated) {
+    WordAt word = wordBefore(std::string_view(buffer).substr(0, cursor));
+    Completer::Result result = completer.complete(cwd, word.text, word.position, listLimit);
+    if (result.total == 0) {
+        write("\a");
+        return;
+    }
+
+    std::string text = word.quote != 0 ? word.quote + result.replacement : escapeWord(result.replacement);
+    if (result.unique && result.replacement.back() != '/') {
+        if (word.quote != 0) {
+            text += word.quote;
+        }
+        text += ' ';
+    }
+    if (buffer.compare(word.start, cursor - word.start, text) != 0) {
+        buffer.replace(word.start, cursor - word.start, text);
+        cursor = word.start + text.size();
+        refresh();
+        return;
+    }
+    // Nothing more to add: a second Tab shows what the choices are
+    if (result.unique) {
+        return;
+    }
+    if (repeated) {
+        listCandidates(result);
+    } else {
+        write("\a");
+    }
+}
+
+void LineEditor::listCandidates(const Completer::Result& result) {
+    const std::vector<std::string>& names = result.candidates;
+    size_t widest = 0;
+    for (const std::string& name : names) {
+        widest = std::max(widest, columns(name));
+    }
+    size_t columnWidth = widest + 2;
+    size_t perRow = std::max<size_t>(1, terminalWidth(outFd) / columnWidth);
+    size_t rows = (names.size() + perRow - 1) / perRow;
+
+    // Down the columns, as ls lists them
+    std::string out = "\r\n";
+    for (size_t row = 0; row < rows; ++row) {
+        for (size_t index = row; index < names.size(); index += rows) {
+            out += names[index];
+            if (index + rows < names.size()) {
+                out.append(columnWidth - columns(names[index]), ' ');
+            }
+        }
+        out += "\r\n";
+    }
+    if (result.total > names.size()) {
+        out += "... and " + std::to_string(result.total - names.size()) + " more\r\n";
+    }
+    write(out);
+    refresh();
+}
@@ -0,0 +1,60 @@
+// lineeditor.h; Raw-mode line editor for the lsh console
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef LINEEDITOR_H
+#define LINEEDITOR_H
+
+#include <string>
+#include <string_view>
+
+#include "completion.h"
+#include "history.h"
+
+/*
+ * Reads one command line from a terminal with the terminal in raw mode, so keys act
+ * as they are pressed: cursor movement and Emacs-style editing keys, Up/Down through
+ * the history, Ctrl-R for an incremental search back through it, and Tab to complete
+ * the word under the cursor (a second Tab lists the candidates). The line is drawn on
+ * a single row and scrolls sideways when it is wider than the terminal.
+ */
+class LineEditor {
+public:
+    LineEditor(int inFd, int outFd, History& history, Completer& completer);
+
+    // Both ends are a terminal; otherwise read lines with std::getline
+    static bool available(int inFd, int outFd);
+
+    // False at the end of input (Ctrl-D on an empty line, or the terminal went away)
+    bool readLine(const std::string& prompt, const std::string& cwd, std::string& line);
+
+private:
+    int readKey();
+    int readByte(int timeoutMs);
+    void write(std::string_view text);
+    void refresh();
+    void refresh(const std::string& shownPrompt, size_t shownWidth);
+
+    void insert(std::string_view text);
+    void erase(size_t from, size_t to);
+    void moveHistory(bool older);
+    int reverseSearch();
+    void complete(bool repeated);
+    void listCandidates(const Completer::Result& result);
+
+    int inFd;
+    int outFd;
+    History& history;
+    Completer& completer;
+
+    // State of the line being read
+    std::string prompt;
+    size_t promptWidth = 0;
+    std::string cwd;
+    std::string buffer;
+    size_t cursor = 0;       // Byte offset in buffer
+    size_t scroll = 0;       // First column shown when the line is wider than the terminal
+    size_t historyIndex = 0; // history.size() while editing a new line
+    std::string editing;     // The new line, kept while browsing the history
+};
+
+#endif // LINEEDITOR_H
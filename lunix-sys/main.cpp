@@ -9,14 +9,65 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <cstring>
+#include <cstdlib>
 
 #include "kernel/kernel/kernel.h"
+#include "kernel/output.h"
+#include "kernel/kernel/trace.h"
+#include "kernel/kernel/klog.h"
+
+extern kernel Kernel;
 
 int main(int argc, char **argv) {
+    // Console output is buffered per thread and written at prompts, not once per line
+    installConsoleOutput();
+
+    // LUNIX_TRACE=1: trace from the start, so boot shows up in `trace dump`
+    if (getenv("LUNIX_TRACE") != nullptr) {
+        tracer().start();
+    }
+
+    // LUNIX_LOG=binary: write rootfs/kernel.log in the binary format (dmesg reads both);
+    // LUNIX_LOG_LEVEL=debug also logs every LISP server request
+    if (const char* format = getenv("LUNIX_LOG")) {
+        KernelLog::Options options;
+        options.binary = std::strcmp(format, "binary") == 0;
+        kernelLog().configure(options);
+    }
+    if (const char* level = getenv("LUNIX_LOG_LEVEL")) {
+        int threshold = KernelLog::parseLevel(level);
+        if (threshold >= 0) {
+            logThreshold = static_cast<uint8_t>(threshold);
+        }
+    }
+
+    // lunix -c "command": run one command line without a terminal
+    if (argc >= 2 && std::strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            std::cerr << "Usage: " << argv[0] << " [-c command | script.lsh]\n";
+            return 2;
+        }
+        std::istringstream script(argv[2]);
+        return Kernel.startBatch(script);
+    }
+
+    // lunix script.lsh: run every line of the script
+    if (argc >= 2) {
+        // Opened before boot, since the kernel changes into the rootfs
+        std::ifstream script(argv[1]);
+        if (!script) {
+            std::cerr << argv[0] << ": cannot open " << argv[1] << "\n";
+            return 127;
+        }
+        return Kernel.startBatch(script);
+    }
+
     // Start the kernel
     std::cout << "Loading the kernel...\n";
-    kernel Kernel;
     Kernel.start();
 
     return 0;